@@ -11,6 +11,7 @@ extern volatile struct limine_hhdm_request hhdm_request;
 extern volatile struct limine_module_request module_request;
 extern volatile struct limine_rsdp_request rsdp_request;
 extern volatile struct limine_executable_cmdline_request cmdargs_request;
+extern volatile struct limine_mp_request mp_request;
 extern volatile uint64_t limine_requests_start_marker[];
 extern volatile uint64_t limine_requests_end_marker[];
 
@@ -2,7 +2,7 @@
 #define BOREALOS_SERVICEMANAGER_H
 
 #include <Definitions.h>
-#include <Utility/List.h>
+#include <Core/Sync/RCUArray.h>
 
 namespace Core {
     class ServiceManager {
@@ -20,7 +20,7 @@ namespace Core {
             void* address;
         };
 
-        Utility::List<Service> _services;
+        Sync::RCUArray<Service> _services; // Looked up by every module, so lookups take no lock
     };
 }
 
@@ -0,0 +1,49 @@
+#ifndef BOREALOS_WORKQUEUESERVICE_H
+#define BOREALOS_WORKQUEUESERVICE_H
+
+#include <Definitions.h>
+
+#define WORKQUEUE_SERVICE_NAME "workqueue.service"
+
+namespace WorkQueues {
+    /// Runs on a worker thread of the queue, with interrupts enabled. It may sleep and block.
+    typedef void (*WorkFunction)(void* context);
+
+    // Opaque handles, owned by the kernel
+    struct Queue;
+    struct Work;
+
+    /// Creates a named queue. maxActive is how many of its work items may run at the same time on one CPU.
+    typedef Queue* (*CreateQueueFunc)(const char* name, uint32_t maxActive);
+    /// The kernel's shared queue, for work that doesn't need a queue of its own.
+    typedef Queue* (*GetSystemQueueFunc)();
+
+    /// Creates a work item that runs function(context) every time it is queued. Destroying it cancels it first.
+    typedef Work* (*CreateWorkFunc)(WorkFunction function, void* context);
+    typedef void (*DestroyWorkFunc)(Work* work);
+
+    /// Queues work on the calling CPU, or after delayNs. Returns false if it was already pending, in which case nothing changes.
+    typedef bool (*QueueWorkFunc)(Queue* queue, Work* work);
+    typedef bool (*QueueDelayedWorkFunc)(Queue* queue, Work* work, uint64_t delayNs);
+
+    /// Cancels pending work and waits for it to finish if it is running. Returns true if it was pending. Only from threads.
+    typedef bool (*CancelWorkFunc)(Work* work);
+    /// Waits until the work isn't pending or running anymore. Returns true if it had to wait. Only from threads.
+    typedef bool (*FlushWorkFunc)(Work* work);
+    /// Waits until every work item that was queued on the queue before the call has finished. Only from threads.
+    typedef void (*FlushQueueFunc)(Queue* queue);
+
+    struct WorkQueueService {
+        CreateQueueFunc CreateQueue;
+        GetSystemQueueFunc GetSystemQueue;
+        CreateWorkFunc CreateWork;
+        DestroyWorkFunc DestroyWork;
+        QueueWorkFunc QueueWork;
+        QueueDelayedWorkFunc QueueDelayedWork;
+        CancelWorkFunc CancelWork;
+        FlushWorkFunc FlushWork;
+        FlushQueueFunc FlushQueue;
+    };
+}
+
+#endif //BOREALOS_WORKQUEUESERVICE_H
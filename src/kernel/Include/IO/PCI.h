@@ -5,6 +5,7 @@
 #include "Utility/List.h"
 #include "Memory/Paging.h"
 #include "IO/Serial.h"
+#include "Core/Sync/SpinLock.h"
 
 namespace IO {
 
@@ -47,6 +48,13 @@ namespace IO {
             uint32_t vectorControl; // Bit 0 is masked
         };
 
+        typedef void (*IrqHandler)(void* context);
+
+        // Interrupt types AllocateIrqVectors may use
+        static constexpr uint32_t IRQ_VECTORS_MSIX = 1 << 0;
+        static constexpr uint32_t IRQ_VECTORS_MSI  = 1 << 1;
+        static constexpr uint32_t IRQ_VECTORS_ALL  = IRQ_VECTORS_MSIX | IRQ_VECTORS_MSI;
+
         // Common PCI header flags
         static constexpr uint16_t PCI_HEADER_FLAG_MULTIFUNCTION = 0x80;
         static constexpr uint16_t PCI_HEADER_FLAG_HEADER_TYPE   = 0x0E;
@@ -66,6 +74,16 @@ namespace IO {
         // Offsets
         static constexpr uint8_t PCI_OFFSET_SECONDARY_BUS = 0x18;
 
+        // Command register bits
+        static constexpr uint16_t PCI_COMMAND_INTX_DISABLE = 1 << 10;
+
+        // MSI and MSI-X message control bits
+        static constexpr uint16_t MSI_CONTROL_ENABLE          = 1 << 0;
+        static constexpr uint16_t MSI_CONTROL_64BIT           = 1 << 7;
+        static constexpr uint16_t MSIX_CONTROL_FUNCTION_MASK  = 1 << 14;
+        static constexpr uint16_t MSIX_CONTROL_ENABLE         = 1 << 15;
+        static constexpr uint32_t MSIX_ENTRY_MASKED           = 1 << 0;
+
         // Header types
         static constexpr uint8_t PCI_HEADER_TYPE_PCI_CARDBUS_BRIDGE = 0x02;
         static constexpr uint8_t PCI_HEADER_TYPE_PCI_PCI_BRIDGE     = 0x01;
@@ -253,6 +271,19 @@ namespace IO {
         uint8_t FindCapability(const PCI::PCIDeviceHeader& device, uint8_t capabilityID);
         bool EnableMSIX(const PCI::PCIDeviceHeader& device, uint64_t messageAddr, uint32_t messageData, uint16_t entryIndex);
         bool EnableMSI(const PCI::PCIDeviceHeader& device, uint64_t messageAddr, uint32_t messageData);
+
+        /// Allocates between min and max interrupt vectors for the device and programs them: one MSI-X table entry per vector (e.g. one per
+        /// queue), or multi-message MSI (a power of two) if MSI-X isn't available or allowed. Legacy INTx is disabled. Returns the number of
+        /// vectors, 0 if not even min could be set up. The vectors have no handlers yet, see SetIrqHandler.
+        uint32_t AllocateIrqVectors(const PCI::PCIDeviceHeader& device, uint32_t min, uint32_t max, uint32_t types = IRQ_VECTORS_ALL);
+        void FreeIrqVectors(const PCI::PCIDeviceHeader& device); // Disables MSI/MSI-X and frees the vectors and their handlers
+        [[nodiscard]] uint32_t GetIrqVectorCount(const PCI::PCIDeviceHeader& device);
+        [[nodiscard]] uint8_t GetIrqVector(const PCI::PCIDeviceHeader& device, uint32_t index); // The CPU vector of entry index, 0 if there is none
+        /// The handler gets the context on every interrupt of entry index, a null handler removes it
+        bool SetIrqHandler(const PCI::PCIDeviceHeader& device, uint32_t index, IrqHandler handler, void* context);
+        /// Steers entry index to the CPUs in cpuMask (CPU indices), e.g. the one that consumes the data of the queue behind it, and
+        /// keeps the IRQ balancer from moving it. Multi-message MSI has one address for all its vectors, they all move together.
+        bool SetIrqAffinity(const PCI::PCIDeviceHeader& device, uint32_t index, uint64_t cpuMask);
         void WriteConfig(const PCI::PCIDeviceHeader& device, uint8_t offset, uint32_t value);
         void FindDevicesByClass(uint8_t classCode, uint8_t subclass, Utility::List<PCI::PCIDeviceHeader*>& results);
         void FindDevicesByID(uint16_t vendorID, uint16_t deviceID, Utility::List<PCI::PCIDeviceHeader*>& results);
@@ -272,8 +303,36 @@ namespace IO {
         void CheckFunction(uint8_t bus, uint8_t slot, uint8_t function);
         void CheckSlot(uint8_t bus, uint8_t slot);
         void CheckBus(uint8_t bus);
+
+        static constexpr uint32_t MAX_IRQ_VECTORS = 32; // Per device
+
+        // Vectors set up by AllocateIrqVectors
+        struct IrqVectors {
+            uint8_t bus;
+            uint8_t slot;
+            uint8_t function;
+            bool isMSIX;
+            uint8_t capabilityOffset;
+            volatile MSIXTableEntry* table; // MSI-X only
+            uint32_t count;
+            uint8_t vectors[MAX_IRQ_VECTORS]; // For multi-message MSI these are consecutive
+        };
+
+        IrqVectors* FindIrqVectors(const PCI::PCIDeviceHeader& device, size_t* index = nullptr);
+        volatile MSIXTableEntry* MapMSIXTable(const PCI::PCIDeviceHeader& device, uint8_t capabilityOffset, uint16_t& tableSize);
+        uint32_t SetUpMSIX(const PCI::PCIDeviceHeader& device, IrqVectors* irqVectors, uint32_t min, uint32_t max);
+        uint32_t SetUpMSI(const PCI::PCIDeviceHeader& device, IrqVectors* irqVectors, uint32_t min, uint32_t max);
+        void DisableINTx(const PCI::PCIDeviceHeader& device);
+        void WriteIrqMessage(IrqVectors* irqVectors, uint32_t index, uint64_t cpuMask); // Entry index, or the whole block for MSI
+        static bool SetIRQBalancerAffinity(void* context, uint8_t vector, uint64_t cpuMask);
+
         Utility::List<PCI::PCIDeviceHeader> _PCIDevices;
+        Utility::List<IrqVectors*> _irqVectors;
         Memory::Paging* _paging = nullptr;
+
+        // Mechanism #1 selects the register through 0xCF8 and accesses it through 0xCFC, another CPU selecting one in between would
+        // redirect the access. Taken with interrupts disabled, the IRQ balancer reprograms MSI from under its own IRQ-safe lock.
+        Core::Sync::SpinLock _configLock;
     };
 }
 
@@ -2,5 +2,9 @@
 #define BOREALOS_SETTINGS_H
 
 #define SETTING_TEST_MODE 1
+#define SETTING_BENCHMARK_MODE 0 // Runs the kernel benchmarks once initialization has finished, the results are logged over serial
+#define SETTING_LOCK_STAT 0 // Counts acquisitions, contention and hold times per lock class, dumped over serial once the kernel has started
+#define SETTING_SCHED_TRACE 1 // Per-CPU histograms of wakeup latency, timer lateness and run queue length, see Scheduler::DumpTrace
+#define SETTING_IRQ_STAT 1 // Per-CPU, per-vector histograms of interrupt handler durations, see IDT::DumpStatistics
 
 #endif //BOREALOS_SETTINGS_H
\ No newline at end of file
@@ -0,0 +1,75 @@
+#ifndef BOREALOS_HISTOGRAM_H
+#define BOREALOS_HISTOGRAM_H
+
+#include <Definitions.h>
+#include <Utility/StringFormatter.h>
+
+namespace Utility {
+    /// Power of two histogram for latencies and lengths: bucket 0 counts zeros, bucket n counts values in [2^(n-1), 2^n).
+    /// Recording is a bit scan and three adds, cheap enough to stay on in hot paths. Not synchronized, every writer needs its own
+    /// copy (e.g. one per CPU) and readers merge them.
+    struct Histogram {
+        static constexpr size_t BUCKETS = 65;
+
+        uint64_t Buckets[BUCKETS] {};
+        uint64_t Count = 0;
+        uint64_t Total = 0;
+        uint64_t Max = 0;
+
+        static constexpr size_t BucketOf(uint64_t value) {
+            return value ? 64 - __builtin_clzll(value) : 0;
+        }
+
+        static constexpr uint64_t LowerBound(size_t bucket) {
+            return bucket ? 1ULL << (bucket - 1) : 0;
+        }
+
+        void Record(uint64_t value) {
+            Buckets[BucketOf(value)]++;
+            Count++;
+            Total += value;
+            if (value > Max) Max = value;
+        }
+
+        void Merge(const Histogram& other) {
+            for (size_t i = 0; i < BUCKETS; i++) Buckets[i] += other.Buckets[i];
+            Count += other.Count;
+            Total += other.Total;
+            if (other.Max > Max) Max = other.Max;
+        }
+
+        [[nodiscard]] uint64_t Average() const {
+            return Count ? Total / Count : 0;
+        }
+
+        /// Upper bound of the bucket that holds the given per mille of the values, e.g. 990 for the 99th percentile
+        [[nodiscard]] uint64_t Percentile(uint32_t perMille) const {
+            if (!Count) return 0;
+
+            uint64_t target = Count / 1000 * perMille + (Count % 1000) * perMille / 1000;
+            uint64_t seen = 0;
+            for (size_t i = 0; i < BUCKETS; i++) {
+                seen += Buckets[i];
+                if (seen > target) {
+                    uint64_t upper = i == BUCKETS - 1 ? UINT64_MAX : (1ULL << i) - 1;
+                    return upper < Max ? upper : Max;
+                }
+            }
+            return Max;
+        }
+
+        /// Writes the non-empty buckets as "lower bound:count" pairs, for logging
+        void FormatBuckets(char* buffer, size_t size) const {
+            if (!size) return;
+            buffer[0] = '\0';
+
+            size_t length = 0;
+            for (size_t i = 0; i < BUCKETS && length + 1 < size; i++) {
+                if (!Buckets[i]) continue;
+                length += StringFormatter::snprintf(buffer + length, size - length, length ? " %u64:%u64" : "%u64:%u64", LowerBound(i), Buckets[i]);
+            }
+        }
+    };
+}
+
+#endif //BOREALOS_HISTOGRAM_H
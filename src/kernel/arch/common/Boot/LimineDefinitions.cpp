@@ -53,6 +53,14 @@ volatile limine_executable_cmdline_request cmdargs_request = {
     .response = nullptr,
 };
 
+__attribute__((used, section(".limine_requests")))
+volatile limine_mp_request mp_request = {
+    .id = LIMINE_MP_REQUEST_ID,
+    .revision = 0,
+    .response = nullptr,
+    .flags = LIMINE_MP_REQUEST_X86_64_X2APIC // x2APIC mode if the CPU supports it and the firmware doesn't opt out, APIC handles both modes
+};
+
 // Finally, define the start and end markers for the Limine requests.
 // These can also be moved anywhere, to any .c file, as seen fit.
 
@@ -0,0 +1,13 @@
+#include "Benchmarks.h"
+
+namespace Benchmarks {
+    void RunAll() {
+        LOG_INFO("Running kernel benchmarks...");
+        RunMemoryBenchmark();
+        RunTimerWheelBenchmark();
+        RunContextSwitchBenchmark();
+        RunIPIBenchmark();
+        RunPeriodicTaskBenchmark();
+        LOG_INFO("Kernel benchmarks finished.");
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef BOREALOS_BENCHMARKS_H
+#define BOREALOS_BENCHMARKS_H
+
+#include <Definitions.h>
+
+// Boot-time micro benchmarks, enabled with SETTING_BENCHMARK_MODE. The results are only logged, nothing is asserted.
+// Cycles are measured with the TSC, so they are reference cycles rather than core clock cycles.
+namespace Benchmarks {
+    void RunAll();
+
+    // memcpy/memset/memcmp throughput from 16 B to 16 MiB, for every available implementation
+    void RunMemoryBenchmark();
+
+    // Insert, re-arm, cancel and expiry cost of the scheduler's timer wheel with 100k timers
+    void RunTimerWheelBenchmark();
+
+    // Cycles per thread switch, measured by two threads yielding to each other
+    void RunContextSwitchBenchmark();
+
+    // Round trip cycles of an SMP call to one and to every other CPU, and of TLB shootdowns
+    void RunIPIBenchmark();
+
+    // Release latency, jitter and overruns of a 1 kHz and a 2 kHz periodic task over 200 ms
+    void RunPeriodicTaskBenchmark();
+
+    // Cycles per null syscall round trip from userspace. Not part of RunAll: the user trampoline measures it once it's entered
+    // userspace and reports through the ReportSyscallBenchmark syscall, which calls this.
+    void ReportSyscallBenchmark(uint64_t iterations, uint64_t totalCycles, uint64_t minCycles);
+}
+
+#endif //BOREALOS_BENCHMARKS_H
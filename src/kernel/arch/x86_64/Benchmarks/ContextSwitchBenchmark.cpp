@@ -0,0 +1,69 @@
+#include "Benchmarks.h"
+
+#include <Kernel.h>
+#include "../KernelData.h"
+
+namespace Benchmarks {
+    namespace {
+        constexpr size_t Iterations = 100000;
+
+        struct PingPong {
+            Core::Time::Scheduler* scheduler;
+            volatile bool done;
+        };
+
+        void Partner(void* context) {
+            auto pingPong = static_cast<PingPong*>(context);
+            while (!pingPong->done) {
+                pingPong->scheduler->Yield();
+            }
+        }
+    }
+
+    void RunContextSwitchBenchmark() {
+        auto data = Kernel<KernelData>::GetInstance()->ArchitectureData;
+        auto tsc = &data->Tsc;
+        auto scheduler = data->DefaultScheduler;
+
+        // Both threads stay on the boot CPU, otherwise an idle CPU steals the partner and the two no longer switch to each other
+        auto self = scheduler->GetCurrentThread();
+        Core::Time::Scheduler::SetAffinity(self, 1);
+
+        // Yield with nobody else ready only goes through the scheduler's bookkeeping, that's the overhead the switch itself is on top of
+        uint64_t start = tsc->GetTicks();
+        for (size_t i = 0; i < Iterations; i++) {
+            scheduler->Yield();
+        }
+        uint64_t cycles = tsc->GetTicks() - start;
+        LOG_INFO("Context switch: Yield without other threads: %u64 cycles per call", cycles / Iterations);
+
+        auto pingPong = new PingPong { scheduler, false };
+        auto partner = scheduler->CreateThread("benchmark-partner", Partner, pingPong);
+        if (!partner) {
+            LOG_WARNING("Context switch: couldn't create the partner thread, skipping the benchmark.");
+            delete pingPong;
+            Core::Time::Scheduler::SetAffinity(self, ~0ULL);
+            return;
+        }
+        Core::Time::Scheduler::SetAffinity(partner, 1);
+
+        // Let the partner start once, so its first run through the trampoline isn't measured
+        scheduler->Yield();
+
+        uint64_t switchesBefore = scheduler->GetContextSwitchCount();
+        start = tsc->GetTicks();
+        for (size_t i = 0; i < Iterations; i++) {
+            scheduler->Yield();
+        }
+        cycles = tsc->GetTicks() - start;
+        uint64_t switches = scheduler->GetContextSwitchCount() - switchesBefore;
+
+        LOG_INFO("Context switch: %u64 switches in %u64 cycles (%u64 cycles per switch)", switches, cycles, switches ? cycles / switches : 0);
+
+        // The partner exits on its next turn, the idle thread frees it
+        pingPong->done = true;
+        scheduler->Yield();
+        delete pingPong;
+        Core::Time::Scheduler::SetAffinity(self, ~0ULL);
+    }
+}
@@ -0,0 +1,56 @@
+#include "Benchmarks.h"
+
+#include <Kernel.h>
+#include "../KernelData.h"
+
+namespace Benchmarks {
+    namespace {
+        constexpr size_t Iterations = 10000;
+
+        void Nothing(void*) {
+
+        }
+    }
+
+    void RunIPIBenchmark() {
+        auto data = Kernel<KernelData>::GetInstance()->ArchitectureData;
+        auto tsc = &data->Tsc;
+        auto smp = data->Smp;
+
+        if (!smp || smp->GetCPUCount() < 2) {
+            LOG_INFO("IPI: only one CPU is online, skipping the benchmark.");
+            return;
+        }
+
+        // The target sits in its idle loop, so every round trip includes waking it from hlt
+        uint64_t target = 1ULL << 1;
+        smp->CallFunction(target, Nothing, nullptr, true);
+
+        uint64_t start = tsc->GetTicks();
+        for (size_t i = 0; i < Iterations; i++) {
+            smp->CallFunction(target, Nothing, nullptr, true);
+        }
+        uint64_t cycles = tsc->GetTicks() - start;
+        LOG_INFO("IPI: call function round trip to CPU 1: %u64 cycles", cycles / Iterations);
+
+        uint64_t others = smp->GetOnlineMask() & ~1ULL;
+        start = tsc->GetTicks();
+        for (size_t i = 0; i < Iterations; i++) {
+            smp->CallFunction(others, Nothing, nullptr, true);
+        }
+        cycles = tsc->GetTicks() - start;
+        LOG_INFO("IPI: call function round trip to all %u32 other CPUs: %u64 cycles", smp->GetCPUCount() - 1, cycles / Iterations);
+
+        // Shootdowns of a range below and above the full flush threshold. The range is still mapped, the entries are simply reloaded on the next access.
+        uint64_t address = reinterpret_cast<uint64_t>(&Nothing) & ~static_cast<uint64_t>(Architecture::KernelPageSize - 1);
+        constexpr size_t pageCounts[] = { 1, Core::SMP::TLB_FLUSH_ALL_THRESHOLD, Core::SMP::TLB_FLUSH_ALL_THRESHOLD + 1 };
+        for (size_t pages : pageCounts) {
+            start = tsc->GetTicks();
+            for (size_t i = 0; i < Iterations; i++) {
+                smp->ShootdownTLB(address, pages);
+            }
+            cycles = tsc->GetTicks() - start;
+            LOG_INFO("IPI: TLB shootdown of %u64 page(s): %u64 cycles", static_cast<uint64_t>(pages), cycles / Iterations);
+        }
+    }
+}
@@ -0,0 +1,116 @@
+#include "Benchmarks.h"
+
+#include <Kernel.h>
+#include <Utility/MemoryUtilities.h>
+#include "../KernelData.h"
+#include "../Memory/MemoryRoutines.h"
+
+namespace Benchmarks {
+    namespace {
+        constexpr size_t MinSize = 16;
+        constexpr size_t MaxSize = 16 * Constants::MiB;
+        constexpr uint64_t BytesPerSize = 64 * Constants::MiB; // Data moved per size and implementation, so small sizes run enough iterations to be measurable
+        constexpr uint64_t MinIterations = 4;
+
+        typedef void* (*CopyFunction)(void*, const void*, size_t);
+        typedef void* (*SetFunction)(void*, uint8_t, size_t);
+        typedef int (*CompareFunction)(const void*, const void*, size_t);
+
+        uint64_t GetIterations(size_t size) {
+            uint64_t iterations = BytesPerSize / size;
+            return iterations < MinIterations ? MinIterations : iterations;
+        }
+
+        // The string formatter has no floating point support, so bytes per cycle are printed with two fixed decimals
+        void LogResult(const char* name, size_t size, uint64_t iterations, uint64_t cycles) {
+            uint64_t hundredths = cycles ? (size * iterations * 100) / cycles : 0;
+            LOG_INFO("%s %u64 B: %u64.%u64%u64 bytes/cycle (%u64 cycles per call)", name, size, hundredths / 100, (hundredths / 10) % 10, hundredths % 10, cycles / iterations);
+        }
+
+        void MeasureCopy(const char* name, CopyFunction function, void* dest, const void* src, size_t size) {
+            auto tsc = &Kernel<KernelData>::GetInstance()->ArchitectureData->Tsc;
+            uint64_t iterations = GetIterations(size);
+
+            function(dest, src, size); // Warm up the caches and TLB
+            uint64_t start = tsc->GetTicks();
+            for (uint64_t i = 0; i < iterations; i++) {
+                function(dest, src, size);
+                asm volatile ("" ::: "memory");
+            }
+            uint64_t end = tsc->GetTicks();
+
+            LogResult(name, size, iterations, end - start);
+        }
+
+        void MeasureSet(const char* name, SetFunction function, void* dest, size_t size) {
+            auto tsc = &Kernel<KernelData>::GetInstance()->ArchitectureData->Tsc;
+            uint64_t iterations = GetIterations(size);
+
+            function(dest, 0xA5, size);
+            uint64_t start = tsc->GetTicks();
+            for (uint64_t i = 0; i < iterations; i++) {
+                function(dest, static_cast<uint8_t>(i), size);
+                asm volatile ("" ::: "memory");
+            }
+            uint64_t end = tsc->GetTicks();
+
+            LogResult(name, size, iterations, end - start);
+        }
+
+        void MeasureCompare(const char* name, CompareFunction function, const void* s1, const void* s2, size_t size) {
+            auto tsc = &Kernel<KernelData>::GetInstance()->ArchitectureData->Tsc;
+            uint64_t iterations = GetIterations(size);
+            volatile int result = 0;
+
+            uint64_t start = tsc->GetTicks();
+            for (uint64_t i = 0; i < iterations; i++) {
+                result = function(s1, s2, size);
+            }
+            uint64_t end = tsc->GetTicks();
+
+            if (result != 0) LOG_WARNING("memcmp benchmark buffers differ at size %u64!", size);
+            LogResult(name, size, iterations, end - start);
+        }
+    }
+
+    void RunMemoryBenchmark() {
+        auto pmm = &Kernel<KernelData>::GetInstance()->ArchitectureData->Pmm;
+        uint32_t pageCount = MaxSize / Architecture::KernelPageSize;
+
+        uintptr_t srcPhysical = pmm->AllocatePages(pageCount);
+        uintptr_t destPhysical = pmm->AllocatePages(pageCount);
+        if (!srcPhysical || !destPhysical) {
+            LOG_WARNING("Not enough contiguous memory for the memory benchmark, skipping it.");
+            if (srcPhysical) pmm->FreePages(srcPhysical, pageCount);
+            if (destPhysical) pmm->FreePages(destPhysical, pageCount);
+            return;
+        }
+
+        auto src = reinterpret_cast<uint8_t*>(HIGHER_HALF(srcPhysical));
+        auto dest = reinterpret_cast<uint8_t*>(HIGHER_HALF(destPhysical));
+        for (size_t i = 0; i < MaxSize; i++) src[i] = static_cast<uint8_t>(i * 31);
+
+        LOG_INFO("Memory benchmark, dispatch strategy is \"%s\", SIMD routines use %s.", Memory::MemoryRoutines::GetStrategyName(), Memory::MemoryRoutines::GetSimdLevelName());
+
+        for (size_t size = MinSize; size <= MaxSize; size *= 2) {
+            MeasureCopy("memcpy", memcpy, dest, src, size);
+            MeasureCopy("copy/words", Memory::MemoryRoutines::CopyWords, dest, src, size);
+            MeasureCopy("copy/rep movsb", Memory::MemoryRoutines::CopyRepMovsb, dest, src, size);
+            MeasureCopy("copy/movnti", Memory::MemoryRoutines::CopyNonTemporal, dest, src, size);
+            MeasureCopy("copy/simd", Memory::MemoryRoutines::CopySIMD, dest, src, size);
+
+            MeasureSet("memset", [](void* d, uint8_t v, size_t n) { return memset(d, v, n); }, dest, size);
+            MeasureSet("set/words", Memory::MemoryRoutines::SetWords, dest, size);
+            MeasureSet("set/rep stosb", Memory::MemoryRoutines::SetRepStosb, dest, size);
+            MeasureSet("set/movnti", Memory::MemoryRoutines::SetNonTemporal, dest, size);
+            MeasureSet("set/simd", Memory::MemoryRoutines::SetSIMD, dest, size);
+
+            memcpy(dest, src, size);
+            MeasureCompare("memcmp", memcmp, dest, src, size);
+            MeasureCompare("compare/simd", Memory::MemoryRoutines::CompareSIMD, dest, src, size);
+        }
+
+        pmm->FreePages(srcPhysical, pageCount);
+        pmm->FreePages(destPhysical, pageCount);
+    }
+}
@@ -0,0 +1,63 @@
+#include "Benchmarks.h"
+
+#include <Kernel.h>
+#include "../KernelData.h"
+
+namespace Benchmarks {
+    namespace {
+        constexpr uint64_t RunNs = 200'000'000; // 200 ms
+
+        struct Spin {
+            Core::Time::TSC* tsc;
+            uint64_t nanoseconds;
+        };
+
+        // Stands in for the work a control loop does on every activation
+        void Work(void* context) {
+            auto spin = static_cast<Spin*>(context);
+            uint64_t end = spin->tsc->GetNanoseconds() + spin->nanoseconds;
+            while (spin->tsc->GetNanoseconds() < end) {
+                asm volatile("pause");
+            }
+        }
+
+        void LogResult(const char* name, const Core::Time::PeriodicStatistics& statistics) {
+            uint64_t activations = statistics.Activations;
+            LOG_INFO("Periodic task %s: %u64 activations, %u64 overruns, %u64 deadline misses", name, activations, statistics.Overruns, statistics.DeadlineMisses);
+            if (activations == 0) return;
+
+            LOG_INFO("Periodic task %s: release latency min %u64 ns, avg %u64 ns, max %u64 ns, max jitter %u64 ns, runtime avg %u64 ns, max %u64 ns", name,
+                     statistics.MinLatencyNs, statistics.TotalLatencyNs / activations, statistics.MaxLatencyNs, statistics.MaxJitterNs,
+                     statistics.TotalRuntimeNs / activations, statistics.MaxRuntimeNs);
+        }
+    }
+
+    void RunPeriodicTaskBenchmark() {
+        auto data = Kernel<KernelData>::GetInstance()->ArchitectureData;
+        auto scheduler = data->DefaultScheduler;
+
+        // Two rates that release together every other period, so the deadline ordering between them is exercised too
+        Spin fastWork = { &data->Tsc, 20'000 };
+        Spin slowWork = { &data->Tsc, 50'000 };
+        auto fast = scheduler->CreatePeriodicTask(Work, &fastWork, 500'000);
+        auto slow = scheduler->CreatePeriodicTask(Work, &slowWork, 1'000'000, 800'000);
+        if (!fast || !slow) {
+            LOG_ERROR("Periodic task benchmark: failed to create the tasks!");
+            if (fast) scheduler->DestroyPeriodicTask(fast);
+            if (slow) scheduler->DestroyPeriodicTask(slow);
+            return;
+        }
+
+        scheduler->StartPeriodicTask(fast);
+        scheduler->StartPeriodicTask(slow);
+        scheduler->Sleep(RunNs);
+        scheduler->StopPeriodicTask(fast);
+        scheduler->StopPeriodicTask(slow);
+
+        LogResult("2 kHz", scheduler->GetPeriodicStatistics(fast));
+        LogResult("1 kHz", scheduler->GetPeriodicStatistics(slow));
+
+        scheduler->DestroyPeriodicTask(fast);
+        scheduler->DestroyPeriodicTask(slow);
+    }
+}
@@ -0,0 +1,14 @@
+#include "Benchmarks.h"
+
+namespace Benchmarks {
+    void ReportSyscallBenchmark(uint64_t iterations, uint64_t totalCycles, uint64_t minCycles) {
+        if (!iterations) {
+            LOG_WARNING("Syscall: the user trampoline reported no iterations.");
+            return;
+        }
+
+        // Each round trip is timed with RDTSC around the syscall instruction, so the cycles include the fenced timestamp reads
+        LOG_INFO("Syscall: null syscall round trip from userspace: %u64 cycles average, %u64 cycles fastest (%u64 iterations)",
+                 totalCycles / iterations, minCycles, iterations);
+    }
+}
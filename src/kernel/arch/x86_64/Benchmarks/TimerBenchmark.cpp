@@ -0,0 +1,82 @@
+#include "Benchmarks.h"
+
+#include <Kernel.h>
+#include "../KernelData.h"
+#include "../Core/Time/TimerWheel.h"
+
+namespace Benchmarks {
+    namespace {
+        constexpr size_t TimerCount = 100000;
+        constexpr uint64_t MaxDelayTicks = 1ULL << 30; // ~18 minutes worth of scheduler ticks, so every wheel level up to 5 gets used
+
+        void CountExpiry(void* context) {
+            (*static_cast<size_t*>(context))++;
+        }
+
+        // Small xorshift generator, the delays only need to be spread out, not random
+        uint64_t NextRandom(uint64_t& state) {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            return state;
+        }
+
+        void LogResult(const char* name, size_t operations, uint64_t cycles) {
+            LOG_INFO("Timer wheel %s: %u64 operations in %u64 cycles (%u64 cycles per operation)", name, operations, cycles, operations ? cycles / operations : 0);
+        }
+    }
+
+    void RunTimerWheelBenchmark() {
+        auto tsc = &Kernel<KernelData>::GetInstance()->ArchitectureData->Tsc;
+        auto wheel = new Core::Time::TimerWheel(0);
+        auto timers = new Core::Time::Timer[TimerCount];
+        size_t expired = 0;
+        uint64_t random = 0x9E3779B97F4A7C15ULL;
+
+        for (size_t i = 0; i < TimerCount; i++) {
+            timers[i].function = CountExpiry;
+            timers[i].context = &expired;
+        }
+
+        // Mix short and long delays, most real timers are short but the long ones are what stress the cascading
+        uint64_t start = tsc->GetTicks();
+        for (size_t i = 0; i < TimerCount; i++) {
+            uint64_t delay = NextRandom(random) % ((i & 3) == 0 ? MaxDelayTicks : 4096);
+            wheel->Insert(&timers[i], 1 + delay);
+        }
+        LogResult("insert", TimerCount, tsc->GetTicks() - start);
+
+        start = tsc->GetTicks();
+        size_t rearmed = 0;
+        for (size_t i = 0; i < TimerCount; i += 5) {
+            wheel->Insert(&timers[i], 1 + NextRandom(random) % MaxDelayTicks);
+            rearmed++;
+        }
+        LogResult("re-arm", rearmed, tsc->GetTicks() - start);
+
+        start = tsc->GetTicks();
+        size_t cancelled = 0;
+        for (size_t i = 0; i < TimerCount; i += 3) {
+            if (wheel->Remove(&timers[i])) cancelled++;
+        }
+        LogResult("cancel", cancelled, tsc->GetTicks() - start);
+
+        // Walk the wheel forward in 1 ms steps like the scheduler would, the steps without work are part of the cost
+        start = tsc->GetTicks();
+        uint64_t steps = 0;
+        for (uint64_t tick = 0; wheel->GetPendingCount() > 0; tick += 1024, steps++) {
+            uint64_t next = wheel->GetNextExpiry();
+            if (next > tick) tick = next; // Tickless: jump straight to the next deadline
+            wheel->Advance(tick);
+        }
+        LogResult("expiry", expired, tsc->GetTicks() - start);
+
+        if (expired != TimerCount - cancelled) {
+            LOG_ERROR("Timer wheel benchmark expired %u64 timers, expected %u64!", expired, TimerCount - cancelled);
+        }
+        LOG_INFO("Timer wheel benchmark needed %u64 advance steps.", steps);
+
+        delete[] timers;
+        delete wheel;
+    }
+}
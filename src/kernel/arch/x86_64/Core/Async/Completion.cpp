@@ -0,0 +1,117 @@
+#include "Completion.h"
+
+#include "../Time/Scheduler.h"
+
+namespace Core::Async {
+    bool Completion::Awaiter::await_resume() {
+        // The timer and the coroutine are on the executor's CPU, so it can't be running right now, and once cancelled it never will
+        if (_result && _timeoutNs != NO_TIMEOUT && _promise) _promise->Owner->GetScheduler()->CancelTimer(&_timer);
+        return _result;
+    }
+
+    bool Completion::Awaiter::Suspend(PromiseBase *promise) {
+        uint64_t flags = _owner->_lock.LockIrqSave();
+
+        // A Complete may have come after the check in await_ready
+        if (_owner->Consume()) {
+            _owner->_lock.UnlockIrqRestore(flags);
+            _result = true;
+            return false;
+        }
+
+        if (_timeoutNs == 0) {
+            _owner->_lock.UnlockIrqRestore(flags);
+            _result = false;
+            return false;
+        }
+
+        if (!promise->Owner) {
+            PANIC("Tried to wait on a completion in a coroutine that doesn't run on an executor!");
+        }
+
+        _promise = promise;
+        _queued = true;
+        _next = nullptr;
+        _prev = _owner->_tail;
+        if (_owner->_tail) _owner->_tail->_next = this;
+        else _owner->_head = this;
+        _owner->_tail = this;
+
+        if (_timeoutNs != NO_TIMEOUT) {
+            _timer.function = TimedOut;
+            _timer.context = this;
+            promise->Owner->GetScheduler()->ArmTimer(&_timer, _timeoutNs);
+        }
+
+        _owner->_lock.UnlockIrqRestore(flags);
+        return true;
+    }
+
+    void Completion::Awaiter::TimedOut(void *context) {
+        auto awaiter = static_cast<Awaiter*>(context);
+        Completion* owner = awaiter->_owner;
+
+        // A Complete that came first already handed the completion over and queued the coroutine
+        uint64_t flags = owner->_lock.LockIrqSave();
+        if (awaiter->_queued) owner->Hand(awaiter, false);
+        owner->_lock.UnlockIrqRestore(flags);
+    }
+
+    void Completion::Complete() {
+        uint64_t flags = _lock.LockIrqSave();
+        if (_head) Hand(_head, true);
+        else if (_done != ALL) _done++;
+        _lock.UnlockIrqRestore(flags);
+    }
+
+    void Completion::CompleteAll() {
+        uint64_t flags = _lock.LockIrqSave();
+        _done = ALL;
+        while (_head) Hand(_head, true);
+        _lock.UnlockIrqRestore(flags);
+    }
+
+    bool Completion::TryWait() {
+        uint64_t flags = _lock.LockIrqSave();
+        bool consumed = Consume();
+        _lock.UnlockIrqRestore(flags);
+        return consumed;
+    }
+
+    void Completion::Reset() {
+        uint64_t flags = _lock.LockIrqSave();
+        _done = 0;
+        _lock.UnlockIrqRestore(flags);
+    }
+
+    bool Completion::IsDone() const {
+        uint64_t flags = _lock.LockIrqSave();
+        bool done = _done != 0;
+        _lock.UnlockIrqRestore(flags);
+        return done;
+    }
+
+    bool Completion::Consume() {
+        if (_done == 0) return false;
+        if (_done != ALL) _done--;
+        return true;
+    }
+
+    void Completion::Unlink(Awaiter *awaiter) {
+        if (awaiter->_prev) awaiter->_prev->_next = awaiter->_next;
+        else _head = awaiter->_next;
+        if (awaiter->_next) awaiter->_next->_prev = awaiter->_prev;
+        else _tail = awaiter->_prev;
+
+        awaiter->_next = awaiter->_prev = nullptr;
+        awaiter->_queued = false;
+    }
+
+    void Completion::Hand(Awaiter *awaiter, bool result) {
+        Unlink(awaiter);
+        awaiter->_result = result;
+
+        // Still under the lock: the awaiter lives in the coroutine frame, which may be gone as soon as the coroutine resumed
+        Executor::Resume(awaiter->_promise);
+    }
+}
@@ -0,0 +1,87 @@
+#ifndef BOREALOS_ASYNC_COMPLETION_H
+#define BOREALOS_ASYNC_COMPLETION_H
+
+#include <Definitions.h>
+
+#include "Executor.h"
+#include "../Sync/SpinLock.h"
+
+namespace Core::Async {
+    /// Sync::Completion for coroutines: co_await completion.Wait() suspends the coroutine until someone calls Complete, e.g. the
+    /// interrupt handler of the device it talks to. Every Complete lets one Wait through, even if it came first; CompleteAll lets every
+    /// current and future Wait through until Reset. Complete works from any context.
+    /// With a count of one it also serves as a lock between coroutines: Wait takes it, Complete hands it on.
+    class Completion {
+    public:
+        class Awaiter {
+        public:
+            [[nodiscard]] bool await_ready() {
+                _result = _owner->TryWait();
+                return _result;
+            }
+
+            template<typename Promise>
+            bool await_suspend(std::coroutine_handle<Promise> handle) {
+                return Suspend(&GetPromise(handle));
+            }
+
+            /// False if the timeout passed first, always true without one
+            bool await_resume();
+
+        private:
+            friend class Completion;
+
+            Completion* _owner;
+            uint64_t _timeoutNs;
+            PromiseBase* _promise = nullptr;
+            Awaiter* _next = nullptr;
+            Awaiter* _prev = nullptr;
+            bool _queued = false;
+            bool _result = false;
+            Time::Timer _timer; // Only armed with a timeout
+
+            Awaiter(Completion* owner, uint64_t timeoutNs) : _owner(owner), _timeoutNs(timeoutNs) {}
+
+            bool Suspend(PromiseBase* promise); // Returns false if the coroutine goes on right away
+            static void TimedOut(void* context);
+        };
+
+        constexpr explicit Completion(Sync::LockClass* lockClass = nullptr) : _lock(lockClass) {}
+
+        Completion(const Completion&) = delete;
+        Completion& operator=(const Completion&) = delete;
+
+        void Complete();
+        void CompleteAll();
+
+        Awaiter Wait() {
+            return Awaiter(this, NO_TIMEOUT);
+        }
+
+        Awaiter WaitTimeout(uint64_t timeoutNs) {
+            return Awaiter(this, timeoutNs);
+        }
+
+        /// Consumes one completion without waiting, returns false if there is none
+        bool TryWait();
+        /// Forgets earlier completions, for reusing the object. Nobody may be waiting.
+        void Reset();
+        [[nodiscard]] bool IsDone() const;
+
+    private:
+        static constexpr uint32_t ALL = static_cast<uint32_t>(-1);
+        static constexpr uint64_t NO_TIMEOUT = static_cast<uint64_t>(-1);
+
+        mutable Sync::SpinLock _lock;
+        uint32_t _done = 0;
+        Awaiter* _head = nullptr;
+        Awaiter* _tail = nullptr;
+
+        // Lock must be held for all of these
+        bool Consume();
+        void Unlink(Awaiter* awaiter);
+        void Hand(Awaiter* awaiter, bool result); // Dequeues the waiter and queues its coroutine to resume with the given result
+    };
+}
+
+#endif //BOREALOS_ASYNC_COMPLETION_H
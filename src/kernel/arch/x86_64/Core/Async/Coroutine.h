@@ -0,0 +1,112 @@
+#ifndef BOREALOS_COROUTINE_H
+#define BOREALOS_COROUTINE_H
+
+#include <Definitions.h>
+
+// The compiler looks up std::coroutine_traits and std::coroutine_handle to build coroutines, and the freestanding toolchain has no
+// <coroutine>. This is the subset of it we use, on top of the same compiler builtins libstdc++ and libc++ use.
+namespace std {
+    template<typename Return, typename... Arguments>
+    struct coroutine_traits {
+        using promise_type = typename Return::promise_type;
+    };
+
+    template<typename Promise = void>
+    struct coroutine_handle;
+
+    template<>
+    struct coroutine_handle<void> {
+        constexpr coroutine_handle() noexcept = default;
+        constexpr coroutine_handle(decltype(nullptr)) noexcept {}
+
+        static constexpr coroutine_handle from_address(void* address) noexcept {
+            coroutine_handle handle;
+            handle._frame = address;
+            return handle;
+        }
+
+        [[nodiscard]] constexpr void* address() const noexcept { return _frame; }
+        constexpr explicit operator bool() const noexcept { return _frame != nullptr; }
+
+        [[nodiscard]] bool done() const noexcept { return __builtin_coro_done(_frame); }
+        void operator()() const { resume(); }
+        void resume() const { __builtin_coro_resume(_frame); }
+        void destroy() const { __builtin_coro_destroy(_frame); }
+
+    protected:
+        void* _frame = nullptr;
+    };
+
+    template<typename Promise>
+    struct coroutine_handle : coroutine_handle<void> {
+        constexpr coroutine_handle() noexcept = default;
+        constexpr coroutine_handle(decltype(nullptr)) noexcept {}
+
+        static constexpr coroutine_handle from_address(void* address) noexcept {
+            coroutine_handle handle;
+            handle._frame = address;
+            return handle;
+        }
+
+        static coroutine_handle from_promise(Promise& promise) noexcept {
+            coroutine_handle handle;
+            handle._frame = __builtin_coro_promise(reinterpret_cast<char*>(&promise), __alignof(Promise), true);
+            return handle;
+        }
+
+        [[nodiscard]] Promise& promise() const {
+            return *static_cast<Promise*>(__builtin_coro_promise(_frame, __alignof(Promise), false));
+        }
+    };
+
+    struct noop_coroutine_promise {};
+
+    namespace __coroutine_detail {
+        inline void DoNothing() {}
+
+        // Laid out like a compiler generated frame: the resume and destroy functions come first, then the promise
+        struct NoopFrame {
+            void (*Resume)() = DoNothing;
+            void (*Destroy)() = DoNothing;
+            noop_coroutine_promise Promise;
+        };
+
+        inline NoopFrame noopFrame {};
+    }
+
+    // Resuming it does nothing, for symmetric transfer when there is nothing to transfer to
+    template<>
+    struct coroutine_handle<noop_coroutine_promise> : coroutine_handle<void> {
+        [[nodiscard]] constexpr bool done() const noexcept { return false; }
+        void operator()() const noexcept {}
+        void resume() const noexcept {}
+        void destroy() const noexcept {}
+
+    private:
+        friend coroutine_handle noop_coroutine() noexcept;
+
+        coroutine_handle() noexcept {
+            _frame = &__coroutine_detail::noopFrame;
+        }
+    };
+
+    using noop_coroutine_handle = coroutine_handle<noop_coroutine_promise>;
+
+    inline noop_coroutine_handle noop_coroutine() noexcept {
+        return noop_coroutine_handle();
+    }
+
+    struct suspend_always {
+        [[nodiscard]] constexpr bool await_ready() const noexcept { return false; }
+        constexpr void await_suspend(coroutine_handle<>) const noexcept {}
+        constexpr void await_resume() const noexcept {}
+    };
+
+    struct suspend_never {
+        [[nodiscard]] constexpr bool await_ready() const noexcept { return true; }
+        constexpr void await_suspend(coroutine_handle<>) const noexcept {}
+        constexpr void await_resume() const noexcept {}
+    };
+}
+
+#endif //BOREALOS_COROUTINE_H
@@ -0,0 +1,120 @@
+#include "Executor.h"
+
+#include "../PerCPU.h"
+#include "../Time/Scheduler.h"
+#include "Kernel.h"
+#include "../../KernelData.h"
+
+namespace Core::Async {
+    Executor::Executor(const char *name, uint32_t cpu) : _name(name) {
+        auto smp = Kernel<KernelData>::GetInstance()->ArchitectureData->Smp;
+        uint32_t cpuCount = smp ? smp->GetCPUCount() : 1;
+        if (cpu >= cpuCount) {
+            LOG_WARNING("Executor %s asked for CPU %u32, which isn't online, using CPU 0 instead.", name, cpu);
+            cpu = 0;
+        }
+
+        _cpu = cpu;
+        _scheduler = smp ? smp->GetCPU(cpu)->Scheduler : PerCPU::Get()->Scheduler;
+
+        // Timers of sleeping coroutines are armed on the executor's CPU, so they never race with the coroutine on another CPU
+        _thread = _scheduler->CreateThread(name, Main, this, 1ULL << cpu);
+        if (!_thread) {
+            PANIC("Failed to create an executor thread!");
+        }
+    }
+
+    bool Executor::Spawn(Task<> task) {
+        auto handle = task.Release();
+        if (!handle) return false;
+
+        auto& promise = handle.promise();
+        promise.Owner = this;
+        promise.Detached = true;
+        __atomic_fetch_add(&_spawns, 1, __ATOMIC_RELAXED);
+
+        Post(&promise);
+        return true;
+    }
+
+    void Executor::Resume(PromiseBase *promise) {
+        if (!promise->Owner) {
+            PANIC("Tried to resume a coroutine that doesn't run on an executor!");
+        }
+
+        promise->Owner->Post(promise);
+    }
+
+    const char *Executor::GetName() const {
+        return _name;
+    }
+
+    uint32_t Executor::GetCPU() const {
+        return _cpu;
+    }
+
+    Time::Scheduler *Executor::GetScheduler() const {
+        return _scheduler;
+    }
+
+    uint64_t Executor::GetResumeCount() const {
+        return __atomic_load_n(&_resumes, __ATOMIC_RELAXED);
+    }
+
+    uint64_t Executor::GetSpawnCount() const {
+        return __atomic_load_n(&_spawns, __ATOMIC_RELAXED);
+    }
+
+    void Executor::Post(PromiseBase *promise) {
+        PromiseBase* head = __atomic_load_n(&_ready, __ATOMIC_RELAXED);
+        do {
+            promise->NextReady = head;
+        } while (!__atomic_compare_exchange_n(&_ready, &head, promise, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+        // Only the push onto an empty list has to wake the thread, the others are picked up by the same pass
+        if (!head) _wake.WakeOne();
+    }
+
+    void Executor::Main(void *argument) {
+        auto executor = static_cast<Executor*>(argument);
+
+        while (true) {
+            executor->_wake.WaitEvent([executor] {
+                return __atomic_load_n(&executor->_ready, __ATOMIC_ACQUIRE) != nullptr;
+            });
+
+            // The list is newest first, reversing it resumes the coroutines in the order they became ready
+            PromiseBase* ready = __atomic_exchange_n(&executor->_ready, nullptr, __ATOMIC_ACQUIRE);
+            PromiseBase* ordered = nullptr;
+            while (ready) {
+                PromiseBase* next = ready->NextReady;
+                ready->NextReady = ordered;
+                ordered = ready;
+                ready = next;
+            }
+
+            while (ordered) {
+                // The coroutine may free its frame, or get queued again, before resume returns
+                PromiseBase* promise = ordered;
+                ordered = promise->NextReady;
+
+                __atomic_store_n(&executor->_resumes, executor->_resumes + 1, __ATOMIC_RELAXED);
+                promise->Self.resume();
+            }
+        }
+    }
+
+    void Sleep::Arm(PromiseBase *promise) {
+        if (!promise->Owner) {
+            PANIC("Tried to sleep in a coroutine that doesn't run on an executor!");
+        }
+
+        _timer.function = Expired;
+        _timer.context = promise;
+        promise->Owner->GetScheduler()->ArmTimer(&_timer, _nanoseconds);
+    }
+
+    void Sleep::Expired(void *context) {
+        Executor::Resume(static_cast<PromiseBase*>(context));
+    }
+}
@@ -0,0 +1,102 @@
+#ifndef BOREALOS_EXECUTOR_H
+#define BOREALOS_EXECUTOR_H
+
+#include <Definitions.h>
+
+#include "Task.h"
+#include "../Sync/WaitQueue.h"
+#include "../Threading/Thread.h"
+#include "../Time/TimerWheel.h"
+
+namespace Core::Time {
+    class Scheduler;
+}
+
+namespace Core::Async {
+    /// Runs coroutines on one kernel thread, pinned to one CPU. Coroutines that wait for a device or a timer cost a frame instead of a
+    /// thread, so any number of device conversations share the executor's thread, and take turns whenever one of them waits.
+    /// Coroutines are resumed in the order they became ready. They must not block the thread for long (sleeping with Sync::SleepNs or
+    /// waiting on a Sync::WaitQueue holds up every other coroutine of the executor); they co_await instead.
+    /// Anything may make a coroutine ready, including interrupt handlers. Executors live as long as the kernel.
+    class Executor {
+    public:
+        Executor(const char* name, uint32_t cpu);
+
+        /// Starts the task on this executor, it runs on its own and frees itself once it returned. Returns false if the task is
+        /// invalid (its frame couldn't be allocated). Works from any context.
+        bool Spawn(Task<> task);
+        /// Queues a suspended coroutine to be resumed on its executor, from any context. For awaitables.
+        static void Resume(PromiseBase* promise);
+
+        [[nodiscard]] const char* GetName() const;
+        [[nodiscard]] uint32_t GetCPU() const;
+        [[nodiscard]] Time::Scheduler* GetScheduler() const; // Of the CPU the executor runs on, for timers
+        [[nodiscard]] uint64_t GetResumeCount() const; // Coroutines resumed so far, awaited tasks that started right away don't count
+        [[nodiscard]] uint64_t GetSpawnCount() const;
+
+    private:
+        const char* _name;
+        uint32_t _cpu;
+        Time::Scheduler* _scheduler;
+        Threading::Thread* _thread = nullptr;
+        PromiseBase* volatile _ready = nullptr; // Pushed lock-free, newest first
+        Sync::WaitQueue _wake;
+        uint64_t _resumes = 0;
+        uint64_t _spawns = 0;
+
+        void Post(PromiseBase* promise);
+        [[noreturn]] static void Main(void* argument);
+    };
+
+    /// co_await Sleep(ns) suspends the coroutine for at least ns, its executor's thread runs other coroutines meanwhile
+    struct Sleep {
+        explicit Sleep(uint64_t nanoseconds) : _nanoseconds(nanoseconds) {}
+
+        [[nodiscard]] bool await_ready() const noexcept { return _nanoseconds == 0; }
+
+        template<typename Promise>
+        void await_suspend(std::coroutine_handle<Promise> handle) {
+            Arm(&GetPromise(handle));
+        }
+
+        void await_resume() const noexcept {}
+
+    private:
+        uint64_t _nanoseconds;
+        Time::Timer _timer; // Lives in the coroutine frame while it sleeps
+
+        void Arm(PromiseBase* promise);
+        static void Expired(void* context);
+    };
+
+    /// co_await Yield() lets every coroutine that is ready now run before this one goes on
+    struct Yield {
+        [[nodiscard]] bool await_ready() const noexcept { return false; }
+
+        template<typename Promise>
+        void await_suspend(std::coroutine_handle<Promise> handle) {
+            Executor::Resume(&GetPromise(handle));
+        }
+
+        void await_resume() const noexcept {}
+    };
+
+    /// co_await PollEventTimeout(condition, timeoutNs, intervalNs) is Sync::PollEventTimeout for coroutines: condition() is checked
+    /// every intervalNs until it is true or the timeout passed, and the result is the last check's.
+    template<typename Condition>
+    Task<bool> PollEventTimeout(Condition condition, uint64_t timeoutNs, uint64_t intervalNs) {
+        uint64_t deadline = Sync::WaitClockNanoseconds() + timeoutNs;
+
+        while (!condition()) {
+            uint64_t now = Sync::WaitClockNanoseconds();
+            if (now >= deadline) co_return condition();
+
+            uint64_t remaining = deadline - now;
+            co_await Sleep(remaining < intervalNs ? remaining : intervalNs);
+        }
+
+        co_return true;
+    }
+}
+
+#endif //BOREALOS_EXECUTOR_H
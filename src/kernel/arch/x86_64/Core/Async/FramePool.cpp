@@ -0,0 +1,72 @@
+#include "FramePool.h"
+
+namespace Core::Async {
+    Sync::SpinLock FramePool::_lock;
+    FramePool::FreeFrame* FramePool::_free[CLASS_COUNT] {};
+    size_t FramePool::_cached[CLASS_COUNT] {};
+    FramePool::Statistics FramePool::_statistics {};
+
+    void* FramePool::Allocate(size_t size) {
+        size_t sizeClass = GetClass(size);
+
+        uint64_t flags = _lock.LockIrqSave();
+        _statistics.Allocations++;
+        if (sizeClass < CLASS_COUNT && _free[sizeClass]) {
+            FreeFrame* frame = _free[sizeClass];
+            _free[sizeClass] = frame->Next;
+            _cached[sizeClass]--;
+            _statistics.Cached--;
+            _statistics.Reused++;
+            _lock.UnlockIrqRestore(flags);
+            return frame;
+        }
+        _statistics.HeapAllocations++;
+        _lock.UnlockIrqRestore(flags);
+
+        // A pooled frame gets its whole class, so it fits every frame of the class once it is reused
+        size_t bytes = sizeClass < CLASS_COUNT ? 1ULL << (MIN_CLASS_SHIFT + sizeClass) : size;
+        void* frame = new uint8_t[bytes];
+
+        if (!frame) {
+            flags = _lock.LockIrqSave();
+            _statistics.Failures++;
+            _lock.UnlockIrqRestore(flags);
+        }
+
+        return frame;
+    }
+
+    void FramePool::Free(void *frame, size_t size) {
+        if (!frame) return;
+
+        size_t sizeClass = GetClass(size);
+        if (sizeClass < CLASS_COUNT) {
+            uint64_t flags = _lock.LockIrqSave();
+            if (_cached[sizeClass] < MAX_CACHED_PER_CLASS) {
+                auto freeFrame = static_cast<FreeFrame*>(frame);
+                freeFrame->Next = _free[sizeClass];
+                _free[sizeClass] = freeFrame;
+                _cached[sizeClass]++;
+                _statistics.Cached++;
+                _lock.UnlockIrqRestore(flags);
+                return;
+            }
+            _lock.UnlockIrqRestore(flags);
+        }
+
+        delete[] static_cast<uint8_t*>(frame);
+    }
+
+    FramePool::Statistics FramePool::GetStatistics() {
+        uint64_t flags = _lock.LockIrqSave();
+        Statistics statistics = _statistics;
+        _lock.UnlockIrqRestore(flags);
+        return statistics;
+    }
+
+    size_t FramePool::GetClass(size_t size) {
+        size_t sizeClass = 0;
+        while (sizeClass < CLASS_COUNT && (1ULL << (MIN_CLASS_SHIFT + sizeClass)) < size) sizeClass++;
+        return sizeClass;
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef BOREALOS_FRAMEPOOL_H
+#define BOREALOS_FRAMEPOOL_H
+
+#include <Definitions.h>
+
+#include "../Sync/SpinLock.h"
+
+namespace Core::Async {
+    /// Where coroutine frames come from. Frames are rounded up to a power of two size class, and freed frames are kept on a free list
+    /// per class, so a driver that starts the same conversation over and over doesn't go through the kernel heap every time.
+    /// Frames larger than the largest class come straight from the heap. Works from any context.
+    class FramePool {
+    public:
+        struct Statistics {
+            uint64_t Allocations; // Every frame, pooled or not
+            uint64_t Reused; // Taken off a free list
+            uint64_t HeapAllocations; // Had to come from the kernel heap, including frames too large for a class
+            uint64_t Failures;
+            size_t Cached; // Free frames waiting on the lists
+        };
+
+        [[nodiscard]] static void* Allocate(size_t size); // nullptr if the heap is out of memory
+        static void Free(void* frame, size_t size); // size must be the size it was allocated with
+
+        [[nodiscard]] static Statistics GetStatistics();
+
+        static constexpr size_t MIN_CLASS_SHIFT = 7; // 128 bytes
+        static constexpr size_t CLASS_COUNT = 6; // Up to 4 KiB
+        static constexpr size_t MAX_CACHED_PER_CLASS = 64; // Beyond this, freed frames go back to the heap
+
+    private:
+        struct FreeFrame {
+            FreeFrame* Next;
+        };
+
+        static Sync::SpinLock _lock;
+        static FreeFrame* _free[CLASS_COUNT];
+        static size_t _cached[CLASS_COUNT];
+        static Statistics _statistics;
+
+        static size_t GetClass(size_t size); // CLASS_COUNT if the frame is too large for every class
+    };
+}
+
+#endif //BOREALOS_FRAMEPOOL_H
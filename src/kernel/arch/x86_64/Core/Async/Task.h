@@ -0,0 +1,170 @@
+#ifndef BOREALOS_TASK_H
+#define BOREALOS_TASK_H
+
+#include <Definitions.h>
+
+#include "Coroutine.h"
+#include "FramePool.h"
+
+namespace Core::Async {
+    class Executor;
+
+    /// What the promise of every coroutine an Executor runs starts with. Awaitables reach the executor through it, and the executor
+    /// links ready coroutines through it, so resuming a coroutine never allocates.
+    struct PromiseBase {
+        std::coroutine_handle<> Self;
+        Executor* Owner = nullptr; // Awaited tasks run on the executor of the coroutine that awaits them
+        std::coroutine_handle<> Continuation; // The awaiting coroutine, resumed once this one returned
+        bool Detached = false; // Spawned, the frame frees itself once the coroutine returned
+        PromiseBase* NextReady = nullptr; // In the executor's ready list
+
+        // Frames come from the frame pool. Allocation failures don't throw, the task is then invalid (see Task::IsValid).
+        static void* operator new(size_t size) noexcept {
+            return FramePool::Allocate(size);
+        }
+
+        static void operator delete(void* frame, size_t size) noexcept {
+            FramePool::Free(frame, size);
+        }
+
+        // Resumes the awaiting coroutine right away, without going through the executor
+        struct FinalAwaiter {
+            [[nodiscard]] bool await_ready() const noexcept { return false; }
+
+            template<typename Promise>
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> finished) noexcept {
+                PromiseBase& promise = finished.promise();
+                if (promise.Continuation) return promise.Continuation;
+                if (promise.Detached) finished.destroy();
+                return std::noop_coroutine();
+            }
+
+            void await_resume() const noexcept {}
+        };
+
+        // Tasks start when they are awaited or spawned, not when they are called
+        std::suspend_always initial_suspend() const noexcept { return {}; }
+        FinalAwaiter final_suspend() const noexcept { return {}; }
+
+        void unhandled_exception() {
+            PANIC("Exception escaped a kernel coroutine!");
+        }
+    };
+
+    /// The promise of the coroutine an awaitable suspends, which must be one an Executor runs
+    template<typename Promise>
+    PromiseBase& GetPromise(std::coroutine_handle<Promise> handle) {
+        static_assert(__is_base_of(PromiseBase, Promise), "Only coroutines that run on an Executor can await this!");
+        return handle.promise();
+    }
+
+    template<typename T>
+    struct TaskPromise : PromiseBase {
+        ~TaskPromise() {
+            if (_hasValue) reinterpret_cast<T*>(_value)->~T();
+        }
+
+        template<typename Value>
+        void return_value(Value&& value) {
+            new (_value) T(static_cast<Value&&>(value));
+            _hasValue = true;
+        }
+
+        T TakeResult() {
+            return static_cast<T&&>(*reinterpret_cast<T*>(_value));
+        }
+
+    private:
+        alignas(T) uint8_t _value[sizeof(T)];
+        bool _hasValue = false;
+    };
+
+    template<>
+    struct TaskPromise<void> : PromiseBase {
+        void return_void() const noexcept {}
+        void TakeResult() const noexcept {}
+    };
+
+    /// A coroutine that returns T, for driver code that waits on devices and timers without holding a thread: co_await a Task,
+    /// or one of the awaitables (Sleep, Yield, Completion::Wait) from inside another Task. A task runs once it is awaited, or once it
+    /// is handed to Executor::Spawn. Awaiting a task runs it to completion before the awaiting coroutine goes on.
+    /// Tasks are owned by their handle like a unique pointer, and may only be awaited once.
+    template<typename T = void>
+    class [[nodiscard]] Task {
+    public:
+        struct promise_type : TaskPromise<T> {
+            Task get_return_object() noexcept {
+                auto handle = std::coroutine_handle<promise_type>::from_promise(*this);
+                this->Self = handle;
+                return Task(handle);
+            }
+
+            static Task get_return_object_on_allocation_failure() noexcept {
+                return Task();
+            }
+        };
+
+        Task() = default;
+        Task(const Task&) = delete;
+        Task& operator=(const Task&) = delete;
+
+        Task(Task&& other) noexcept : _handle(other._handle) {
+            other._handle = nullptr;
+        }
+
+        Task& operator=(Task&& other) noexcept {
+            if (this != &other) {
+                if (_handle) _handle.destroy();
+                _handle = other._handle;
+                other._handle = nullptr;
+            }
+            return *this;
+        }
+
+        ~Task() {
+            if (_handle) _handle.destroy();
+        }
+
+        /// False if the coroutine frame couldn't be allocated
+        [[nodiscard]] bool IsValid() const {
+            return static_cast<bool>(_handle);
+        }
+
+        struct Awaiter {
+            std::coroutine_handle<promise_type> Handle;
+
+            [[nodiscard]] bool await_ready() const noexcept { return false; }
+
+            template<typename Promise>
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> awaiting) noexcept {
+                promise_type& promise = Handle.promise();
+                promise.Continuation = awaiting;
+                promise.Owner = GetPromise(awaiting).Owner;
+                return Handle; // Symmetric transfer, the awaited task starts without going through the executor
+            }
+
+            T await_resume() {
+                return Handle.promise().TakeResult();
+            }
+        };
+
+        Awaiter operator co_await() && noexcept {
+            if (!_handle) PANIC("Awaited a task whose coroutine frame couldn't be allocated!");
+            return Awaiter { _handle };
+        }
+
+        /// Gives up ownership of the frame, for the executor
+        std::coroutine_handle<promise_type> Release() {
+            auto handle = _handle;
+            _handle = nullptr;
+            return handle;
+        }
+
+    private:
+        std::coroutine_handle<promise_type> _handle;
+
+        explicit Task(std::coroutine_handle<promise_type> handle) : _handle(handle) {}
+    };
+}
+
+#endif //BOREALOS_TASK_H
@@ -59,6 +59,48 @@ namespace Core {
         return value;
     }
 
+    uint64_t CPU::DisableInterrupts() {
+        uint64_t flags;
+        asm volatile ("pushfq\n\t"
+                      "pop %0\n\t"
+                      "cli"
+                      : "=r"(flags)
+                      :
+                      : "memory");
+        return flags;
+    }
+
+    void CPU::RestoreInterrupts(uint64_t flags) {
+        // Bit 9 of RFLAGS is the interrupt flag
+        if (flags & (1 << 9)) asm volatile ("sti" ::: "memory");
+    }
+
+    bool CPU::InterruptsEnabled() {
+        uint64_t flags;
+        asm volatile ("pushfq\n\t"
+                      "pop %0"
+                      : "=r"(flags));
+        return flags & (1 << 9);
+    }
+
+    uint64_t CPU::ReadXCR0() {
+        uint32_t lo, hi;
+        asm volatile ("xgetbv"
+                    : "=a"(lo), "=d"(hi)
+                    : "c"(0));
+        return ((uint64_t)hi << 32) | lo;
+    }
+
+    void CPU::WriteXCR0(uint64_t value) {
+        uint32_t lo = (uint32_t)(value & 0xFFFFFFFF);
+        uint32_t hi = (uint32_t)(value >> 32);
+
+        asm volatile ("xsetbv"
+                    :
+                    : "c"(0), "a"(lo), "d"(hi)
+                    : "memory");
+    }
+
     uint64_t CPU::ReadCR3() {
         uint64_t value;
         __asm__ volatile (
@@ -154,6 +196,26 @@ namespace Core {
         LOG_INFO("SSE initialized.");
     }
 
+    void CPU::InitializeXSAVE() {
+        // Without XSAVE the vector state can only be saved with FXSAVE, which covers x87 and SSE but not AVX
+        if (!HasFeature(CPUFeatures::XSAVE)) {
+            LOG_WARNING("This system doesn't support XSAVE, kernel SIMD sections will fall back to FXSAVE.");
+            return;
+        }
+
+        // Set the OSXSAVE bit (bit 18) in CR4, this enables XGETBV/XSETBV and the XSAVE instruction family
+        uint64_t cr4 = ReadCR4();
+        cr4 |= (1 << 18);
+        WriteCR4(cr4);
+
+        // Enable the x87 and SSE state components, plus the upper halves of the YMM registers if the CPU has AVX
+        uint64_t xcr0 = XCR0_X87 | XCR0_SSE;
+        if (HasFeature(CPUFeatures::AVX)) xcr0 |= XCR0_AVX;
+        WriteXCR0(xcr0);
+
+        LOG_INFO("XSAVE initialized (XCR0 = 0x%x64).", xcr0);
+    }
+
     void CPU::Initialize() {
         uint32_t tempEAX = 0, tempEBX = 0, tempECX = 0, tempEDX = 0;
         
@@ -162,6 +224,8 @@ namespace Core {
 
         // Get the processor's vendor ID
         if (__get_cpuid(CPUIDLeaves::HFP_ManufacturerID, &featureEAX, &featureEBX, &featureECX, &featureEDX)) {
+            maxBasicLeaf = featureEAX;
+
             // The register order is intentional here!
             *reinterpret_cast<uint32_t*>(&vendorID[0]) = featureEBX;
             *reinterpret_cast<uint32_t*>(&vendorID[4]) = featureEDX;
@@ -219,6 +283,11 @@ namespace Core {
         // Cache the CPU features
         if (!__get_cpuid(CPUIDLeaves::Features, &featureEAX, &featureEBX, &featureECX, &featureEDX)) PANIC("Failed to get CPU features!");
 
+        // Leaf 7 holds the structured extended features (AVX2, ERMS, FSRM, ...), it only exists on newer CPUs
+        if (maxBasicLeaf >= CPUIDLeaves::StructuredExtendedFeatures) {
+            __cpuid_count(CPUIDLeaves::StructuredExtendedFeatures, 0, tempEAX, extFeatureEBX, extFeatureECX, extFeatureEDX);
+        }
+
         // Check if the CPU supports SSE and FXSR
         if (!HasFeature(CPUFeatures::SSE)) PANIC("This system doesn't support SSE, which is required by x86_64!");
         if (!HasFeature(CPUFeatures::FXSR)) PANIC("This system doesn't support FXSR, which is required by x86_64!");
@@ -226,11 +295,21 @@ namespace Core {
         // Initialize SSE
         InitializeSSE();
 
+        // Initialize XSAVE (and with it AVX) if the CPU supports it
+        InitializeXSAVE();
+
         // Initialize the FPU if there is one in the system
         InitializeFPU();
     }
 
-    // This implementation is only safe for leaf 1, because it assumes CPUID set up the registers for leaf 1
+    void CPU::InitializeAP() {
+        // Control registers and XCR0 are per CPU, the CPUID results are the same on every core
+        InitializeSSE();
+        InitializeXSAVE();
+        InitializeFPU();
+    }
+
+    // This implementation only covers leaf 1 and leaf 7 (subleaf 0), since those are the only leaves cached by Initialize
     bool CPU::HasFeature(CPUFeatures::Feature feature) {
         // Make sure the bit is between 0 and 31
         if (feature.bit > 31) return false;
@@ -242,6 +321,15 @@ namespace Core {
 
             case CPUFeatures::Register::EDX:
                 return (featureEDX & (1u << feature.bit)) != 0;
+
+            case CPUFeatures::Register::EXT_EBX:
+                return (extFeatureEBX & (1u << feature.bit)) != 0;
+
+            case CPUFeatures::Register::EXT_ECX:
+                return (extFeatureECX & (1u << feature.bit)) != 0;
+
+            case CPUFeatures::Register::EXT_EDX:
+                return (extFeatureEDX & (1u << feature.bit)) != 0;
         }
 
         return false;
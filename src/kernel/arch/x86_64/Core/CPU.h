@@ -10,13 +10,19 @@ namespace Core {
         constexpr unsigned int Features = 1;
         constexpr unsigned int Cache_TLB = 2;
         constexpr unsigned int SerialNumber = 3; // This feature is not implemented in any AMD CPUs or any Intel CPUs released after the Pentium III, use is not recommended
+        constexpr unsigned int MonitorMwait = 5;
+        constexpr unsigned int ThermalPower = 6;
+        constexpr unsigned int StructuredExtendedFeatures = 7;
         constexpr unsigned int ExtendedFeature = 0x80000000;
     }
 
     namespace CPUFeatures {
         enum class Register : uint8_t {
             ECX,
-            EDX
+            EDX,
+            EXT_EBX, // CPUID leaf 7, subleaf 0
+            EXT_ECX,
+            EXT_EDX
         };
 
         struct Feature {
@@ -85,11 +91,21 @@ namespace Core {
         constexpr Feature TM          { Register::EDX, 29 };
         constexpr Feature IA64        { Register::EDX, 30 };
         constexpr Feature PBE         { Register::EDX, 31 };
+        constexpr Feature FSGSBASE    { Register::EXT_EBX,  0 };
+        constexpr Feature BMI1        { Register::EXT_EBX,  3 };
+        constexpr Feature AVX2        { Register::EXT_EBX,  5 };
+        constexpr Feature BMI2        { Register::EXT_EBX,  8 };
+        constexpr Feature ERMS        { Register::EXT_EBX,  9 }; // Enhanced REP MOVSB/STOSB
+        constexpr Feature INVPCID     { Register::EXT_EBX, 10 };
+        constexpr Feature AVX512F     { Register::EXT_EBX, 16 };
+        constexpr Feature WAITPKG     { Register::EXT_ECX,  5 };
+        constexpr Feature FSRM        { Register::EXT_EDX,  4 }; // Fast short REP MOVSB
     }
     
     class CPU {
     public:
         void Initialize();
+        void InitializeAP(); // Enables the same features on an application processor, using the features Initialize detected on the boot CPU
 
         bool HasFeature(CPUFeatures::Feature feature);
 
@@ -104,14 +120,27 @@ namespace Core {
         static uint64_t ReadCR0();
         static void WriteCR4(uint64_t value);
         static uint64_t ReadCR4();
+        static uint64_t ReadXCR0();
+        static uint64_t DisableInterrupts(); // Returns the previous RFLAGS, pass them to RestoreInterrupts to re-enable interrupts only if they were enabled before
+        static void RestoreInterrupts(uint64_t flags);
+        static bool InterruptsEnabled();
+        static void WriteXCR0(uint64_t value);
+
+        // Bits of the XCR0 extended control register (the state components managed by XSAVE)
+        static constexpr uint64_t XCR0_X87 = 1 << 0;
+        static constexpr uint64_t XCR0_SSE = 1 << 1;
+        static constexpr uint64_t XCR0_AVX = 1 << 2;
 
     private:
         static constexpr unsigned int CPUID_BRAND_STRING_START = 0x80000002;
         static constexpr unsigned int CPUID_BRAND_STRING_END = 0x80000004;
 
         void InitializeSSE();
+        void InitializeXSAVE();
         void InitializeFPU();
         uint32_t featureEAX, featureEBX, featureECX, featureEDX; // These should only be used for the CPUID supported features leaf
+        uint32_t extFeatureEBX = 0, extFeatureECX = 0, extFeatureEDX = 0; // Structured extended features (leaf 7, subleaf 0), zero if the leaf isn't supported
+        uint32_t maxBasicLeaf = 0;
         uint32_t maxExtendedLeaf;
     };
 }
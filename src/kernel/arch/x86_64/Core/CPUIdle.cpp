@@ -0,0 +1,168 @@
+#include "CPUIdle.h"
+
+#include "Time/Scheduler.h"
+#include "Kernel.h"
+#include "../KernelData.h"
+
+namespace Core {
+    bool CPUIdle::_hasMWait = false;
+    CPUIdle::Table CPUIdle::_defaultTable = { { { "C1", EntryMethod::Halt, 0, 1000 } }, 1 };
+    CPUIdle::Table CPUIdle::_acpiTable = {};
+    const CPUIdle::Table* CPUIdle::_table = &CPUIdle::_defaultTable;
+    CPUIdle::Residency CPUIdle::_residency[SMP::MAX_CPUS][MAX_STATES] = {};
+
+    void CPUIdle::Initialize(CPU *cpu) {
+        // MWAIT hint 0 is C1 on every CPU that has it, and unlike HLT it also wakes up on a write to the monitored line
+        _hasMWait = cpu->HasFeature(CPUFeatures::MONITOR);
+        if (_hasMWait) _defaultTable.States[0].Method = EntryMethod::MWait;
+    }
+
+    void CPUIdle::LoadACPIStates(Firmware::ACPI *acpi) {
+        Firmware::ACPI::CState cStates[MAX_STATES];
+        size_t count = acpi->GetProcessorCStates(cStates, MAX_STATES);
+        if (!count) {
+            LOG_INFO("The firmware reports no C-states, idling in C1 with %s.", _hasMWait ? "MWAIT" : "HLT");
+            return;
+        }
+
+        unsigned int eax = 0, ebx, ecx, edx;
+        bool arat = __get_cpuid(CPUIDLeaves::ThermalPower, &eax, &ebx, &ecx, &edx) && (eax & ARAT);
+
+        static const char* names[] = { "C0", "C1", "C2", "C3" };
+        Table* table = &_acpiTable;
+        table->Count = 0;
+
+        for (size_t i = 0; i < count; i++) {
+            const Firmware::ACPI::CState& cState = cStates[i];
+            if (cState.Type < 1 || cState.Type > 3) continue;
+
+            State state;
+            state.Name = names[cState.Type];
+            state.ExitLatencyNs = static_cast<uint64_t>(cState.LatencyUs) * 1000;
+
+            if (cState.Register.AddressSpace == Firmware::ACPI::ADDRESS_SPACE_FFH && cState.Register.BitOffset == 1) {
+                // Native C-state instruction, the address holds the MWAIT hint
+                if (!_hasMWait) continue;
+                state.Method = EntryMethod::MWait;
+                state.Hint = static_cast<uint32_t>(cState.Register.Address);
+            }
+            else if (cState.Type == 1) {
+                state.Method = _hasMWait ? EntryMethod::MWait : EntryMethod::Halt;
+            }
+            else {
+                // Entering C2/C3 through an I/O port read needs bus master arbitration and cache flushing, which we don't do
+                LOG_DEBUG("Skipping %s, it is entered through I/O port %x64.", state.Name, cState.Register.Address);
+                continue;
+            }
+
+            if (cState.Type > 1 && !arat) {
+                LOG_DEBUG("Skipping %s, the LAPIC timer may stop in it on this CPU.", state.Name);
+                continue;
+            }
+
+            // _CST lists the states from shallow to deep, anything out of order would confuse Select
+            if (table->Count && state.ExitLatencyNs < table->States[table->Count - 1].ExitLatencyNs) continue;
+
+            table->States[table->Count++] = state;
+        }
+
+        if (!table->Count) {
+            LOG_INFO("None of the firmware's C-states are usable, idling in C1 with %s.", _hasMWait ? "MWAIT" : "HLT");
+            return;
+        }
+
+        for (size_t i = 0; i < table->Count; i++) {
+            const State& state = table->States[i];
+            LOG_INFO("Idle state %s: %s (hint %x32), exit latency %u64us.", state.Name, state.Method == EntryMethod::MWait ? "MWAIT" : "HLT",
+                     state.Hint, state.ExitLatencyNs / 1000);
+        }
+
+        __atomic_store_n(&_table, table, __ATOMIC_RELEASE);
+    }
+
+    void CPUIdle::Enter(uint64_t predictedNs) {
+        PerCPU* cpu = PerCPU::Get();
+        const Table* table = __atomic_load_n(&_table, __ATOMIC_ACQUIRE);
+        size_t index = Select(table, predictedNs);
+        const State& state = table->States[index];
+
+        // Interrupt handlers that wake a thread leave the switch to the idle loop instead of switching away from here, so the
+        // residency doesn't include other threads. The idle loop schedules right after anyway.
+        Time::Scheduler::DisablePreemption();
+        uint64_t start = Time::GetNanoseconds();
+
+        if (state.Method == EntryMethod::MWait) {
+            // Wakers that see IdlePolling write the flag and skip the IPI, the ones that came before it sent one, which stays pending
+            // until the sti. A write between the store and the monitor is caught by the check in between.
+            __atomic_store_n(&cpu->IdlePolling, true, __ATOMIC_SEQ_CST);
+            asm volatile ("monitor" :: "a"(&cpu->IdleWakeFlag), "c"(0), "d"(0) : "memory");
+            if (!__atomic_load_n(&cpu->IdleWakeFlag, __ATOMIC_SEQ_CST)) {
+                // Like sti; hlt, the interrupt shadow of sti covers the mwait
+                asm volatile ("sti\n\tmwait" :: "a"(state.Hint), "c"(0) : "memory");
+                CPU::DisableInterrupts();
+            }
+
+            __atomic_store_n(&cpu->IdlePolling, false, __ATOMIC_SEQ_CST);
+            __atomic_store_n(&cpu->IdleWakeFlag, 0, __ATOMIC_RELAXED);
+        }
+        else {
+            // sti only takes effect after the next instruction, so no interrupt can slip in between and leave us halted with work to do
+            asm volatile ("sti\n\thlt" ::: "memory");
+            CPU::DisableInterrupts();
+        }
+
+        Residency& residency = _residency[cpu->Index][index];
+        residency.Entries++;
+        residency.Nanoseconds += Time::GetNanoseconds() - start;
+        Time::Scheduler::EnablePreemption();
+
+        // Wakeups other CPUs posted through the flag, IdlePolling is clear so the next ones send an IPI again
+        cpu->Scheduler->ProcessRemoteWakeups();
+    }
+
+    bool CPUIdle::WakePolling(PerCPU *cpu) {
+        // The caller's push onto the wakeup list was a locked instruction, so this load isn't reordered before it
+        if (!__atomic_load_n(&cpu->IdlePolling, __ATOMIC_SEQ_CST)) return false;
+
+        __atomic_store_n(&cpu->IdleWakeFlag, 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    size_t CPUIdle::GetStateCount() {
+        return __atomic_load_n(&_table, __ATOMIC_ACQUIRE)->Count;
+    }
+
+    const CPUIdle::State* CPUIdle::GetState(size_t index) {
+        const Table* table = __atomic_load_n(&_table, __ATOMIC_ACQUIRE);
+        return index < table->Count ? &table->States[index] : nullptr;
+    }
+
+    CPUIdle::Residency CPUIdle::GetResidency(uint32_t cpu, size_t state) {
+        if (cpu >= SMP::MAX_CPUS || state >= MAX_STATES) return {};
+        return _residency[cpu][state];
+    }
+
+    void CPUIdle::DumpStatistics() {
+        auto smp = Kernel<KernelData>::GetInstance()->ArchitectureData->Smp;
+        uint32_t cpuCount = smp ? smp->GetCPUCount() : 1;
+        const Table* table = __atomic_load_n(&_table, __ATOMIC_ACQUIRE);
+
+        LOG_INFO("Idle state residency:");
+        for (uint32_t cpu = 0; cpu < cpuCount; cpu++) {
+            for (size_t i = 0; i < table->Count; i++) {
+                const Residency& residency = _residency[cpu][i];
+                if (!residency.Entries) continue;
+
+                LOG_INFO("  CPU %u32 %s: %u64 entries, %u64us total, %u64us average.", cpu, table->States[i].Name, residency.Entries,
+                         residency.Nanoseconds / 1000, residency.Nanoseconds / residency.Entries / 1000);
+            }
+        }
+    }
+
+    size_t CPUIdle::Select(const Table *table, uint64_t predictedNs) {
+        // The deepest state that the CPU is expected to stay in long enough to make up for its exit latency
+        size_t index = table->Count - 1;
+        while (index > 0 && table->States[index].ExitLatencyNs * TARGET_RESIDENCY_FACTOR > predictedNs) index--;
+        return index;
+    }
+}
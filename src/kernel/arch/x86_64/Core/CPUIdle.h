@@ -0,0 +1,70 @@
+#ifndef BOREALOS_CPUIDLE_H
+#define BOREALOS_CPUIDLE_H
+
+#include <Definitions.h>
+#include "CPU.h"
+#include "PerCPU.h"
+#include "SMP.h"
+#include "Firmware/ACPI.h"
+
+namespace Core {
+    // The idle states the idle threads put their CPU in. Until ACPI is up there is a single C1 state, entered with MWAIT if the CPU
+    // has MONITOR/MWAIT and with HLT otherwise. LoadACPIStates adds the deeper states from the processor's _CST.
+    // Each idle period picks the deepest state whose exit latency is small against the time until the CPU's next timer.
+    // While a CPU waits in MWAIT it monitors PerCPU::IdleWakeFlag, so remote wakeups write that flag instead of sending an IPI.
+    class CPUIdle {
+    public:
+        enum class EntryMethod : uint8_t {
+            Halt,
+            MWait
+        };
+
+        struct State {
+            const char* Name = nullptr;
+            EntryMethod Method = EntryMethod::Halt;
+            uint32_t Hint = 0; // EAX for MWAIT
+            uint64_t ExitLatencyNs = 0;
+        };
+
+        struct Residency {
+            uint64_t Entries = 0;
+            uint64_t Nanoseconds = 0; // Including the interrupt that ended each stay
+        };
+
+        static void Initialize(CPU* cpu); // Before the application processors start, they go idle right away
+        static void LoadACPIStates(Firmware::ACPI* acpi); // Once LAI is loaded
+
+        /// Puts the calling CPU to sleep until an interrupt or a polled wakeup, for about predictedNs at most. Called by the idle thread
+        /// with interrupts disabled after it found nothing to run, returns with interrupts disabled.
+        static void Enter(uint64_t predictedNs);
+        /// For a remote wakeup that was just queued on cpu: writes its monitored flag if it waits in MWAIT. Returns false if it
+        /// doesn't, then the caller has to send an IPI.
+        static bool WakePolling(PerCPU* cpu);
+
+        [[nodiscard]] static size_t GetStateCount();
+        [[nodiscard]] static const State* GetState(size_t index);
+        [[nodiscard]] static Residency GetResidency(uint32_t cpu, size_t state);
+        static void DumpStatistics(); // Logs the time every online CPU spent in each state
+
+        static constexpr size_t MAX_STATES = 8;
+
+    private:
+        struct Table {
+            State States[MAX_STATES];
+            size_t Count;
+        };
+
+        static constexpr uint32_t TARGET_RESIDENCY_FACTOR = 3; // A state pays off once the CPU stays idle this many times its exit latency
+        static constexpr unsigned int ARAT = 1 << 2; // CPUID leaf 6 EAX: the LAPIC timer keeps running in deep C-states
+
+        static bool _hasMWait;
+        static Table _defaultTable;
+        static Table _acpiTable;
+        static const Table* _table; // Swapped once the ACPI states are ready, idle CPUs may be reading the old one
+        static Residency _residency[SMP::MAX_CPUS][MAX_STATES];
+
+        static size_t Select(const Table* table, uint64_t predictedNs);
+    };
+}
+
+#endif //BOREALOS_CPUIDLE_H
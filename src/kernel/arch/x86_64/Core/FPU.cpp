@@ -0,0 +1,116 @@
+#include "FPU.h"
+
+#include "PerCPU.h"
+#include "Time/Scheduler.h"
+
+namespace Core {
+    FPU::SaveMethod FPU::_saveMethod = FPU::SaveMethod::FXSAVE;
+    uint32_t FPU::_stateSize = 512;
+    bool FPU::_avxUsable = false;
+    bool FPU::_avx2Usable = false;
+    uint8_t FPU::_bootSaveAreas[SAVE_AREAS_SIZE];
+
+    void FPU::Initialize(CPU* cpu) {
+        // CPU::Initialize only sets OSXSAVE if XSAVE is supported, so CR4 tells us which save method we can use
+        if (CPU::ReadCR4() & (1 << 18)) {
+            uint32_t eax, ebx, ecx, edx;
+
+            // EBX of subleaf 0 is the size of the XSAVE area for the components currently enabled in XCR0
+            __cpuid_count(CPUID_XSAVE_LEAF, 0, eax, ebx, ecx, edx);
+            _stateSize = ebx;
+
+            // Bit 0 of EAX in subleaf 1 reports XSAVEOPT, which skips components that weren't modified since the last XRSTOR
+            __cpuid_count(CPUID_XSAVE_LEAF, 1, eax, ebx, ecx, edx);
+            _saveMethod = (eax & 1) ? SaveMethod::XSAVEOPT : SaveMethod::XSAVE;
+
+            uint64_t xcr0 = CPU::ReadXCR0();
+            _avxUsable = (xcr0 & (CPU::XCR0_SSE | CPU::XCR0_AVX)) == (CPU::XCR0_SSE | CPU::XCR0_AVX);
+            _avx2Usable = _avxUsable && cpu->HasFeature(CPUFeatures::AVX2);
+        }
+        else {
+            _saveMethod = SaveMethod::FXSAVE;
+            _stateSize = 512;
+        }
+
+        if (_stateSize > SAVE_AREA_SIZE) PANIC("The vector state is larger than the kernel FPU save areas!");
+        PerCPU::Get()->FpuSaveAreas = _bootSaveAreas;
+
+        LOG_DEBUG("Kernel SIMD sections save %u32 bytes of vector state with %s (AVX %s, AVX2 %s).", _stateSize, GetSaveMethodName(),
+            _avxUsable ? "usable" : "unusable", _avx2Usable ? "usable" : "unusable");
+    }
+
+    bool FPU::IsAVXUsable() {
+        return _avxUsable;
+    }
+
+    bool FPU::IsAVX2Usable() {
+        return _avx2Usable;
+    }
+
+    uint32_t FPU::GetStateSize() {
+        return _stateSize;
+    }
+
+    const char* FPU::GetSaveMethodName() {
+        switch (_saveMethod) {
+            case SaveMethod::FXSAVE: return "FXSAVE";
+            case SaveMethod::XSAVE: return "XSAVE";
+            case SaveMethod::XSAVEOPT: return "XSAVEOPT";
+        }
+
+        return "unknown";
+    }
+
+    void FPU::SaveState(void* area) {
+        // EDX:EAX is the requested-feature bitmap, all ones saves every component enabled in XCR0
+        switch (_saveMethod) {
+            case SaveMethod::XSAVEOPT:
+                asm volatile ("xsaveopt64 (%0)" : : "r"(area), "a"(0xFFFFFFFF), "d"(0xFFFFFFFF) : "memory");
+                break;
+            case SaveMethod::XSAVE:
+                asm volatile ("xsave64 (%0)" : : "r"(area), "a"(0xFFFFFFFF), "d"(0xFFFFFFFF) : "memory");
+                break;
+            case SaveMethod::FXSAVE:
+                asm volatile ("fxsave64 (%0)" : : "r"(area) : "memory");
+                break;
+        }
+    }
+
+    void FPU::RestoreState(const void* area) {
+        switch (_saveMethod) {
+            case SaveMethod::XSAVEOPT:
+            case SaveMethod::XSAVE:
+                asm volatile ("xrstor64 (%0)" : : "r"(area), "a"(0xFFFFFFFF), "d"(0xFFFFFFFF) : "memory");
+                break;
+            case SaveMethod::FXSAVE:
+                asm volatile ("fxrstor64 (%0)" : : "r"(area) : "memory");
+                break;
+        }
+    }
+
+    void FPU::SetUserStateLive(bool live) {
+        PerCPU::Get()->FpuUserStateLive = live;
+    }
+
+    KernelFpuScope::KernelFpuScope() {
+        // The save areas belong to the CPU, not to a thread, so the scope must end on the thread that started it
+        Time::Scheduler::DisablePreemption();
+
+        // Claim a nesting level first; an interrupt arriving after this point uses the next level and can't clobber our save area
+        PerCPU* cpu = PerCPU::Get();
+        _level = __atomic_fetch_add(&cpu->FpuDepth, 1, __ATOMIC_ACQ_REL);
+        if (_level >= FPU::MAX_NESTING) PANIC("Kernel FPU scopes are nested too deeply!");
+
+        // Only an outer scope or userspace can have live vector state, if neither exists there is nothing to preserve
+        _saved = _level > 0 || cpu->FpuUserStateLive;
+        if (_saved) FPU::SaveState(cpu->FpuSaveAreas + _level * FPU::SAVE_AREA_SIZE);
+    }
+
+    KernelFpuScope::~KernelFpuScope() {
+        // Preemption is disabled, so this is still the CPU the scope was opened on
+        PerCPU* cpu = PerCPU::Get();
+        if (_saved) FPU::RestoreState(cpu->FpuSaveAreas + _level * FPU::SAVE_AREA_SIZE);
+        __atomic_fetch_sub(&cpu->FpuDepth, 1, __ATOMIC_ACQ_REL);
+        Time::Scheduler::EnablePreemption();
+    }
+}
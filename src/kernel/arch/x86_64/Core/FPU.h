@@ -0,0 +1,64 @@
+#ifndef BOREALOS_FPU_H
+#define BOREALOS_FPU_H
+
+#include <Definitions.h>
+#include "CPU.h"
+
+namespace Core {
+    // Vector state management for kernel SIMD sections.
+    // The kernel itself is built without SSE/AVX, so the vector registers only hold live state when userspace (or an outer
+    // KernelFpuScope) owns them. The state is only saved in those cases, everything else enters a scope for free.
+    class FPU {
+    public:
+        static void Initialize(CPU* cpu);
+
+        [[nodiscard]] static bool IsAVXUsable();
+        [[nodiscard]] static bool IsAVX2Usable();
+        [[nodiscard]] static uint32_t GetStateSize();
+        [[nodiscard]] static const char* GetSaveMethodName();
+
+        static void SaveState(void* area);
+        static void RestoreState(const void* area);
+
+        // Set when the vector registers of the calling CPU hold userspace state that kernel SIMD sections must preserve
+        static void SetUserStateLive(bool live);
+
+        static constexpr uint32_t MAX_NESTING = 4; // Thread, bottom half, IRQ and NMI level
+        static constexpr uint32_t SAVE_AREA_SIZE = 1024; // Legacy area + XSAVE header + AVX state is 832 bytes
+        static constexpr uint32_t SAVE_AREAS_SIZE = MAX_NESTING * SAVE_AREA_SIZE; // Every CPU needs this much for PerCPU::FpuSaveAreas
+
+    private:
+        friend class KernelFpuScope;
+
+        enum class SaveMethod : uint8_t {
+            FXSAVE,
+            XSAVE,
+            XSAVEOPT
+        };
+
+        static constexpr unsigned int CPUID_XSAVE_LEAF = 0xD;
+
+        static SaveMethod _saveMethod;
+        static uint32_t _stateSize;
+        static bool _avxUsable;
+        static bool _avx2Usable;
+        static uint8_t _bootSaveAreas[SAVE_AREAS_SIZE] ALIGNED(64); // XSAVE requires 64 byte alignment
+    };
+
+    // Section in which the kernel may use SSE/AVX registers, only code from SIMD translation units (*.sse2.cpp, *.avx2.cpp) should run inside it.
+    // Scopes nest, an interrupt handler may open its own scope while the interrupted code is inside one.
+    class KernelFpuScope {
+    public:
+        KernelFpuScope();
+        ~KernelFpuScope();
+
+        KernelFpuScope(const KernelFpuScope&) = delete;
+        KernelFpuScope& operator=(const KernelFpuScope&) = delete;
+
+    private:
+        uint32_t _level;
+        bool _saved;
+    };
+}
+
+#endif //BOREALOS_FPU_H
@@ -1,14 +1,24 @@
 #include "ACPI.h"
 #include "../../IO/Serial.h"
+#include "../Sync/WaitQueue.h"
 #include "lai_include.h"
 
 namespace Core::Firmware {
-    void ACPI::WriteByteCommand(uint8_t command) {
-        if (!(IO::Serial::inw(_fadt->PM1aControlBlock) & 1)) {
-            IO::Serial::outb(_fadt->SMI_CommandPort, command);
+    void ACPI::EnableACPIMode() {
+        if (!_fadt || (IO::Serial::inw(_fadt->PM1aControlBlock) & SCI_ENABLED)) return;
 
-            while (!(IO::Serial::inw(_fadt->PM1aControlBlock) & 1));
-        }
+        // Without an SMI command port or enable value the system is always in ACPI mode
+        if (!_fadt->SMI_CommandPort || !_fadt->AcpiEnable) return;
+
+        LOG_DEBUG("Writing 0x%x8 to the SMI command port to enable ACPI...", _fadt->AcpiEnable);
+        IO::Serial::outb(_fadt->SMI_CommandPort, _fadt->AcpiEnable);
+
+        // The firmware takes its time to hand over, the thread sleeps between checks instead of spinning
+        bool enabled = Sync::PollEventTimeout([this] {
+            return (IO::Serial::inw(_fadt->PM1aControlBlock) & SCI_ENABLED) != 0;
+        }, ACPI_ENABLE_TIMEOUT_NS, ACPI_ENABLE_POLL_NS);
+
+        if (!enabled) LOG_WARNING("The firmware didn't switch to ACPI mode within %u64ms!", ACPI_ENABLE_TIMEOUT_NS / 1'000'000);
     }
 
     void* ACPI::FindFACP(void* rootSDT) {
@@ -180,10 +190,6 @@ namespace Core::Firmware {
         _dsdt = (void*)(DSDTAddrPhysical + hhdm_request.response->offset);
         LOG_DEBUG("DSDT address: %p (offset from physical address %p)", _dsdt, DSDTAddrPhysical);
 
-        // Enable ACPI mode
-        LOG_DEBUG("Writing 0x%x8 to PM1a control block (address is %p) to enable ACPI...", _fadt->AcpiEnable, _fadt->PM1aControlBlock);
-        WriteByteCommand(_fadt->AcpiEnable);
-
         // Get the system's preferred power management profile
         PowerProfile = _fadt->PreferredPowerManagementProfile;
         if (PowerProfile <= 7) LOG_DEBUG("The device has a preferred power management profile of \"%s\" (profile ID %u8).", powerProfileStrings[PowerProfile], PowerProfile);
@@ -201,10 +207,82 @@ namespace Core::Firmware {
         lai_create_namespace();
         asm volatile("sti");
 
+        // Done here rather than in Initialize, which runs before there is a clock to time out on or a scheduler to sleep with
+        EnableACPIMode();
         lai_enable_acpi(1);
         _laiLoaded = true;
     }
 
+    size_t ACPI::GetProcessorCStates(CState *states, size_t maxStates) {
+        if (!_laiLoaded) return 0;
+
+        // Processors are Processor objects on older firmware and ACPI0007 devices on newer ones, only processors have a _CST.
+        // Every processor normally reports the same states, so the first one stands in for all of them.
+        lai_nsnode_t* cst = nullptr;
+        lai_ns_iterator iterator = LAI_NS_ITERATOR_INITIALIZER;
+        while (lai_nsnode_t* node = lai_ns_iterate(&iterator)) {
+            auto type = lai_ns_get_node_type(node);
+            if (type != LAI_NODETYPE_PROCESSOR && type != LAI_NODETYPE_DEVICE) continue;
+
+            cst = lai_ns_get_child(node, "_CST");
+            if (cst) break;
+        }
+        if (!cst) return 0;
+
+        lai_state_t state;
+        lai_init_state(&state);
+        lai_variable_t package = LAI_VAR_INITIALIZER;
+        size_t count = 0;
+
+        if (lai_eval(&package, cst, &state) == LAI_ERROR_NONE && lai_obj_get_type(&package) == LAI_TYPE_PACKAGE) {
+            // Package { Count, Package { Register, Type, Latency, Power }, ... }
+            size_t entries = lai_exec_pkg_size(&package);
+            for (size_t i = 1; i < entries && count < maxStates; i++) {
+                lai_variable_t entry = LAI_VAR_INITIALIZER;
+                lai_variable_t reg = LAI_VAR_INITIALIZER;
+                lai_variable_t field = LAI_VAR_INITIALIZER;
+                uint64_t type = 0, latency = 0, power = 0;
+
+                bool valid = lai_obj_get_pkg(&package, i, &entry) == LAI_ERROR_NONE && lai_exec_pkg_size(&entry) >= 4
+                    && lai_obj_get_pkg(&entry, 0, &reg) == LAI_ERROR_NONE && lai_obj_get_type(&reg) == LAI_TYPE_BUFFER
+                    && lai_exec_buffer_size(&reg) >= 3 + sizeof(GenericAddr);
+                if (valid) {
+                    lai_obj_get_pkg(&entry, 1, &field);
+                    valid = lai_obj_get_integer(&field, &type) == LAI_ERROR_NONE;
+                    lai_var_finalize(&field);
+                    lai_obj_get_pkg(&entry, 2, &field);
+                    valid = valid && lai_obj_get_integer(&field, &latency) == LAI_ERROR_NONE;
+                    lai_var_finalize(&field);
+                    lai_obj_get_pkg(&entry, 3, &field);
+                    if (lai_obj_get_integer(&field, &power) != LAI_ERROR_NONE) power = 0;
+                    lai_var_finalize(&field);
+                }
+
+                if (valid) {
+                    // A Generic Register Descriptor: tag and 16-bit length, then the same layout as a GenericAddr
+                    CState* out = &states[count++];
+                    memcpy(&out->Register, static_cast<uint8_t*>(lai_exec_buffer_get(&reg)) + 3, sizeof(GenericAddr));
+                    out->Type = static_cast<uint8_t>(type);
+                    out->LatencyUs = static_cast<uint32_t>(latency);
+                    out->PowerMw = static_cast<uint32_t>(power);
+                }
+                else {
+                    LOG_WARNING("Skipping malformed _CST entry %u64!", i);
+                }
+
+                lai_var_finalize(&reg);
+                lai_var_finalize(&entry);
+            }
+        }
+        else {
+            LOG_WARNING("Failed to evaluate _CST!");
+        }
+
+        lai_var_finalize(&package);
+        lai_finalize_state(&state);
+        return count;
+    }
+
     void* ACPI::GetTable(const char* signature, uint64_t index) {
         if (strcmp(signature, "DSDT") == 0) return _dsdt;
         if (strcmp(signature, "FACP") == 0 || strcmp(signature, "FADT") == 0) return _facp;
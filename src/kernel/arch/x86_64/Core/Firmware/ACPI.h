@@ -183,10 +183,25 @@ namespace Core::Firmware
             GenericAddr X_GPE1Block;
         } PACKED;
 
+        /// An entry of a processor's _CST. Register says how to enter it: a read from an I/O port, or functional fixed hardware,
+        /// which on x86 is MWAIT with Register.Address as the hint (BitWidth is the vendor, BitOffset the class, 1 is native C-states).
+        struct CState {
+            GenericAddr Register;
+            uint8_t Type; // 1 to 3 for C1 to C3
+            uint32_t LatencyUs; // Worst case exit latency
+            uint32_t PowerMw;
+        };
+
+        static constexpr uint8_t ADDRESS_SPACE_SYSTEM_IO = 0x01;
+        static constexpr uint8_t ADDRESS_SPACE_FFH = 0x7F;
+
         void Initialize();
         void LoadLAI();
         bool ACPISupported();
         void* GetTable(const char* signature, uint64_t index = 0);
+        [[nodiscard]] FADT* GetFADT() const { return _fadt; }
+        /// Evaluates _CST of the first processor object that has one, returns the number of states written (0 without LAI or _CST)
+        size_t GetProcessorCStates(CState* states, size_t maxStates);
 
         uint8_t PowerProfile = 0;
 
@@ -195,7 +210,11 @@ namespace Core::Firmware
         bool ValidateXSDP(XSDP* xsdp);
         bool ValidateSDT(SDTHeader* sdt);
         void* FindFACP(void* rootSDT);
-        void WriteByteCommand(uint8_t command);
+        void EnableACPIMode(); // Asks the firmware to switch to ACPI mode through the SMI command port and waits for SCI_EN
+
+        static constexpr uint16_t SCI_ENABLED = 1; // SCI_EN, bit 0 of the PM1 control register
+        static constexpr uint64_t ACPI_ENABLE_TIMEOUT_NS = 3'000'000'000; // 3s
+        static constexpr uint64_t ACPI_ENABLE_POLL_NS = 1'000'000; // 1ms
 
         limine_rsdp_response* _rsdp_response{};
         bool _systemHasACPI = false;
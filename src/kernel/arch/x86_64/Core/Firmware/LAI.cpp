@@ -3,6 +3,7 @@
 #include <Kernel.h>
 #include "../../KernelData.h"
 #include "../../Memory/Paging.h"
+#include "../Sync/WaitQueue.h"
 #include "lai_include.h"
 
 IO::PCI* cachedPCI = nullptr;
@@ -136,12 +137,12 @@ extern "C" {
     }
 
     void laihost_sleep(uint64_t ms) {
-        auto hpet = &Kernel<KernelData>::GetInstance()->ArchitectureData->Hpet;
-        hpet->BusyWait(ms * 1000 * 1000); // Convert ms to ns for HPET
+        // AML sleeps for whole milliseconds, the thread gives the CPU away meanwhile (it spins while the namespace is set up with interrupts off)
+        Core::Sync::SleepNs(ms * 1000 * 1000);
     }
 
     uint64_t laihost_timer(void) {
-        auto hpet = &Kernel<KernelData>::GetInstance()->ArchitectureData->Hpet;
-        return hpet->GetNanoseconds() / 100; // Return time in 100ns units for LAI
+        auto clocksources = Kernel<KernelData>::GetInstance()->ArchitectureData->Clocksources;
+        return clocksources->GetNanoseconds() / 100; // Return time in 100ns units for LAI
     }
 }
\ No newline at end of file
@@ -0,0 +1,106 @@
+#ifndef BOREALOS_PERCPU_H
+#define BOREALOS_PERCPU_H
+
+#include <Definitions.h>
+
+#include "CPU.h"
+#include "../Interrupts/GDT.h"
+#include "../Interrupts/TSS.h"
+#include "../Interrupts/Syscall.h"
+#include "../Memory/Paging.h"
+
+namespace Core::Time {
+    class Scheduler;
+    class ClockEvent;
+    struct Timer;
+}
+
+namespace Core::Sync {
+    struct RCUHead;
+}
+
+namespace Interrupts {
+    struct DeferredWork;
+    struct InterruptStatistics;
+}
+
+namespace Core {
+    struct SMPCallNode;
+
+    /// State that every CPU has its own copy of. The block of the running CPU is reached through the GS base, so Get() is a single load
+    /// and works from any context, including interrupt handlers.
+    struct PerCPU {
+        PerCPU* Self = nullptr; // Must stay the first member, Get() reads it through gs:0
+        // Used by the syscall entry in Syscall.S through %gs, their offsets are hardcoded there
+        uint64_t SyscallKernelStack = 0; // Top of the running thread's kernel stack
+        uint64_t SyscallUserStack = 0; // Scratch slot for the user RSP until it's pushed onto the kernel stack
+        uint64_t SyscallCounts[Interrupts::Syscall::COUNT] = {}; // By number, read by Syscall::DumpStatistics from other CPUs
+        uint64_t InvalidSyscalls = 0; // Numbers without a handler
+
+        uint32_t Index = 0; // 0 is the BSP, application processors are numbered in the order they were started
+        uint32_t LAPICID = 0;
+
+        Interrupts::GDT::Table* Gdt = nullptr;
+        Interrupts::TSS::TSSStruct* Tss = nullptr;
+        uintptr_t KernelStackTop = 0; // The stack the CPU was brought up on
+        uintptr_t FaultStackTop = 0; // IST1, used for double faults, GPFs and page faults
+        uintptr_t NmiStackTop = 0; // IST2, used for NMIs and machine checks
+
+        Time::Scheduler* Scheduler = nullptr;
+        Time::ClockEvent* ClockEvent = nullptr; // Drives Scheduler's timers, null if this CPU has no local timer we can use
+        Memory::Paging::PagingState* PagingState = nullptr; // The page table currently loaded in CR3
+
+        volatile uint32_t PreemptDisableCount = 0;
+        volatile uint32_t FpuDepth = 0; // Nesting level of kernel SIMD sections
+        volatile bool FpuUserStateLive = false;
+        uint8_t* FpuSaveAreas = nullptr; // FPU::MAX_NESTING areas of FPU::SAVE_AREA_SIZE bytes, 64 byte aligned
+
+        SMPCallNode* volatile CallQueue = nullptr; // Functions other CPUs asked this one to run, pushed lock-free by SMP::CallFunction
+
+        // RCU callbacks queued on this CPU in grace period order, only touched by this CPU with interrupts disabled
+        Sync::RCUHead* RcuCallbacks = nullptr;
+        Sync::RCUHead* RcuCallbacksTail = nullptr;
+        Time::Timer* RcuCheckTimer = nullptr; // Created on first use
+
+        // Bottom halves queued by this CPU's interrupt handlers, run by IDT::IRQHandler after the EOI. Only touched with interrupts disabled.
+        Interrupts::DeferredWork* DeferredWork = nullptr;
+        Interrupts::DeferredWork* DeferredWorkTail = nullptr;
+        bool InDeferredWork = false; // Nested interrupts leave the work to the handler that is already running it
+
+        // Interrupts this CPU took, by vector. Only this CPU writes them, the IRQ balancer and IDT::DumpStatistics read them from other CPUs.
+        uint64_t InterruptCounts[256] = {};
+        uint64_t SpuriousInterrupts = 0; // On the LAPIC's spurious vector, which gets no EOI
+        uint64_t UnhandledInterrupts = 0; // On vectors nothing registered a handler for
+        uint64_t NestedInterrupts = 0; // Taken while a handler or the deferred work of an earlier interrupt was running
+        uint32_t InterruptDepth = 0;
+        uint32_t MaxInterruptDepth = 0;
+        Interrupts::InterruptStatistics* InterruptStats = nullptr; // Only with SETTING_IRQ_STAT
+
+        // Set while the idle thread waits in MWAIT on IdleWakeFlag's cache line, other CPUs then wake it by writing the flag instead of an IPI
+        volatile bool IdlePolling = false;
+        volatile uint32_t IdleWakeFlag = 0;
+
+        volatile bool Online = false;
+
+        static constexpr uint32_t MSR_GS_BASE = 0xC0000101;
+        static constexpr uint32_t MSR_KERNEL_GS_BASE = 0xC0000102; // Swapped with the GS base by swapgs
+
+        [[nodiscard]] static PerCPU* Get() {
+            PerCPU* cpu;
+            asm volatile ("mov %%gs:0, %0" : "=r"(cpu));
+            return cpu;
+        }
+
+        /// Points the GS base of the calling CPU at this block. Loading a GS selector clears the base, so this has to happen after the GDT is loaded.
+        void Install() {
+            Self = this;
+            CPU::WriteMSR(MSR_GS_BASE, reinterpret_cast<uint64_t>(this));
+        }
+    };
+
+    static_assert(offsetof(PerCPU, SyscallKernelStack) == 8, "Syscall.S expects the syscall kernel stack at gs:8");
+    static_assert(offsetof(PerCPU, SyscallUserStack) == 16, "Syscall.S expects the user stack scratch slot at gs:16");
+    static_assert(offsetof(PerCPU, SyscallCounts) == 24, "Syscall.S expects the syscall counters at gs:24");
+}
+
+#endif //BOREALOS_PERCPU_H
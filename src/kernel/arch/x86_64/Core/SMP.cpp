@@ -0,0 +1,310 @@
+#include "SMP.h"
+
+#include <Boot/LimineDefinitions.h>
+#include <Utility/MemoryUtilities.h>
+#include "Kernel.h"
+#include "../KernelData.h"
+#include "FPU.h"
+#include "Time/Scheduler.h"
+#include "Time/ClockEvent.h"
+#include "../Interrupts/Syscall.h"
+
+extern "C" {
+    extern char _fault_handler_stack_top[];
+    extern char _nmi_stack_top[];
+}
+
+namespace Core {
+    static_assert(sizeof(SMPCall::Nodes) / sizeof(SMPCallNode) >= SMP::MAX_CPUS, "An SMP call needs a queue node for every CPU");
+
+    PerCPU SMP::_bootCPU;
+
+    struct TLBRange {
+        uint64_t VirtualAddress;
+        size_t PageCount;
+    };
+
+    SMP::SMP(Interrupts::APIC *apic, Interrupts::IDT *idt, CPU *cpu, Time::TSC *tsc, Memory::PMM *pmm, Memory::Paging *paging)
+        : _apic(apic), _idt(idt), _cpu(cpu), _tsc(tsc), _pmm(pmm), _paging(paging) {
+
+    }
+
+    void SMP::InitializeBootCPU() {
+        _bootCPU.Index = 0;
+        _bootCPU.Gdt = Interrupts::GDT::GetBootTable();
+        _bootCPU.Tss = Interrupts::TSS::GetTSSStruct();
+        _bootCPU.KernelStackTop = reinterpret_cast<uintptr_t>(Architecture::KernelStackTop);
+        _bootCPU.FaultStackTop = reinterpret_cast<uintptr_t>(&_fault_handler_stack_top[0]);
+        _bootCPU.NmiStackTop = reinterpret_cast<uintptr_t>(&_nmi_stack_top[0]);
+        _bootCPU.SyscallKernelStack = _bootCPU.KernelStackTop;
+        _bootCPU.Install();
+    }
+
+    void SMP::Initialize() {
+        _bootCPU.LAPICID = _apic->GetCurrentLAPICID();
+        _cpus[0] = &_bootCPU;
+        _cpuCount = 1;
+
+        // The IDT is shared, so the handlers only have to be registered once
+        _idt->RegisterIRQHandler(CALL_FUNCTION_VECTOR - Interrupts::APIC::IRQ_OFFSET, CallFunctionInterrupt);
+        _idt->RegisterIRQHandler(RESCHEDULE_VECTOR - Interrupts::APIC::IRQ_OFFSET, RescheduleInterrupt);
+
+        auto response = mp_request.response;
+        if (!response) {
+            LOG_WARNING("Limine didn't provide MP information, only the boot CPU will be used.");
+            return;
+        }
+
+        LOG_DEBUG("Limine found %u64 CPU(s), the boot CPU has LAPIC ID %u32.", response->cpu_count, response->bsp_lapic_id);
+
+        for (uint64_t i = 0; i < response->cpu_count; i++) {
+            limine_mp_info* info = response->cpus[i];
+            if (info->lapic_id == response->bsp_lapic_id) continue;
+
+            if (_cpuCount >= MAX_CPUS) {
+                LOG_WARNING("This system has more than %u32 CPUs, the rest won't be used.", MAX_CPUS);
+                break;
+            }
+
+            PerCPU* cpu = AllocateCPU(_cpuCount, info->lapic_id);
+            if (!cpu) break;
+
+            // Limine parks the AP until goto_address is written, so the argument has to be visible before that
+            info->extra_argument = reinterpret_cast<uint64_t>(cpu);
+            __atomic_store_n(&info->goto_address, &APEntry, __ATOMIC_RELEASE);
+
+            // Bring-up happens one CPU at a time, so the log messages of the APs don't interleave
+            uint64_t deadline = Time::GetNanoseconds() + STARTUP_TIMEOUT_NS;
+            while (!__atomic_load_n(&cpu->Online, __ATOMIC_ACQUIRE)) {
+                if (Time::GetNanoseconds() > deadline) {
+                    LOG_ERROR("CPU with LAPIC ID %u32 didn't come online, not starting any more CPUs.", info->lapic_id);
+                    return;
+                }
+
+                asm volatile ("pause");
+            }
+
+            // Other CPUs already look through the list to steal work, the entry must be visible before the count covers it
+            _cpus[_cpuCount] = cpu;
+            __atomic_store_n(&_cpuCount, _cpuCount + 1, __ATOMIC_RELEASE);
+        }
+    }
+
+    uint32_t SMP::GetCPUCount() const {
+        return __atomic_load_n(&_cpuCount, __ATOMIC_ACQUIRE);
+    }
+
+    PerCPU* SMP::GetCPU(uint32_t index) const {
+        return index < GetCPUCount() ? _cpus[index] : nullptr;
+    }
+
+    uint64_t SMP::GetOnlineMask() const {
+        uint32_t count = GetCPUCount();
+        return count >= 64 ? ~0ULL : (1ULL << count) - 1;
+    }
+
+    void SMP::CallFunction(uint64_t cpuMask, SMPCallFunction function, void *context, bool wait) {
+        // Staying on this CPU keeps the own-CPU check below valid until the local call has run
+        Time::Scheduler::DisablePreemption();
+
+        uint64_t self = 1ULL << PerCPU::Get()->Index;
+        cpuMask &= GetOnlineMask();
+        bool runLocally = cpuMask & self;
+        cpuMask &= ~self;
+
+        SMPCall localCall;
+        SMPCall* call = nullptr;
+        if (cpuMask) {
+            call = wait ? &localCall : new SMPCall();
+            call->Function = function;
+            call->Context = context;
+            uint32_t targets = 0;
+            for (uint64_t mask = cpuMask; mask; mask &= mask - 1) targets++; // __builtin_popcountll would need libgcc without -mpopcnt
+            call->Remaining = targets;
+            call->FreeWhenDone = !wait;
+
+            // Once the last node is pushed the call may complete (and be freed) at any time, so nothing touches it after that
+            for (uint64_t mask = cpuMask; mask; mask &= mask - 1) {
+                uint32_t index = __builtin_ctzll(mask);
+                PerCPU* target = _cpus[index];
+                SMPCallNode* node = &call->Nodes[index];
+                node->Call = call;
+
+                SMPCallNode* head = __atomic_load_n(&target->CallQueue, __ATOMIC_RELAXED);
+                do {
+                    node->Next = head;
+                } while (!__atomic_compare_exchange_n(&target->CallQueue, &head, node, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+                // A non-empty queue already has an IPI on its way, which will pick this call up as well
+                if (!head) SendIPI(target, CALL_FUNCTION_VECTOR);
+            }
+        }
+
+        if (runLocally) {
+            uint64_t flags = CPU::DisableInterrupts();
+            function(context);
+            CPU::RestoreInterrupts(flags);
+        }
+
+        if (cpuMask && wait) {
+            while (__atomic_load_n(&localCall.Remaining, __ATOMIC_ACQUIRE)) {
+                // The caller may have interrupts disabled, so calls sent to us have to be served here or two CPUs waiting on each other would hang
+                ProcessCallQueue();
+                asm volatile ("pause");
+            }
+        }
+
+        Time::Scheduler::EnablePreemption();
+    }
+
+    void SMP::SendIPI(const PerCPU *cpu, uint8_t vector) {
+        _apic->SendIPI(cpu->LAPICID, vector);
+    }
+
+    void SMP::ShootdownTLB(uint64_t virtualAddress, size_t pageCount) {
+        if (_cpuCount < 2 || pageCount == 0) return;
+
+        // Every CPU may have the kernel half cached, and we don't track which CPUs ran on which process page table, so all of them flush
+        TLBRange range = { virtualAddress, pageCount };
+        uint64_t others = GetOnlineMask() & ~(1ULL << PerCPU::Get()->Index);
+        CallFunction(others, FlushTLBCall, &range, true);
+    }
+
+    void SMP::FlushLocalTLB(uint64_t virtualAddress, size_t pageCount) {
+        if (pageCount > TLB_FLUSH_ALL_THRESHOLD) {
+            // Reloading CR3 flushes every non-global entry
+            uint64_t cr3;
+            asm volatile ("mov %%cr3, %0" : "=r"(cr3));
+            asm volatile ("mov %0, %%cr3" : : "r"(cr3) : "memory");
+            return;
+        }
+
+        for (size_t i = 0; i < pageCount; i++) {
+            asm volatile ("invlpg (%0)" : : "r"(virtualAddress + i * Architecture::KernelPageSize) : "memory");
+        }
+    }
+
+    void SMP::ProcessCallQueue() {
+        PerCPU* cpu = PerCPU::Get();
+        SMPCallNode* node = __atomic_exchange_n(&cpu->CallQueue, nullptr, __ATOMIC_ACQUIRE);
+        if (!node) return;
+
+        // The queue is a stack, reverse it so calls run in the order they were sent
+        SMPCallNode* ordered = nullptr;
+        while (node) {
+            SMPCallNode* next = node->Next;
+            node->Next = ordered;
+            ordered = node;
+            node = next;
+        }
+
+        uint64_t flags = CPU::DisableInterrupts();
+        while (ordered) {
+            // The node lives inside the call, which the sender may reuse as soon as Remaining drops, so read everything first
+            SMPCallNode* next = ordered->Next;
+            SMPCall* call = ordered->Call;
+
+            call->Function(call->Context);
+            bool freeCall = call->FreeWhenDone;
+            if (__atomic_sub_fetch(&call->Remaining, 1, __ATOMIC_ACQ_REL) == 0 && freeCall) delete call;
+
+            ordered = next;
+        }
+        CPU::RestoreInterrupts(flags);
+    }
+
+    void SMP::CallFunctionInterrupt() {
+        Kernel<KernelData>::GetInstance()->ArchitectureData->Smp->ProcessCallQueue();
+    }
+
+    void SMP::RescheduleInterrupt() {
+        auto scheduler = PerCPU::Get()->Scheduler;
+        if (scheduler) scheduler->ProcessRemoteWakeups();
+    }
+
+    void SMP::FlushTLBCall(void *context) {
+        auto range = static_cast<TLBRange*>(context);
+        FlushLocalTLB(range->VirtualAddress, range->PageCount);
+    }
+
+    PerCPU* SMP::AllocateCPU(uint32_t index, uint32_t lapicId) {
+        static_assert(FPU::SAVE_AREAS_SIZE <= 0x1000, "The FPU save areas of a CPU must fit in one page");
+
+        uintptr_t kernelStack = AllocateStack();
+        uintptr_t faultStack = AllocateStack();
+        uintptr_t nmiStack = AllocateStack();
+        uintptr_t fpuPage = _pmm->AllocatePages(1);
+        if (!kernelStack || !faultStack || !nmiStack || !fpuPage) {
+            LOG_ERROR("Not enough memory to start CPU %u32!", index);
+            return nullptr;
+        }
+
+        auto cpu = new PerCPU();
+        cpu->Index = index;
+        cpu->LAPICID = lapicId;
+        cpu->Gdt = new Interrupts::GDT::Table();
+        cpu->Tss = new Interrupts::TSS::TSSStruct();
+        cpu->KernelStackTop = kernelStack;
+        cpu->FaultStackTop = faultStack;
+        cpu->NmiStackTop = nmiStack;
+        cpu->SyscallKernelStack = kernelStack;
+        cpu->FpuSaveAreas = reinterpret_cast<uint8_t*>(HIGHER_HALF(fpuPage)); // Page aligned, which covers the 64 byte alignment XSAVE needs
+#if SETTING_IRQ_STAT
+        cpu->InterruptStats = new Interrupts::InterruptStatistics();
+#endif
+
+        Interrupts::TSS::InitializeForCPU(cpu->Tss, kernelStack, faultStack, nmiStack);
+        return cpu;
+    }
+
+    uintptr_t SMP::AllocateStack() {
+        uintptr_t physical = _pmm->AllocatePages(STACK_PAGES);
+        if (!physical) return 0;
+
+        return HIGHER_HALF(physical) + STACK_PAGES * Architecture::KernelPageSize; // Stacks grow down, so this returns the top
+    }
+
+    void SMP::APEntry(limine_mp_info *info) {
+        auto cpu = reinterpret_cast<PerCPU*>(info->extra_argument);
+
+        // Limine's stack is in bootloader reclaimable memory, move to our own before doing anything else
+        asm volatile (
+            "mov %0, %%rsp\n\t"
+            "xor %%ebp, %%ebp\n\t"
+            "call *%1\n\t"
+            "ud2"
+            :
+            : "r"(cpu->KernelStackTop), "r"(&APMain), "D"(cpu)
+            : "memory"
+        );
+
+        __builtin_unreachable();
+    }
+
+    void SMP::APMain(PerCPU *cpu) {
+        SMP* smp = Kernel<KernelData>::GetInstance()->ArchitectureData->Smp;
+
+        // Loading the GDT clears the GS base, so the per-CPU block can only be installed after it.
+        // Everything below may use PerCPU::Get(), including the page table switch.
+        Interrupts::GDT::InitializeForCPU(cpu->Gdt, cpu->Tss);
+        cpu->Install();
+        smp->_paging->SwitchToKernelPageTable();
+        smp->_idt->Load();
+
+        smp->_cpu->InitializeAP();
+        Interrupts::Syscall::Initialize();
+        smp->_apic->InitializeLocal();
+
+        // Every CPU runs its own timers and threads, driven by its own LAPIC timer
+        cpu->Scheduler = new Time::Scheduler();
+        cpu->ClockEvent = Time::ClockEvent::CreateLocal(smp->_apic, smp->_tsc, smp->_cpu);
+        if (cpu->ClockEvent) cpu->Scheduler->SetClockEvent(cpu->ClockEvent);
+        else LOG_WARNING("CPU %u32 has no usable LAPIC timer, its timers won't fire.", cpu->Index);
+        cpu->Scheduler->InitializeIdleThreading(smp->_pmm, smp->_paging);
+
+        LOG_INFO("CPU %u32 (LAPIC ID %u32) is online.", cpu->Index, cpu->LAPICID);
+        __atomic_store_n(&cpu->Online, true, __ATOMIC_RELEASE);
+
+        cpu->Scheduler->EnterIdle();
+    }
+}
@@ -0,0 +1,97 @@
+#ifndef BOREALOS_SMP_H
+#define BOREALOS_SMP_H
+
+#include <Definitions.h>
+
+#include "CPU.h"
+#include "PerCPU.h"
+#include "Time/TSC.h"
+#include "../Interrupts/APIC.h"
+#include "../Interrupts/IDT.h"
+#include "../Memory/Paging.h"
+#include "../Memory/PMM.h"
+
+struct limine_mp_info;
+
+namespace Core {
+    typedef void (*SMPCallFunction)(void* context);
+
+    struct SMPCall;
+
+    /// Links one call into one target CPU's queue, every target has its own node so the queues can be pushed to independently
+    struct SMPCallNode {
+        SMPCallNode* Next = nullptr;
+        SMPCall* Call = nullptr;
+    };
+
+    struct SMPCall {
+        SMPCallFunction Function = nullptr;
+        void* Context = nullptr;
+        volatile uint32_t Remaining = 0; // Targets that haven't finished running the function yet
+        bool FreeWhenDone = false; // Calls that nobody waits for are heap allocated and freed by the last target
+        SMPCallNode Nodes[64]; // Indexed by CPU index
+    };
+
+    /// Brings up the application processors Limine found. Every CPU gets its own GDT, TSS, kernel and fault stacks, LAPIC setup,
+    /// scheduler and per-CPU block, then waits in its idle thread until work is scheduled on it.
+    class SMP {
+    public:
+        SMP(Interrupts::APIC* apic, Interrupts::IDT* idt, CPU* cpu, Time::TSC* tsc, Memory::PMM* pmm, Memory::Paging* paging);
+
+        /// Installs the boot CPU's per-CPU block. Must run right after the GDT is loaded, anything after it may use PerCPU::Get().
+        static void InitializeBootCPU();
+
+        /// Starts the application processors one at a time, each one is fully set up before the next one starts
+        void Initialize();
+
+        [[nodiscard]] uint32_t GetCPUCount() const; // Online CPUs, including the boot CPU
+        [[nodiscard]] PerCPU* GetCPU(uint32_t index) const;
+        [[nodiscard]] uint64_t GetOnlineMask() const; // Bit n is set if CPU n is online
+
+        /// Runs function(context) on every CPU in cpuMask with interrupts disabled, including the calling CPU if its bit is set.
+        /// With wait, this returns once every target has finished; the caller keeps running calls sent to it meanwhile, so two CPUs
+        /// calling each other can't deadlock. Without wait the call may still be running when this returns.
+        void CallFunction(uint64_t cpuMask, SMPCallFunction function, void* context, bool wait);
+        void SendIPI(const PerCPU* cpu, uint8_t vector);
+
+        /// Invalidates pageCount pages starting at virtualAddress on every other online CPU and waits until they did.
+        /// Ranges above TLB_FLUSH_ALL_THRESHOLD pages flush the whole TLB instead, which is cheaper than that many invlpgs.
+        void ShootdownTLB(uint64_t virtualAddress, size_t pageCount);
+        static void FlushLocalTLB(uint64_t virtualAddress, size_t pageCount);
+
+        static constexpr uint32_t MAX_CPUS = 64;
+        static constexpr size_t STACK_PAGES = 4; // 16KiB, for both the kernel stack and the fault stack
+        static constexpr uint64_t STARTUP_TIMEOUT_NS = 1'000'000'000; // 1s
+        static constexpr size_t TLB_FLUSH_ALL_THRESHOLD = 32;
+
+        // IPI vectors, at the top of the vector space so they have the highest priority
+        static constexpr uint8_t CALL_FUNCTION_VECTOR = 0xF0;
+        static constexpr uint8_t RESCHEDULE_VECTOR = 0xF1; // Sent by Scheduler::WakeThread to the CPU that owns the thread
+
+    private:
+        static PerCPU _bootCPU;
+
+        Interrupts::APIC* _apic;
+        Interrupts::IDT* _idt;
+        CPU* _cpu;
+        Time::TSC* _tsc;
+        Memory::PMM* _pmm;
+        Memory::Paging* _paging;
+
+        PerCPU* _cpus[MAX_CPUS] {};
+        uint32_t _cpuCount = 0;
+
+        PerCPU* AllocateCPU(uint32_t index, uint32_t lapicId);
+        uintptr_t AllocateStack();
+        void ProcessCallQueue(); // Runs the calls queued for the calling CPU
+
+        static void CallFunctionInterrupt();
+        static void RescheduleInterrupt();
+        static void FlushTLBCall(void* context);
+
+        static void APEntry(limine_mp_info* info); // Called by Limine on the AP, with Limine's stack and page tables
+        [[noreturn]] static void APMain(PerCPU* cpu);
+    };
+}
+
+#endif //BOREALOS_SMP_H
@@ -4,22 +4,28 @@
 #include "../KernelData.h"
 
 namespace Core {
-    ServiceManager::ServiceManager() : _services(16) {
+    static Sync::LockClass serviceLockClass = { "services" };
+
+    ServiceManager::ServiceManager() : _services(&serviceLockClass) {
     }
 
     void ServiceManager::RegisterService(const char *name, void *address) {
-        if (GetService(name) != nullptr) {
+        bool added = _services.Add({name, address}, [name](const Service& service) {
+            return strcmp(service.name, name) == 0;
+        });
+
+        if (!added) {
             LOG_ERROR("Service with name %s is already registered!", name);
             PANIC("Service is already registered");
         }
-
-        _services.Add({name, address});
     }
 
     void* ServiceManager::GetService(const char *name) const {
-        for (size_t i = 0; i < _services.Size(); i++) {
-            if (strcmp(_services[i].name, name) == 0) {
-                return _services[i].address;
+        Sync::RCUReadGuard guard;
+        auto services = _services.Read();
+        for (size_t i = 0; i < services->Count; i++) {
+            if (strcmp((*services)[i].name, name) == 0) {
+                return (*services)[i].address;
             }
         }
 
@@ -0,0 +1,64 @@
+#ifndef BOREALOS_COMPLETION_H
+#define BOREALOS_COMPLETION_H
+
+#include <Definitions.h>
+
+#include "WaitQueue.h"
+
+namespace Core::Sync {
+    /// Signals that something finished, e.g. a device answered or a thread is done. Every Complete lets one Wait through, even if it
+    /// came first; CompleteAll lets every current and future Wait through until Reset. Complete works from any context, waiting is
+    /// for threads (see WaitQueue for callers that can't sleep).
+    class Completion {
+    public:
+        constexpr explicit Completion(LockClass* lockClass = nullptr) : _waiters(lockClass) {}
+
+        void Complete() {
+            uint32_t done = __atomic_load_n(&_done, __ATOMIC_RELAXED);
+            while (done != ALL && !__atomic_compare_exchange_n(&_done, &done, done + 1, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {}
+            _waiters.WakeOne();
+        }
+
+        void CompleteAll() {
+            __atomic_store_n(&_done, ALL, __ATOMIC_RELEASE);
+            _waiters.WakeAll();
+        }
+
+        void Wait() {
+            _waiters.WaitEvent([this] { return TryWait(); });
+        }
+
+        /// Returns false if the timeout passed first
+        bool WaitTimeout(uint64_t timeoutNs) {
+            return _waiters.WaitEventTimeout([this] { return TryWait(); }, timeoutNs);
+        }
+
+        /// Consumes one completion without waiting, returns false if there is none
+        bool TryWait() {
+            uint32_t done = __atomic_load_n(&_done, __ATOMIC_ACQUIRE);
+            while (done != 0) {
+                if (done == ALL) return true;
+                if (__atomic_compare_exchange_n(&_done, &done, done - 1, true, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) return true;
+            }
+
+            return false;
+        }
+
+        /// Forgets earlier completions, for reusing the object. Nobody may be waiting.
+        void Reset() {
+            __atomic_store_n(&_done, 0, __ATOMIC_RELAXED);
+        }
+
+        [[nodiscard]] bool IsDone() const {
+            return __atomic_load_n(&_done, __ATOMIC_ACQUIRE) != 0;
+        }
+
+    private:
+        static constexpr uint32_t ALL = static_cast<uint32_t>(-1);
+
+        uint32_t _done = 0;
+        WaitQueue _waiters;
+    };
+}
+
+#endif //BOREALOS_COMPLETION_H
@@ -0,0 +1,89 @@
+#ifndef BOREALOS_LOCKGUARD_H
+#define BOREALOS_LOCKGUARD_H
+
+#include <Definitions.h>
+
+#include "MCSLock.h"
+#include "RWLock.h"
+
+namespace Core::Sync {
+    // Scoped locking for SpinLock, TicketLock and MCSLock: the lock is held until the guard goes out of scope.
+    template<typename Lock>
+    class LockGuard {
+    public:
+        explicit LockGuard(Lock& lock) : _lock(lock) { _lock.Lock(); }
+        ~LockGuard() { _lock.Unlock(); }
+        LockGuard(const LockGuard&) = delete;
+        LockGuard& operator=(const LockGuard&) = delete;
+
+    private:
+        Lock& _lock;
+    };
+
+    // Same, with interrupts disabled while the lock is held
+    template<typename Lock>
+    class IrqLockGuard {
+    public:
+        explicit IrqLockGuard(Lock& lock) : _lock(lock) { _flags = _lock.LockIrqSave(); }
+        ~IrqLockGuard() { _lock.UnlockIrqRestore(_flags); }
+        IrqLockGuard(const IrqLockGuard&) = delete;
+        IrqLockGuard& operator=(const IrqLockGuard&) = delete;
+
+    private:
+        Lock& _lock;
+        uint64_t _flags;
+    };
+
+    // The MCS guards carry the queue node
+    template<>
+    class LockGuard<MCSLock> {
+    public:
+        explicit LockGuard(MCSLock& lock) : _lock(lock) { _lock.Lock(&_node); }
+        ~LockGuard() { _lock.Unlock(&_node); }
+        LockGuard(const LockGuard&) = delete;
+        LockGuard& operator=(const LockGuard&) = delete;
+
+    private:
+        MCSLock& _lock;
+        MCSLock::Node _node;
+    };
+
+    template<>
+    class IrqLockGuard<MCSLock> {
+    public:
+        explicit IrqLockGuard(MCSLock& lock) : _lock(lock) { _flags = _lock.LockIrqSave(&_node); }
+        ~IrqLockGuard() { _lock.UnlockIrqRestore(&_node, _flags); }
+        IrqLockGuard(const IrqLockGuard&) = delete;
+        IrqLockGuard& operator=(const IrqLockGuard&) = delete;
+
+    private:
+        MCSLock& _lock;
+        MCSLock::Node _node;
+        uint64_t _flags;
+    };
+
+    class ReadLockGuard {
+    public:
+        explicit ReadLockGuard(RWLock& lock) : _lock(lock) { _lock.ReadLock(); }
+        ~ReadLockGuard() { _lock.ReadUnlock(); }
+        ReadLockGuard(const ReadLockGuard&) = delete;
+        ReadLockGuard& operator=(const ReadLockGuard&) = delete;
+
+    private:
+        RWLock& _lock;
+    };
+
+    class WriteLockGuard {
+    public:
+        explicit WriteLockGuard(RWLock& lock) : _lock(lock) { _flags = _lock.WriteLock(); }
+        ~WriteLockGuard() { _lock.WriteUnlock(_flags); }
+        WriteLockGuard(const WriteLockGuard&) = delete;
+        WriteLockGuard& operator=(const WriteLockGuard&) = delete;
+
+    private:
+        RWLock& _lock;
+        uint64_t _flags;
+    };
+}
+
+#endif //BOREALOS_LOCKGUARD_H
@@ -0,0 +1,33 @@
+#include "LockStat.h"
+
+namespace Core::Sync::LockStat {
+    static LockClass* classes = nullptr;
+
+    void Register(LockClass *lockClass) {
+        // Two CPUs can race to register the same class, only the one that flips the flag links it
+        if (__atomic_exchange_n(&lockClass->Registered, true, __ATOMIC_ACQ_REL)) return;
+
+        LockClass* head = __atomic_load_n(&classes, __ATOMIC_RELAXED);
+        do {
+            lockClass->Next = head;
+        } while (!__atomic_compare_exchange_n(&classes, &head, lockClass, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    }
+
+    void Dump() {
+#if SETTING_LOCK_STAT
+        LOG_INFO("Lock statistics (cycles are TSC reference cycles):");
+        for (LockClass* lockClass = __atomic_load_n(&classes, __ATOMIC_ACQUIRE); lockClass; lockClass = lockClass->Next) {
+            uint64_t acquisitions = lockClass->Acquisitions;
+            uint64_t contentions = lockClass->Contentions;
+            uint64_t holds = lockClass->Holds;
+            LOG_INFO("  %s: %u64 acquisitions, %u64 contended, %u64 cycles average wait, %u64 cycles average hold, %u64 cycles longest hold",
+                     lockClass->Name, acquisitions, contentions,
+                     contentions ? lockClass->WaitCycles / contentions : 0,
+                     holds ? lockClass->HoldCycles / holds : 0,
+                     lockClass->MaxHoldCycles);
+        }
+#else
+        LOG_INFO("Lock statistics are disabled, set SETTING_LOCK_STAT to collect them.");
+#endif
+    }
+}
@@ -0,0 +1,86 @@
+#ifndef BOREALOS_LOCKSTAT_H
+#define BOREALOS_LOCKSTAT_H
+
+#include <Definitions.h>
+#include <Settings.h>
+
+namespace Core::Sync {
+    /// Statistics shared by every lock of one kind, e.g. all heap locks. Only collected when SETTING_LOCK_STAT is enabled; otherwise
+    /// locks ignore their class. Classes must have static storage, they are linked into a global list on their first acquisition.
+    struct LockClass {
+        const char* Name = nullptr;
+        volatile uint64_t Acquisitions = 0;
+        volatile uint64_t Contentions = 0; // Acquisitions that found the lock taken and had to wait
+        volatile uint64_t WaitCycles = 0;
+        volatile uint64_t Holds = 0; // Exclusive holds only, reader holds of a reader-writer lock overlap and aren't timed
+        volatile uint64_t HoldCycles = 0;
+        volatile uint64_t MaxHoldCycles = 0;
+        LockClass* Next = nullptr;
+        volatile bool Registered = false;
+    };
+
+    namespace LockStat {
+        void Register(LockClass* lockClass);
+        void Dump(); // Logs every class that was acquired at least once
+
+        inline uint64_t ReadCycles() {
+            uint32_t low, high;
+            asm volatile ("rdtsc" : "=a"(low), "=d"(high));
+            return (static_cast<uint64_t>(high) << 32) | low;
+        }
+    }
+
+    /// The per-lock half of the statistics, embedded in every lock. Compiles to nothing without SETTING_LOCK_STAT.
+    class LockStatState {
+    public:
+        constexpr explicit LockStatState(LockClass* lockClass) : _class(lockClass) {}
+
+        [[nodiscard]] uint64_t WaitStart() const {
+#if SETTING_LOCK_STAT
+            if (_class) return LockStat::ReadCycles();
+#endif
+            return 0;
+        }
+
+        void Acquired(bool contended, uint64_t waitStart, bool exclusive = true) {
+#if SETTING_LOCK_STAT
+            if (!_class) return;
+            if (!__atomic_load_n(&_class->Registered, __ATOMIC_ACQUIRE)) LockStat::Register(_class);
+
+            uint64_t now = LockStat::ReadCycles();
+            __atomic_fetch_add(&_class->Acquisitions, 1, __ATOMIC_RELAXED);
+            if (contended) {
+                __atomic_fetch_add(&_class->Contentions, 1, __ATOMIC_RELAXED);
+                __atomic_fetch_add(&_class->WaitCycles, now - waitStart, __ATOMIC_RELAXED);
+            }
+            if (exclusive) _acquiredAt = now;
+#else
+            (void)contended;
+            (void)waitStart;
+            (void)exclusive;
+#endif
+        }
+
+        void Released() {
+#if SETTING_LOCK_STAT
+            if (!_class) return;
+
+            uint64_t held = LockStat::ReadCycles() - _acquiredAt;
+            __atomic_fetch_add(&_class->Holds, 1, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&_class->HoldCycles, held, __ATOMIC_RELAXED);
+
+            uint64_t max = __atomic_load_n(&_class->MaxHoldCycles, __ATOMIC_RELAXED);
+            while (held > max && !__atomic_compare_exchange_n(&_class->MaxHoldCycles, &max, held, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            }
+#endif
+        }
+
+    private:
+        LockClass* _class;
+#if SETTING_LOCK_STAT
+        uint64_t _acquiredAt = 0;
+#endif
+    };
+}
+
+#endif //BOREALOS_LOCKSTAT_H
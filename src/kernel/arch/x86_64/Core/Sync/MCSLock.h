@@ -0,0 +1,77 @@
+#ifndef BOREALOS_MCSLOCK_H
+#define BOREALOS_MCSLOCK_H
+
+#include <Definitions.h>
+
+#include "LockStat.h"
+#include "../CPU.h"
+
+namespace Core::Sync {
+    // Queue lock (Mellor-Crummey and Scott): waiters form a list and each one spins on a flag in its own node, so a release only
+    // touches the next waiter's cache line. Fair like a TicketLock, but it keeps scaling when many CPUs contend.
+    // Every acquisition needs a node that stays alive until the matching Unlock, usually on the stack:
+    //
+    //     MCSLock::Node node;
+    //     lock.Lock(&node);
+    //     ...
+    //     lock.Unlock(&node);
+    class MCSLock {
+    public:
+        struct Node {
+            Node* Next = nullptr;
+            bool Waiting = false;
+        };
+
+        constexpr explicit MCSLock(LockClass* lockClass = nullptr) : _stat(lockClass) {}
+
+        void Lock(Node* node) {
+            uint64_t waitStart = _stat.WaitStart();
+            node->Next = nullptr;
+            node->Waiting = true;
+
+            Node* previous = __atomic_exchange_n(&_tail, node, __ATOMIC_ACQ_REL);
+            if (previous) {
+                __atomic_store_n(&previous->Next, node, __ATOMIC_RELEASE);
+                while (__atomic_load_n(&node->Waiting, __ATOMIC_ACQUIRE)) {
+                    asm volatile ("pause");
+                }
+            }
+
+            _stat.Acquired(previous != nullptr, waitStart);
+        }
+
+        void Unlock(Node* node) {
+            _stat.Released();
+
+            Node* next = __atomic_load_n(&node->Next, __ATOMIC_ACQUIRE);
+            if (!next) {
+                // Nobody queued behind us, unless someone swapped the tail and hasn't linked itself yet
+                Node* expected = node;
+                if (__atomic_compare_exchange_n(&_tail, &expected, nullptr, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) return;
+
+                while (!(next = __atomic_load_n(&node->Next, __ATOMIC_ACQUIRE))) {
+                    asm volatile ("pause");
+                }
+            }
+
+            __atomic_store_n(&next->Waiting, false, __ATOMIC_RELEASE);
+        }
+
+        [[nodiscard]] uint64_t LockIrqSave(Node* node) {
+            uint64_t flags = CPU::DisableInterrupts();
+            Lock(node);
+            return flags;
+        }
+
+        void UnlockIrqRestore(Node* node, uint64_t flags) {
+            Unlock(node);
+            CPU::RestoreInterrupts(flags);
+        }
+
+    private:
+        Node* _tail = nullptr; // The last waiter, or the holder if nobody waits
+        LockStatState _stat;
+    };
+}
+
+#endif //BOREALOS_MCSLOCK_H
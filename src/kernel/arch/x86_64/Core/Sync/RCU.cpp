@@ -0,0 +1,163 @@
+#include "RCU.h"
+
+#include "LockGuard.h"
+#include "../SMP.h"
+#include "../Time/Scheduler.h"
+#include "Kernel.h"
+#include "../../KernelData.h"
+
+namespace Core::Sync {
+    static LockClass gracePeriodLockClass = { "rcu grace periods" };
+
+    SpinLock RCU::_gpLock(&gracePeriodLockClass);
+    uint64_t RCU::_gpCurrent = 0;
+    uint64_t RCU::_gpCompleted = 0;
+    uint64_t RCU::_gpRequested = 0;
+    uint64_t RCU::_pendingMask = 0;
+
+    struct SynchronizeWait {
+        RCUHead Head; // Must stay the first member, the callback casts the head back
+        Threading::Thread* Thread;
+        volatile bool Done;
+    };
+
+    static void SynchronizeDone(RCUHead* head) {
+        auto wait = reinterpret_cast<SynchronizeWait*>(head);
+        wait->Done = true;
+        wait->Thread->Owner->WakeThread(wait->Thread);
+    }
+
+    void RCU::Call(RCUHead *head, RCUCallback function) {
+        auto flags = CPU::DisableInterrupts();
+        PerCPU* cpu = PerCPU::Get();
+
+        head->Next = nullptr;
+        head->Function = function;
+
+        uint64_t kick;
+        {
+            LockGuard<SpinLock> guard(_gpLock);
+
+            // A grace period that is already running may have started before the caller unpublished the object, so it has to be the next one
+            head->GracePeriod = _gpCurrent + 1;
+            if (_gpRequested < head->GracePeriod) _gpRequested = head->GracePeriod;
+            kick = StartGracePeriodIfNeeded();
+        }
+
+        // Grace periods only grow, so the callbacks that may run are always at the front
+        if (cpu->RcuCallbacksTail) cpu->RcuCallbacksTail->Next = head;
+        else cpu->RcuCallbacks = head;
+        cpu->RcuCallbacksTail = head;
+
+        // The caller may be in a read section itself, so this CPU reports its quiescent state later like any other
+        KickCPUs(kick & ~(1ULL << cpu->Index));
+        ArmCheckTimer(cpu);
+        CPU::RestoreInterrupts(flags);
+    }
+
+    void RCU::Synchronize() {
+        Time::Scheduler* scheduler = PerCPU::Get()->Scheduler;
+        if (!scheduler || !scheduler->GetCurrentThread()) {
+            PANIC("RCU::Synchronize needs a thread that can block!");
+        }
+
+        SynchronizeWait wait { {}, scheduler->GetCurrentThread(), false };
+
+        // Callbacks run from this CPU's interrupts and idle loop, neither of which can happen before this thread blocked with interrupts disabled
+        auto flags = CPU::DisableInterrupts();
+        Call(&wait.Head, SynchronizeDone);
+        while (!wait.Done) {
+            PerCPU::Get()->Scheduler->BlockCurrentThread();
+        }
+        CPU::RestoreInterrupts(flags);
+    }
+
+    void RCU::Check() {
+        PerCPU* cpu = PerCPU::Get();
+
+        // Ticks and IPIs land here with the interrupted code's count, which is only zero outside of read sections
+        if (!cpu->PreemptDisableCount) NoteQuiescentState();
+        RunCallbacks(cpu);
+
+        if (cpu->RcuCallbacks || (__atomic_load_n(&_pendingMask, __ATOMIC_RELAXED) & (1ULL << cpu->Index))) {
+            ArmCheckTimer(cpu);
+        }
+    }
+
+    void RCU::NoteQuiescentState() {
+        PerCPU* cpu = PerCPU::Get();
+        uint64_t self = 1ULL << cpu->Index;
+
+        // The common case, no grace period waits for us, only reads the shared mask
+        if (!(__atomic_load_n(&_pendingMask, __ATOMIC_RELAXED) & self)) return;
+
+        uint64_t kick;
+        {
+            LockGuard<SpinLock> guard(_gpLock);
+            if (!(_pendingMask & self)) return;
+
+            uint64_t pending = _pendingMask & ~self;
+            __atomic_store_n(&_pendingMask, pending, __ATOMIC_RELAXED);
+            if (pending) return;
+
+            __atomic_store_n(&_gpCompleted, _gpCurrent, __ATOMIC_RELEASE);
+            kick = StartGracePeriodIfNeeded();
+        }
+
+        KickCPUs(kick & ~self);
+        if (kick & self) ArmCheckTimer(cpu);
+    }
+
+    uint64_t RCU::GetCompletedGracePeriods() {
+        return __atomic_load_n(&_gpCompleted, __ATOMIC_ACQUIRE);
+    }
+
+    uint64_t RCU::StartGracePeriodIfNeeded() {
+        if (_gpCurrent != _gpCompleted || _gpRequested <= _gpCurrent) return 0;
+
+        // CPUs that come online later can't be in a read section that started before this, so they don't have to be waited for
+        auto smp = Kernel<KernelData>::GetInstance()->ArchitectureData->Smp;
+        uint64_t mask = smp ? smp->GetOnlineMask() : 1;
+
+        _gpCurrent++;
+        __atomic_store_n(&_pendingMask, mask, __ATOMIC_RELAXED);
+        return mask;
+    }
+
+    void RCU::KickCPUs(uint64_t mask) {
+        if (!mask) return;
+
+        // The kick runs Check in interrupt context, which is a quiescent state for a CPU that is idle or outside a read section
+        auto smp = Kernel<KernelData>::GetInstance()->ArchitectureData->Smp;
+        if (smp) smp->CallFunction(mask, KickCall, nullptr, false);
+    }
+
+    void RCU::RunCallbacks(PerCPU *cpu) {
+        uint64_t completed = __atomic_load_n(&_gpCompleted, __ATOMIC_ACQUIRE);
+
+        while (cpu->RcuCallbacks && cpu->RcuCallbacks->GracePeriod <= completed) {
+            RCUHead* head = cpu->RcuCallbacks;
+            cpu->RcuCallbacks = head->Next;
+            if (!cpu->RcuCallbacks) cpu->RcuCallbacksTail = nullptr;
+
+            head->Function(head);
+        }
+    }
+
+    void RCU::ArmCheckTimer(PerCPU *cpu) {
+        // Without a scheduler there are no ticks yet, the idle loop picks the work up once it runs
+        Time::Scheduler* scheduler = cpu->Scheduler;
+        if (!scheduler) return;
+
+        if (!cpu->RcuCheckTimer) cpu->RcuCheckTimer = scheduler->CreateTimer(CheckTimerExpired, nullptr);
+        if (!scheduler->IsTimerPending(cpu->RcuCheckTimer)) scheduler->ArmTimer(cpu->RcuCheckTimer, CHECK_INTERVAL_NS);
+    }
+
+    void RCU::KickCall(void *) {
+        Check();
+    }
+
+    void RCU::CheckTimerExpired(void *) {
+        // Scheduler::Tick runs Check once the expired timers ran, this timer only makes sure there is a tick
+    }
+}
@@ -0,0 +1,89 @@
+#ifndef BOREALOS_RCU_H
+#define BOREALOS_RCU_H
+
+#include <Definitions.h>
+
+#include "SpinLock.h"
+#include "../PerCPU.h"
+
+namespace Core::Sync {
+    struct RCUHead;
+    typedef void (*RCUCallback)(RCUHead* head);
+
+    /// Embedded in objects that are freed through RCU::Call
+    struct RCUHead {
+        RCUHead* Next = nullptr;
+        RCUCallback Function = nullptr;
+        uint64_t GracePeriod = 0; // The grace period that has to complete before Function may run
+    };
+
+    /// Read-copy-update: readers take no lock and write no shared memory, writers publish a new copy and free the old one once
+    /// every reader that could still see it is gone. Read sections only disable preemption, so they must not sleep, block or yield.
+    /// A CPU is known to have left every read section it was in when it passes a quiescent state: a context switch, the idle loop,
+    /// or a scheduler tick or IPI that interrupted code outside a read section. A grace period completes once every CPU that was
+    /// online when it started has passed one. Idle and tickless CPUs are kicked with a cross-CPU call when a grace period starts,
+    /// and CPUs with callbacks keep a check timer armed until their callbacks ran.
+    class RCU {
+    public:
+        static void ReadLock() {
+            __atomic_fetch_add(&PerCPU::Get()->PreemptDisableCount, 1, __ATOMIC_ACQ_REL);
+        }
+
+        static void ReadUnlock() {
+            __atomic_fetch_sub(&PerCPU::Get()->PreemptDisableCount, 1, __ATOMIC_ACQ_REL);
+        }
+
+        /// Loads a pointer that is published with Assign, inside a read section
+        template<typename T>
+        static T* Dereference(T* const& pointer) {
+            return __atomic_load_n(&pointer, __ATOMIC_ACQUIRE);
+        }
+
+        /// Publishes a pointer, everything written to the object before is visible to readers that see the new pointer
+        template<typename T>
+        static void Assign(T*& pointer, T* value) {
+            __atomic_store_n(&pointer, value, __ATOMIC_RELEASE);
+        }
+
+        /// Runs function(head) on the calling CPU once every read section that was running when this was called has ended.
+        /// Callbacks run with interrupts disabled, possibly in interrupt context. Never blocks, so it can be called from anywhere.
+        static void Call(RCUHead* head, RCUCallback function);
+        /// Waits for a full grace period, for threads only
+        static void Synchronize();
+
+        /// Notes a quiescent state if the calling CPU isn't in a read section, then runs its callbacks whose grace period completed.
+        /// Called by the scheduler from its tick and the idle loop, with interrupts disabled and no read section of its own.
+        static void Check();
+        /// Only notes a quiescent state, for the context switch where running callbacks isn't safe
+        static void NoteQuiescentState();
+
+        [[nodiscard]] static uint64_t GetCompletedGracePeriods();
+
+        static constexpr uint64_t CHECK_INTERVAL_NS = 1'000'000; // 1ms, while the CPU has callbacks or owes a quiescent state
+
+    private:
+        static SpinLock _gpLock; // Serializes starting and completing grace periods
+        static uint64_t _gpCurrent; // The last grace period that started
+        static uint64_t _gpCompleted; // The last grace period that completed, equal to _gpCurrent while none is running
+        static uint64_t _gpRequested; // The last grace period a callback waits for
+        static uint64_t _pendingMask; // CPUs that haven't passed a quiescent state in the current grace period
+
+        static uint64_t StartGracePeriodIfNeeded(); // Returns the CPUs to kick, _gpLock must be held
+        static void KickCPUs(uint64_t mask);
+        static void RunCallbacks(PerCPU* cpu);
+        static void ArmCheckTimer(PerCPU* cpu);
+        static void KickCall(void* context);
+        static void CheckTimerExpired(void* context);
+    };
+
+    // Scoped read section
+    class RCUReadGuard {
+    public:
+        RCUReadGuard() { RCU::ReadLock(); }
+        ~RCUReadGuard() { RCU::ReadUnlock(); }
+        RCUReadGuard(const RCUReadGuard&) = delete;
+        RCUReadGuard& operator=(const RCUReadGuard&) = delete;
+    };
+}
+
+#endif //BOREALOS_RCU_H
@@ -0,0 +1,115 @@
+#ifndef BOREALOS_RCUARRAY_H
+#define BOREALOS_RCUARRAY_H
+
+#include <Definitions.h>
+
+#include "LockGuard.h"
+#include "RCU.h"
+#include "SpinLock.h"
+
+namespace Core::Sync {
+    /// A small array of plain data that is read far more often than it changes. Readers look at an immutable snapshot inside an RCU
+    /// read section, so a lookup takes no lock and writes no shared memory. Every change copies the array under the writer lock,
+    /// publishes the copy and frees the old snapshot once the readers that could still see it are gone.
+    template<typename T>
+    class RCUArray {
+        static_assert(__is_trivially_copyable(T), "Snapshots are copied and freed without running constructors or destructors");
+
+    public:
+        struct Snapshot {
+            RCUHead Rcu; // Must stay the first member, Free casts the head back
+            size_t Count = 0;
+
+            [[nodiscard]] const T* Items() const { return reinterpret_cast<const T*>(this + 1); }
+            [[nodiscard]] T* Items() { return reinterpret_cast<T*>(this + 1); }
+            const T& operator[](size_t index) const { return Items()[index]; }
+        };
+
+        static_assert(alignof(T) <= alignof(Snapshot), "The items are placed right behind the snapshot header");
+
+        constexpr explicit RCUArray(LockClass* writerLockClass = nullptr) : _writerLock(writerLockClass) {}
+
+        ~RCUArray() {
+            // Whoever destroys the array must make sure no reader is left
+            if (_snapshot != &_empty) Free(&_snapshot->Rcu);
+        }
+
+        RCUArray(const RCUArray&) = delete;
+        RCUArray& operator=(const RCUArray&) = delete;
+
+        /// The current snapshot, never null. Only valid until the read section it was taken in ends.
+        [[nodiscard]] const Snapshot* Read() const {
+            return RCU::Dereference(_snapshot);
+        }
+
+        /// Appends item, unless conflicts(existing) returns true for an item that is already in the array. Returns false in that case.
+        template<typename Match>
+        bool Add(const T& item, Match conflicts) {
+            Snapshot* old;
+            {
+                IrqLockGuard<SpinLock> guard(_writerLock);
+                old = _snapshot;
+                for (size_t i = 0; i < old->Count; i++) {
+                    if (conflicts((*old)[i])) return false;
+                }
+
+                Snapshot* copy = Allocate(old->Count + 1);
+                for (size_t i = 0; i < old->Count; i++) copy->Items()[i] = (*old)[i];
+                copy->Items()[old->Count] = item;
+                RCU::Assign(_snapshot, copy);
+            }
+
+            Retire(old);
+            return true;
+        }
+
+        void Add(const T& item) {
+            Add(item, [](const T&) { return false; });
+        }
+
+        /// Removes the first item for which match(item) returns true. Returns false if there is none.
+        template<typename Match>
+        bool Remove(Match match) {
+            Snapshot* old;
+            {
+                IrqLockGuard<SpinLock> guard(_writerLock);
+                old = _snapshot;
+
+                size_t index = 0;
+                while (index < old->Count && !match((*old)[index])) index++;
+                if (index == old->Count) return false;
+
+                Snapshot* copy = old->Count > 1 ? Allocate(old->Count - 1) : &_empty;
+                for (size_t i = 0, j = 0; i < old->Count; i++) {
+                    if (i != index) copy->Items()[j++] = (*old)[i];
+                }
+                RCU::Assign(_snapshot, copy);
+            }
+
+            Retire(old);
+            return true;
+        }
+
+    private:
+        static inline Snapshot _empty {}; // Shared by every empty array of this type, so readers never check for null
+
+        Snapshot* _snapshot = &_empty;
+        SpinLock _writerLock; // Serializes writers, taken with interrupts disabled since input callbacks may (un)subscribe from interrupt handlers
+
+        static Snapshot* Allocate(size_t count) {
+            auto snapshot = new (new uint8_t[sizeof(Snapshot) + count * sizeof(T)]) Snapshot();
+            snapshot->Count = count;
+            return snapshot;
+        }
+
+        static void Retire(Snapshot* snapshot) {
+            if (snapshot != &_empty) RCU::Call(&snapshot->Rcu, Free);
+        }
+
+        static void Free(RCUHead* head) {
+            delete[] reinterpret_cast<uint8_t*>(head);
+        }
+    };
+}
+
+#endif //BOREALOS_RCUARRAY_H
@@ -0,0 +1,73 @@
+#ifndef BOREALOS_RWLOCK_H
+#define BOREALOS_RWLOCK_H
+
+#include <Definitions.h>
+
+#include "LockStat.h"
+#include "../CPU.h"
+
+namespace Core::Sync {
+    // Reader-writer spinlock for registries that are looked up far more often than they change. Any number of readers may hold it at
+    // once, a writer holds it alone. Readers only wait for a writer that holds the lock, not for one that waits, so a reader in an
+    // interrupt handler can never deadlock against a writer queued behind the reader it interrupted. The price is that a steady
+    // stream of readers can hold writers off.
+    // Writers always run with interrupts disabled, so readers in interrupt handlers can't spin on a writer of their own CPU.
+    class RWLock {
+    public:
+        constexpr explicit RWLock(LockClass* lockClass = nullptr) : _stat(lockClass) {}
+
+        void ReadLock() {
+            uint64_t waitStart = _stat.WaitStart();
+            bool contended = false;
+
+            int32_t state = __atomic_load_n(&_state, __ATOMIC_RELAXED);
+            while (true) {
+                if (state >= 0 && __atomic_compare_exchange_n(&_state, &state, state + 1, true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) break;
+
+                if (state < 0) {
+                    contended = true;
+                    asm volatile ("pause");
+                    state = __atomic_load_n(&_state, __ATOMIC_RELAXED);
+                }
+            }
+
+            _stat.Acquired(contended, waitStart, false);
+        }
+
+        void ReadUnlock() {
+            __atomic_fetch_sub(&_state, 1, __ATOMIC_RELEASE);
+        }
+
+        [[nodiscard]] uint64_t WriteLock() {
+            uint64_t flags = CPU::DisableInterrupts();
+            uint64_t waitStart = _stat.WaitStart();
+            bool contended = false;
+
+            int32_t expected = 0;
+            while (!__atomic_compare_exchange_n(&_state, &expected, WRITER, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                contended = true;
+                while (__atomic_load_n(&_state, __ATOMIC_RELAXED) != 0) {
+                    asm volatile ("pause");
+                }
+                expected = 0;
+            }
+
+            _stat.Acquired(contended, waitStart);
+            return flags;
+        }
+
+        void WriteUnlock(uint64_t flags) {
+            _stat.Released();
+            __atomic_store_n(&_state, 0, __ATOMIC_RELEASE);
+            CPU::RestoreInterrupts(flags);
+        }
+
+    private:
+        static constexpr int32_t WRITER = -1;
+
+        int32_t _state = 0; // The number of readers, or WRITER
+        LockStatState _stat;
+    };
+}
+
+#endif //BOREALOS_RWLOCK_H
@@ -0,0 +1,72 @@
+#ifndef BOREALOS_SEQLOCK_H
+#define BOREALOS_SEQLOCK_H
+
+#include <Definitions.h>
+
+#include "SpinLock.h"
+
+namespace Core::Sync {
+    // Sequence lock for small pieces of state that are read far more often than they are written (e.g. clock state).
+    // Readers never write shared memory or block a writer, they copy the state and retry if a write happened in the meantime:
+    //
+    //     uint32_t seq;
+    //     do {
+    //         seq = lock.ReadBegin();
+    //         ... copy the protected state ...
+    //     } while (lock.ReadRetry(seq));
+    //
+    // Writers must be serialized by the caller and run with interrupts disabled, a reader interrupting a writer on the same CPU would spin forever.
+    class SeqLock {
+    public:
+        [[nodiscard]] uint32_t ReadBegin() const {
+            uint32_t sequence;
+            while ((sequence = __atomic_load_n(&_sequence, __ATOMIC_ACQUIRE)) & 1) {
+                asm volatile ("pause"); // A write is in progress
+            }
+            return sequence;
+        }
+
+        [[nodiscard]] bool ReadRetry(uint32_t sequence) const {
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            return __atomic_load_n(&_sequence, __ATOMIC_RELAXED) != sequence;
+        }
+
+        void WriteBegin() {
+            __atomic_store_n(&_sequence, _sequence + 1, __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_RELEASE);
+        }
+
+        void WriteEnd() {
+            __atomic_store_n(&_sequence, _sequence + 1, __ATOMIC_RELEASE);
+        }
+
+    private:
+        uint32_t _sequence = 0; // Odd while a write is in progress
+    };
+
+    // A SeqLock that serializes its writers itself, for state that more than one CPU updates. Readers are the same lock-free loop.
+    class SeqSpinLock {
+    public:
+        constexpr explicit SeqSpinLock(LockClass* lockClass = nullptr) : _writer(lockClass) {}
+
+        [[nodiscard]] uint32_t ReadBegin() const { return _sequence.ReadBegin(); }
+        [[nodiscard]] bool ReadRetry(uint32_t sequence) const { return _sequence.ReadRetry(sequence); }
+
+        [[nodiscard]] uint64_t WriteLock() {
+            uint64_t flags = _writer.LockIrqSave();
+            _sequence.WriteBegin();
+            return flags;
+        }
+
+        void WriteUnlock(uint64_t flags) {
+            _sequence.WriteEnd();
+            _writer.UnlockIrqRestore(flags);
+        }
+
+    private:
+        SeqLock _sequence;
+        SpinLock _writer;
+    };
+}
+
+#endif //BOREALOS_SEQLOCK_H
@@ -0,0 +1,64 @@
+#ifndef BOREALOS_SPINLOCK_H
+#define BOREALOS_SPINLOCK_H
+
+#include <Definitions.h>
+
+#include "LockStat.h"
+#include "../CPU.h"
+
+namespace Core::Sync {
+    // Test-and-test-and-set spinlock for short critical sections. Waiters spin on a plain load so the cache line stays shared
+    // until the lock is released. Not fair: under heavy contention use a TicketLock or an MCSLock instead.
+    // Locks that are also taken in interrupt handlers must be taken with LockIrqSave (or an IrqLockGuard) everywhere else,
+    // an interrupt on the CPU that holds the lock would spin forever otherwise.
+    class SpinLock {
+    public:
+        constexpr explicit SpinLock(LockClass* lockClass = nullptr) : _stat(lockClass) {}
+
+        void Lock() {
+            uint64_t waitStart = _stat.WaitStart();
+            bool contended = false;
+
+            while (__atomic_exchange_n(&_locked, true, __ATOMIC_ACQUIRE)) {
+                contended = true;
+                while (__atomic_load_n(&_locked, __ATOMIC_RELAXED)) {
+                    asm volatile ("pause");
+                }
+            }
+
+            _stat.Acquired(contended, waitStart);
+        }
+
+        [[nodiscard]] bool TryLock() {
+            if (__atomic_load_n(&_locked, __ATOMIC_RELAXED) || __atomic_exchange_n(&_locked, true, __ATOMIC_ACQUIRE)) return false;
+            _stat.Acquired(false, 0);
+            return true;
+        }
+
+        void Unlock() {
+            _stat.Released();
+            __atomic_store_n(&_locked, false, __ATOMIC_RELEASE);
+        }
+
+        [[nodiscard]] uint64_t LockIrqSave() {
+            uint64_t flags = CPU::DisableInterrupts();
+            Lock();
+            return flags;
+        }
+
+        void UnlockIrqRestore(uint64_t flags) {
+            Unlock();
+            CPU::RestoreInterrupts(flags);
+        }
+
+        [[nodiscard]] bool IsLocked() const {
+            return __atomic_load_n(&_locked, __ATOMIC_RELAXED);
+        }
+
+    private:
+        bool _locked = false;
+        LockStatState _stat;
+    };
+}
+
+#endif //BOREALOS_SPINLOCK_H
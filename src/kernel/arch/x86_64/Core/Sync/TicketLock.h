@@ -0,0 +1,63 @@
+#ifndef BOREALOS_TICKETLOCK_H
+#define BOREALOS_TICKETLOCK_H
+
+#include <Definitions.h>
+
+#include "LockStat.h"
+#include "../CPU.h"
+
+namespace Core::Sync {
+    // Fair spinlock: every waiter draws a ticket and the lock is handed over in ticket order, so no CPU can starve.
+    // All waiters spin on the same cache line, which makes it slower than an MCSLock once many CPUs contend.
+    class TicketLock {
+    public:
+        constexpr explicit TicketLock(LockClass* lockClass = nullptr) : _stat(lockClass) {}
+
+        void Lock() {
+            uint64_t waitStart = _stat.WaitStart();
+            uint32_t ticket = __atomic_fetch_add(&_next, 1, __ATOMIC_RELAXED);
+            bool contended = false;
+
+            while (__atomic_load_n(&_serving, __ATOMIC_ACQUIRE) != ticket) {
+                contended = true;
+                asm volatile ("pause");
+            }
+
+            _stat.Acquired(contended, waitStart);
+        }
+
+        [[nodiscard]] bool TryLock() {
+            // Only take a ticket if it would be served right away
+            uint32_t serving = __atomic_load_n(&_serving, __ATOMIC_ACQUIRE);
+            uint32_t expected = serving;
+            if (!__atomic_compare_exchange_n(&_next, &expected, serving + 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) return false;
+
+            _stat.Acquired(false, 0);
+            return true;
+        }
+
+        void Unlock() {
+            _stat.Released();
+            // Only the holder writes _serving, so a plain increment is enough
+            __atomic_store_n(&_serving, _serving + 1, __ATOMIC_RELEASE);
+        }
+
+        [[nodiscard]] uint64_t LockIrqSave() {
+            uint64_t flags = CPU::DisableInterrupts();
+            Lock();
+            return flags;
+        }
+
+        void UnlockIrqRestore(uint64_t flags) {
+            Unlock();
+            CPU::RestoreInterrupts(flags);
+        }
+
+    private:
+        uint32_t _next = 0; // The next ticket to hand out
+        uint32_t _serving = 0; // The ticket that holds the lock
+        LockStatState _stat;
+    };
+}
+
+#endif //BOREALOS_TICKETLOCK_H
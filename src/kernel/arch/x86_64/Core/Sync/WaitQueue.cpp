@@ -0,0 +1,103 @@
+#include "WaitQueue.h"
+
+#include "../PerCPU.h"
+#include "../Time/Scheduler.h"
+#include "../Time/Clocksource.h"
+
+namespace Core::Sync {
+    bool CanSleep() {
+        return Time::Scheduler::CanSleep();
+    }
+
+    void SleepNs(uint64_t nanoseconds) {
+        if (CanSleep()) {
+            PerCPU::Get()->Scheduler->Sleep(nanoseconds);
+            return;
+        }
+
+        uint64_t end = WaitClockNanoseconds() + nanoseconds;
+        while (WaitClockNanoseconds() < end) {
+            asm volatile ("pause");
+        }
+    }
+
+    uint64_t WaitClockNanoseconds() {
+        return Time::GetNanoseconds();
+    }
+
+    size_t WaitQueue::WakeOne() {
+        return Wake(1);
+    }
+
+    size_t WaitQueue::WakeAll() {
+        return Wake(static_cast<size_t>(-1));
+    }
+
+    bool WaitQueue::HasWaiters() const {
+        return __atomic_load_n(&_head, __ATOMIC_RELAXED) != nullptr;
+    }
+
+    void WaitQueue::Prepare(Entry *entry) {
+        if (!entry->Sleeper) entry->Sleeper = PerCPU::Get()->Scheduler->GetCurrentThread();
+
+        _lock.Lock();
+        if (!entry->Queued) {
+            entry->Queued = true;
+            entry->Woken = false;
+            entry->Next = nullptr;
+            entry->Prev = _tail;
+            if (_tail) _tail->Next = entry;
+            else _head = entry;
+            _tail = entry;
+        }
+        _lock.Unlock();
+    }
+
+    void WaitQueue::Finish(Entry *entry, bool satisfied) {
+        _lock.Lock();
+        if (entry->Queued) Unlink(entry);
+        bool woken = entry->Woken;
+        _lock.Unlock();
+
+        // A waker picked this entry while the waiter was leaving. If it leaves with its condition true the wakeup was used, but one
+        // that leaves on its timeout hands it on, so a WakeOne is never swallowed while another waiter still needs it.
+        if (woken && !satisfied) Wake(1);
+    }
+
+    void WaitQueue::Block() {
+        PerCPU::Get()->Scheduler->BlockCurrentThread();
+    }
+
+    void WaitQueue::BlockTimeout(uint64_t timeoutNs) {
+        // Sleep uses the thread's sleep timer, which WakeThread cancels when a waker comes first
+        PerCPU::Get()->Scheduler->Sleep(timeoutNs);
+    }
+
+    size_t WaitQueue::Wake(size_t count) {
+        size_t woken = 0;
+        uint64_t flags = _lock.LockIrqSave();
+
+        while (_head && woken < count) {
+            Entry* entry = _head;
+            Unlink(entry);
+            entry->Woken = true;
+
+            // Still under the lock: the entry lives on the waiter's stack and is gone as soon as the waiter can leave Finish
+            entry->Sleeper->Owner->WakeThread(entry->Sleeper);
+            woken++;
+        }
+
+        _lock.UnlockIrqRestore(flags);
+        return woken;
+    }
+
+    void WaitQueue::Unlink(Entry *entry) {
+        if (entry->Prev) entry->Prev->Next = entry->Next;
+        else _head = entry->Next;
+        if (entry->Next) entry->Next->Prev = entry->Prev;
+        else _tail = entry->Prev;
+
+        entry->Next = entry->Prev = nullptr;
+        entry->Queued = false;
+    }
+}
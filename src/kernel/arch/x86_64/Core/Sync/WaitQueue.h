@@ -0,0 +1,129 @@
+#ifndef BOREALOS_WAITQUEUE_H
+#define BOREALOS_WAITQUEUE_H
+
+#include <Definitions.h>
+
+#include "SpinLock.h"
+#include "../Threading/Thread.h"
+
+namespace Core::Sync {
+    /// True if the caller is a thread that may give up the CPU, see Time::Scheduler::CanSleep
+    bool CanSleep();
+    /// Sleeps for at least nanoseconds. Callers that can't sleep (early boot, interrupt handlers, code with interrupts or preemption
+    /// disabled) spin on the TSC instead, so this is safe to call from anywhere.
+    void SleepNs(uint64_t nanoseconds);
+    /// The clock timeouts are measured on, the kernel's time like the scheduler's timers
+    uint64_t WaitClockNanoseconds();
+
+    /// Waits until condition() returns true or timeoutNs passed, and returns the last result. For hardware that raises no interrupt
+    /// for the event: the condition is polled every intervalNs, and the thread sleeps in between if it can.
+    template<typename Condition>
+    bool PollEventTimeout(Condition condition, uint64_t timeoutNs, uint64_t intervalNs) {
+        uint64_t deadline = WaitClockNanoseconds() + timeoutNs;
+
+        while (!condition()) {
+            uint64_t now = WaitClockNanoseconds();
+            if (now >= deadline) return condition();
+
+            uint64_t remaining = deadline - now;
+            SleepNs(remaining < intervalNs ? remaining : intervalNs);
+        }
+
+        return true;
+    }
+
+    /// Threads waiting for an event that someone else signals with WakeOne or WakeAll. The waiter states what it waits for as a
+    /// condition, which is checked again after every wakeup, so wakeups are never lost and spurious ones don't matter: the waker
+    /// makes the condition true first and wakes afterwards. Waking works from any context, including interrupt handlers.
+    /// Conditions are evaluated with interrupts disabled, so they must be short and must not block.
+    /// Callers that can't sleep (see CanSleep) spin on the condition instead.
+    class WaitQueue {
+    public:
+        /// Queued while the thread waits, lives on the waiter's stack
+        struct Entry {
+            Threading::Thread* Sleeper = nullptr;
+            Entry* Next = nullptr;
+            Entry* Prev = nullptr;
+            bool Queued = false;
+            bool Woken = false; // A waker dequeued it since it was last queued
+        };
+
+        constexpr explicit WaitQueue(LockClass* lockClass = nullptr) : _lock(lockClass) {}
+
+        WaitQueue(const WaitQueue&) = delete;
+        WaitQueue& operator=(const WaitQueue&) = delete;
+
+        template<typename Condition>
+        void WaitEvent(Condition condition) {
+            if (!CanSleep()) {
+                while (!condition()) asm volatile ("pause");
+                return;
+            }
+
+            // Interrupts stay disabled from queueing the entry until the thread blocked, so a wakeup can't come before it
+            // (see Scheduler::BlockCurrentThread)
+            Entry entry;
+            uint64_t flags = CPU::DisableInterrupts();
+            while (true) {
+                Prepare(&entry);
+                if (condition()) break;
+                Block();
+            }
+
+            Finish(&entry, true);
+            CPU::RestoreInterrupts(flags);
+        }
+
+        /// Returns the condition's last result, false means the timeout passed first
+        template<typename Condition>
+        bool WaitEventTimeout(Condition condition, uint64_t timeoutNs) {
+            uint64_t deadline = WaitClockNanoseconds() + timeoutNs;
+
+            if (!CanSleep()) {
+                while (!condition()) {
+                    if (WaitClockNanoseconds() >= deadline) return condition();
+                    asm volatile ("pause");
+                }
+                return true;
+            }
+
+            Entry entry;
+            bool done;
+            uint64_t flags = CPU::DisableInterrupts();
+            while (true) {
+                Prepare(&entry);
+                done = condition();
+                if (done) break;
+
+                uint64_t now = WaitClockNanoseconds();
+                if (now >= deadline) break;
+                BlockTimeout(deadline - now);
+            }
+
+            Finish(&entry, done);
+            CPU::RestoreInterrupts(flags);
+            return done;
+        }
+
+        /// Wake the first waiter or every waiter. Returns how many were woken.
+        size_t WakeOne();
+        size_t WakeAll();
+
+        [[nodiscard]] bool HasWaiters() const;
+
+    private:
+        SpinLock _lock;
+        Entry* _head = nullptr;
+        Entry* _tail = nullptr;
+
+        // All of these run with interrupts disabled
+        void Prepare(Entry* entry); // Queues the entry unless it still is
+        void Finish(Entry* entry, bool satisfied); // Dequeues the entry if no waker did, passes an unused wakeup on
+        static void Block();
+        static void BlockTimeout(uint64_t timeoutNs); // Woken by the timeout or a waker, whichever comes first
+        size_t Wake(size_t count);
+        void Unlink(Entry* entry); // Lock must be held
+    };
+}
+
+#endif //BOREALOS_WAITQUEUE_H
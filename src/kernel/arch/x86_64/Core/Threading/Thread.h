@@ -0,0 +1,54 @@
+#ifndef BOREALOS_THREAD_H
+#define BOREALOS_THREAD_H
+
+#include <Definitions.h>
+
+#include "../Time/TimerWheel.h"
+#include "../../Memory/Paging.h"
+
+namespace Core::Time {
+    class Scheduler;
+}
+
+namespace Core::Threading {
+    typedef void (*ThreadFunction)(void* argument);
+
+    enum class ThreadState : uint8_t {
+        Ready,    // In the run queue
+        Running,
+        Sleeping, // Waiting for its sleep timer
+        Blocked,  // Waiting for someone to call Scheduler::WakeThread
+        Dead      // Exited, the idle thread frees it
+    };
+
+    struct Thread {
+        uint64_t StackPointer = 0; // Saved by SwitchContext while the thread isn't running. SwitchContext is passed its address, so it may sit anywhere in the struct.
+        uint64_t Id = 0;
+        const char* Name = nullptr;
+        ThreadState State = ThreadState::Ready;
+        ThreadFunction Function = nullptr;
+        void* Argument = nullptr;
+        uintptr_t StackPhysical = 0; // 0 for the boot thread, which keeps running on the stack the bootloader gave us
+        uintptr_t KernelStackTop = 0; // Loaded into the TSS RSP0 and the syscall stack while the thread runs, so user mode entries land on its own stack
+        Time::Scheduler* Owner = nullptr; // The scheduler of the CPU the thread runs or is queued on, changes when another CPU steals it
+        volatile uint64_t AffinityMask = ~0ULL; // Bit n set: the thread may run on CPU n, see Scheduler::SetAffinity
+        volatile bool OnCPU = false; // From being switched to until its context is saved after being switched out, a thief must wait for this to clear
+        Memory::Paging::PagingState* PagingState = nullptr; // The page table the thread was running on when it was switched out
+        Thread* Next = nullptr; // Run queue or dead list link
+        Thread* WakeNext = nullptr; // Link in the owner's remote wakeup list, Next may still be in use while a wakeup is pending
+        volatile bool WakePending = false; // Set while the thread is in its owner's remote wakeup list
+        uint64_t WakeRequestedAt = 0; // Time in nanoseconds of the first wakeup since it last ran, for the scheduler's wakeup latency trace
+        Time::Timer SleepTimer;
+
+        static constexpr size_t STACK_PAGES = 4; // 16KiB
+    };
+}
+
+extern "C" {
+    // Saves the callee-saved registers and RFLAGS on the current stack, stores the stack pointer in *oldStackPointer and resumes the context on newStackPointer
+    void SwitchContext(uint64_t* oldStackPointer, uint64_t newStackPointer);
+    // First code a new thread runs, SwitchContext "returns" into it with the thread in r12
+    void ThreadTrampoline();
+}
+
+#endif //BOREALOS_THREAD_H
@@ -0,0 +1,347 @@
+#include "WorkQueue.h"
+
+#include "../PerCPU.h"
+#include "../Time/Scheduler.h"
+#include "Kernel.h"
+#include "../../KernelData.h"
+
+namespace Core::Threading {
+    WorkQueue::WorkQueue(const char *name, uint32_t maxActive) : _name(name) {
+        if (maxActive == 0 || maxActive > MAX_ACTIVE) {
+            LOG_WARNING("Workqueue %s asked for %u32 concurrent items per CPU, using %u32 instead.", name, maxActive, MAX_ACTIVE);
+            maxActive = MAX_ACTIVE;
+        }
+
+        auto smp = Kernel<KernelData>::GetInstance()->ArchitectureData->Smp;
+        _poolCount = smp ? smp->GetCPUCount() : 1;
+
+        for (uint32_t i = 0; i < _poolCount; i++) {
+            auto pool = new Pool();
+            pool->CPUIndex = i;
+
+            PerCPU* cpu = smp ? smp->GetCPU(i) : PerCPU::Get();
+            for (uint32_t w = 0; w < maxActive; w++) {
+                Worker* worker = &pool->Workers[w];
+                worker->Owner = pool;
+                worker->WorkerThread = cpu->Scheduler->CreateThread(name, WorkerMain, worker, 1ULL << i);
+                if (!worker->WorkerThread) {
+                    PANIC("Failed to create a workqueue worker thread!");
+                }
+            }
+
+            pool->WorkerCount = maxActive;
+            _pools[i] = pool;
+        }
+    }
+
+    bool WorkQueue::Queue(WorkItem *item) {
+        auto flags = CPU::DisableInterrupts();
+        bool queued = QueueOn(PerCPU::Get()->Index, item);
+        CPU::RestoreInterrupts(flags);
+        return queued;
+    }
+
+    bool WorkQueue::QueueOn(uint32_t cpu, WorkItem *item) {
+        if (__atomic_exchange_n(&item->Pending, true, __ATOMIC_ACQUIRE)) return false;
+
+        Enqueue(GetPool(cpu), item);
+        return true;
+    }
+
+    bool WorkQueue::QueueDelayed(WorkItem *item, uint64_t delayNs) {
+        if (delayNs == 0) return Queue(item);
+        if (__atomic_exchange_n(&item->Pending, true, __ATOMIC_ACQUIRE)) return false;
+
+        auto flags = CPU::DisableInterrupts();
+        PerCPU* cpu = PerCPU::Get();
+
+        item->Queue = this;
+        item->Delayed = true;
+        item->DelayCPUIndex = cpu->Index;
+        item->DelayTimer.function = DelayExpired;
+        item->DelayTimer.context = item;
+        cpu->Scheduler->ArmTimer(&item->DelayTimer, delayNs);
+
+        CPU::RestoreInterrupts(flags);
+        return true;
+    }
+
+    bool WorkQueue::Cancel(WorkItem *item) {
+        WorkQueue* queue = item->Queue;
+        if (!queue) return false; // Never queued
+
+        bool wasPending = false;
+
+        // Cancelling the timer runs on the CPU it's armed on, so if that fails the item is already in a worker list
+        if (item->Delayed && queue->GetScheduler(item->DelayCPUIndex)->CancelTimer(&item->DelayTimer)) {
+            item->Delayed = false;
+            __atomic_store_n(&item->Pending, false, __ATOMIC_RELEASE);
+            wasPending = true;
+        }
+
+        while (true) {
+            Pool* pool = queue->GetPool(item->CPUIndex);
+            uint64_t flags = pool->Lock.LockIrqSave();
+            if (queue->GetPool(item->CPUIndex) != pool) {
+                // Moved to another CPU's list before we got the lock
+                pool->Lock.UnlockIrqRestore(flags);
+                continue;
+            }
+
+            if (Unlink(pool, item)) {
+                __atomic_store_n(&item->Pending, false, __ATOMIC_RELEASE);
+                wasPending = true;
+            }
+
+            if (!IsRunning(pool, item)) {
+                pool->Lock.UnlockIrqRestore(flags);
+                return wasPending;
+            }
+
+            Wait(pool, flags);
+        }
+    }
+
+    bool WorkQueue::Flush(WorkItem *item) {
+        WorkQueue* queue = item->Queue;
+        if (!queue) return false; // Never queued
+
+        // Waiting out the delay isn't what a flush is for, so the item is queued right away instead
+        if (item->Delayed && queue->GetScheduler(item->DelayCPUIndex)->CancelTimer(&item->DelayTimer)) {
+            item->Delayed = false;
+            queue->Enqueue(queue->GetPool(item->DelayCPUIndex), item);
+        }
+
+        bool waited = false;
+        while (true) {
+            Pool* pool = queue->GetPool(item->CPUIndex);
+            uint64_t flags = pool->Lock.LockIrqSave();
+            if (queue->GetPool(item->CPUIndex) != pool) {
+                pool->Lock.UnlockIrqRestore(flags);
+                continue;
+            }
+
+            if (!item->Pending && !IsRunning(pool, item)) {
+                pool->Lock.UnlockIrqRestore(flags);
+                return waited;
+            }
+
+            Wait(pool, flags);
+            waited = true;
+        }
+    }
+
+    void WorkQueue::FlushAll() {
+        for (uint32_t i = 0; i < _poolCount; i++) {
+            Pool* pool = _pools[i];
+            uint64_t flags = pool->Lock.LockIrqSave();
+
+            // Items get increasing sequence numbers as they are queued, so everything before the flush is done once nothing older is left
+            uint64_t target = pool->NextSequence;
+            while (OldestUnfinished(pool) < target) {
+                Wait(pool, flags);
+                flags = pool->Lock.LockIrqSave();
+            }
+
+            pool->Lock.UnlockIrqRestore(flags);
+        }
+    }
+
+    const char* WorkQueue::GetName() const {
+        return _name;
+    }
+
+    WorkQueue::Pool* WorkQueue::GetPool(uint32_t cpu) const {
+        // CPUs that came online after the queue was created share the boot CPU's workers
+        return _pools[cpu < _poolCount ? cpu : 0];
+    }
+
+    Time::Scheduler* WorkQueue::GetScheduler(uint32_t cpu) {
+        auto smp = Kernel<KernelData>::GetInstance()->ArchitectureData->Smp;
+        return smp ? smp->GetCPU(cpu)->Scheduler : PerCPU::Get()->Scheduler;
+    }
+
+    void WorkQueue::Enqueue(Pool *pool, WorkItem *item) {
+        // The caller owns the Pending flag, so nobody else queues the item meanwhile. An item that is still running on another CPU is
+        // queued behind itself there, so an item is only ever in one CPU's hands and Cancel and Flush only have to watch that one.
+        if (item->Queue == this && item->CPUIndex != pool->CPUIndex) {
+            Pool* last = GetPool(item->CPUIndex);
+            uint64_t flags = last->Lock.LockIrqSave();
+            bool running = IsRunning(last, item);
+            last->Lock.UnlockIrqRestore(flags);
+            if (running) pool = last;
+        }
+
+        Thread* wake = nullptr;
+        uint64_t flags = pool->Lock.LockIrqSave();
+
+        item->Queue = this;
+        item->CPUIndex = pool->CPUIndex;
+        item->Sequence = pool->NextSequence++;
+        item->Next = nullptr;
+        if (pool->Tail) pool->Tail->Next = item;
+        else pool->Head = item;
+        pool->Tail = item;
+
+        for (uint32_t i = 0; i < pool->WorkerCount; i++) {
+            if (pool->Workers[i].Idle) {
+                pool->Workers[i].Idle = false;
+                wake = pool->Workers[i].WorkerThread;
+                break;
+            }
+        }
+
+        pool->Lock.UnlockIrqRestore(flags);
+        if (wake) wake->Owner->WakeThread(wake);
+    }
+
+    bool WorkQueue::Unlink(Pool *pool, WorkItem *item) {
+        WorkItem* previous = nullptr;
+        for (WorkItem* current = pool->Head; current; previous = current, current = current->Next) {
+            if (current != item) continue;
+
+            if (previous) previous->Next = item->Next;
+            else pool->Head = item->Next;
+            if (pool->Tail == item) pool->Tail = previous;
+            return true;
+        }
+
+        return false;
+    }
+
+    bool WorkQueue::IsRunning(const Pool *pool, const WorkItem *item) {
+        for (uint32_t i = 0; i < pool->WorkerCount; i++) {
+            if (pool->Workers[i].Current == item) return true;
+        }
+
+        return false;
+    }
+
+    uint64_t WorkQueue::OldestUnfinished(const Pool *pool) {
+        uint64_t oldest = pool->Head ? pool->Head->Sequence : pool->NextSequence;
+        for (uint32_t i = 0; i < pool->WorkerCount; i++) {
+            if (pool->Workers[i].Current && pool->Workers[i].Sequence < oldest) oldest = pool->Workers[i].Sequence;
+        }
+
+        return oldest;
+    }
+
+    void WorkQueue::Wait(Pool *pool, uint64_t flags) {
+        // Interrupts stay disabled until the thread blocked, so the wakeup can't come before it (see Scheduler::BlockCurrentThread).
+        // The waker unlinks the whole list under the lock, so the waiter may live on our stack.
+        Waiter waiter { PerCPU::Get()->Scheduler->GetCurrentThread(), pool->Waiters };
+        pool->Waiters = &waiter;
+        pool->Lock.Unlock();
+
+        PerCPU::Get()->Scheduler->BlockCurrentThread();
+        CPU::RestoreInterrupts(flags);
+    }
+
+    void WorkQueue::WorkerMain(void *argument) {
+        auto worker = static_cast<Worker*>(argument);
+        Pool* pool = worker->Owner;
+
+        while (true) {
+            uint64_t flags = pool->Lock.LockIrqSave();
+
+            WorkItem* item = pool->Head;
+            if (!item) {
+                worker->Idle = true;
+                pool->Lock.Unlock();
+                PerCPU::Get()->Scheduler->BlockCurrentThread();
+                CPU::RestoreInterrupts(flags);
+                continue;
+            }
+
+            pool->Head = item->Next;
+            if (!pool->Head) pool->Tail = nullptr;
+            worker->Current = item;
+            worker->Sequence = item->Sequence;
+
+            // Cleared before it runs, so queueing it again from inside the function or while it runs makes it run once more
+            __atomic_store_n(&item->Pending, false, __ATOMIC_RELEASE);
+            pool->Lock.UnlockIrqRestore(flags);
+
+            // The function may free the item, so it isn't touched afterwards, only compared against
+            item->Function(item->Context);
+
+            flags = pool->Lock.LockIrqSave();
+            worker->Current = nullptr;
+
+            Waiter* waiter = pool->Waiters;
+            pool->Waiters = nullptr;
+            while (waiter) {
+                Waiter* next = waiter->Next; // The waiter may be gone as soon as it's woken
+                waiter->Sleeper->Owner->WakeThread(waiter->Sleeper);
+                waiter = next;
+            }
+
+            pool->Lock.UnlockIrqRestore(flags);
+        }
+    }
+
+    void WorkQueue::DelayExpired(void *context) {
+        // Runs in the timer interrupt of the CPU that armed it
+        auto item = static_cast<WorkItem*>(context);
+        item->Delayed = false;
+        item->Queue->Enqueue(item->Queue->GetPool(PerCPU::Get()->Index), item);
+    }
+
+    // --- Service for driver modules ---
+    static WorkQueues::Queue* ServiceCreateQueue(const char* name, uint32_t maxActive) {
+        return reinterpret_cast<WorkQueues::Queue*>(new WorkQueue(name, maxActive));
+    }
+
+    static WorkQueues::Queue* ServiceGetSystemQueue() {
+        return reinterpret_cast<WorkQueues::Queue*>(Kernel<KernelData>::GetInstance()->ArchitectureData->SystemWorkQueue);
+    }
+
+    static WorkQueues::Work* ServiceCreateWork(WorkQueues::WorkFunction function, void* context) {
+        auto item = new WorkItem();
+        item->Function = function;
+        item->Context = context;
+        return reinterpret_cast<WorkQueues::Work*>(item);
+    }
+
+    static void ServiceDestroyWork(WorkQueues::Work* work) {
+        auto item = reinterpret_cast<WorkItem*>(work);
+        WorkQueue::Cancel(item);
+        delete item;
+    }
+
+    static bool ServiceQueueWork(WorkQueues::Queue* queue, WorkQueues::Work* work) {
+        return reinterpret_cast<WorkQueue*>(queue)->Queue(reinterpret_cast<WorkItem*>(work));
+    }
+
+    static bool ServiceQueueDelayedWork(WorkQueues::Queue* queue, WorkQueues::Work* work, uint64_t delayNs) {
+        return reinterpret_cast<WorkQueue*>(queue)->QueueDelayed(reinterpret_cast<WorkItem*>(work), delayNs);
+    }
+
+    static bool ServiceCancelWork(WorkQueues::Work* work) {
+        return WorkQueue::Cancel(reinterpret_cast<WorkItem*>(work));
+    }
+
+    static bool ServiceFlushWork(WorkQueues::Work* work) {
+        return WorkQueue::Flush(reinterpret_cast<WorkItem*>(work));
+    }
+
+    static void ServiceFlushQueue(WorkQueues::Queue* queue) {
+        reinterpret_cast<WorkQueue*>(queue)->FlushAll();
+    }
+
+    static WorkQueues::WorkQueueService workQueueService = {
+        .CreateQueue = ServiceCreateQueue,
+        .GetSystemQueue = ServiceGetSystemQueue,
+        .CreateWork = ServiceCreateWork,
+        .DestroyWork = ServiceDestroyWork,
+        .QueueWork = ServiceQueueWork,
+        .QueueDelayedWork = ServiceQueueDelayedWork,
+        .CancelWork = ServiceCancelWork,
+        .FlushWork = ServiceFlushWork,
+        .FlushQueue = ServiceFlushQueue
+    };
+
+    WorkQueues::WorkQueueService* WorkQueue::GetService() {
+        return &workQueueService;
+    }
+}
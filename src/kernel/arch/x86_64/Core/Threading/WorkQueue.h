@@ -0,0 +1,103 @@
+#ifndef BOREALOS_WORKQUEUE_H
+#define BOREALOS_WORKQUEUE_H
+
+#include <Definitions.h>
+#include <Core/WorkQueueService.h>
+
+#include "Thread.h"
+#include "../SMP.h"
+#include "../Sync/SpinLock.h"
+#include "../Time/TimerWheel.h"
+
+namespace Core::Threading {
+    class WorkQueue;
+    typedef void (*WorkFunction)(void* context);
+
+    /// A function to run on a workqueue. The caller owns the item and the queues link it intrusively, so queueing never allocates.
+    /// An item is pending at most once: queueing it again before it started running does nothing, queueing it while it runs runs it again.
+    /// The function may free its own item.
+    struct WorkItem {
+        WorkFunction Function = nullptr;
+        void* Context = nullptr;
+
+        // Managed by the workqueue
+        WorkItem* Next = nullptr;
+        WorkQueue* Queue = nullptr; // The queue it was last queued on
+        uint32_t CPUIndex = 0; // The CPU whose workers it was last queued for
+        volatile bool Pending = false; // Queued, or waiting for its delay
+        bool Delayed = false; // Pending on DelayTimer rather than in the worker list
+        uint32_t DelayCPUIndex = 0; // The CPU whose scheduler DelayTimer is armed on
+        uint64_t Sequence = 0; // Order in its worker list, for FlushAll
+        Time::Timer DelayTimer;
+    };
+
+    /// A named queue of background work that runs on kernel threads, so it may sleep and block, unlike timers and deferred interrupt work.
+    /// Every CPU has its own workers for the queue, pinned to it, and work runs on the CPU it was queued on. maxActive is the number of
+    /// workers per CPU, which limits how many items of this queue run concurrently on one CPU.
+    /// Queueing works from any context, including interrupt handlers; cancelling and flushing wait, so they are for threads only.
+    /// Queues live as long as the kernel.
+    class WorkQueue {
+    public:
+        WorkQueue(const char* name, uint32_t maxActive = 1);
+
+        bool Queue(WorkItem* item); // On the calling CPU. Returns false if the item was already pending.
+        bool QueueOn(uint32_t cpu, WorkItem* item);
+        bool QueueDelayed(WorkItem* item, uint64_t delayNs); // Queued on the calling CPU once the delay passed
+
+        static bool Cancel(WorkItem* item); // Returns true if the item was pending, waits for it if it is running
+        static bool Flush(WorkItem* item); // Waits until the item is neither pending nor running, returns true if it had to wait
+        void FlushAll(); // Waits until every item that was queued before the call has finished. Delayed items that didn't get queued yet don't count.
+
+        [[nodiscard]] const char* GetName() const;
+
+        /// The shared functions behind WORKQUEUE_SERVICE_NAME, for driver modules
+        static WorkQueues::WorkQueueService* GetService();
+
+        static constexpr uint32_t MAX_ACTIVE = 8;
+
+    private:
+        struct Pool;
+
+        struct Worker {
+            Threading::Thread* WorkerThread = nullptr;
+            Pool* Owner = nullptr;
+            WorkItem* Current = nullptr;
+            uint64_t Sequence = 0; // Of Current, which may already be queued again with a newer one
+            bool Idle = false; // Blocked until work is queued
+        };
+
+        // Someone waiting in Cancel or Flush, woken whenever an item of the pool finishes
+        struct Waiter {
+            Threading::Thread* Sleeper;
+            Waiter* Next;
+        };
+
+        struct Pool {
+            Sync::SpinLock Lock;
+            uint32_t CPUIndex = 0;
+            WorkItem* Head = nullptr;
+            WorkItem* Tail = nullptr;
+            uint64_t NextSequence = 1;
+            Worker Workers[MAX_ACTIVE];
+            uint32_t WorkerCount = 0;
+            Waiter* Waiters = nullptr;
+        };
+
+        const char* _name;
+        Pool* _pools[SMP::MAX_CPUS] {};
+        uint32_t _poolCount = 0;
+
+        Pool* GetPool(uint32_t cpu) const;
+        static Time::Scheduler* GetScheduler(uint32_t cpu);
+        void Enqueue(Pool* pool, WorkItem* item);
+        static bool Unlink(Pool* pool, WorkItem* item); // Pool lock must be held
+        static bool IsRunning(const Pool* pool, const WorkItem* item); // Pool lock must be held
+        static uint64_t OldestUnfinished(const Pool* pool); // Pool lock must be held
+        static void Wait(Pool* pool, uint64_t flags); // Drops the pool lock taken with LockIrqSave and blocks until an item finishes
+
+        [[noreturn]] static void WorkerMain(void* argument);
+        static void DelayExpired(void* context);
+    };
+}
+
+#endif //BOREALOS_WORKQUEUE_H
@@ -0,0 +1,94 @@
+#ifndef BOREALOS_WORKSTEALINGDEQUE_H
+#define BOREALOS_WORKSTEALINGDEQUE_H
+
+#include <Definitions.h>
+
+namespace Core::Threading {
+    /// Bounded Chase-Lev deque: one owner pushes and pops at the bottom without atomic read-modify-writes, any CPU steals from the top with a CAS.
+    /// The memory orders follow "Correct and Efficient Work-Stealing for Weak Memory Models" (Lê et al., 2013).
+    /// _top and _bottom sit on cache lines of their own, so the owner's pushes and pops don't bounce the line thieves CAS on.
+    template<typename T, size_t Capacity>
+    class WorkStealingDeque {
+        static_assert(Capacity && !(Capacity & (Capacity - 1)), "The capacity must be a power of two");
+
+    public:
+        /// Owner only. Returns false if the deque is full.
+        bool Push(T* item) {
+            int64_t bottom = __atomic_load_n(&_bottom, __ATOMIC_RELAXED);
+            int64_t top = __atomic_load_n(&_top, __ATOMIC_ACQUIRE);
+            if (bottom - top >= static_cast<int64_t>(Capacity)) return false;
+
+            __atomic_store_n(&_buffer[bottom & MASK], item, __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_RELEASE);
+            __atomic_store_n(&_bottom, bottom + 1, __ATOMIC_RELAXED);
+            return true;
+        }
+
+        /// Owner only, takes the most recently pushed item. Returns nullptr if the deque is empty.
+        T* Pop() {
+            int64_t bottom = __atomic_load_n(&_bottom, __ATOMIC_RELAXED) - 1;
+            __atomic_store_n(&_bottom, bottom, __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            int64_t top = __atomic_load_n(&_top, __ATOMIC_RELAXED);
+
+            if (top > bottom) {
+                __atomic_store_n(&_bottom, bottom + 1, __ATOMIC_RELAXED);
+                return nullptr;
+            }
+
+            T* item = __atomic_load_n(&_buffer[bottom & MASK], __ATOMIC_RELAXED);
+            if (top == bottom) {
+                // The last item, race the thieves for it
+                if (!__atomic_compare_exchange_n(&_top, &top, top + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) item = nullptr;
+                __atomic_store_n(&_bottom, bottom + 1, __ATOMIC_RELAXED);
+            }
+
+            return item;
+        }
+
+        /// Any CPU, takes the oldest item if accept(item) returns true. Returns nullptr if the deque is empty, another CPU
+        /// took the item first, or the item was not accepted; an unaccepted item stays where it is.
+        template<typename Accept>
+        T* Steal(Accept accept) {
+            int64_t top = __atomic_load_n(&_top, __ATOMIC_ACQUIRE);
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            int64_t bottom = __atomic_load_n(&_bottom, __ATOMIC_ACQUIRE);
+            if (top >= bottom) return nullptr;
+
+            T* item = __atomic_load_n(&_buffer[top & MASK], __ATOMIC_RELAXED);
+            if (!accept(item)) return nullptr;
+            if (!__atomic_compare_exchange_n(&_top, &top, top + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) return nullptr;
+            return item;
+        }
+
+        T* Steal() {
+            return Steal([](T*) { return true; });
+        }
+
+        /// A snapshot, other CPUs may change it right after
+        [[nodiscard]] size_t Size() const {
+            int64_t bottom = __atomic_load_n(&_bottom, __ATOMIC_RELAXED);
+            int64_t top = __atomic_load_n(&_top, __ATOMIC_RELAXED);
+            return bottom > top ? static_cast<size_t>(bottom - top) : 0;
+        }
+
+        [[nodiscard]] bool IsEmpty() const {
+            return Size() == 0;
+        }
+
+    private:
+        static constexpr int64_t MASK = static_cast<int64_t>(Capacity) - 1;
+        static constexpr size_t CACHE_LINE_SIZE = 64;
+
+        // Padded rather than aligned, the deque lives in heap objects and operator new only guarantees 16 bytes. Padding a whole
+        // line around each index keeps them apart wherever the deque starts.
+        uint8_t _padding1[CACHE_LINE_SIZE] {};
+        int64_t _top = 0;
+        uint8_t _padding2[CACHE_LINE_SIZE - sizeof(int64_t)] {};
+        int64_t _bottom = 0;
+        uint8_t _padding3[CACHE_LINE_SIZE - sizeof(int64_t)] {};
+        T* _buffer[Capacity] {};
+    };
+}
+
+#endif //BOREALOS_WORKSTEALINGDEQUE_H
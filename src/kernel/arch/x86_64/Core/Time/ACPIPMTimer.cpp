@@ -0,0 +1,47 @@
+#include "ACPIPMTimer.h"
+
+#include "../../IO/Serial.h"
+
+namespace Core::Time {
+    ACPIPMTimer::ACPIPMTimer(Firmware::ACPI *acpi) : _acpi(acpi) {
+
+    }
+
+    bool ACPIPMTimer::Initialize() {
+        Firmware::ACPI::FADT* fadt = _acpi->GetFADT();
+        if (!fadt) return false;
+
+        // Prefer the ACPI 2.0+ extended address, it may only live in I/O space for us since we don't map it
+        if (fadt->sdt.length >= offsetof(Firmware::ACPI::FADT, X_PMTimerBlock) + sizeof(Firmware::ACPI::GenericAddr) && fadt->X_PMTimerBlock.Address != 0) {
+            if (fadt->X_PMTimerBlock.AddressSpace != ADDRESS_SPACE_SYSTEM_IO) return false;
+            _port = static_cast<uint16_t>(fadt->X_PMTimerBlock.Address);
+        }
+        else {
+            _port = static_cast<uint16_t>(fadt->PMTimerBlock);
+        }
+
+        if (_port == 0 || fadt->PMTimerLength < 4) return false;
+
+        _clocksource.Name = "ACPI PM timer";
+        _clocksource.Rating = 200;
+        _clocksource.Read = ReadClocksource;
+        _clocksource.Context = this;
+        _clocksource.Mask = (fadt->Flags & FADT_TMR_VAL_EXT) ? 0xFFFFFFFFULL : 0xFFFFFFULL;
+        _clocksource.SetFrequency(FREQUENCY);
+
+        LOG_DEBUG("ACPI PM timer at port 0x%x32, %s counter.", _port, (fadt->Flags & FADT_TMR_VAL_EXT) ? "32-bit" : "24-bit");
+        return true;
+    }
+
+    uint32_t ACPIPMTimer::GetCounter() const {
+        return IO::Serial::inl(_port) & static_cast<uint32_t>(_clocksource.Mask);
+    }
+
+    Clocksource* ACPIPMTimer::GetClocksource() {
+        return &_clocksource;
+    }
+
+    uint64_t ACPIPMTimer::ReadClocksource(const Clocksource *source) {
+        return static_cast<const ACPIPMTimer*>(source->Context)->GetCounter();
+    }
+}
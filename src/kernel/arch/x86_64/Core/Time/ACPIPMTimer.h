@@ -0,0 +1,34 @@
+#ifndef BOREALOS_ACPIPMTIMER_H
+#define BOREALOS_ACPIPMTIMER_H
+
+#include <Definitions.h>
+
+#include "Clocksource.h"
+#include "../Firmware/ACPI.h"
+
+namespace Core::Time {
+    // The ACPI power management timer, a 24 or 32-bit counter at 3.579545MHz in I/O space. Slow to read, but present on nearly every
+    // ACPI system, so it's the clocksource of last resort when there is neither an invariant TSC nor an HPET.
+    class ACPIPMTimer {
+    public:
+        explicit ACPIPMTimer(Firmware::ACPI* acpi);
+        bool Initialize(); // Returns false if the FADT doesn't describe a PM timer
+
+        [[nodiscard]] uint32_t GetCounter() const;
+        [[nodiscard]] Clocksource* GetClocksource();
+
+        static constexpr uint64_t FREQUENCY = 3'579'545;
+
+    private:
+        static constexpr uint8_t ADDRESS_SPACE_SYSTEM_IO = 1;
+        static constexpr uint32_t FADT_TMR_VAL_EXT = 1 << 8; // The counter is 32 bits wide instead of 24
+
+        Firmware::ACPI* _acpi;
+        uint16_t _port = 0;
+        Clocksource _clocksource;
+
+        static uint64_t ReadClocksource(const Clocksource* source);
+    };
+}
+
+#endif //BOREALOS_ACPIPMTIMER_H
@@ -0,0 +1,148 @@
+#include "ClockEvent.h"
+
+#include "Kernel.h"
+#include "../../KernelData.h"
+#include "../PerCPU.h"
+
+namespace Core::Time {
+    ClockEvent* ClockEvent::Create(Interrupts::APIC *apic, Interrupts::IDT *idt, HPET *hpet, TSC *tsc, CPU *cpu) {
+        // Application processors use their LAPIC timers even if the boot CPU falls back to the HPET, so the vector is always handled
+        idt->RegisterIRQHandler(Interrupts::APIC::LVT_VECTOR - Interrupts::APIC::IRQ_OFFSET, HandleInterrupt);
+
+        ClockEvent* device = CreateLocal(apic, tsc, cpu);
+        if (device) return device;
+
+        uint32_t gsi;
+        if (!hpet->SetupOneShotTimer(0, &gsi)) PANIC("HPET timer 0 can't be routed to the IOAPIC, there is no usable clock event device!");
+
+        device = new HPETClockEvent(hpet, 0);
+        idt->RegisterIRQHandler(HPETClockEvent::VECTOR - Interrupts::APIC::IRQ_OFFSET, HandleInterrupt);
+        apic->MapGSI(gsi, HPETClockEvent::VECTOR, 0, 1, 0);
+        apic->UnmaskGSI(gsi);
+        return device;
+    }
+
+    ClockEvent* ClockEvent::CreateLocal(Interrupts::APIC *apic, TSC *tsc, CPU *cpu) {
+        // TSC-deadline mode compares against the TSC directly, so there is nothing to calibrate and no rounding between time bases
+        if (cpu->HasFeature(CPUFeatures::TSC_DEADLINE)) {
+            return new LAPICClockEvent(apic, tsc, LAPICClockEvent::Mode::TSCDeadline);
+        }
+
+        auto lapic = new LAPICClockEvent(apic, tsc, LAPICClockEvent::Mode::OneShot);
+        if (lapic->GetTimerFrequency() != 0) return lapic;
+
+        LOG_WARNING("The LAPIC timer didn't count during calibration, it can't be used as a clock event device.");
+        delete lapic;
+        return nullptr;
+    }
+
+    void ClockEvent::HandleInterrupt() {
+        // Tick runs the expired timers and programs the device for the next deadline
+        Scheduler* scheduler = PerCPU::Get()->Scheduler;
+        if (scheduler) scheduler->Tick();
+    }
+
+    LAPICClockEvent::LAPICClockEvent(Interrupts::APIC *apic, TSC *tsc, Mode mode) : _apic(apic), _tsc(tsc), _mode(mode) {
+        if (_mode == Mode::TSCDeadline) {
+            _apic->SetTimerMode(Interrupts::APIC::LVT_TIMER_TSC_DEADLINE, false);
+
+            // The LVT write is an MMIO store and the deadline a WRMSR, which isn't serializing for this MSR.
+            // Intel requires a fence in between, otherwise the first deadline can be written before the timer is in TSC-deadline mode.
+            asm volatile ("mfence" ::: "memory");
+            return;
+        }
+
+        Calibrate();
+        _apic->SetTimerMode(Interrupts::APIC::LVT_TIMER_ONESHOT, false);
+    }
+
+    void LAPICClockEvent::SetNextEvent(uint64_t deadlineNs) {
+        if (_mode == Mode::TSCDeadline) {
+            // Kernel time may come from another clocksource, so the deadline is converted as a distance from now.
+            // Writing 0 disarms the timer, so a deadline at TSC 0 has to be moved by a tick.
+            uint64_t currentNs = GetNanoseconds();
+            uint64_t deadline = _tsc->GetTicks() + (deadlineNs > currentNs ? _tsc->NanosecondsToTicks(deadlineNs - currentNs) : 0);
+            CPU::WriteMSR(MSR_IA32_TSC_DEADLINE, deadline ? deadline : 1);
+            return;
+        }
+
+        uint64_t currentNs = GetNanoseconds();
+        uint64_t count = deadlineNs > currentNs ? Clocksource::Scale(deadlineNs - currentNs, 1'000'000'000ULL, _timerFrequency) : 1;
+
+        // The count register is 32 bits wide, a deadline further away than that fires early and the scheduler simply re-arms it
+        if (count == 0) count = 1;
+        if (count > 0xFFFFFFFF) count = 0xFFFFFFFF;
+        _apic->SetTimerInitialCount(static_cast<uint32_t>(count));
+    }
+
+    void LAPICClockEvent::Stop() {
+        if (_mode == Mode::TSCDeadline) {
+            CPU::WriteMSR(MSR_IA32_TSC_DEADLINE, 0);
+        }
+        else {
+            _apic->SetTimerInitialCount(0);
+        }
+    }
+
+    const char* LAPICClockEvent::GetName() const {
+        return _mode == Mode::TSCDeadline ? "LAPIC TSC-deadline" : "LAPIC one-shot";
+    }
+
+    uint64_t LAPICClockEvent::GetTimerFrequency() const {
+        return _timerFrequency;
+    }
+
+    void LAPICClockEvent::Calibrate() {
+        // Let the masked timer count down from its maximum for a fixed amount of TSC time, the TSC frequency is already known at this point
+        uint64_t flags = CPU::DisableInterrupts();
+        _apic->SetTimerMode(Interrupts::APIC::LVT_TIMER_ONESHOT, true);
+        _apic->SetTimerDivide(TIMER_DIVIDE_16);
+
+        uint64_t waitTicks = _tsc->NanosecondsToTicks(CALIBRATION_NS);
+        uint64_t tscStart = _tsc->GetTicks();
+        _apic->SetTimerInitialCount(0xFFFFFFFF);
+
+        while (_tsc->GetTicks() - tscStart < waitTicks) {
+            asm volatile ("pause");
+        }
+
+        uint32_t remaining = _apic->GetTimerCurrentCount();
+        uint64_t tscDelta = _tsc->GetTicks() - tscStart;
+        _apic->SetTimerInitialCount(0);
+        CPU::RestoreInterrupts(flags);
+
+        uint64_t elapsed = 0xFFFFFFFFULL - remaining;
+        _timerFrequency = tscDelta ? Clocksource::Scale(elapsed, tscDelta, _tsc->GetFrequency()) : 0;
+        LOG_DEBUG("LAPIC timer frequency (divided by 16): %u64hz", _timerFrequency);
+    }
+
+    HPETClockEvent::HPETClockEvent(HPET *hpet, uint8_t timer) : _hpet(hpet), _timer(timer) {
+
+    }
+
+    void HPETClockEvent::SetNextEvent(uint64_t deadlineNs) {
+        uint64_t currentNs = GetNanoseconds();
+        uint64_t delta = deadlineNs > currentNs ? Clocksource::Scale(deadlineNs - currentNs, 1'000'000'000ULL, _hpet->GetFrequency()) : 0;
+        if (delta < MIN_DELTA_TICKS) delta = MIN_DELTA_TICKS;
+        if (delta > MAX_DELTA_TICKS) delta = MAX_DELTA_TICKS;
+
+        // The comparator only fires when the counter crosses it, if the counter already went past it by the time the write lands
+        // the interrupt would only come after a full wrap around. Check for that and retry further out.
+        while (true) {
+            uint64_t target = _hpet->GetCounter() + delta;
+            _hpet->SetComparator(_timer, target);
+
+            auto remaining = static_cast<int32_t>(static_cast<uint32_t>(target) - static_cast<uint32_t>(_hpet->GetCounter()));
+            if (remaining > 0) break;
+            delta *= 2;
+        }
+    }
+
+    void HPETClockEvent::Stop() {
+        _hpet->StopTimer(_timer);
+    }
+
+    const char* HPETClockEvent::GetName() const {
+        return "HPET one-shot";
+    }
+}
@@ -0,0 +1,81 @@
+#ifndef BOREALOS_CLOCKEVENT_H
+#define BOREALOS_CLOCKEVENT_H
+
+#include <Definitions.h>
+
+#include "HPET.h"
+#include "TSC.h"
+#include "../CPU.h"
+#include "../../Interrupts/APIC.h"
+#include "../../Interrupts/IDT.h"
+
+namespace Core::Time {
+    /// A device that raises a single interrupt at a requested time. The scheduler programs it for exactly its next timer deadline and
+    /// runs its Tick from that interrupt, so the CPU isn't interrupted at all while no timers are pending.
+    class ClockEvent {
+    public:
+        virtual ~ClockEvent() = default;
+
+        // Arms the device to interrupt at the given time in nanoseconds (Time::GetNanoseconds), replacing any earlier request. Deadlines in the past fire as soon as possible.
+        virtual void SetNextEvent(uint64_t deadlineNs) = 0;
+        virtual void Stop() = 0;
+        [[nodiscard]] virtual const char* GetName() const = 0;
+
+        /// Picks the best device on this machine (LAPIC TSC-deadline, LAPIC one-shot, then an HPET comparator) and routes its interrupt to the
+        /// scheduler of the CPU it fires on
+        static ClockEvent* Create(Interrupts::APIC* apic, Interrupts::IDT* idt, HPET* hpet, TSC* tsc, CPU* cpu);
+        /// The LAPIC timer of the calling CPU, for application processors. Returns nullptr if it can't be used, the HPET can't be shared between CPUs.
+        static ClockEvent* CreateLocal(Interrupts::APIC* apic, TSC* tsc, CPU* cpu);
+
+    private:
+        static void HandleInterrupt();
+    };
+
+    class LAPICClockEvent : public ClockEvent {
+    public:
+        enum class Mode {
+            OneShot,
+            TSCDeadline
+        };
+
+        LAPICClockEvent(Interrupts::APIC* apic, TSC* tsc, Mode mode);
+
+        void SetNextEvent(uint64_t deadlineNs) override;
+        void Stop() override;
+        [[nodiscard]] const char* GetName() const override;
+
+        [[nodiscard]] uint64_t GetTimerFrequency() const; // Ticks per second of the LAPIC timer in one-shot mode, 0 if calibration failed
+
+    private:
+        static constexpr uint32_t MSR_IA32_TSC_DEADLINE = 0x6E0;
+        static constexpr uint8_t TIMER_DIVIDE_16 = 0b011;
+        static constexpr uint64_t CALIBRATION_NS = 10'000'000; // 10ms
+
+        Interrupts::APIC* _apic;
+        TSC* _tsc;
+        Mode _mode;
+        uint64_t _timerFrequency = 0;
+
+        void Calibrate();
+    };
+
+    class HPETClockEvent : public ClockEvent {
+    public:
+        HPETClockEvent(HPET* hpet, uint8_t timer);
+
+        void SetNextEvent(uint64_t deadlineNs) override;
+        void Stop() override;
+        [[nodiscard]] const char* GetName() const override;
+
+        static constexpr uint8_t VECTOR = 0x41; // Right after the LAPIC timer
+
+    private:
+        static constexpr uint64_t MIN_DELTA_TICKS = 64; // Comparator writes closer than this to the counter may be missed
+        static constexpr uint64_t MAX_DELTA_TICKS = 0x7FFFFFFF; // Keeps 32-bit comparators unambiguous, a longer wait just fires early and gets re-armed
+
+        HPET* _hpet;
+        uint8_t _timer;
+    };
+}
+
+#endif //BOREALOS_CLOCKEVENT_H
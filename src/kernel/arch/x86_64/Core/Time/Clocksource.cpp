@@ -0,0 +1,135 @@
+#include "Clocksource.h"
+
+#include "Scheduler.h"
+#include "../CPU.h"
+#include "Kernel.h"
+#include "../../KernelData.h"
+
+namespace Core::Time {
+    uint64_t GetNanoseconds() {
+        KernelData* data = Kernel<KernelData>::GetInstance()->ArchitectureData;
+        ClocksourceManager* clocksources = data->Clocksources;
+        return clocksources && clocksources->GetCurrent() ? clocksources->GetNanoseconds() : data->Tsc.GetNanoseconds();
+    }
+
+    void Clocksource::SetFrequency(uint64_t frequency) {
+        Frequency = frequency;
+        Mult = CalculateMult(frequency, 1'000'000'000ULL, &Shift);
+    }
+
+    uint64_t Clocksource::CalculateMult(uint64_t fromFrequency, uint64_t toFrequency, uint32_t* shift) {
+        // to / from < 2^(log + 1), so a shift of 62 - log keeps the result below 2^63
+        int log = (63 - __builtin_clzll(toFrequency)) - (63 - __builtin_clzll(fromFrequency));
+        int bits = 62 - log;
+        if (bits > 63) bits = 63;
+        if (bits < 0) bits = 0;
+        *shift = bits;
+
+        // (to << shift) / from without 128 bit division: shift the remainder in 16 bits at a time, it stays below from (< 2^48) so it can't overflow
+        uint64_t quotient = toFrequency / fromFrequency;
+        uint64_t remainder = toFrequency % fromFrequency;
+        while (bits > 0) {
+            int step = bits < 16 ? bits : 16;
+            remainder <<= step;
+            quotient = (quotient << step) + remainder / fromFrequency;
+            remainder %= fromFrequency;
+            bits -= step;
+        }
+
+        return quotient;
+    }
+
+    uint64_t Clocksource::Scale(uint64_t value, uint64_t fromFrequency, uint64_t toFrequency) {
+        // Split into whole periods of the source and a remainder, so the multiplication can't overflow
+        uint64_t whole = value / fromFrequency;
+        uint64_t remainder = value % fromFrequency;
+        return (whole * toFrequency) + (remainder * toFrequency + fromFrequency - 1) / fromFrequency;
+    }
+
+    void ClocksourceManager::Register(Clocksource *source) {
+        if (_sourceCount >= MAX_SOURCES) {
+            LOG_WARNING("Too many clocksources, ignoring %s.", source->Name);
+            return;
+        }
+
+        _sources[_sourceCount++] = source;
+        LOG_DEBUG("Registered clocksource %s (rating %u32, %u64hz).", source->Name, source->Rating, source->Frequency);
+
+        if (_current && _current->Rating >= source->Rating) return;
+
+        auto flags = CPU::DisableInterrupts();
+        _lock.WriteBegin();
+
+        if (_current) {
+            // Fold the time elapsed on the old source into the base, the new source continues from there
+            Accumulate();
+        }
+        else {
+            _nsBase = _earlyClock ? _earlyClock() : source->CyclesToNanoseconds(source->Read(source));
+        }
+
+        _current = source;
+        _cycleLast = source->Read(source);
+
+        _lock.WriteEnd();
+        CPU::RestoreInterrupts(flags);
+
+        LOG_INFO("Switched to clocksource %s.", source->Name);
+        ArmUpdates();
+    }
+
+    void ClocksourceManager::StartUpdates(Scheduler *scheduler) {
+        _scheduler = scheduler;
+        _updateTimer = scheduler->CreateTimer(UpdateTimerCallback, this);
+        ArmUpdates();
+    }
+
+    uint64_t ClocksourceManager::GetNanoseconds() const {
+        uint32_t sequence;
+        uint64_t nanoseconds;
+
+        do {
+            sequence = _lock.ReadBegin();
+            const Clocksource* source = _current;
+            uint64_t delta = (source->Read(source) - _cycleLast) & source->Mask;
+            nanoseconds = _nsBase + source->CyclesToNanoseconds(delta);
+        } while (_lock.ReadRetry(sequence));
+
+        return nanoseconds;
+    }
+
+    const Clocksource* ClocksourceManager::GetCurrent() const {
+        return _current;
+    }
+
+    void ClocksourceManager::Accumulate() {
+        uint64_t now = _current->Read(_current);
+        _nsBase += _current->CyclesToNanoseconds((now - _cycleLast) & _current->Mask);
+        _cycleLast = now;
+    }
+
+    void ClocksourceManager::ArmUpdates() {
+        if (!_updateTimer) return;
+
+        // A full 64 bit counter never wraps in practice, and the conversion can't overflow, so only narrower counters need updates.
+        // Those are accumulated twice per wrap around, e.g. every ~2.3s for a 24-bit ACPI PM timer.
+        if (_current->Mask == static_cast<uint64_t>(-1)) {
+            _scheduler->CancelTimer(_updateTimer);
+            return;
+        }
+
+        _updateIntervalNs = _current->CyclesToNanoseconds(_current->Mask) / 2;
+        _scheduler->ArmTimer(_updateTimer, _updateIntervalNs);
+    }
+
+    void ClocksourceManager::UpdateTimerCallback(void *context) {
+        auto manager = static_cast<ClocksourceManager*>(context);
+
+        // Timer callbacks run with interrupts disabled, as the write section requires
+        manager->_lock.WriteBegin();
+        manager->Accumulate();
+        manager->_lock.WriteEnd();
+
+        manager->_scheduler->ArmTimer(manager->_updateTimer, manager->_updateIntervalNs);
+    }
+}
@@ -0,0 +1,79 @@
+#ifndef BOREALOS_CLOCKSOURCE_H
+#define BOREALOS_CLOCKSOURCE_H
+
+#include <Definitions.h>
+
+#include "../Sync/SeqLock.h"
+
+namespace Core::Time {
+    class Scheduler;
+    struct Timer;
+
+    /// A free running counter that can be read to tell the time. The counter is converted to nanoseconds with a precomputed
+    /// multiplier, (cycles * Mult) >> Shift, so reading the time never divides.
+    struct Clocksource {
+        const char* Name = nullptr;
+        uint32_t Rating = 0; // Higher is better: 300 for an invariant TSC, 250 for the HPET, 200 for the ACPI PM timer, 100 for an unreliable TSC
+        uint64_t (*Read)(const Clocksource* source) = nullptr;
+        void* Context = nullptr; // For the read function
+        uint64_t Mask = 0; // The valid bits of the counter, differences must be masked with this to handle a wrap around
+        uint64_t Frequency = 0;
+        uint64_t Mult = 0;
+        uint32_t Shift = 0;
+
+        void SetFrequency(uint64_t frequency);
+
+        [[nodiscard]] uint64_t CyclesToNanoseconds(uint64_t cycles) const {
+            // The 128 bit product can't overflow, so even a full 64 bit counter converts without periodic accumulation
+            return static_cast<uint64_t>((static_cast<__uint128_t>(cycles) * Mult) >> Shift);
+        }
+
+        /// Returns the multiplier and shift that convert values at fromFrequency to toFrequency. The shift is as large as possible while
+        /// keeping the multiplier below 2^63, so the conversion keeps ~62 bits of precision and doesn't drift measurably over time.
+        static uint64_t CalculateMult(uint64_t fromFrequency, uint64_t toFrequency, uint32_t* shift);
+        /// value * toFrequency / fromFrequency rounded up, without overflowing for any value when one of the frequencies is 1GHz (nanoseconds)
+        static uint64_t Scale(uint64_t value, uint64_t fromFrequency, uint64_t toFrequency);
+    };
+
+    /// The kernel's monotonic time in nanoseconds, which timers, timeouts and timestamps are measured on: the best registered
+    /// clocksource once ArchitectureData->Clocksources exists, the TSC before that.
+    [[nodiscard]] uint64_t GetNanoseconds();
+
+    /// Keeps the kernel's monotonic time on the best registered clocksource.
+    /// The current source and its base cycle/nanosecond pair are protected by a seqlock, so readers never disable interrupts or take a lock.
+    class ClocksourceManager {
+    public:
+        /// The first source continues from earlyClock, the time the kernel kept before, so earlier timestamps stay comparable
+        explicit ClocksourceManager(uint64_t (*earlyClock)() = nullptr) : _earlyClock(earlyClock) {}
+
+        /// Adds a clocksource, switching to it if it has a higher rating than the current one. Time stays continuous across a switch.
+        void Register(Clocksource* source);
+        /// Counters that wrap within a few minutes need their elapsed cycles folded into the base regularly, this arms a timer for that
+        void StartUpdates(Scheduler* scheduler);
+
+        [[nodiscard]] uint64_t GetNanoseconds() const;
+        [[nodiscard]] const Clocksource* GetCurrent() const;
+
+        static constexpr size_t MAX_SOURCES = 8;
+
+    private:
+        uint64_t (*_earlyClock)() = nullptr;
+        Clocksource* _sources[MAX_SOURCES] {};
+        size_t _sourceCount = 0;
+
+        Sync::SeqLock _lock;
+        Clocksource* _current = nullptr;
+        uint64_t _cycleLast = 0;
+        uint64_t _nsBase = 0;
+
+        Scheduler* _scheduler = nullptr;
+        Timer* _updateTimer = nullptr;
+        uint64_t _updateIntervalNs = 0;
+
+        void Accumulate(); // Must be called inside a write section
+        void ArmUpdates();
+        static void UpdateTimerCallback(void* context);
+    };
+}
+
+#endif //BOREALOS_CLOCKSOURCE_H
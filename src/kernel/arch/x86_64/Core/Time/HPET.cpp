@@ -4,7 +4,7 @@
 #include "../../KernelData.h"
 
 namespace Core::Time {
-    HPET::HPET(Firmware::ACPI *acpi, Memory::Paging *paging, Interrupts::IDT* idt) : _acpi(acpi), _paging(paging), _idt(idt), _totalTicks(0) {
+    HPET::HPET(Firmware::ACPI *acpi, Memory::Paging *paging, Interrupts::IDT* idt) : _acpi(acpi), _paging(paging), _idt(idt) {
         _hpetTable = reinterpret_cast<HPETTable*>(_acpi->GetTable("HPET"));
     }
 
@@ -34,106 +34,108 @@ void HPET::Initialize() {
     LOG_DEBUG("  Number of Timers: %u64", _timerCount);
     LOG_DEBUG("  Counter Size: %s", capabilities->CountSizeCap ? "64-bit" : "32-bit");
 
+    _counterIs64Bit = capabilities->CountSizeCap;
+    _counterMask = _counterIs64Bit ? static_cast<uint64_t>(-1) : 0xFFFFFFFFULL;
+
+    _clocksource.Name = "HPET";
+    _clocksource.Rating = 250;
+    _clocksource.Read = ReadClocksource;
+    _clocksource.Context = this;
+    _clocksource.Mask = _counterMask;
+    _clocksource.SetFrequency(_hpetFrequency);
+
     asm volatile ("cli"); // Disable interrupts while configuring HPET
 
     // Disable HPET before configuring it
     volatile auto configReg = reinterpret_cast<uint64_t *>(static_cast<char *>(_hpetMappedAddress) + 0x10);
     *configReg = 0;
 
-    volatile auto timer0Config = reinterpret_cast<uint64_t *>(static_cast<char *>(_hpetMappedAddress) + 0x100); // Timer 0 config is at the same offset as its capabilities
-    volatile auto timer0Comparator = reinterpret_cast<uint64_t *>(static_cast<char *>(_hpetMappedAddress) + 0x108); // Timer 0 comparator is at offset 0x108
-    uint32_t allowedGsis = static_cast<uint32_t>(*timer0Config >> 32);
-    uint8_t selectedGsi = 0;
-        for (uint64_t i = 0; i < _timerCount; i++) {
-            volatile auto timerCfg = reinterpret_cast<uint64_t*>(
-                static_cast<char*>(_hpetMappedAddress) + 0x100 + (i * 0x20)
-            );
-            uint64_t rawCaps = *timerCfg;
-            bool periodic = (rawCaps >> 32) & (1 << 4);
-            uint32_t gsiMask = static_cast<uint32_t>(rawCaps >> 32);
-            LOG_DEBUG("Timer %u64: periodic=%s, GSI mask=0x%x32", i, periodic ? "yes" : "no", gsiMask);
-        }
-    // Find the first available GSI in the capability bitmask
-    for (uint8_t i = 0; i < 32; i++) {
-        if (allowedGsis & (1 << i)) {
-            selectedGsi = i;
-            break;
-        }
+    for (uint64_t i = 0; i < _timerCount; i++) {
+        uint64_t rawCaps = *GetTimerConfigRegister(i);
+        bool periodic = (rawCaps >> 32) & (1 << 4);
+        uint32_t gsiMask = static_cast<uint32_t>(rawCaps >> 32);
+        LOG_DEBUG("Timer %u64: periodic=%s, GSI mask=0x%x32", i, periodic ? "yes" : "no", gsiMask);
+
+        // Make sure no comparator fires until a clock event device claims it
+        StopTimer(i);
     }
-        uint64_t rawCaps = *timer0Config;
-        bool periodicSupported = (rawCaps >> 32) & (1 << 4); // bit 36 overall
-        LOG_DEBUG("Periodic mode supported: %s", periodicSupported ? "yes" : "no");
-    // https://wiki.osdev.org/HPET
-    // We need to set timer 0 to a periodic interrupt firing every second, to call our Tick() function.
-    *timer0Config = 0;
-    SET_BIT(*timer0Config, 3); // Set periodic mode
-    SET_BIT(*timer0Config, 2); // Enable interrupts from this timer
-    CLEAR_BIT(*timer0Config, 1); // Set interrupt type to edge-triggered
-
-    // Set bits 9-12 to the selected GSI for this timer
-    *timer0Config |= (static_cast<uint64_t>(selectedGsi) << 9);
-
-    SET_BIT(*timer0Config, 6);
-    *timer0Comparator = _hpetFrequency * 1;
-
-    // Register the HPET interrupt handler for timer 0.
-    _idt->RegisterIRQHandler(2, []() {
-        auto *hpet = &Kernel<KernelData>::GetInstance()->ArchitectureData->Hpet;
-        static uint64_t lastTime = 0;
-        uint64_t currentTime = hpet->GetNanoseconds();
-        uint64_t delta = currentTime - lastTime;
-        uint64_t msDelta = delta / 1'000'000ULL;
-        lastTime = currentTime;
-    });
-
-    auto *apic = Kernel<KernelData>::GetInstance()->ArchitectureData->Apic;
-    apic->MapGSI(selectedGsi, 2 + 0x20, false, true, false); // Get the raw vector, by adding 32
-    _idt->UnmaskIRQ(selectedGsi);
 
     // Reset the main counter.
     volatile auto mainCounter = reinterpret_cast<uint64_t*>(static_cast<char*>(_hpetMappedAddress) + 0xF0);
     *mainCounter = 0;
 
-    // Finally, enable HPET
+    // Finally, enable HPET. The comparators are only used as a one-shot clock event fallback, so there are no periodic interrupts.
     SET_BIT(*configReg, 0);
 
     asm volatile ("sti");
 }
 
-    uint64_t HPET::GetCounter() const {
-        volatile auto hpetRegs = static_cast<HPETRegisters*>(_hpetMappedAddress);
-        return hpetRegs->MainCounterValue;
+    bool HPET::SetupOneShotTimer(uint8_t timer, uint32_t* gsi) {
+        if (timer >= _timerCount) return false;
+
+        // https://wiki.osdev.org/HPET
+        // Bits 32-63 of the capabilities are the IOAPIC inputs this comparator can be routed to, take the first one
+        volatile uint64_t* timerConfig = GetTimerConfigRegister(timer);
+        uint32_t allowedGsis = static_cast<uint32_t>(*timerConfig >> 32);
+        if (allowedGsis == 0) return false;
+        uint8_t selectedGsi = __builtin_ctz(allowedGsis);
+
+        // Only the low half is writable, the high half holds the routing capabilities
+        uint32_t config = static_cast<uint32_t>(*timerConfig);
+        CLEAR_BIT(config, 3); // Non-periodic (one-shot) mode
+        CLEAR_BIT(config, 2); // Keep interrupts off until a comparator value is written
+        CLEAR_BIT(config, 1); // Set interrupt type to edge-triggered
+        config &= ~(0x1FU << 9);
+        config |= (static_cast<uint32_t>(selectedGsi) << 9); // Set bits 9-13 to the selected GSI for this timer
+        *timerConfig = config;
+
+        *gsi = selectedGsi;
+        return true;
     }
 
-    uint64_t HPET::GetNanoseconds() const {
-        uint64_t total;
-        uint32_t last;
-        asm volatile("cli");
-        total = _totalTicks;
-        last = _lastCounter;
-        asm volatile("sti");
+    void HPET::SetComparator(uint8_t timer, uint64_t value) {
+        volatile uint64_t* timerConfig = GetTimerConfigRegister(timer);
+        *(timerConfig + 1) = value; // The comparator is right after the configuration register
+        *timerConfig = static_cast<uint32_t>(*timerConfig) | (1U << 2); // Enable interrupts from this timer
+    }
+
+    void HPET::StopTimer(uint8_t timer) {
+        volatile uint64_t* timerConfig = GetTimerConfigRegister(timer);
+        *timerConfig = static_cast<uint32_t>(*timerConfig) & ~(1U << 2);
+    }
 
-        auto current = static_cast<uint32_t>(GetCounter());
-        uint32_t delta = current - last;
+    bool HPET::IsCounter64Bit() const {
+        return _counterIs64Bit;
+    }
 
-        return (total + delta) * 1'000'000'000ULL / _hpetFrequency;
+    volatile uint64_t* HPET::GetTimerConfigRegister(uint64_t timer) const {
+        return reinterpret_cast<volatile uint64_t*>(static_cast<char*>(_hpetMappedAddress) + 0x100 + (timer * 0x20));
+    }
+
+    uint64_t HPET::GetCounter() const {
+        auto mainCounter = reinterpret_cast<volatile uint64_t*>(static_cast<char*>(_hpetMappedAddress) + 0xF0);
+        return *mainCounter & _counterMask;
+    }
+
+    uint64_t HPET::GetCounterMask() const {
+        return _counterMask;
+    }
+
+    uint64_t HPET::GetNanoseconds() const {
+        // No state to protect, a 64-bit counter converts directly. A 32-bit counter wraps after ~5 minutes at 14.3MHz, use the
+        // ClocksourceManager for a monotonic time on such hardware, it accumulates the wraps.
+        return _clocksource.CyclesToNanoseconds(GetCounter());
     }
 
     uint64_t HPET::GetFrequency() const {
         return _hpetFrequency;
     }
 
-    void HPET::BusyWait(uint64_t nanoseconds) const {
-        uint64_t startTime = GetNanoseconds();
-        while (GetNanoseconds() - startTime < nanoseconds) {
-        }
+    Clocksource* HPET::GetClocksource() {
+        return &_clocksource;
     }
 
-    void HPET::Tick() {
-        auto current32 = static_cast<uint32_t>(GetCounter());
-        auto last32 = static_cast<uint32_t>(_lastCounter);
-        auto delta = current32 - last32; // Standard 32-bit wrap-around math
-        _totalTicks += delta;
-        _lastCounter = current32;
+    uint64_t HPET::ReadClocksource(const Clocksource *source) {
+        return static_cast<const HPET*>(source->Context)->GetCounter();
     }
 }
@@ -7,6 +7,7 @@
 #include "../../Memory/Paging.h"
 #include "../../Interrupts/IDT.h"
 #include "../../Memory/HeapAllocator.h"
+#include "Clocksource.h"
 
 namespace Core::Time {
     class HPET {
@@ -15,10 +16,16 @@ namespace Core::Time {
         void Initialize();
 
         [[nodiscard]] uint64_t GetCounter() const;
+        [[nodiscard]] uint64_t GetCounterMask() const; // Counter differences must be masked with this, the counter may only be 32 bits wide
         [[nodiscard]] uint64_t GetNanoseconds() const;
         [[nodiscard]] uint64_t GetFrequency() const;
+        [[nodiscard]] Clocksource* GetClocksource();
 
-        void BusyWait(uint64_t nanoseconds) const;
+        // Comparators, used as a one-shot clock event when the LAPIC timer can't be
+        bool SetupOneShotTimer(uint8_t timer, uint32_t* gsi); // Routes the comparator to the first IOAPIC input it supports, returns false if it can't be routed
+        void SetComparator(uint8_t timer, uint64_t value); // Fires once when the main counter reaches the value
+        void StopTimer(uint8_t timer);
+        [[nodiscard]] bool IsCounter64Bit() const;
 
     private:
         Firmware::ACPI* _acpi;
@@ -71,9 +78,11 @@ namespace Core::Time {
         void* _hpetMappedAddress;
         uint64_t _hpetFrequency;
         uint64_t _timerCount;
-        uint64_t _totalTicks;
-        uint64_t _lastCounter;
-        void Tick();
+        uint64_t _counterMask;
+        bool _counterIs64Bit;
+        Clocksource _clocksource;
+        static uint64_t ReadClocksource(const Clocksource* source);
+        volatile uint64_t* GetTimerConfigRegister(uint64_t timer) const;
     };
 }
 
@@ -3,34 +3,26 @@
 #include "Kernel.h"
 #include "../../IO/Serial.h"
 #include "../../KernelData.h"
-
-void RTCInterruptHandler() {
-    IO::Serial::outb(0x70, 0x0C);
-    IO::Serial::inb(0x71);
-
-    auto* rtc = &Kernel<KernelData>::GetInstance()->ArchitectureData->Rtc;
-    rtc->UpdateTicks();
-}
+#include "../Sync/WaitQueue.h"
 
 namespace Core::Time {
-    RTC::RTC(Interrupts::IDT *idt) : _idt(idt), _ticks(0) {
+    RTC::RTC(Interrupts::IDT *idt) : _idt(idt) {
 
     }
 
     void RTC::Initialize()  {
-        _idt->RegisterIRQHandler(RTCInterruptVector, RTCInterruptHandler);
-        _idt->UnmaskIRQ(RTCInterruptVector);
-
-        // Capture initial time once
+        // Capture initial time once, the TSC keeps time from here on so the RTC doesn't need a periodic interrupt.
+        // The TSC frequency isn't known yet, but reading the counter itself works at any point.
         TimeData initialTime = ReadFullCMOS();
+        _baseTSCTicks = Kernel<KernelData>::GetInstance()->ArchitectureData->Tsc.GetTicks();
         _baseTimestamp = ConvertToTimestamp(initialTime);
 
+        // Make sure the periodic interrupt (bit 6 of status register B) is off, firmware may have left it enabled
         asm volatile ("cli");
         IO::Serial::outb(0x70, 0x8B);
         uint8_t prev = IO::Serial::inb(0x71);
         IO::Serial::outb(0x70, 0x8B);
-        // Set periodic interrupt (bit 6) and ensure rate is default (lower 4 bits)
-        IO::Serial::outb(0x71, (prev & 0xF0) | 0x40 | 0x06);
+        IO::Serial::outb(0x71, prev & ~0x40);
         asm volatile ("sti");
 
         LOG_DEBUG("Current time: %u32/%u32/%u32 %u32:%u32:%u32.",
@@ -38,26 +30,26 @@ namespace Core::Time {
                   initialTime.hour, initialTime.minute, initialTime.second);
     }
 
-    void RTC::BusyWait(size_t secondsToWait) const {
-        uint64_t startSeconds = _ticks / TicksPerSecond;
-        while ((_ticks / TicksPerSecond) < startSeconds + secondsToWait) {
-            asm volatile ("hlt");
-        }
-    }
-
-    void RTC::UpdateTicks() {
-        _ticks += 1;
+    void RTC::Sleep(size_t seconds) const {
+        // The RTC has no interrupt of its own enabled, the scheduler's timers wake the thread instead
+        Sync::SleepNs(seconds * 1'000'000'000ULL);
     }
 
     uint64_t RTC::GetUnixTimestamp() const {
-        return _baseTimestamp + (_ticks / TicksPerSecond);
+        auto* tsc = &Kernel<KernelData>::GetInstance()->ArchitectureData->Tsc;
+
+        // Until the TSC is calibrated its ticks can't be turned into seconds, the CMOS clock is read directly instead
+        uint64_t frequency = tsc->GetFrequency();
+        if (!frequency) return ConvertToTimestamp(ReadFullCMOS());
+
+        return _baseTimestamp + ((tsc->GetTicks() - _baseTSCTicks) / frequency);
     }
 
     RTC::TimeData RTC::ReadFullCMOS() {
         IO::Serial::outb(0x70, 0x0A | 0x80);
         while (IO::Serial::inb(0x71) & 0x80) {
-            // Wait until RTC is not updating
-            asm volatile ("hlt");
+            // Wait until RTC is not updating, this takes at most ~2ms so spinning is fine (and nothing would wake a hlt)
+            asm volatile ("pause");
         }
 
         uint8_t seconds = BCDToBinary(ReadRegister(0x00));
@@ -10,9 +10,8 @@ namespace Core::Time {
         explicit RTC(Interrupts::IDT *idt);
         void Initialize();
 
-        void BusyWait(size_t secondsToWait) const;
+        void Sleep(size_t seconds) const; // Spins if the caller can't sleep, see Sync::SleepNs
 
-        void UpdateTicks();
         [[nodiscard]] uint64_t GetUnixTimestamp() const;
     private:
         struct TimeData {
@@ -30,11 +29,8 @@ namespace Core::Time {
         static uint16_t BCDToBinary(uint8_t bcd);
 
         Interrupts::IDT* _idt;
-        volatile uint64_t _ticks = 0;
         uint64_t _baseTimestamp = 0;
-        static constexpr uint32_t TicksPerSecond = 1024; // Default RTC periodic rate
-        static constexpr uint8_t RTCInterruptVector = 8;
-        static volatile bool _firstUpdate;
+        uint64_t _baseTSCTicks = 0; // TSC value when the CMOS time was read, the time since then is measured with the TSC instead of RTC interrupts
     };
 }
 
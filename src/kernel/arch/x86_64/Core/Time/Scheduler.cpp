@@ -1,47 +1,883 @@
 #include "Scheduler.h"
-#include "Scheduler.h"
+
+#include "ClockEvent.h"
+#include "../PerCPU.h"
+#include "../SMP.h"
+#include "../CPUIdle.h"
+#include "../Sync/RCU.h"
+#include "Kernel.h"
+#include "../../KernelData.h"
+#include <Utility/MemoryUtilities.h>
+
+extern "C" [[noreturn]] void ThreadMain(Core::Threading::Thread* thread) {
+    Core::PerCPU::Get()->Scheduler->FinishSwitch();
+
+    // The initial RFLAGS of a thread have interrupts disabled, since the switch into it happened with interrupts disabled
+    asm volatile ("sti");
+    thread->Function(thread->Argument);
+    thread->Owner->ExitThread();
+}
 
 namespace Core::Time {
-    Scheduler::Scheduler(TSC *tsc) : _tsc(tsc), _taskHeap(256) {
+    uint64_t Scheduler::_nextThreadId = 0;
+
+    Scheduler::Scheduler() : _cpu(PerCPU::Get()), _wheel(GetNanoseconds() >> TICK_SHIFT) {
 
     }
 
     void Scheduler::ScheduleTask(TaskFunction function, void *context, uint64_t delayNs) {
-        uint64_t currentNs = _tsc->GetNanoseconds();
-        uint64_t endNs = currentNs + delayNs;
+        auto flags = CPU::DisableInterrupts();
+        if (!IsOwnCPU()) {
+            CPU::RestoreInterrupts(flags);
+            RemoteTimerCall call = { this, nullptr, delayNs, function, context, false };
+            RunOnOwnCPU(RemoteScheduleTask, &call);
+            return;
+        }
 
-        Task newTask {
-            .endTime = endNs,
-            .function = function,
-            .context = context
-        };
+        OneShotTask* task = _freeOneShots;
+        if (task) {
+            _freeOneShots = task->nextFree;
+        }
+        else {
+            task = new OneShotTask();
+            task->timer.function = RunOneShot;
+            task->timer.context = task;
+            task->owner = this;
+        }
+
+        task->function = function;
+        task->context = context;
+        CPU::RestoreInterrupts(flags);
+
+        ArmTimer(&task->timer, delayNs);
+    }
+
+    TimerHandle Scheduler::CreateTimer(TaskFunction function, void *context) {
+        auto timer = new Timer();
+        timer->function = function;
+        timer->context = context;
+        return timer;
+    }
+
+    void Scheduler::DestroyTimer(TimerHandle timer) {
+        CancelTimer(timer);
+        delete timer;
+    }
+
+    void Scheduler::ArmTimer(TimerHandle timer, uint64_t delayNs) {
+        uint64_t currentNs = GetNanoseconds();
+        uint64_t deadlineNs = currentNs + delayNs;
+
+        // Saturate instead of wrapping around into the past
+        if (deadlineNs < currentNs) deadlineNs = static_cast<uint64_t>(-1);
+
+        ArmTimerAt(timer, deadlineNs);
+    }
+
+    void Scheduler::ArmTimerAt(TimerHandle timer, uint64_t deadlineNs) {
+        auto flags = CPU::DisableInterrupts();
+        if (!IsOwnCPU()) {
+            CPU::RestoreInterrupts(flags);
+            RemoteTimerCall call = { this, timer, deadlineNs, nullptr, nullptr, false };
+            RunOnOwnCPU(RemoteArmTimer, &call);
+            return;
+        }
+
+        _wheel.Insert(timer, NanosecondsToTicks(deadlineNs));
+
+        // Only an earlier deadline needs the device to be re-armed, a cancelled or later one at worst causes an early Tick
+        if (GetNextDeadline() < _programmedDeadline) ProgramClockEvent();
+        CPU::RestoreInterrupts(flags);
+    }
+
+    bool Scheduler::CancelTimer(TimerHandle timer) {
+        auto flags = CPU::DisableInterrupts();
+        if (!IsOwnCPU()) {
+            CPU::RestoreInterrupts(flags);
+            RemoteTimerCall call = { this, timer, 0, nullptr, nullptr, false };
+            RunOnOwnCPU(RemoteCancelTimer, &call);
+            return call.result;
+        }
+
+        bool wasPending = _wheel.Remove(timer);
+        CPU::RestoreInterrupts(flags);
+        return wasPending;
+    }
+
+    bool Scheduler::IsTimerPending(TimerHandle timer) const {
+        return timer->pending;
+    }
 
-        if (endNs < currentNs) {
-            // The end time is in the past, so we should execute this task immediately. We can do this by setting endTime to 0, which will cause it to be executed on the next tick.
-            newTask.endTime = 0;
+    PeriodicHandle Scheduler::CreatePeriodicTask(TaskFunction function, void *context, uint64_t periodNs, uint64_t deadlineNs) {
+        if (periodNs == 0) {
+            LOG_WARNING("Tried to create a periodic task with a period of 0!");
+            return nullptr;
         }
 
-        InsertTask(newTask);
+        auto task = new PeriodicTask();
+        task->timer.function = ReleasePeriodic;
+        task->timer.context = task;
+        task->function = function;
+        task->context = context;
+        task->owner = this;
+        task->periodNs = periodNs;
+        task->deadlineNs = deadlineNs ? deadlineNs : periodNs;
+        return task;
+    }
+
+    void Scheduler::DestroyPeriodicTask(PeriodicHandle task) {
+        StopPeriodicTask(task);
+        delete task;
+    }
+
+    void Scheduler::StartPeriodicTask(PeriodicHandle task, uint64_t delayNs) {
+        StopPeriodicTask(task);
+
+        // Stopped, so nothing on the owning CPU touches the task until the timer is armed
+        task->releaseNs = GetNanoseconds() + delayNs;
+        task->lastStartNs = 0;
+        task->active = true;
+        ArmTimerAt(&task->timer, task->releaseNs);
+    }
+
+    bool Scheduler::StopPeriodicTask(PeriodicHandle task) {
+        auto flags = CPU::DisableInterrupts();
+        if (!IsOwnCPU()) {
+            CPU::RestoreInterrupts(flags);
+            RemoteTimerCall call = { this, nullptr, 0, nullptr, task, false };
+            RunOnOwnCPU(RemoteStopPeriodicTask, &call);
+            return call.result;
+        }
+
+        // The task may be armed for its next release, or released and waiting for its turn in RunDuePeriodicTasks
+        bool wasActive = task->active;
+        task->active = false;
+        _wheel.Remove(&task->timer);
+        if (task->due) UnlinkDue(task);
+        CPU::RestoreInterrupts(flags);
+        return wasActive;
+    }
+
+    PeriodicStatistics Scheduler::GetPeriodicStatistics(PeriodicHandle task) const {
+        auto flags = CPU::DisableInterrupts();
+        PeriodicStatistics statistics = task->statistics;
+        CPU::RestoreInterrupts(flags);
+        return statistics;
     }
 
     void Scheduler::Tick() {
-        uint64_t currentNs = _tsc->GetNanoseconds();
-        while (!_taskHeap.IsEmpty()) {
-            Task* nextTask = _taskHeap.Peek();
-            if (nextTask->endTime > currentNs) {
-                // The next task is scheduled for the future, so we're done for this tick.
-                break;
+        auto flags = CPU::DisableInterrupts();
+
+        // Timers armed by the callbacks must not program the device one by one, so pretend it's armed for the earliest possible time until they all ran
+        _programmedDeadline = 0;
+        _wheel.Advance(GetNanoseconds() >> TICK_SHIFT, SETTING_SCHED_TRACE ? &_trace.TimerLateness : nullptr);
+        RunDuePeriodicTasks();
+        Sync::RCU::Check(); // May re-arm the RCU check timer, which is why it runs before the device is programmed
+
+        _programmedDeadline = NO_DEADLINE;
+        ProgramClockEvent();
+        CPU::RestoreInterrupts(flags);
+    }
+
+    void Scheduler::SetClockEvent(ClockEvent *clockEvent) {
+        auto flags = CPU::DisableInterrupts();
+        _clockEvent = clockEvent;
+        _programmedDeadline = NO_DEADLINE;
+        ProgramClockEvent();
+        CPU::RestoreInterrupts(flags);
+    }
+
+    uint64_t Scheduler::GetNextDeadline() const {
+        uint64_t next = _wheel.GetNextExpiry();
+        if (next >= (NO_DEADLINE >> TICK_SHIFT)) return NO_DEADLINE;
+        return next << TICK_SHIFT;
+    }
+
+    size_t Scheduler::GetPendingTimerCount() const {
+        return _wheel.GetPendingCount();
+    }
+
+    void Scheduler::ProgramClockEvent() {
+        if (!_clockEvent) return;
+
+        uint64_t deadline = GetNextDeadline();
+        if (deadline == NO_DEADLINE) _clockEvent->Stop();
+        else _clockEvent->SetNextEvent(deadline);
+
+        _programmedDeadline = deadline;
+    }
+
+    void Scheduler::RunOneShot(void *context) {
+        auto task = static_cast<OneShotTask*>(context);
+        task->function(task->context);
+
+        // Tick runs with interrupts disabled, so the free list can be touched directly
+        task->nextFree = task->owner->_freeOneShots;
+        task->owner->_freeOneShots = task;
+    }
+
+    void Scheduler::ReleasePeriodic(void *context) {
+        auto task = static_cast<PeriodicTask*>(context);
+        Scheduler* owner = task->owner;
+
+        // Tasks released by the same Advance wait until all of them are known, then run in deadline order
+        uint64_t deadline = task->releaseNs + task->deadlineNs;
+        PeriodicTask** link = &owner->_duePeriodic;
+        while (*link && (*link)->releaseNs + (*link)->deadlineNs <= deadline) link = &(*link)->nextDue;
+
+        task->nextDue = *link;
+        *link = task;
+        task->due = true;
+    }
+
+    void Scheduler::RunDuePeriodicTasks() {
+        while (_duePeriodic) {
+            PeriodicTask* task = _duePeriodic;
+            _duePeriodic = task->nextDue;
+            task->nextDue = nullptr;
+            task->due = false;
+
+            uint64_t start = GetNanoseconds();
+            uint64_t release = task->releaseNs;
+            uint64_t period = task->periodNs;
+            PeriodicStatistics& statistics = task->statistics;
+
+            // The next release follows from this one rather than from now, releases that already passed are skipped
+            uint64_t next = release + period;
+            if (next <= start) {
+                uint64_t missed = (start - release) / period;
+                statistics.Overruns += missed;
+                next = release + (missed + 1) * period;
+            }
+            task->releaseNs = next;
+
+            // Re-armed before it runs, so the function may stop its own task. Tick keeps the device from being programmed meanwhile.
+            _wheel.Insert(&task->timer, NanosecondsToTicks(next));
+
+            uint64_t latency = start - release;
+            statistics.Activations++;
+            statistics.TotalLatencyNs += latency;
+            if (latency < statistics.MinLatencyNs) statistics.MinLatencyNs = latency;
+            if (latency > statistics.MaxLatencyNs) statistics.MaxLatencyNs = latency;
+
+            if (task->lastStartNs) {
+                uint64_t interval = start - task->lastStartNs;
+                uint64_t jitter = interval > period ? interval - period : period - interval;
+                if (jitter > statistics.MaxJitterNs) statistics.MaxJitterNs = jitter;
+            }
+            task->lastStartNs = start;
+
+            task->function(task->context);
+
+            uint64_t end = GetNanoseconds();
+            uint64_t runtime = end - start;
+            statistics.TotalRuntimeNs += runtime;
+            if (runtime > statistics.MaxRuntimeNs) statistics.MaxRuntimeNs = runtime;
+            if (end > release + task->deadlineNs) statistics.DeadlineMisses++;
+        }
+    }
+
+    void Scheduler::UnlinkDue(PeriodicTask *task) {
+        PeriodicTask** link = &_duePeriodic;
+        while (*link && *link != task) link = &(*link)->nextDue;
+        if (*link) *link = task->nextDue;
+
+        task->nextDue = nullptr;
+        task->due = false;
+    }
+
+    uint64_t Scheduler::NanosecondsToTicks(uint64_t ns) {
+        // Round up so that a timer never fires before its deadline
+        uint64_t ticks = ns >> TICK_SHIFT;
+        if (ns & ((1ULL << TICK_SHIFT) - 1)) ticks++;
+        return ticks;
+    }
+
+    bool Scheduler::IsOwnCPU() const {
+        return _cpu == PerCPU::Get();
+    }
+
+    void Scheduler::RunOnOwnCPU(void (*function)(void *), RemoteTimerCall *call) {
+        Kernel<KernelData>::GetInstance()->ArchitectureData->Smp->CallFunction(1ULL << _cpu->Index, function, call, true);
+    }
+
+    void Scheduler::RemoteScheduleTask(void *context) {
+        auto call = static_cast<RemoteTimerCall*>(context);
+        call->scheduler->ScheduleTask(call->function, call->context, call->deadlineNs);
+    }
+
+    void Scheduler::RemoteArmTimer(void *context) {
+        auto call = static_cast<RemoteTimerCall*>(context);
+        call->scheduler->ArmTimerAt(call->timer, call->deadlineNs);
+    }
+
+    void Scheduler::RemoteCancelTimer(void *context) {
+        auto call = static_cast<RemoteTimerCall*>(context);
+        call->result = call->scheduler->CancelTimer(call->timer);
+    }
+
+    void Scheduler::RemoteStopPeriodicTask(void *context) {
+        auto call = static_cast<RemoteTimerCall*>(context);
+        call->result = call->scheduler->StopPeriodicTask(static_cast<PeriodicTask*>(call->context));
+    }
+
+    void Scheduler::InitializeThreading(Memory::PMM *pmm, Memory::Paging *paging) {
+        _current = AdoptCurrentContext("kernel", pmm, paging);
+
+        // The idle thread never enters the run queue, it only runs when the queue is empty
+        _idle = AllocateThread("idle", IdleThread, this);
+        if (!_idle) PANIC("Failed to allocate the idle thread!");
+        _idle->AffinityMask = 1ULL << _cpu->Index;
+    }
+
+    void Scheduler::InitializeIdleThreading(Memory::PMM *pmm, Memory::Paging *paging) {
+        _idle = AdoptCurrentContext("idle", pmm, paging);
+        _idle->AffinityMask = 1ULL << _cpu->Index;
+        _current = _idle;
+        _isIdle = true;
+    }
+
+    void Scheduler::EnterIdle() {
+        IdleThread(this);
+    }
+
+    Threading::Thread* Scheduler::AdoptCurrentContext(const char *name, Memory::PMM *pmm, Memory::Paging *paging) {
+        _pmm = pmm;
+        _paging = paging;
+        _sliceTimer = CreateTimer(SliceExpired, this);
+        _balanceTimer = CreateTimer(BalanceExpired, this);
+
+        // The running code becomes a thread as it is, its context gets saved the first time it's switched out
+        auto thread = new Threading::Thread();
+        thread->Id = __atomic_fetch_add(&_nextThreadId, 1, __ATOMIC_RELAXED);
+        thread->Name = name;
+        thread->State = Threading::ThreadState::Running;
+        thread->OnCPU = true;
+        thread->Owner = this;
+        thread->PagingState = _paging->GetCurrentPagingState();
+        thread->KernelStackTop = PerCPU::Get()->KernelStackTop;
+        thread->SleepTimer.function = SleepExpired;
+        thread->SleepTimer.context = thread;
+        return thread;
+    }
+
+    Threading::Thread* Scheduler::CreateThread(const char *name, Threading::ThreadFunction function, void *argument, uint64_t affinityMask) {
+        Threading::Thread* thread = AllocateThread(name, function, argument);
+        if (!thread) return nullptr;
+
+        thread->AffinityMask = affinityMask; // Before it's queued anywhere, so it never runs outside the mask
+        WakeThread(thread);
+        return thread;
+    }
+
+    void Scheduler::ExitThread() {
+        CPU::DisableInterrupts(); // Never restored, this thread doesn't run again
+        Scheduler* local = Local();
+
+        // The thread is still running on its stack, so the idle thread frees it later
+        local->_current->State = Threading::ThreadState::Dead;
+        local->_current->Next = local->_deadThreads;
+        local->_deadThreads = local->_current;
+
+        local->Schedule();
+        PANIC("A dead thread was scheduled again!");
+    }
+
+    void Scheduler::Yield() {
+        auto flags = CPU::DisableInterrupts();
+        Local()->Schedule();
+        CPU::RestoreInterrupts(flags);
+    }
+
+    void Scheduler::Sleep(uint64_t nanoseconds) {
+        auto flags = CPU::DisableInterrupts();
+        Scheduler* local = Local();
+
+        if (!local->_current || local->_current == local->_idle) {
+            // There is nothing to switch to before threading is up (and the idle thread must never block), so spin instead
+            CPU::RestoreInterrupts(flags);
+            uint64_t end = GetNanoseconds() + nanoseconds;
+            while (GetNanoseconds() < end) {
+                asm volatile ("pause");
+            }
+            return;
+        }
+
+        local->_current->State = Threading::ThreadState::Sleeping;
+        local->ArmTimer(&local->_current->SleepTimer, nanoseconds);
+        local->Schedule();
+        CPU::RestoreInterrupts(flags);
+    }
+
+    void Scheduler::BlockCurrentThread() {
+        auto flags = CPU::DisableInterrupts();
+        Scheduler* local = Local();
+        local->_current->State = Threading::ThreadState::Blocked;
+        local->Schedule();
+        CPU::RestoreInterrupts(flags);
+    }
+
+    void Scheduler::WakeThread(Threading::Thread *thread) {
+        // Sleeping and blocked threads never move, so the owner seen here is the one that has to wake it.
+        // Ready threads may be stolen meanwhile, but waking those is a no-op anyway.
+        Scheduler* owner = thread->Owner;
+        if (owner != this) {
+            owner->WakeThread(thread);
+            return;
+        }
+
+        auto flags = CPU::DisableInterrupts();
+
+        if (!IsOwnCPU()) {
+            // The run queue and timers of another CPU can only be touched by that CPU
+            CPU::RestoreInterrupts(flags);
+            QueueRemoteWakeup(thread);
+            return;
+        }
+
+        if (thread->State != Threading::ThreadState::Sleeping && thread->State != Threading::ThreadState::Blocked) {
+            // Already running or queued, or dead. A remote request that came while it was running doesn't count as a wakeup.
+            if (thread->State == Threading::ThreadState::Running) thread->WakeRequestedAt = 0;
+            CPU::RestoreInterrupts(flags);
+            return;
+        }
+
+        CancelTimer(&thread->SleepTimer);
+
+        if (!MayRunHere(thread)) {
+            // The affinity changed while it was waiting, its sleep timer is gone so it can be handed over as it is
+            Scheduler* target = PickAllowedScheduler(thread);
+            thread->Owner = target;
+            CPU::RestoreInterrupts(flags);
+            target->WakeThread(thread);
+            return;
+        }
+
+        Enqueue(thread);
+#if SETTING_SCHED_TRACE
+        if (!thread->WakeRequestedAt) thread->WakeRequestedAt = GetNanoseconds();
+        _trace.Wakeups++;
+#endif
+
+        // An idle CPU switches right away, a busy one shares the CPU once the running thread's slice is over
+        if (_current == _idle) _needReschedule = true;
+        else if (!IsTimerPending(_sliceTimer)) ArmTimer(_sliceTimer, TIME_SLICE_NS);
+
+        CPU::RestoreInterrupts(flags);
+    }
+
+    void Scheduler::ProcessRemoteWakeups() {
+        Threading::Thread* thread = __atomic_exchange_n(&_remoteWakeups, nullptr, __ATOMIC_ACQUIRE);
+        while (thread) {
+            Threading::Thread* next = thread->WakeNext;
+            __atomic_store_n(&thread->WakePending, false, __ATOMIC_RELEASE);
+            WakeThread(thread);
+            thread = next;
+        }
+    }
+
+    void Scheduler::QueueRemoteWakeup(Threading::Thread *thread) {
+        // A thread can only be in the list once, a second wakeup before the first one is processed has nothing left to do
+        if (__atomic_exchange_n(&thread->WakePending, true, __ATOMIC_ACQ_REL)) return;
+#if SETTING_SCHED_TRACE
+        if (!thread->WakeRequestedAt) thread->WakeRequestedAt = GetNanoseconds(); // Published by the push below
+#endif
+
+        Threading::Thread* head = __atomic_load_n(&_remoteWakeups, __ATOMIC_RELAXED);
+        do {
+            thread->WakeNext = head;
+        } while (!__atomic_compare_exchange_n(&_remoteWakeups, &head, thread, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+        // Only the push onto an empty list sends the IPI, the others are picked up by the same one. A CPU waiting in MWAIT only needs its flag written.
+        if (!head && !CPUIdle::WakePolling(_cpu)) Kernel<KernelData>::GetInstance()->ArchitectureData->Smp->SendIPI(_cpu, SMP::RESCHEDULE_VECTOR);
+    }
+
+    void Scheduler::SetAffinity(Threading::Thread *thread, uint64_t mask) {
+        auto smp = Kernel<KernelData>::GetInstance()->ArchitectureData->Smp;
+        uint64_t online = smp ? smp->GetOnlineMask() : 1;
+        if (!(mask & online)) {
+            LOG_WARNING("Ignoring affinity mask %x64 for thread %s, it contains no online CPU.", mask, thread->Name);
+            return;
+        }
+
+        thread->AffinityMask = mask;
+
+        auto flags = CPU::DisableInterrupts();
+        Scheduler* local = Local();
+        if (thread == local->_current && !local->MayRunHere(thread)) local->Schedule();
+        CPU::RestoreInterrupts(flags);
+    }
+
+    void Scheduler::FinishSwitch() {
+        // Until now the previous thread's registers weren't saved yet, so a CPU that stole it had to wait
+        __atomic_store_n(&_previous->OnCPU, false, __ATOMIC_RELEASE);
+        _previous = nullptr;
+
+        if (_migrating) {
+            Threading::Thread* thread = _migrating;
+            _migrating = nullptr;
+
+            Scheduler* target = PickAllowedScheduler(thread);
+            thread->Owner = target;
+            target->WakeThread(thread);
+        }
+    }
+
+    void Scheduler::PreemptIfNeeded() {
+        if (!_current || !_needReschedule || PerCPU::Get()->PreemptDisableCount) return;
+        Schedule();
+    }
+
+    void Scheduler::DisablePreemption() {
+        __atomic_fetch_add(&PerCPU::Get()->PreemptDisableCount, 1, __ATOMIC_ACQ_REL);
+    }
+
+    void Scheduler::EnablePreemption() {
+        __atomic_fetch_sub(&PerCPU::Get()->PreemptDisableCount, 1, __ATOMIC_ACQ_REL);
+    }
+
+    bool Scheduler::CanSleep() {
+        // The default scheduler is created after the boot CPU's PerCPU, so gs:0 is only read once it is usable
+        if (!Kernel<KernelData>::GetInstance()->ArchitectureData->DefaultScheduler || !CPU::InterruptsEnabled()) return false;
+
+        auto flags = CPU::DisableInterrupts();
+        PerCPU* cpu = PerCPU::Get();
+        Scheduler* local = cpu->Scheduler;
+        bool canSleep = local && local->_current && local->_current != local->_idle && !cpu->PreemptDisableCount;
+        CPU::RestoreInterrupts(flags);
+        return canSleep;
+    }
+
+    Threading::Thread* Scheduler::GetCurrentThread() const {
+        return Local()->_current;
+    }
+
+    uint64_t Scheduler::GetContextSwitchCount() const {
+        return _contextSwitches;
+    }
+
+    uint64_t Scheduler::GetStealCount() const {
+        return _steals;
+    }
+
+    size_t Scheduler::GetQueuedThreadCount() const {
+        return _runQueue.Size() + _expiredCount;
+    }
+
+    const SchedulerTrace& Scheduler::GetTrace() const {
+        return _trace;
+    }
+
+    void Scheduler::DumpTrace() {
+#if SETTING_SCHED_TRACE
+        auto smp = Kernel<KernelData>::GetInstance()->ArchitectureData->Smp;
+        uint32_t cpuCount = smp ? smp->GetCPUCount() : 1;
+        char buckets[512];
+
+        auto logHistogram = [&buckets](uint32_t cpu, const char* name, const char* unit, const Utility::Histogram& histogram) {
+            if (!histogram.Count) return;
+            histogram.FormatBuckets(buckets, sizeof(buckets));
+            LOG_INFO("  CPU %u32 %s (%s): %u64 samples, avg %u64, p50 <= %u64, p99 <= %u64, max %u64", cpu, name, unit, histogram.Count,
+                     histogram.Average(), histogram.Percentile(500), histogram.Percentile(990), histogram.Max);
+            LOG_INFO("  CPU %u32 %s buckets (lower bound:count): %s", cpu, name, buckets);
+        };
+
+        LOG_INFO("Scheduler trace:");
+        for (uint32_t cpu = 0; cpu < cpuCount; cpu++) {
+            Scheduler* scheduler = smp ? smp->GetCPU(cpu)->Scheduler : PerCPU::Get()->Scheduler;
+            if (!scheduler) continue;
+
+            const SchedulerTrace& trace = scheduler->_trace;
+            LOG_INFO("  CPU %u32: %u64 context switches (%u64 voluntary, %u64 involuntary), %u64 wakeups, %u64 steals, %u64 threads queued.", cpu,
+                     scheduler->_contextSwitches, trace.VoluntarySwitches, trace.InvoluntarySwitches, trace.Wakeups, scheduler->_steals,
+                     static_cast<uint64_t>(scheduler->GetQueuedThreadCount()));
+            logHistogram(cpu, "wakeup latency", "ns", trace.WakeupLatency);
+            logHistogram(cpu, "timer lateness", "wheel ticks", trace.TimerLateness);
+            logHistogram(cpu, "run queue length", "threads", trace.RunQueueLength);
+        }
+#else
+        LOG_INFO("Scheduler tracing is disabled, set SETTING_SCHED_TRACE to collect it.");
+#endif
+    }
+
+    void Scheduler::Schedule() {
+        Threading::Thread* previous = _current;
+        [[maybe_unused]] bool runnable = previous->State == Threading::ThreadState::Running;
+        _needReschedule = false;
+
+        // A thread that blocks or yields inside a read section is a bug, but it must not end a grace period early because of it
+        if (!_cpu->PreemptDisableCount) Sync::RCU::NoteQuiescentState();
+
+        // Round-robin: a thread that is still runnable waits for everyone in the run queue, unless it isn't allowed on this CPU anymore
+        if (previous->State == Threading::ThreadState::Running && previous != _idle) {
+            if (MayRunHere(previous)) {
+                EnqueueExpired(previous);
             }
+            else {
+                previous->State = Threading::ThreadState::Blocked;
+                _migrating = previous;
+            }
+        }
+
+#if SETTING_SCHED_TRACE
+        _trace.RunQueueLength.Record(_runQueue.Size() + _expiredCount);
+#endif
+
+        // An empty queue means this CPU is about to go idle, which is when it looks for work on the others
+        Threading::Thread* next = Dequeue();
+        if (!next) next = StealThread();
+        if (!next) next = _idle;
+        next->State = Threading::ThreadState::Running;
+
+#if SETTING_SCHED_TRACE
+        // Also for stolen threads, the wait on the other CPU's queue is part of the delay
+        if (next->WakeRequestedAt) {
+            uint64_t now = GetNanoseconds();
+            _trace.WakeupLatency.Record(now > next->WakeRequestedAt ? now - next->WakeRequestedAt : 0);
+            next->WakeRequestedAt = 0;
+        }
+#endif
+
+        // The slice only needs to end if someone else is waiting for the CPU, a lone thread runs without any timer interrupts
+        if (!_runQueue.IsEmpty() || _expiredHead) {
+            if (next != _idle) ArmTimer(_sliceTimer, TIME_SLICE_NS);
+        }
+        else {
+            CancelTimer(_sliceTimer);
+        }
+
+        _isIdle = next == _idle;
+        if (next == previous) return;
+
+        previous->PagingState = _paging->GetCurrentPagingState();
+        if (next->PagingState != previous->PagingState) _paging->SwitchToPageTable(next->PagingState);
+
+        // Interrupts and syscalls from user mode switch to the stack in RSP0 / the per-CPU syscall stack, those must belong to the thread that runs
+        PerCPU* cpu = PerCPU::Get();
+        cpu->Tss->RSP0 = next->KernelStackTop;
+        cpu->SyscallKernelStack = next->KernelStackTop;
 
-            // The next task is scheduled for now or the past, so we should execute it.
-            _taskHeap.Pop(); // Remove the task from the heap
-            nextTask->function(nextTask->context);
+        _current = next;
+        _previous = previous;
+        _contextSwitches++;
+#if SETTING_SCHED_TRACE
+        if (previous != _idle) {
+            if (runnable) _trace.InvoluntarySwitches++;
+            else _trace.VoluntarySwitches++;
         }
+#endif
+        next->OnCPU = true;
+        SwitchContext(&previous->StackPointer, next->StackPointer);
+
+        // This is now the thread that was switched to, possibly on another CPU than the one it was switched out on, so `this` may be stale
+        Local()->FinishSwitch();
+    }
+
+    Threading::Thread* Scheduler::AllocateThread(const char *name, Threading::ThreadFunction function, void *argument) {
+        uintptr_t stackPhysical = _pmm->AllocatePages(Threading::Thread::STACK_PAGES);
+        if (!stackPhysical) {
+            LOG_ERROR("Not enough memory for the stack of thread %s!", name);
+            return nullptr;
+        }
+
+        auto thread = new Threading::Thread();
+        thread->Id = __atomic_fetch_add(&_nextThreadId, 1, __ATOMIC_RELAXED);
+        thread->Name = name;
+        thread->State = Threading::ThreadState::Blocked; // Until the first WakeThread
+        thread->Function = function;
+        thread->Argument = argument;
+        thread->StackPhysical = stackPhysical;
+        thread->Owner = this;
+        thread->PagingState = _paging->GetKernelPagingState();
+        thread->SleepTimer.function = SleepExpired;
+        thread->SleepTimer.context = thread;
+
+        // Build the frame SwitchContext pops: r15, r14, r13, r12, rbx, rbp, RFLAGS and the return address
+        thread->KernelStackTop = HIGHER_HALF(stackPhysical) + Threading::Thread::STACK_PAGES * Architecture::KernelPageSize;
+        auto stack = reinterpret_cast<uint64_t*>(thread->KernelStackTop);
+        *--stack = 0; // Padding, so rsp is 16 byte aligned when the trampoline starts
+        *--stack = 0;
+        *--stack = reinterpret_cast<uint64_t>(ThreadTrampoline);
+        *--stack = 0x2; // RFLAGS, only the reserved bit is set so interrupts stay disabled until ThreadMain
+        *--stack = 0; // rbp
+        *--stack = 0; // rbx
+        *--stack = reinterpret_cast<uint64_t>(thread); // r12
+        *--stack = 0; // r13
+        *--stack = 0; // r14
+        *--stack = 0; // r15
+        thread->StackPointer = reinterpret_cast<uint64_t>(stack);
+
+        return thread;
+    }
+
+    void Scheduler::Enqueue(Threading::Thread *thread) {
+        thread->State = Threading::ThreadState::Ready;
+        thread->Next = nullptr;
+
+        if (!_runQueue.Push(thread)) {
+            EnqueueExpired(thread);
+            return;
+        }
+
+        // While threads wait here, balancing checks regularly whether an idle CPU should take some of them
+        if (!IsTimerPending(_balanceTimer)) ArmTimer(_balanceTimer, BALANCE_INTERVAL_NS);
+    }
+
+    void Scheduler::EnqueueExpired(Threading::Thread *thread) {
+        thread->State = Threading::ThreadState::Ready;
+        thread->Next = nullptr;
+
+        if (_expiredTail) _expiredTail->Next = thread;
+        else _expiredHead = thread;
+        _expiredTail = thread;
+        _expiredCount++;
+
+        if (!IsTimerPending(_balanceTimer)) ArmTimer(_balanceTimer, BALANCE_INTERVAL_NS);
     }
 
-    void Scheduler::InsertTask(Task &task) {
-        if (!_taskHeap.Insert(task)) {
-            PANIC("Scheduler task heap is full, cannot schedule more tasks!");
+    void Scheduler::RefillRunQueue() {
+        while (_expiredHead) {
+            Threading::Thread* thread = _expiredHead;
+            if (!_runQueue.Push(thread)) break;
+
+            _expiredHead = thread->Next;
+            _expiredCount--;
+            thread->Next = nullptr;
+        }
+
+        if (!_expiredHead) _expiredTail = nullptr;
+    }
+
+    Threading::Thread* Scheduler::Dequeue() {
+        // The owner pops the bottom, which needs no atomic read-modify-write unless a thief races it for the last thread. That makes the
+        // run queue LIFO, so round-robin comes from the expired list: a thread that ran goes there, and only once every thread in the
+        // run queue had its turn do the expired ones come back (in reverse order, each still gets one slice per round).
+        // A pop that comes back empty means the queue is empty, even if a thief won the last thread.
+        while (true) {
+            Threading::Thread* thread = _runQueue.Pop();
+            if (thread) return thread;
+            if (!_expiredHead) return nullptr;
+            RefillRunQueue();
+        }
+    }
+
+    Threading::Thread* Scheduler::StealThread() {
+        auto smp = Kernel<KernelData>::GetInstance()->ArchitectureData->Smp;
+        if (!smp) return nullptr;
+
+        uint32_t count = smp->GetCPUCount();
+        uint64_t self = 1ULL << _cpu->Index;
+
+        // Start at the next CPU, so thieves spread over the victims instead of all hitting CPU 0
+        for (uint32_t i = 1; i < count; i++) {
+            Scheduler* victim = smp->GetCPU((_cpu->Index + i) % count)->Scheduler;
+            if (!victim || victim->_runQueue.IsEmpty()) continue;
+
+            Threading::Thread* thread = victim->_runQueue.Steal([self](Threading::Thread* candidate) {
+                return (candidate->AffinityMask & self) != 0;
+            });
+            if (!thread) continue;
+
+            // The victim may have queued it on its way out and still be saving its registers
+            while (__atomic_load_n(&thread->OnCPU, __ATOMIC_ACQUIRE)) {
+                asm volatile ("pause");
+            }
+
+            thread->Owner = this;
+            _steals++;
+            return thread;
         }
+
+        return nullptr;
+    }
+
+    bool Scheduler::MayRunHere(const Threading::Thread *thread) const {
+        if (thread->AffinityMask & (1ULL << _cpu->Index)) return true;
+
+        // A thread whose CPUs are all gone runs wherever it is instead of nowhere
+        auto smp = Kernel<KernelData>::GetInstance()->ArchitectureData->Smp;
+        return !smp || !(thread->AffinityMask & smp->GetOnlineMask());
+    }
+
+    Scheduler* Scheduler::PickAllowedScheduler(const Threading::Thread *thread) const {
+        auto smp = Kernel<KernelData>::GetInstance()->ArchitectureData->Smp;
+        uint64_t allowed = thread->AffinityMask & smp->GetOnlineMask();
+
+        // Prefer an idle CPU, otherwise the first allowed one
+        Scheduler* fallback = nullptr;
+        for (uint64_t mask = allowed; mask; mask &= mask - 1) {
+            Scheduler* scheduler = smp->GetCPU(__builtin_ctzll(mask))->Scheduler;
+            if (!scheduler) continue;
+            if (scheduler->_isIdle) return scheduler;
+            if (!fallback) fallback = scheduler;
+        }
+
+        return fallback ? fallback : const_cast<Scheduler*>(this);
+    }
+
+    void Scheduler::FreeDeadThreads() {
+        while (_deadThreads) {
+            Threading::Thread* thread = _deadThreads;
+            _deadThreads = thread->Next;
+
+            if (thread->StackPhysical) _pmm->FreePages(thread->StackPhysical, Threading::Thread::STACK_PAGES);
+            delete thread;
+        }
+    }
+
+    void Scheduler::IdleThread(void *argument) {
+        auto scheduler = static_cast<Scheduler*>(argument);
+
+        while (true) {
+            CPU::DisableInterrupts();
+            scheduler->FreeDeadThreads();
+            Sync::RCU::Check(); // The idle thread never is in a read section
+
+            // Steals work from another CPU if there is any, and returns once there is nothing left to run
+            scheduler->Schedule();
+
+            // The next timer bounds how long we stay idle, unless another CPU wakes us first. Enter returns once we were woken, and the
+            // loop picks up the woken thread, or steals again after a balancing kick.
+            uint64_t deadline = scheduler->GetNextDeadline();
+            uint64_t now = GetNanoseconds();
+            uint64_t predicted = deadline == NO_DEADLINE ? UINT64_MAX : (deadline > now ? deadline - now : 0);
+            CPUIdle::Enter(predicted);
+        }
+    }
+
+    Scheduler* Scheduler::Local() {
+        return PerCPU::Get()->Scheduler;
+    }
+
+    void Scheduler::SliceExpired(void *context) {
+        static_cast<Scheduler*>(context)->_needReschedule = true;
+    }
+
+    void Scheduler::BalanceExpired(void *context) {
+        auto scheduler = static_cast<Scheduler*>(context);
+        auto smp = Kernel<KernelData>::GetInstance()->ArchitectureData->Smp;
+
+        // Idle CPUs only steal when they wake up, so kick one for every thread that is waiting here. The balancing stops once nothing waits.
+        size_t waiting = scheduler->_runQueue.Size() + scheduler->_expiredCount;
+        if (!waiting || !smp || smp->GetCPUCount() < 2) return;
+
+        // Thieves only look at the run queue, the expired threads have to be in it for an idle CPU to find them
+        scheduler->RefillRunQueue();
+
+        uint32_t count = smp->GetCPUCount();
+        for (uint32_t i = 1; i < count && waiting; i++) {
+            PerCPU* cpu = smp->GetCPU((scheduler->_cpu->Index + i) % count);
+            if (!cpu->Scheduler || !cpu->Scheduler->_isIdle) continue;
+
+            smp->SendIPI(cpu, SMP::RESCHEDULE_VECTOR);
+            waiting--;
+        }
+
+        scheduler->ArmTimer(scheduler->_balanceTimer, BALANCE_INTERVAL_NS);
+    }
+
+    void Scheduler::SleepExpired(void *context) {
+        auto thread = static_cast<Threading::Thread*>(context);
+        thread->Owner->WakeThread(thread);
     }
 }
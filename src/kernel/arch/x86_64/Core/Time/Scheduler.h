@@ -2,93 +2,238 @@
 #define BOREALOS_SCHEDULER_H
 
 #include <Definitions.h>
-#include "TSC.h"
+#include <Settings.h>
+#include <Utility/Histogram.h>
+#include "Clocksource.h"
+#include "TimerWheel.h"
+#include "../Threading/Thread.h"
+#include "../Threading/WorkStealingDeque.h"
+#include "../../Memory/PMM.h"
+
+namespace Core {
+    struct PerCPU;
+}
 
 namespace Core::Time {
+    class ClockEvent;
+    class Scheduler;
+    typedef Timer* TimerHandle;
+
+    struct PeriodicStatistics {
+        uint64_t Activations = 0;
+        uint64_t Overruns = 0; // Releases that were skipped because an activation started after the next release was already due
+        uint64_t DeadlineMisses = 0; // Activations that returned after their deadline
+        uint64_t MinLatencyNs = UINT64_MAX; // From the release to the start of the function
+        uint64_t MaxLatencyNs = 0;
+        uint64_t TotalLatencyNs = 0;
+        uint64_t MaxJitterNs = 0; // Largest difference between the period and the time from one start to the next
+        uint64_t MaxRuntimeNs = 0;
+        uint64_t TotalRuntimeNs = 0;
+    };
+
+    /// A function that runs every period from the scheduler's Tick, see Scheduler::CreatePeriodicTask. Times are kernel nanoseconds, see Time::GetNanoseconds.
+    struct PeriodicTask {
+        Timer timer;
+        TimerFunction function = nullptr;
+        void* context = nullptr;
+        Scheduler* owner = nullptr;
+        uint64_t periodNs = 0;
+        uint64_t deadlineNs = 0; // Relative to each release
+        uint64_t releaseNs = 0; // Of the next activation, or of the current one while it is due or running
+        uint64_t lastStartNs = 0; // 0 until the first activation
+        PeriodicTask* nextDue = nullptr;
+        bool active = false;
+        bool due = false; // Released, waiting in the scheduler's deadline ordered list for its turn
+        PeriodicStatistics statistics;
+    };
+
+    typedef PeriodicTask* PeriodicHandle;
+
+    /// Scheduling delay of one CPU, collected while SETTING_SCHED_TRACE is enabled. Only the owning CPU writes it, with interrupts disabled.
+    struct SchedulerTrace {
+        Utility::Histogram WakeupLatency; // Nanoseconds from a thread's wakeup (or the remote wakeup request) until it runs
+        Utility::Histogram TimerLateness; // Wheel ticks (~1us) from a timer's expiry until the Tick that ran it
+        Utility::Histogram RunQueueLength; // Threads waiting for the CPU, sampled every time the next thread is picked
+        uint64_t Wakeups = 0;
+        uint64_t VoluntarySwitches = 0; // The previous thread slept, blocked or exited
+        uint64_t InvoluntarySwitches = 0; // The previous thread was still runnable: its slice ended, it yielded or has to migrate
+    };
+
+    /// Timer and thread scheduler of a CPU. Timers live in a hierarchical timer wheel, threads in a round-robin run queue that is
+    /// preempted by a time slice timer. Nothing runs periodically: the clock event device is only armed for the next timer or slice end.
+    /// Every CPU has its own run queue, a Chase-Lev deque that other CPUs steal from when they run out of work, so there is no global lock.
+    /// Timer functions may be called from any CPU, calls from another CPU than the scheduler's own are forwarded to it with an IPI.
     class Scheduler {
     public:
-        typedef void (*TaskFunction)(void* context);
+        typedef TimerFunction TaskFunction;
 
-        explicit Scheduler(TSC *tsc);
+        Scheduler();
 
+        /// Runs function(context) once after delayNs. The timer is owned by the scheduler, so it can't be cancelled; use CreateTimer for that.
         void ScheduleTask(TaskFunction function, void* context, uint64_t delayNs);
+
+        TimerHandle CreateTimer(TaskFunction function, void* context);
+        void DestroyTimer(TimerHandle timer); // Cancels the timer if it's still pending
+        void ArmTimer(TimerHandle timer, uint64_t delayNs); // (Re)arms the timer relative to now
+        void ArmTimerAt(TimerHandle timer, uint64_t deadlineNs); // (Re)arms the timer for an absolute time in nanoseconds (Time::GetNanoseconds)
+        bool CancelTimer(TimerHandle timer); // Returns false if the timer wasn't pending
+        [[nodiscard]] bool IsTimerPending(TimerHandle timer) const;
+
+        /// Runs every expired timer and programs the clock event device for the next deadline. Called from the clock event interrupt.
         void Tick();
-    private:
-        TSC *_tsc;
+        void SetClockEvent(ClockEvent* clockEvent); // Until one is set, nothing calls Tick
+
+        /// The time in nanoseconds at which Tick has to run next, NO_DEADLINE if no timers are pending
+        [[nodiscard]] uint64_t GetNextDeadline() const;
+        [[nodiscard]] size_t GetPendingTimerCount() const;
+
+        // --- Periodic tasks ---
+        /// Creates a task that runs function(context) every periodNs once started. Releases are absolute: release n is at
+        /// start + n * period, no matter how late the activations before it ran, so errors don't add up. An activation that starts after
+        /// the next release was due skips the releases it missed and counts them as overruns. Tasks released in the same Tick run
+        /// earliest deadline first, the deadline is deadlineNs after the release (the period if 0). Like timers they run from the timer
+        /// interrupt, so they must be short and must not block.
+        PeriodicHandle CreatePeriodicTask(TaskFunction function, void* context, uint64_t periodNs, uint64_t deadlineNs = 0);
+        void DestroyPeriodicTask(PeriodicHandle task); // Stops the task first
+        void StartPeriodicTask(PeriodicHandle task, uint64_t delayNs = 0); // The first release is delayNs from now, a running task restarts
+        bool StopPeriodicTask(PeriodicHandle task); // Returns false if it wasn't running. A task may stop itself.
+        /// Jitter and overrun statistics measured on the kernel clock. Read from another CPU while the task runs, the fields may come from
+        /// two different activations.
+        [[nodiscard]] PeriodicStatistics GetPeriodicStatistics(PeriodicHandle task) const;
+
+        static constexpr uint32_t TICK_SHIFT = 10; // A wheel tick is 2^10 ns (~1 us)
+        static constexpr uint64_t NO_DEADLINE = TimerWheel::NO_EXPIRY;
+
+        // --- Threads ---
+        /// Turns the code that is currently running into the first thread and creates the idle thread
+        void InitializeThreading(Memory::PMM* pmm, Memory::Paging* paging);
+        /// For application processors: the code that is currently running becomes the idle thread, and enters its loop once EnterIdle is called
+        void InitializeIdleThreading(Memory::PMM* pmm, Memory::Paging* paging);
+        [[noreturn]] void EnterIdle();
+        /// The thread starts on this scheduler's CPU and may only run on the CPUs in affinityMask (see SetAffinity)
+        Threading::Thread* CreateThread(const char* name, Threading::ThreadFunction function, void* argument, uint64_t affinityMask = ~0ULL);
+
+        // These act on the thread running on the calling CPU, no matter which CPU's scheduler they are called on (threads move between CPUs)
+        [[noreturn]] void ExitThread();
+        void Yield(); // Gives the CPU to the next ready thread, returns right away if there is none
+        void Sleep(uint64_t nanoseconds);
+        void BlockCurrentThread(); // The caller must make sure someone calls WakeThread, and disable interrupts before publishing that it's about to block
+        /// Makes a sleeping or blocked thread ready again. Threads of other CPUs are handed to their CPU with a reschedule IPI.
+        void WakeThread(Threading::Thread* thread);
+        void ProcessRemoteWakeups(); // Wakes the threads other CPUs queued for this scheduler, called from the reschedule IPI
+        /// Restricts the CPUs a thread may run on, bit n is CPU n. A thread that is running or queued elsewhere moves at its next switch,
+        /// the calling thread moves right away. A mask without any online CPU is ignored.
+        static void SetAffinity(Threading::Thread* thread, uint64_t mask);
+        void FinishSwitch(); // Runs on the thread that was just switched to, before anything else. Only for the switch path and ThreadMain.
+
+        /// Switches threads if the time slice ran out or a thread woke up while the CPU was idle. Called after the EOI of every interrupt.
+        void PreemptIfNeeded();
+        // Sections that must not be switched away from (e.g. kernel SIMD sections, which share their save areas between threads).
+        // The count is per CPU, these apply to whichever scheduler runs on the calling CPU.
+        static void DisablePreemption();
+        static void EnablePreemption();
+
+        /// True if the caller is a thread that may block or sleep: threading is up, it isn't the idle thread, interrupts are enabled
+        /// (so it isn't an interrupt handler) and preemption isn't disabled (so it isn't deferred interrupt work or an RCU read section)
+        [[nodiscard]] static bool CanSleep();
+        [[nodiscard]] Threading::Thread* GetCurrentThread() const; // Of the calling CPU
+        [[nodiscard]] uint64_t GetContextSwitchCount() const;
+        [[nodiscard]] uint64_t GetStealCount() const; // Threads this CPU took from other CPUs' run queues
+        [[nodiscard]] size_t GetQueuedThreadCount() const;
+        /// Updated live by this scheduler's CPU, so values read from another CPU may be from slightly different points in time
+        [[nodiscard]] const SchedulerTrace& GetTrace() const;
+        /// Logs the trace of every CPU over serial
+        static void DumpTrace();
+
+        static constexpr uint64_t TIME_SLICE_NS = 10'000'000; // 10ms
+        static constexpr uint64_t BALANCE_INTERVAL_NS = 4'000'000; // 4ms, only while threads are waiting in the run queue
+        static constexpr size_t RUN_QUEUE_CAPACITY = 256; // Threads beyond this wait in the expired list, which can't be stolen from
 
-        struct Task {
-            uint64_t endTime; // In nanoseconds.
+    private:
+        PerCPU* _cpu; // The CPU this scheduler runs on, timers and threads are only touched from there
+        TimerWheel _wheel;
+        ClockEvent* _clockEvent = nullptr;
+        uint64_t _programmedDeadline = NO_DEADLINE; // The deadline the clock event device is currently armed for
+
+        // Timers created by ScheduleTask, they are recycled through a free list after they fired
+        struct OneShotTask {
+            Timer timer;
             TaskFunction function;
             void* context;
+            Scheduler* owner;
+            OneShotTask* nextFree;
         };
 
-        /// Basic min-heap implementation for storing scheduled tasks, sorted by endTime. The task with the earliest endTime is at the top of the heap.
-        class TaskHeap {
-        public:
-            TaskHeap(size_t capacity) : _size(0), _capacity(capacity) {
-                _data = new Task[_capacity];
-            }
-
-            ~TaskHeap() {
-                delete[] _data;
-            }
-
-            bool Insert(Task &task) {
-                if (_size >= _capacity) {
-                    return false; // Heap is full
-                }
-
-                // Insert the new task at the end of the heap and then bubble it up to maintain the min-heap property.
-                size_t i = _size++;
-                while (i > 0) {
-                    size_t parent = (i - 1) / 2;
-                    if (_data[parent].endTime <= task.endTime) break; // Parent is smaller or equal, we're done
-                    _data[i] = _data[parent];
-                    i = parent;
-                }
-                _data[i] = task;
-                return true;
-            }
-
-            [[nodiscard]] Task* Peek() const {
-                if (_size == 0) return nullptr;
-                return &_data[0];
-            }
-
-            Task* Pop() {
-                if (_size == 0) return nullptr;
-
-                Task& root = _data[0];
-                Task& last = _data[--_size];
-
-                // Bubble down
-                size_t i = 0;
-                while (i * 2 + 1 < _size) {
-                    size_t child = i * 2 + 1;
-                    if (child + 1 < _size && _data[child + 1].endTime < _data[child].endTime) {
-                        child++;
-                    }
-                    if (last.endTime <= _data[child].endTime) break;
-                    _data[i] = _data[child];
-                    i = child;
-                }
-                _data[i] = last;
-                return &root;
-            }
-
-            [[nodiscard]] bool IsEmpty() const { return _size == 0; }
-
-            [[nodiscard]] size_t Size() const { return _size; }
-            [[nodiscard]] size_t Capacity() const { return _capacity; }
-
-        private:
-            Task* _data;
-            size_t _size;
-            size_t _capacity;
+        OneShotTask* _freeOneShots = nullptr;
+        PeriodicTask* _duePeriodic = nullptr; // Released periodic tasks, earliest deadline first
+
+        static void ReleasePeriodic(void* context); // Timer function of periodic tasks
+        void RunDuePeriodicTasks(); // From Tick, after the wheel was advanced
+        void UnlinkDue(PeriodicTask* task);
+
+        void ProgramClockEvent();
+        static void RunOneShot(void* context);
+        static uint64_t NanosecondsToTicks(uint64_t ns);
+
+        // Timer calls made on another CPU run on ours through SMP::CallFunction
+        struct RemoteTimerCall {
+            Scheduler* scheduler;
+            TimerHandle timer;
+            uint64_t deadlineNs;
+            TaskFunction function;
+            void* context;
+            bool result;
         };
 
-        TaskHeap _taskHeap;
-        void InsertTask(Task& task);
+        [[nodiscard]] bool IsOwnCPU() const; // Interrupts must be disabled, or the caller could move to another CPU right after
+        void RunOnOwnCPU(void (*function)(void* context), RemoteTimerCall* call);
+        static void RemoteScheduleTask(void* context);
+        static void RemoteArmTimer(void* context);
+        static void RemoteCancelTimer(void* context);
+        static void RemoteStopPeriodicTask(void* context);
+
+        // Threads, every field is only touched with interrupts disabled
+        Memory::PMM* _pmm = nullptr;
+        Memory::Paging* _paging = nullptr;
+        Threading::Thread* _current = nullptr;
+        Threading::Thread* _idle = nullptr;
+        Threading::WorkStealingDeque<Threading::Thread, RUN_QUEUE_CAPACITY> _runQueue;
+        // Threads that used up their slice (and the ones the run queue had no room for), in FIFO order. They go back into the run queue
+        // once it's empty, so every thread in it gets a turn before any of them gets another one.
+        Threading::Thread* _expiredHead = nullptr;
+        Threading::Thread* _expiredTail = nullptr;
+        size_t _expiredCount = 0;
+        Threading::Thread* _deadThreads = nullptr;
+        Threading::Thread* _previous = nullptr; // The thread switched away from, until FinishSwitch marks its context as saved
+        Threading::Thread* _migrating = nullptr; // Switched away from because its affinity excludes this CPU, handed to an allowed CPU by FinishSwitch
+        Timer* _sliceTimer = nullptr;
+        Timer* _balanceTimer = nullptr;
+        uint64_t _contextSwitches = 0;
+        uint64_t _steals = 0;
+        SchedulerTrace _trace;
+        volatile bool _needReschedule = false;
+        volatile bool _isIdle = false; // Read by other CPUs' balancing to find a CPU to kick
+        Threading::Thread* volatile _remoteWakeups = nullptr; // Pushed lock-free by other CPUs, linked through WakeNext
+
+        static uint64_t _nextThreadId; // Shared by all CPUs
+
+        void Schedule(); // Picks the next thread and switches to it, interrupts must be disabled
+        Threading::Thread* AdoptCurrentContext(const char* name, Memory::PMM* pmm, Memory::Paging* paging);
+        Threading::Thread* AllocateThread(const char* name, Threading::ThreadFunction function, void* argument);
+        void QueueRemoteWakeup(Threading::Thread* thread);
+        void Enqueue(Threading::Thread* thread); // Woken or new, runs before the expired threads
+        void EnqueueExpired(Threading::Thread* thread); // Was running, waits until the run queue is empty
+        void RefillRunQueue(); // Moves the expired threads into the run queue, as many as fit
+        Threading::Thread* Dequeue();
+        Threading::Thread* StealThread(); // From another CPU's run queue, the stolen thread then belongs to this scheduler
+        [[nodiscard]] bool MayRunHere(const Threading::Thread* thread) const;
+        [[nodiscard]] Scheduler* PickAllowedScheduler(const Threading::Thread* thread) const;
+        void FreeDeadThreads();
+        static Scheduler* Local(); // The scheduler of the calling CPU
+        [[noreturn]] static void IdleThread(void* argument);
+        static void SliceExpired(void* context);
+        static void BalanceExpired(void* context);
+        static void SleepExpired(void* context);
     };
 }
 
@@ -2,33 +2,39 @@
 
 namespace Core::Time {
     TSC::TSC(HPET *hpet, CPU *cpu) {
-        if (!cpu->HasInvariantTSC()) {
+        bool invariant = cpu->HasInvariantTSC();
+        if (!invariant) {
             LOG_WARNING("CPU does not have an invariant TSC, TSC frequency may be inaccurate!");
         }
 
+        uint32_t eax, ebx, ecx, edx;
+        uint32_t maxLeaf = __get_cpuid_max(0, nullptr);
+
         // First try to get the frequency from the TSC frequency leaf.
         // If the returned values in EBX and ECX of leaf 15h are both nonzero, then the TSC (Time Stamp Counter) frequency in Hz is given by TSCFreq = ECX*(EBX/EAX).
-        uint32_t eax, ebx, ecx, edx;
-        __cpuid(0x15, eax, ebx, ecx, edx);
-        if (ebx != 0 && ecx != 0) {
-            frequency = (uint64_t)ecx * ((uint64_t)ebx / (uint64_t)eax);
-            LOG_DEBUG("Frequency derived from CPUID leaf 0x15: %u64hz", frequency);
-            return;
+        if (maxLeaf >= 0x15) {
+            __cpuid(0x15, eax, ebx, ecx, edx);
+            if (eax != 0 && ebx != 0 && ecx != 0) {
+                SetFrequency((uint64_t)ecx * (uint64_t)ebx / (uint64_t)eax, invariant); // Multiply first, the ratio itself is usually not an integer
+                LOG_DEBUG("Frequency derived from CPUID leaf 0x15: %u64hz", frequency);
+                return;
+            }
         }
 
         // On some processors (e.g. Intel Skylake),
         // CPUID_15h_ECX is zero but CPUID_16h_EAX is present and not zero.
-        // On all known processors where this is the case,[132] the TSC frequency is equal to the Processor Base Frequency, and the Core Crystal Clock Frequency in Hz can be computed as
-        // CoreCrystalFreq = (CPUID_16h_EAX * 10000000) * (CPUID_15h_EAX/CPUID_15h_EBX).
-        __cpuid(0x16, eax, ebx, ecx, edx);
-        if (eax != 0) {
-            frequency = (uint64_t)eax * 10000000 * ((uint64_t)ebx / (uint64_t)eax);
-            LOG_DEBUG("Frequency derived from CPUID leaf 0x16: %u64hz", frequency);
-            return;
+        // On all known processors where this is the case,[132] the TSC frequency is equal to the Processor Base Frequency, which leaf 16h reports in MHz.
+        if (maxLeaf >= 0x16) {
+            __cpuid(0x16, eax, ebx, ecx, edx);
+            if (eax != 0) {
+                SetFrequency((uint64_t)eax * 1'000'000ULL, invariant);
+                LOG_DEBUG("Frequency derived from CPUID leaf 0x16: %u64hz", frequency);
+                return;
+            }
         }
 
-        // Fall back to measuring the TSC frequency. (most inaccurate but whatever)
-        frequency = CalculateFrequency(hpet);
+        // Fall back to measuring the TSC frequency.
+        SetFrequency(CalculateFrequency(hpet), invariant);
         LOG_DEBUG("Frequency derived from measurement: %u64hz", frequency);
     }
 
@@ -48,33 +54,83 @@ namespace Core::Time {
     }
 
     uint64_t TSC::GetNanoseconds() const {
-        uint64_t ticks = GetTicks();
-        uint64_t seconds = ticks / frequency;
-        uint64_t residualTicks = ticks % frequency;
-        uint64_t residualNs = (residualTicks * 1'000'000'000ULL) / frequency;
+        return _clocksource.CyclesToNanoseconds(GetTicks());
+    }
+
+    uint64_t TSC::NanosecondsToTicks(uint64_t nanoseconds) const {
+        // Round up so we never land before the deadline
+        return static_cast<uint64_t>((static_cast<__uint128_t>(nanoseconds) * _ticksMult) >> _ticksShift) + 1;
+    }
+
+    Clocksource* TSC::GetClocksource() {
+        return &_clocksource;
+    }
+
+    void TSC::SetFrequency(uint64_t tscFrequency, bool invariant) {
+        frequency = tscFrequency;
+        _ticksMult = Clocksource::CalculateMult(1'000'000'000ULL, tscFrequency, &_ticksShift);
+
+        _clocksource.Name = "TSC";
+        _clocksource.Rating = invariant ? 300 : 100; // A TSC that changes speed with the CPU is worse than any other source
+        _clocksource.Read = ReadClocksource;
+        _clocksource.Mask = static_cast<uint64_t>(-1);
+        _clocksource.SetFrequency(tscFrequency);
+    }
 
-        return (seconds * 1'000'000'000ULL) + residualNs;
+    uint64_t TSC::ReadClocksource(const Clocksource*) {
+        uint32_t low, high;
+        asm volatile("lfence\n\t"
+                     "rdtsc\n\t"
+                     : "=a"(low), "=d"(high));
+
+        return ((uint64_t)high << 32) | low;
     }
 
     uint64_t TSC::CalculateFrequency(HPET *hpet) const {
-        // We calculate the frequency by measuring how many ticks passed.
-        asm volatile ("cli");
+        // We calculate the frequency by measuring how many ticks passed between two HPET readings.
+        // Every TSC read is bracketed by two HPET reads, the width of the bracket bounds the error of that sample. The measurement
+        // stops as soon as the combined error of both samples is below CALIBRATION_PPM of the elapsed time, instead of waiting a fixed time.
+        auto flags = CPU::DisableInterrupts();
 
-        auto hpetStart = hpet->GetCounter();
-        auto tscStart = GetTicks();
+        uint64_t hpetFrequency = hpet->GetFrequency();
+        uint64_t minTicks = Clocksource::Scale(CALIBRATION_MIN_NS, 1'000'000'000ULL, hpetFrequency);
+        uint64_t maxTicks = Clocksource::Scale(CALIBRATION_MAX_NS, 1'000'000'000ULL, hpetFrequency);
 
-        auto ns = 100 * 1000 * 1000; // 100ms
-        hpet->BusyWait(ns);
+        uint64_t hpetStart, tscStart, startError;
+        ReadCalibrationPair(hpet, &hpetStart, &tscStart, &startError);
 
-        auto tscEnd = GetTicks();
-        auto hpetEnd = hpet->GetCounter();
+        uint64_t hpetEnd, tscEnd, endError, hpetDelta;
+        while (true) {
+            ReadCalibrationPair(hpet, &hpetEnd, &tscEnd, &endError);
+            hpetDelta = (hpetEnd - hpetStart) & hpet->GetCounterMask();
 
-        auto hpetDelta = hpetEnd - hpetStart;
-        auto tscDelta = tscEnd - tscStart;
+            if (hpetDelta >= maxTicks) break;
+            if (hpetDelta >= minTicks && (startError + endError) * 1'000'000ULL <= hpetDelta * CALIBRATION_PPM) break;
+        }
 
-        asm volatile ("sti");
+        CPU::RestoreInterrupts(flags);
 
         // frequency = ticks / seconds
-        return tscDelta * 1'000'000'000ULL / (hpetDelta * 1'000'000'000ULL / hpet->GetFrequency());
+        return Clocksource::Scale(tscEnd - tscStart, hpetDelta, hpetFrequency);
+    }
+
+    void TSC::ReadCalibrationPair(HPET *hpet, uint64_t *hpetCounter, uint64_t *tscTicks, uint64_t *error) const {
+        // Keep the attempt with the narrowest bracket, an SMI or a slow MMIO read makes a bracket wider
+        uint64_t bestError = static_cast<uint64_t>(-1);
+
+        for (uint32_t i = 0; i < CALIBRATION_READ_ATTEMPTS; i++) {
+            uint64_t before = hpet->GetCounter();
+            uint64_t ticks = GetTicks();
+            uint64_t after = hpet->GetCounter();
+
+            uint64_t width = (after - before) & hpet->GetCounterMask();
+            if (width < bestError) {
+                bestError = width;
+                *hpetCounter = before + width / 2;
+                *tscTicks = ticks;
+            }
+        }
+
+        *error = bestError + 1; // The counter itself is only accurate to one tick
     }
 }
@@ -4,6 +4,7 @@
 #include <Definitions.h>
 
 #include "HPET.h"
+#include "Clocksource.h"
 #include "../CPU.h"
 
 namespace Core::Time {
@@ -14,11 +15,25 @@ namespace Core::Time {
         [[nodiscard]] uint64_t GetFrequency() const;
         [[nodiscard]] uint64_t GetTicks() const;
         [[nodiscard]] uint64_t GetNanoseconds() const;
+        [[nodiscard]] uint64_t NanosecondsToTicks(uint64_t nanoseconds) const; // The TSC value at which GetNanoseconds reaches the given time
+        [[nodiscard]] Clocksource* GetClocksource();
 
     private:
         uint64_t frequency;
+        uint64_t _ticksMult; // Nanoseconds to ticks, the inverse of the clocksource's conversion
+        uint32_t _ticksShift;
+        Clocksource _clocksource;
+
+        // Calibration samples the HPET until the measured frequency is accurate to CALIBRATION_PPM, which usually takes a few milliseconds
+        static constexpr uint64_t CALIBRATION_MIN_NS = 1'000'000; // 1ms
+        static constexpr uint64_t CALIBRATION_MAX_NS = 50'000'000; // 50ms
+        static constexpr uint64_t CALIBRATION_PPM = 50;
+        static constexpr uint32_t CALIBRATION_READ_ATTEMPTS = 5;
 
         uint64_t CalculateFrequency(HPET * hpet) const;
+        void ReadCalibrationPair(HPET* hpet, uint64_t* hpetCounter, uint64_t* tscTicks, uint64_t* error) const;
+        void SetFrequency(uint64_t tscFrequency, bool invariant);
+        static uint64_t ReadClocksource(const Clocksource* source);
     };
 }
 
@@ -0,0 +1,153 @@
+#include "TimerWheel.h"
+
+#include <Utility/Histogram.h>
+
+namespace Core::Time {
+    TimerWheel::TimerWheel(uint64_t currentTick) : _currentTick(currentTick) {
+
+    }
+
+    void TimerWheel::Insert(Timer *timer, uint64_t expires) {
+        // Re-arming a pending timer simply moves it
+        if (timer->pending) {
+            Unlink(timer);
+            _pendingCount--;
+        }
+
+        timer->expires = expires;
+        timer->pending = true;
+        Link(timer);
+        _pendingCount++;
+    }
+
+    bool TimerWheel::Remove(Timer *timer) {
+        if (!timer->pending) return false;
+
+        Unlink(timer);
+        timer->pending = false;
+        _pendingCount--;
+        return true;
+    }
+
+    size_t TimerWheel::Advance(uint64_t tick, Utility::Histogram* lateness) {
+        size_t ran = 0;
+
+        while (true) {
+            // Jump straight to the next tick that has work, empty slots are never visited
+            uint64_t next = GetNextExpiry();
+            if (next == NO_EXPIRY || next > tick) break;
+            _currentTick = next;
+
+            // Cascade every level whose slot starts at this tick, highest level first. The re-inserted timers land in lower levels.
+            for (uint32_t level = LEVELS - 1; level >= 1; level--) {
+                uint64_t levelMask = (1ULL << (level * LEVEL_BITS)) - 1;
+                if ((next & levelMask) == 0) Cascade(level);
+            }
+
+            // A level 0 slot only ever holds timers that expire at exactly this tick
+            uint32_t slot = next & (SLOTS - 1);
+            _expiring = _slots[0][slot];
+            _slots[0][slot] = nullptr;
+            _occupied[0] &= ~(1ULL << slot);
+
+            for (Timer* timer = _expiring; timer; timer = timer->next) {
+                timer->level = EXPIRING_LEVEL;
+            }
+
+            // Move past this tick before running the callbacks, so a timer re-armed for "now" fires on the next tick instead of looping forever
+            _currentTick = next + 1;
+
+            // The callbacks may arm or cancel any timer (including the ones still waiting in the expiring list), so pop them one at a time
+            while (_expiring) {
+                Timer* timer = _expiring;
+                Unlink(timer);
+                timer->pending = false;
+                _pendingCount--;
+
+                if (lateness) lateness->Record(tick - next);
+                timer->function(timer->context);
+                ran++;
+            }
+        }
+
+        if (tick >= _currentTick) _currentTick = tick + 1;
+        return ran;
+    }
+
+    uint64_t TimerWheel::GetNextExpiry() const {
+        uint64_t best = NO_EXPIRY;
+
+        for (uint32_t level = 0; level < LEVELS; level++) {
+            if (!_occupied[level]) continue;
+
+            // The first slot start of this level at or after the current tick, in units of this level's slot size
+            uint32_t shift = level * LEVEL_BITS;
+            uint64_t base = (_currentTick + (1ULL << shift) - 1) >> shift;
+            uint32_t start = base & (SLOTS - 1);
+
+            // Rotate the bitmap so that bit 0 is the slot at base, the lowest set bit is then the closest occupied slot
+            uint64_t rotated = (_occupied[level] >> start) | (_occupied[level] << ((SLOTS - start) & (SLOTS - 1)));
+            uint64_t candidate = (base + __builtin_ctzll(rotated)) << shift;
+
+            if (candidate < best) best = candidate;
+        }
+
+        return best;
+    }
+
+    uint64_t TimerWheel::GetCurrentTick() const {
+        return _currentTick;
+    }
+
+    size_t TimerWheel::GetPendingCount() const {
+        return _pendingCount;
+    }
+
+    void TimerWheel::Link(Timer *timer) {
+        if (timer->expires < _currentTick) timer->expires = _currentTick;
+
+        uint64_t delta = timer->expires - _currentTick;
+        if (delta > MAX_DELTA) {
+            delta = MAX_DELTA;
+            timer->expires = _currentTick + MAX_DELTA;
+        }
+
+        // The level is the index of the highest set bit of the delta, divided by the bits per level
+        uint32_t level = delta < SLOTS ? 0 : (63 - __builtin_clzll(delta)) / LEVEL_BITS;
+        uint32_t slot = (timer->expires >> (level * LEVEL_BITS)) & (SLOTS - 1);
+
+        timer->level = level;
+        timer->slot = slot;
+        timer->prev = nullptr;
+        timer->next = _slots[level][slot];
+        if (timer->next) timer->next->prev = timer;
+        _slots[level][slot] = timer;
+        _occupied[level] |= 1ULL << slot;
+    }
+
+    void TimerWheel::Unlink(Timer *timer) {
+        Timer** head = timer->level == EXPIRING_LEVEL ? &_expiring : &_slots[timer->level][timer->slot];
+
+        if (timer->prev) timer->prev->next = timer->next;
+        else *head = timer->next;
+        if (timer->next) timer->next->prev = timer->prev;
+
+        if (timer->level != EXPIRING_LEVEL && !*head) _occupied[timer->level] &= ~(1ULL << timer->slot);
+
+        timer->next = nullptr;
+        timer->prev = nullptr;
+    }
+
+    void TimerWheel::Cascade(uint32_t level) {
+        uint32_t slot = (_currentTick >> (level * LEVEL_BITS)) & (SLOTS - 1);
+        Timer* timer = _slots[level][slot];
+        _slots[level][slot] = nullptr;
+        _occupied[level] &= ~(1ULL << slot);
+
+        while (timer) {
+            Timer* next = timer->next;
+            Link(timer);
+            timer = next;
+        }
+    }
+}
@@ -0,0 +1,67 @@
+#ifndef BOREALOS_TIMERWHEEL_H
+#define BOREALOS_TIMERWHEEL_H
+
+#include <Definitions.h>
+
+namespace Utility {
+    struct Histogram;
+}
+
+namespace Core::Time {
+    typedef void (*TimerFunction)(void* context);
+
+    // A timer that can be armed in a TimerWheel. The wheel links the timers intrusively, so arming and cancelling never allocate.
+    struct Timer {
+        Timer* next = nullptr;
+        Timer* prev = nullptr;
+        uint64_t expires = 0; // In wheel ticks
+        TimerFunction function = nullptr;
+        void* context = nullptr;
+        uint8_t level = 0;
+        uint8_t slot = 0;
+        bool pending = false;
+    };
+
+    /// Hierarchical timing wheel with cascading levels, based on the classic BSD/Linux design.
+    /// Level L has 64 slots that each span 64^L ticks. A timer is placed in the lowest level that can hold its delta, and timers in
+    /// higher levels are cascaded (re-inserted) into lower levels when the wheel reaches the start of their slot.
+    /// Insert and Remove are O(1), Advance only visits slots that actually contain timers thanks to a per-level occupancy bitmap.
+    class TimerWheel {
+    public:
+        static constexpr uint32_t LEVEL_BITS = 6;
+        static constexpr uint32_t SLOTS = 1 << LEVEL_BITS;
+        static constexpr uint32_t LEVELS = 9; // 9 * 6 = 54 bits of ticks
+        static constexpr uint64_t MAX_DELTA = (1ULL << (LEVELS * LEVEL_BITS)) - 1;
+        static constexpr uint64_t NO_EXPIRY = static_cast<uint64_t>(-1);
+
+        explicit TimerWheel(uint64_t currentTick = 0);
+
+        // Arms the timer for the given absolute tick. Ticks that were already processed are clamped to the current tick, so such timers fire on the next Advance past it.
+        void Insert(Timer* timer, uint64_t expires);
+        // Disarms the timer, returns false if it wasn't pending
+        bool Remove(Timer* timer);
+        // Runs every timer that expires at or before the given tick and returns how many were run. If given, lateness records how many ticks
+        // after its expiry each timer ran.
+        size_t Advance(uint64_t tick, Utility::Histogram* lateness = nullptr);
+
+        // The tick at which the wheel needs to be advanced next (an expiry or a cascade), NO_EXPIRY if the wheel is empty
+        [[nodiscard]] uint64_t GetNextExpiry() const;
+        [[nodiscard]] uint64_t GetCurrentTick() const;
+        [[nodiscard]] size_t GetPendingCount() const;
+
+    private:
+        static constexpr uint8_t EXPIRING_LEVEL = 0xFF; // Marks timers that were taken out of the wheel but haven't run yet
+
+        Timer* _slots[LEVELS][SLOTS] {};
+        uint64_t _occupied[LEVELS] {}; // Bit n is set if slot n of that level contains at least one timer
+        Timer* _expiring = nullptr;
+        uint64_t _currentTick; // Every tick before this one has been processed
+        size_t _pendingCount = 0;
+
+        void Link(Timer* timer);
+        void Unlink(Timer* timer);
+        void Cascade(uint32_t level);
+    };
+}
+
+#endif //BOREALOS_TIMERWHEEL_H
@@ -1,7 +1,11 @@
 #include <IO/PCI.h>
 
+#include <Kernel.h>
+#include "../KernelData.h"
+#include "../Interrupts/IRQBalancer.h"
+
 namespace IO {
-    PCI::PCI(Memory::Paging* paging) : _PCIDevices(256) {
+    PCI::PCI(Memory::Paging* paging) : _PCIDevices(256), _irqVectors(16) {
         this->_paging = paging;
     }
 
@@ -153,8 +157,11 @@ namespace IO {
         uint32_t configAddress = (bus32 << 16) | (slot32 << 11) |
             (func32 << 8) | (offset & 0xFC) | 0x80000000;
 
+        uint64_t flags = _configLock.LockIrqSave();
         Serial::outl(PCI_CONFIG_ADDRESS, configAddress);
-        return Serial::inl(PCI_CONFIG_DATA);
+        uint32_t value = Serial::inl(PCI_CONFIG_DATA);
+        _configLock.UnlockIrqRestore(flags);
+        return value;
     }
 
     // Returns the selected property of the 32-bit configuration word from device <bus>:<slot>:<func>
@@ -170,12 +177,14 @@ namespace IO {
         configAddress = (uint32_t)((bus32 << 16) | (slot32 << 11) |
                 (func32 << 8) | (offset & 0xFC) | ((uint32_t)0x80000000));
     
-        // Write the config address to the PCI bridge
+        // Write the config address to the PCI bridge and read in the data
+        uint64_t flags = _configLock.LockIrqSave();
         Serial::outl(PCI::PCI_CONFIG_ADDRESS, configAddress);
+        uint32_t value = Serial::inl(PCI::PCI_CONFIG_DATA);
+        _configLock.UnlockIrqRestore(flags);
 
-        // Read in the data
         // NOTE: "(offset & 2) * 8) = 0" chooses the first word of the 32-bit register
-        return (uint16_t)((Serial::inl(PCI::PCI_CONFIG_DATA) >> ((offset & 2) * 8)) & 0xFFFF);
+        return (uint16_t)((value >> ((offset & 2) * 8)) & 0xFFFF);
     }
 
     uint16_t PCI::GetHeaderType(uint8_t bus, uint8_t slot, uint8_t function) {
@@ -232,6 +241,27 @@ namespace IO {
 
         if (entryIndex >= tableSize) return false;
 
+        volatile MSIXTableEntry* table = MapMSIXTable(device, capabilityOffset, tableSize);
+        if (!table) return false;
+
+        // Write the message address and data into the entry
+        table[entryIndex].messageAddrLow  = (uint32_t)(messageAddr & 0xFFFFFFFF);
+        table[entryIndex].messageAddrHigh = (uint32_t)(messageAddr >> 32);
+        table[entryIndex].messageData     = messageData;
+        table[entryIndex].vectorControl   = 0; // Unmask the entry
+
+        // Enable MSI-X by setting bit 15 of the message control and clearing function mask (bit 14)
+        control |=  (1 << 15);
+        control &= ~(1 << 14);
+        WriteConfigDWord(device.bus, device.slot, device.function, capabilityOffset, (dword0 & 0x0000FFFF) | ((uint32_t)control << 16));
+
+        return true;
+    }
+
+    volatile PCI::MSIXTableEntry* PCI::MapMSIXTable(const PCI::PCIDeviceHeader& device, uint8_t capabilityOffset, uint16_t& tableSize) {
+        uint16_t control = (ReadConfigDWord(device.bus, device.slot, device.function, capabilityOffset) >> 16) & 0xFFFF;
+        tableSize = (control & 0x7FF) + 1; // Bits 10:0 are N-1 encoded
+
         // Read the table BIR and offset (second dword)
         uint32_t tableDWord = ReadConfigDWord(device.bus, device.slot, device.function, capabilityOffset + 0x4);
         uint8_t  barIndex   = tableDWord & 0x7;        // Bits 2:0 is "which BAR"
@@ -239,31 +269,262 @@ namespace IO {
 
         // Read the BAR to get the physical base address
         PCI_BAR bar = ReadBAR(device, barIndex);
-        if (bar.address == 0) return false;
+        if (bar.address == 0) return nullptr;
+
+        // Map every page the table covers, a table with many entries or at an offset spans more than the first page of the BAR
+        uint64_t tableStart = bar.address + tableOffset;
+        uint64_t tableEnd = tableStart + tableSize * sizeof(MSIXTableEntry);
+        for (uint64_t page = tableStart & ~(Architecture::KernelPageSize - 1); page < tableEnd; page += Architecture::KernelPageSize) {
+            _paging->MapPage(
+                page,
+                page,
+                Memory::PageFlags::ReadWrite | Memory::PageFlags::NoExecute | Memory::PageFlags::CacheDisable
+            );
+        }
 
-        // Map the MMIO region
-        _paging->MapPage(
-            bar.address,
-            bar.address,
-            Memory::PageFlags::ReadWrite | Memory::PageFlags::NoExecute | Memory::PageFlags::CacheDisable
-        );
+        return reinterpret_cast<volatile MSIXTableEntry*>(tableStart);
+    }
 
-        volatile MSIXTableEntry* table = reinterpret_cast<volatile MSIXTableEntry*>(bar.address + tableOffset);
+    uint32_t PCI::AllocateIrqVectors(const PCI::PCIDeviceHeader& device, uint32_t min, uint32_t max, uint32_t types) {
+        if (min == 0) min = 1;
+        if (max > MAX_IRQ_VECTORS) max = MAX_IRQ_VECTORS;
+        if (min > max) {
+            LOG_ERROR("PCI %u8:%u8.%u8 asked for at least %u32 interrupt vectors, at most %u32 are supported.", device.bus, device.slot, device.function, min, max);
+            return 0;
+        }
 
-        // Write the message address and data into the entry
-        table[entryIndex].messageAddrLow  = (uint32_t)(messageAddr & 0xFFFFFFFF);
-        table[entryIndex].messageAddrHigh = (uint32_t)(messageAddr >> 32);
-        table[entryIndex].messageData     = messageData;
-        table[entryIndex].vectorControl   = 0; // Unmask the entry
+        if (FindIrqVectors(device)) {
+            LOG_ERROR("PCI %u8:%u8.%u8 already has interrupt vectors, free them first.", device.bus, device.slot, device.function);
+            return 0;
+        }
 
-        // Enable MSI-X by setting bit 15 of the message control and clearing function mask (bit 14)
-        control |=  (1 << 15);
-        control &= ~(1 << 14);
+        auto irqVectors = new IrqVectors();
+        irqVectors->bus = device.bus;
+        irqVectors->slot = device.slot;
+        irqVectors->function = device.function;
+
+        uint32_t count = 0;
+        if (types & IRQ_VECTORS_MSIX) count = SetUpMSIX(device, irqVectors, min, max);
+        if (!count && (types & IRQ_VECTORS_MSI)) count = SetUpMSI(device, irqVectors, min, max);
+        if (!count) {
+            delete irqVectors;
+            return 0;
+        }
+
+        // The device could raise both its pin and the messages otherwise
+        DisableINTx(device);
+
+        irqVectors->count = count;
+        _irqVectors.Add(irqVectors);
+
+        // Multi-message MSI vectors can only move together, the first one stands for the block
+        uint32_t balanced = irqVectors->isMSIX ? count : 1;
+        for (uint32_t i = 0; i < balanced; i++) {
+            Interrupts::IRQBalancer::Register(irqVectors->vectors[i], SetIRQBalancerAffinity, irqVectors);
+        }
+        LOG_DEBUG("PCI %u8:%u8.%u8 uses %u32 %s vector(s) starting at 0x%x8.", device.bus, device.slot, device.function, count,
+                  irqVectors->isMSIX ? "MSI-X" : "MSI", irqVectors->vectors[0]);
+        return count;
+    }
+
+    uint32_t PCI::SetUpMSIX(const PCI::PCIDeviceHeader& device, IrqVectors* irqVectors, uint32_t min, uint32_t max) {
+        uint8_t capabilityOffset = FindCapability(device, PCI_CAPABILITY_MSI_X);
+        if (capabilityOffset == 0) return 0;
+
+        uint16_t tableSize;
+        volatile MSIXTableEntry* table = MapMSIXTable(device, capabilityOffset, tableSize);
+        if (!table || tableSize < min) return 0;
+        if (max > tableSize) max = tableSize;
+
+        // MSI-X vectors don't have to be consecutive, so a fragmented vector space still yields as many as are free
+        auto idt = &Kernel<KernelData>::GetInstance()->ArchitectureData->Idt;
+        uint32_t count = 0;
+        while (count < max) {
+            uint8_t vector = idt->AllocateVectors(1);
+            if (!vector) break;
+            irqVectors->vectors[count++] = vector;
+        }
+
+        if (count < min) {
+            for (uint32_t i = 0; i < count; i++) idt->FreeVectors(irqVectors->vectors[i], 1);
+            return 0;
+        }
+
+        // The function mask holds back every message while the entries are half written
+        uint32_t dword0 = ReadConfigDWord(device.bus, device.slot, device.function, capabilityOffset);
+        uint16_t control = ((dword0 >> 16) & 0xFFFF) | MSIX_CONTROL_ENABLE | MSIX_CONTROL_FUNCTION_MASK;
+        WriteConfigDWord(device.bus, device.slot, device.function, capabilityOffset, (dword0 & 0x0000FFFF) | ((uint32_t)control << 16));
+
+        irqVectors->isMSIX = true;
+        irqVectors->capabilityOffset = capabilityOffset;
+        irqVectors->table = table;
+
+        for (uint32_t i = 0; i < tableSize; i++) {
+            if (i < count) WriteIrqMessage(irqVectors, i, Interrupts::IRQBalancer::ALL_CPUS);
+            else table[i].vectorControl = MSIX_ENTRY_MASKED;
+        }
+
+        control &= ~MSIX_CONTROL_FUNCTION_MASK;
+        WriteConfigDWord(device.bus, device.slot, device.function, capabilityOffset, (dword0 & 0x0000FFFF) | ((uint32_t)control << 16));
+        return count;
+    }
+
+    uint32_t PCI::SetUpMSI(const PCI::PCIDeviceHeader& device, IrqVectors* irqVectors, uint32_t min, uint32_t max) {
+        uint8_t capabilityOffset = FindCapability(device, PCI_CAPABILITY_MSI);
+        if (capabilityOffset == 0) return 0;
+
+        uint32_t dword0 = ReadConfigDWord(device.bus, device.slot, device.function, capabilityOffset);
+        uint16_t control = (dword0 >> 16) & 0xFFFF;
+
+        // Multi-message MSI gives the device a power of two block of consecutive vectors, it ORs the message number into the data
+        uint32_t capable = 1 << ((control >> 1) & 0x7);
+        uint32_t count = 1;
+        while (count * 2 <= max && count * 2 <= capable) count *= 2;
+        if (count < min) return 0;
+
+        auto idt = &Kernel<KernelData>::GetInstance()->ArchitectureData->Idt;
+        uint8_t first = idt->AllocateVectors(count);
+        while (!first && count / 2 >= min) {
+            count /= 2;
+            first = idt->AllocateVectors(count);
+        }
+        if (!first) return 0;
+
+        for (uint32_t i = 0; i < count; i++) irqVectors->vectors[i] = first + i;
+        irqVectors->isMSIX = false;
+        irqVectors->capabilityOffset = capabilityOffset;
+        irqVectors->table = nullptr;
+        WriteIrqMessage(irqVectors, 0, Interrupts::IRQBalancer::ALL_CPUS);
+
+        // Multiple Message Enable (bits 6:4) is log2 of the vector count
+        uint32_t log2Count = 0;
+        while ((1U << log2Count) < count) log2Count++;
+        control = (control & ~(0x7 << 4)) | (log2Count << 4) | MSI_CONTROL_ENABLE;
         WriteConfigDWord(device.bus, device.slot, device.function, capabilityOffset, (dword0 & 0x0000FFFF) | ((uint32_t)control << 16));
+        return count;
+    }
+
+    void PCI::FreeIrqVectors(const PCI::PCIDeviceHeader& device) {
+        size_t index;
+        IrqVectors* irqVectors = FindIrqVectors(device, &index);
+        if (!irqVectors) return;
+
+        // Once this returns the balancer isn't retargeting any of them anymore
+        uint32_t balanced = irqVectors->isMSIX ? irqVectors->count : 1;
+        for (uint32_t i = 0; i < balanced; i++) Interrupts::IRQBalancer::Unregister(irqVectors->vectors[i]);
+
+        // Stop the messages before their vectors can be handed to someone else
+        uint32_t dword0 = ReadConfigDWord(device.bus, device.slot, device.function, irqVectors->capabilityOffset);
+        uint16_t control = (dword0 >> 16) & 0xFFFF;
+        if (irqVectors->isMSIX) {
+            for (uint32_t i = 0; i < irqVectors->count; i++) irqVectors->table[i].vectorControl = MSIX_ENTRY_MASKED;
+            control &= ~MSIX_CONTROL_ENABLE;
+        }
+        else {
+            control &= ~MSI_CONTROL_ENABLE;
+        }
+        WriteConfigDWord(device.bus, device.slot, device.function, irqVectors->capabilityOffset, (dword0 & 0x0000FFFF) | ((uint32_t)control << 16));
+
+        auto idt = &Kernel<KernelData>::GetInstance()->ArchitectureData->Idt;
+        if (irqVectors->isMSIX) {
+            for (uint32_t i = 0; i < irqVectors->count; i++) idt->FreeVectors(irqVectors->vectors[i], 1);
+        }
+        else {
+            idt->FreeVectors(irqVectors->vectors[0], irqVectors->count);
+        }
+
+        _irqVectors.Remove(index);
+        delete irqVectors;
+    }
+
+    uint32_t PCI::GetIrqVectorCount(const PCI::PCIDeviceHeader& device) {
+        IrqVectors* irqVectors = FindIrqVectors(device);
+        return irqVectors ? irqVectors->count : 0;
+    }
+
+    uint8_t PCI::GetIrqVector(const PCI::PCIDeviceHeader& device, uint32_t index) {
+        IrqVectors* irqVectors = FindIrqVectors(device);
+        if (!irqVectors || index >= irqVectors->count) return 0;
+        return irqVectors->vectors[index];
+    }
 
+    bool PCI::SetIrqHandler(const PCI::PCIDeviceHeader& device, uint32_t index, IrqHandler handler, void* context) {
+        uint8_t vector = GetIrqVector(device, index);
+        if (!vector) return false;
+
+        Kernel<KernelData>::GetInstance()->ArchitectureData->Idt.RegisterIRQHandler(vector - Interrupts::APIC::IRQ_OFFSET, handler, context);
         return true;
     }
 
+    bool PCI::SetIrqAffinity(const PCI::PCIDeviceHeader& device, uint32_t index, uint64_t cpuMask) {
+        IrqVectors* irqVectors = FindIrqVectors(device);
+        if (!irqVectors || index >= irqVectors->count) return false;
+
+        return Interrupts::IRQBalancer::SetAffinity(irqVectors->vectors[irqVectors->isMSIX ? index : 0], cpuMask);
+    }
+
+    void PCI::WriteIrqMessage(IrqVectors* irqVectors, uint32_t index, uint64_t cpuMask) {
+        uint64_t address;
+        uint32_t data;
+        Kernel<KernelData>::GetInstance()->ArchitectureData->Apic->ComposeMSIMessage(cpuMask, irqVectors->vectors[index], address, data);
+
+        if (irqVectors->isMSIX) {
+            // Masked while it is half written, a message in between is held back as pending and sent with the new contents
+            volatile MSIXTableEntry* entry = &irqVectors->table[index];
+            entry->vectorControl   = MSIX_ENTRY_MASKED;
+            entry->messageAddrLow  = (uint32_t)(address & 0xFFFFFFFF);
+            entry->messageAddrHigh = (uint32_t)(address >> 32);
+            entry->messageData     = data;
+            entry->vectorControl   = 0;
+            return;
+        }
+
+        // MSI may have no per-vector masking. The address and data are written so that a message sent between the two writes has
+        // lowest priority delivery whenever the destination is logical: a fixed message to a logical destination would reach every CPU in it.
+        uint8_t offset = irqVectors->capabilityOffset;
+        uint16_t control = (ReadConfigDWord(irqVectors->bus, irqVectors->slot, irqVectors->function, offset) >> 16) & 0xFFFF;
+        uint8_t dataOffset = (control & MSI_CONTROL_64BIT) ? 0xC : 0x8;
+        bool logical = address & Interrupts::APIC::MSI_ADDRESS_LOGICAL;
+
+        if (logical) WriteConfigDWord(irqVectors->bus, irqVectors->slot, irqVectors->function, offset + dataOffset, data);
+        WriteConfigDWord(irqVectors->bus, irqVectors->slot, irqVectors->function, offset + 0x04, (uint32_t)(address & 0xFFFFFFFF));
+        if (control & MSI_CONTROL_64BIT) {
+            WriteConfigDWord(irqVectors->bus, irqVectors->slot, irqVectors->function, offset + 0x8, (uint32_t)(address >> 32));
+        }
+        if (!logical) WriteConfigDWord(irqVectors->bus, irqVectors->slot, irqVectors->function, offset + dataOffset, data);
+    }
+
+    bool PCI::SetIRQBalancerAffinity(void* context, uint8_t vector, uint64_t cpuMask) {
+        // The vectors stay alive until FreeIrqVectors unregistered them, which waits for the balancer
+        auto irqVectors = static_cast<IrqVectors*>(context);
+        for (uint32_t index = 0; index < irqVectors->count; index++) {
+            if (irqVectors->vectors[index] != vector) continue;
+
+            Kernel<KernelData>::GetInstance()->ArchitectureData->Pci->WriteIrqMessage(irqVectors, index, cpuMask);
+            return true;
+        }
+
+        return false;
+    }
+
+    PCI::IrqVectors* PCI::FindIrqVectors(const PCI::PCIDeviceHeader& device, size_t* index) {
+        for (size_t i = 0; i < _irqVectors.Size(); i++) {
+            IrqVectors* irqVectors = _irqVectors[i];
+            if (irqVectors->bus == device.bus && irqVectors->slot == device.slot && irqVectors->function == device.function) {
+                if (index) *index = i;
+                return irqVectors;
+            }
+        }
+
+        return nullptr;
+    }
+
+    void PCI::DisableINTx(const PCI::PCIDeviceHeader& device) {
+        // The status half of the dword is write-1-to-clear, so only the command half is written back
+        uint16_t command = ReadConfigWord(device.bus, device.slot, device.function, PCI_HEADER_FLAG_COMMAND);
+        WriteConfigDWord(device.bus, device.slot, device.function, PCI_HEADER_FLAG_COMMAND, command | PCI_COMMAND_INTX_DISABLE);
+    }
+
     void PCI::WriteConfig(const PCI::PCIDeviceHeader& device, uint8_t offset, uint32_t value) {
         WriteConfigDWord(device.bus, device.slot, device.function, offset, value);
     }
@@ -276,8 +537,10 @@ namespace IO {
         uint32_t configAddress = (bus32 << 16) | (slot32 << 11) |
             (func32 << 8) | (offset & 0xFC) | 0x80000000;
 
+        uint64_t flags = _configLock.LockIrqSave();
         Serial::outl(PCI_CONFIG_ADDRESS, configAddress);
         Serial::outl(PCI_CONFIG_DATA, value);
+        _configLock.UnlockIrqRestore(flags);
     }
 
     void PCI::CheckFunction(uint8_t bus, uint8_t slot, uint8_t function) {
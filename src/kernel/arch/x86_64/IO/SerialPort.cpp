@@ -1,6 +1,7 @@
 #include "SerialPort.h"
 
 #include "Serial.h"
+#include "../Core/Sync/WaitQueue.h"
 
 IO::SerialPort::SerialPort(uint16_t port) {
     _port = port;
@@ -22,6 +23,9 @@ void IO::SerialPort::Initialize() {
 
     // We still check if the port actually exists, which prevents TX/RX loop stalls and slowdowns
     _initialized = IO::Serial::SerialPortExists(_port);
+
+    // Bits 6 and 7 of the interrupt identification register read back as set if the FIFO we enabled above works (16550A and later)
+    _fifoSize = (IO::Serial::inb(_port + 2) & 0xC0) == 0xC0 ? FIFO_SIZE : 1;
 }
 
 void IO::SerialPort::WriteChar(char c) const {
@@ -29,15 +33,44 @@ void IO::SerialPort::WriteChar(char c) const {
         return;
     }
 
-    IO::Serial::WriteChar(_port, c);
+    WaitTransmitEmpty(false);
+    IO::Serial::outb(_port, c);
 }
 
 void IO::SerialPort::WriteString(const char* str) const {
+    Write(str, false);
+}
+
+void IO::SerialPort::WriteBulk(const char* str) const {
+    Write(str, true);
+}
+
+void IO::SerialPort::Write(const char* str, bool maySleep) const {
     if (!_initialized) {
         return;
     }
 
-    IO::Serial::WriteString(_port, str);
+    while (*str) {
+        // The transmitter is empty now, so a whole FIFO's worth goes out without checking the line status for every byte
+        WaitTransmitEmpty(maySleep);
+        for (uint8_t i = 0; i < _fifoSize && *str; i++) {
+            IO::Serial::outb(_port, *str++);
+        }
+    }
+}
+
+void IO::SerialPort::WaitTransmitEmpty(bool maySleep) const {
+    if (IO::Serial::TransmitEmpty(_port)) return;
+
+    if (!maySleep || !Core::Sync::CanSleep()) {
+        while (IO::Serial::TransmitEmpty(_port) == 0) {}
+        return;
+    }
+
+    // A full FIFO takes about 4ms to drain, so the thread sleeps for about that long between checks
+    Core::Sync::PollEventTimeout([this] {
+        return IO::Serial::TransmitEmpty(_port) != 0;
+    }, TRANSMIT_TIMEOUT_NS, CHARACTER_TIME_NS * _fifoSize);
 }
 
 bool IO::SerialPort::IsInitialized() const {
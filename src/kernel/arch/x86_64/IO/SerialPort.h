@@ -9,12 +9,22 @@ namespace IO {
 
         void Initialize();
         void WriteChar(char c) const;
-        void WriteString(const char* str) const;
+        void WriteString(const char* str) const; // Never sleeps, spins while the FIFO drains
+        void WriteBulk(const char* str) const; // Sleeps while the FIFO drains if the caller can, the log writes through it from threads
         [[nodiscard]] bool IsInitialized() const;
 
     private:
         uint16_t _port;
         bool _initialized;
+        uint8_t _fifoSize = 1; // Bytes that can be written at once after the transmitter reported empty
+
+        // With maySleep, threads sleep while the FIFO drains. Everything else (early boot, interrupt handlers, panics) spins.
+        void WaitTransmitEmpty(bool maySleep) const;
+        void Write(const char* str, bool maySleep) const;
+
+        static constexpr uint8_t FIFO_SIZE = 16; // 16550A
+        static constexpr uint64_t CHARACTER_TIME_NS = 260'417; // 10 bits at 38400 baud (divisor 3)
+        static constexpr uint64_t TRANSMIT_TIMEOUT_NS = 100'000'000; // 100ms, a stuck port drops bytes instead of hanging the caller
     };
 }
 
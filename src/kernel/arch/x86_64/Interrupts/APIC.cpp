@@ -1,5 +1,8 @@
 #include "APIC.h"
 
+#include <Boot/LimineDefinitions.h>
+#include "IRQBalancer.h"
+#include "../Core/PerCPU.h"
 #include "../IO/Serial.h"
 
 namespace Interrupts {
@@ -33,10 +36,12 @@ namespace Interrupts {
     }
 
     void APIC::WriteLAPICRegister(uint32_t regOffset, uint32_t value) {
-        MMIOLAPICAddr[regOffset / 4] = value;
+        if (_x2apic) Core::CPU::WriteMSR(X2APIC_MSR_BASE + (regOffset >> 4), value);
+        else MMIOLAPICAddr[regOffset / 4] = value;
     }
 
     uint32_t APIC::ReadLAPICRegister(uint32_t regOffset) {
+        if (_x2apic) return static_cast<uint32_t>(Core::CPU::ReadMSR(X2APIC_MSR_BASE + (regOffset >> 4)));
         return MMIOLAPICAddr[regOffset / 4];
     }
 
@@ -58,40 +63,183 @@ namespace Interrupts {
         WriteLAPICRegister(regOffset, ReadLAPICRegister(regOffset) & ~(1 << 16));
     }
 
-    void APIC::MaskIRQ(uint8_t irqNum) {
-        // Check if there is an override available for this IRQ
-        Core::Firmware::ACPI::MADTIRQSrcOverride* IRQOverride = GetIRQSrcOverride(irqNum);
-        uint32_t gsi = IRQOverride ? IRQOverride->globalSysInterrupt : irqNum;
-        
-        // Check if any IOAPIC chips are set up to handle this IRQ
-        IOAPICData* APICData = GetIOAPICFromIRQ(gsi);
-        if (!APICData) {
-            LOG_ERROR("No IOAPICs are set up to handle IRQ #%u8", irqNum);
-            PANIC("No IOAPIC was found for the IRQ!");
-        }        
+    uint32_t APIC::GetIRQGSI(uint8_t irqNum) const {
+        return irqNum < 16 ? _isaRoutes[irqNum].gsi : irqNum;
+    }
 
-        // Now we can actually mask the IRQ
-        uint8_t entry = gsi - APICData->gsiBase;
-        uint8_t reg = 0x10 + (entry * 2);
-        WriteIOAPICRegister(APICData->base, reg, ReadIOAPICRegister(APICData->base, reg) | (1 << 16));
+    void APIC::MaskIRQ(uint8_t irqNum) {
+        MaskGSI(GetIRQGSI(irqNum));
     }
 
     void APIC::UnmaskIRQ(uint8_t irqNum) {
-        // Check if there is an override available for this IRQ
-        Core::Firmware::ACPI::MADTIRQSrcOverride* IRQOverride = GetIRQSrcOverride(irqNum);
-        uint32_t gsi = IRQOverride ? IRQOverride->globalSysInterrupt : irqNum;
-        
-        // Check if any IOAPIC chips are set up to handle this IRQ
-        IOAPICData* APICData = GetIOAPICFromIRQ(gsi);
-        if (!APICData) {
-            LOG_ERROR("No IOAPICs are set up to handle IRQ #%u8", irqNum);
+        UnmaskGSI(GetIRQGSI(irqNum));
+    }
+
+    APIC::GSIRoute* APIC::GetRoute(uint32_t gsi) {
+        GSIRoute* route = gsi < _gsiRouteCount ? &_gsiRoutes[gsi] : nullptr;
+        if (!route || !route->ioapic) {
+            LOG_ERROR("No IOAPICs are set up to handle GSI #%u32", gsi);
             PANIC("No IOAPIC was found for the IRQ!");
-        }        
+        }
+        return route;
+    }
 
-        // Now we can actually unmask the IRQ
-        uint8_t entry = gsi - APICData->gsiBase;
-        uint8_t reg = 0x10 + (entry * 2);
-        WriteIOAPICRegister(APICData->base, reg, ReadIOAPICRegister(APICData->base, reg) & ~(1 << 16));
+    void APIC::WriteRoute(GSIRoute* route) {
+        WriteIOAPICRegister(route->ioapic->base, 0x10 + (route->entry * 2), route->low);
+        WriteIOAPICRegister(route->ioapic->base, 0x11 + (route->entry * 2), route->high);
+    }
+
+    void APIC::MaskGSI(uint32_t gsi) {
+        GSIRoute* route = GetRoute(gsi);
+
+        uint64_t flags = _ioapicLock.LockIrqSave();
+        route->low |= 1 << 16;
+        WriteIOAPICRegister(route->ioapic->base, 0x10 + (route->entry * 2), route->low);
+        _ioapicLock.UnlockIrqRestore(flags);
+    }
+
+    void APIC::UnmaskGSI(uint32_t gsi) {
+        GSIRoute* route = GetRoute(gsi);
+
+        uint64_t flags = _ioapicLock.LockIrqSave();
+        route->low &= ~(1 << 16);
+        WriteIOAPICRegister(route->ioapic->base, 0x10 + (route->entry * 2), route->low);
+        _ioapicLock.UnlockIrqRestore(flags);
+    }
+
+    void APIC::ComposeDestination(uint64_t cpuMask, uint32_t& destination, bool& logical) {
+        uint64_t targets = cpuMask & _destinationMask;
+        if (!targets) targets = 1;
+
+        uint32_t first = __builtin_ctzll(targets);
+        logical = false;
+        destination = _lapicIDs[first];
+        if (_destinationModel == DestinationModel::Physical || !(targets & (targets - 1)) || !_logicalIDs[first]) return;
+
+        // Logical destinations are ORed together, in the cluster model only those of the first CPU's cluster
+        uint8_t cluster = _logicalIDs[first] & 0xF0;
+        destination = 0;
+        for (; targets; targets &= targets - 1) {
+            uint8_t logicalID = _logicalIDs[__builtin_ctzll(targets)];
+            if (_destinationModel == DestinationModel::Cluster && (logicalID & 0xF0) != cluster) continue;
+            destination |= logicalID;
+        }
+        logical = true;
+    }
+
+    void APIC::ComposeMSIMessage(uint64_t cpuMask, uint8_t vector, uint64_t& address, uint32_t& data) {
+        uint32_t destination;
+        bool logical;
+        ComposeDestination(cpuMask, destination, logical);
+
+        address = MSI_ADDRESS_BASE | ((destination & 0xFF) << 12);
+        data = vector | DELIVERY_FIXED;
+        if (logical) {
+            address |= MSI_ADDRESS_LOGICAL | MSI_ADDRESS_REDIRECTION_HINT;
+            data |= DELIVERY_LOWEST_PRIORITY;
+        }
+    }
+
+    bool APIC::SetGSIAffinity(uint32_t gsi, uint64_t cpuMask) {
+        if (gsi >= _gsiRouteCount || !_gsiRoutes[gsi].ioapic) return false;
+        GSIRoute* route = &_gsiRoutes[gsi];
+
+        uint32_t destination;
+        bool logical;
+        ComposeDestination(cpuMask, destination, logical);
+
+        uint64_t flags = _ioapicLock.LockIrqSave();
+        // Only entries with fixed or lowest priority delivery follow the destination, NMI or ExtINT entries keep their mode
+        uint32_t deliveryMode = route->low & (0b111 << 8);
+        if (deliveryMode == DELIVERY_FIXED || deliveryMode == DELIVERY_LOWEST_PRIORITY) {
+            route->low &= ~((0b111 << 8) | IOAPIC_DESTINATION_LOGICAL);
+            route->low |= logical ? DELIVERY_LOWEST_PRIORITY | IOAPIC_DESTINATION_LOGICAL : DELIVERY_FIXED;
+        }
+        route->high = destination << 24;
+
+        // Masked while the two halves disagree, an interrupt in between could go to the new ID read in the old mode
+        bool masked = route->low & (1 << 16);
+        WriteIOAPICRegister(route->ioapic->base, 0x10 + (route->entry * 2), route->low | (1 << 16));
+        WriteIOAPICRegister(route->ioapic->base, 0x11 + (route->entry * 2), route->high);
+        if (!masked) WriteIOAPICRegister(route->ioapic->base, 0x10 + (route->entry * 2), route->low);
+        _ioapicLock.UnlockIrqRestore(flags);
+        return true;
+    }
+
+    bool APIC::SetIRQAffinity(uint8_t irqNum, uint64_t cpuMask) {
+        return SetGSIAffinity(GetIRQGSI(irqNum), cpuMask);
+    }
+
+    bool APIC::SetIRQBalancerAffinity(void* context, uint8_t vector, uint64_t cpuMask) {
+        auto apic = static_cast<APIC*>(context);
+        uint32_t gsi = apic->_vectorGSIs[vector];
+        if (gsi == NO_GSI || (apic->_gsiRoutes[gsi].low & 0xFF) != vector) return false; // Mapped to another vector since
+        return apic->SetGSIAffinity(gsi, cpuMask);
+    }
+
+    void APIC::SetTimerMode(uint32_t mode, bool masked) {
+        WriteLAPICRegister(LVT_TIMER_OFFSET,
+            LVT_VECTOR
+            | (0 << 8)                 // Fixed delivery
+            | ((masked ? 1 : 0) << 16) // Mask
+            | mode
+        );
+    }
+
+    void APIC::SetTimerDivide(uint8_t divideConfig) {
+        // NOTE: The DivConf register does not take a literal integer divisor, it uses a specific encoding
+        //      see figure 11-10 in section 11.5.4 for the correct values (Intel 64 and IA-32 Software Developer's Manual, Volume 3A, page 401)
+        WriteLAPICRegister(DIVIDE_CONFIG_REG_OFFSET, divideConfig);
+    }
+
+    void APIC::SetTimerInitialCount(uint32_t count) {
+        // Writing the initial count (re)starts the countdown, writing 0 stops the timer
+        WriteLAPICRegister(INITIAL_COUNT_REG_OFFSET, count);
+    }
+
+    uint32_t APIC::GetTimerCurrentCount() {
+        return ReadLAPICRegister(CURRENT_COUNT_REG_OFFSET);
+    }
+
+    void APIC::WriteICR(uint32_t destination, uint32_t command) {
+        if (_x2apic) {
+            // One write sends the IPI and there is no delivery status to wait for. Unlike the MMIO write this WRMSR isn't serializing, the fences
+            // make sure the target sees every store made before the IPI (section 11.12.3 of the Intel SDM volume 3A).
+            asm volatile ("mfence; lfence" ::: "memory");
+            Core::CPU::WriteMSR(X2APIC_ICR_MSR, (static_cast<uint64_t>(destination) << 32) | command);
+            return;
+        }
+
+        // Writing the low half sends the IPI, an interrupt handler sending its own IPI in between the two writes would change our destination
+        uint64_t flags = Core::CPU::DisableInterrupts();
+
+        while (ReadLAPICRegister(ICR_LOW_REG_OFFSET) & ICR_DELIVERY_PENDING) {
+            asm volatile ("pause");
+        }
+
+        WriteLAPICRegister(ICR_HIGH_REG_OFFSET, destination << 24);
+        WriteLAPICRegister(ICR_LOW_REG_OFFSET, command);
+        Core::CPU::RestoreInterrupts(flags);
+    }
+
+    void APIC::SendIPI(uint32_t lapicId, uint8_t vector) {
+        WriteICR(lapicId, vector | ICR_DELIVERY_FIXED | ICR_LEVEL_ASSERT);
+    }
+
+    void APIC::SendIPIToOthers(uint8_t vector) {
+        WriteICR(0, vector | ICR_DELIVERY_FIXED | ICR_LEVEL_ASSERT | ICR_ALL_EXCLUDING_SELF);
+    }
+
+    void APIC::SendNMI(uint32_t lapicId) {
+        WriteICR(lapicId, ICR_DELIVERY_NMI | ICR_LEVEL_ASSERT);
+    }
+
+    void APIC::SendInitIPI(uint32_t lapicId) {
+        WriteICR(lapicId, ICR_DELIVERY_INIT | ICR_LEVEL_ASSERT);
+    }
+
+    void APIC::SendStartupIPI(uint32_t lapicId, uint8_t page) {
+        WriteICR(lapicId, page | ICR_DELIVERY_STARTUP | ICR_LEVEL_ASSERT);
     }
 
     void APIC::SendEOI(uint8_t irqNum) {
@@ -101,64 +249,83 @@ namespace Interrupts {
         WriteLAPICRegister(EOI_REG_OFFSET, 0x00);
     }
 
-    void APIC::MapGSI(uint32_t gsi, uint8_t vector, uint8_t deliveryMode, uint8_t polarity, uint8_t trigger) {
-        IOAPICData* APICData = GetIOAPICFromIRQ(gsi);
-        if (!APICData) return;
-
-        uint8_t entry = gsi - APICData->gsiBase;
-        uint32_t low = vector | (deliveryMode << 8) | (polarity << 13) | (trigger << 15) | (1 << 16);
-        uint32_t high = (_LAPICID << 24);
-
-        WriteIOAPICRegister(APICData->base, 0x10 + (entry * 2), low);
-        WriteIOAPICRegister(APICData->base, 0x11 + (entry * 2), high);
+    void APIC::MapGSI(uint32_t gsi, uint8_t vector, uint8_t deliveryMode, uint8_t polarity, uint8_t trigger, uint64_t cpuMask) {
+        if (gsi >= _gsiRouteCount || !_gsiRoutes[gsi].ioapic) return;
+        GSIRoute* route = &_gsiRoutes[gsi];
+
+        uint32_t destination;
+        bool logical;
+        ComposeDestination(cpuMask, destination, logical);
+        if (deliveryMode == 0 && logical) deliveryMode = DELIVERY_LOWEST_PRIORITY >> 8;
+
+        uint64_t flags = _ioapicLock.LockIrqSave();
+        route->low =
+            vector
+            | (deliveryMode << 8)
+            | (logical ? IOAPIC_DESTINATION_LOGICAL : 0)
+            | (polarity << 13)
+            | (trigger << 15)
+            | (1 << 16); // Masked
+        route->high = destination << 24;
+        WriteRoute(route);
+        _ioapicLock.UnlockIrqRestore(flags);
+
+        _vectorGSIs[vector] = gsi;
     }
 
     void APIC::MapIRQ(uint8_t irqNum, uint8_t irqVector) {
-        // Check if there is an override available for this IRQ
-        Core::Firmware::ACPI::MADTIRQSrcOverride* IRQOverride = GetIRQSrcOverride(irqNum);
-        uint32_t gsi = IRQOverride ? IRQOverride->globalSysInterrupt : irqNum;
-
-        // ISA PIC defaults to active high and edge triggered modes
-        uint8_t polarity = 0;
-        uint8_t triggerMode = 0;
-
-        if (IRQOverride) {
-            // Make sure the override IRQ actually matches this IRQ
-            if (IRQOverride->IRQSource != irqNum) {
-                LOG_ERROR("IRQ override source (%u8) does not match IRQ number (%u8)!", IRQOverride->IRQSource, irqNum);
-                PANIC("Invalid IRQ source override!");
-            }
+        // The ISA routes already have the source overrides applied
+        const ISARoute& isaRoute = _isaRoutes[irqNum];
+        if (isaRoute.gsi >= _gsiRouteCount || !_gsiRoutes[isaRoute.gsi].ioapic) {
+            LOG_ERROR("No IOAPICs are set up to handle IRQ #%u8", irqNum);
+            PANIC("No IOAPIC was found for the IRQ!");
+        }
 
-            uint8_t polarityFlags = IRQOverride->flags & 0x03;
-            uint8_t triggerFlags = (IRQOverride->flags >> 2) & 0x03;
+        // ISA interrupts go to the boot CPU only, fixed delivery like with the PIC. Their drivers (PS/2) hand the bytes to deferred
+        // work on the CPU that took the interrupt and rely on that always being the same one, which the balancer keeps as it is the
+        // only CPU in the affinity.
+        MapGSI(isaRoute.gsi, irqVector, 0, isaRoute.polarity, isaRoute.trigger, IRQBalancer::BOOT_CPU);
+        IRQBalancer::Register(irqVector, SetIRQBalancerAffinity, this, IRQBalancer::BOOT_CPU);
+    }
 
-            if (polarityFlags == 0x3) polarity = 1;   // 0x01 means active high, 0x03 means active low
-            if (triggerFlags == 0x3) triggerMode = 1; // 0x01 means edge triggered, 0x03 means level triggered
+    void APIC::BuildRoutes() {
+        // GSIs are numbered across all IOAPICs, with gaps between them if the firmware left any
+        for (size_t i = 0; i < _IOAPICs.Size(); i++) {
+            uint32_t end = _IOAPICs[i]->gsiBase + _IOAPICs[i]->redirectionEntryCount;
+            if (end > _gsiRouteCount) _gsiRouteCount = end;
         }
 
-        IOAPICData* APICData = GetIOAPICFromIRQ(gsi);
-        if (!APICData) {
-            LOG_ERROR("No IOAPICs are set up to handle IRQ #%u8", irqNum);
-            PANIC("No IOAPIC was found for the IRQ!");
+        _gsiRoutes = new GSIRoute[_gsiRouteCount];
+        for (uint32_t gsi = 0; gsi < _gsiRouteCount; gsi++) {
+            IOAPICData* ioapic = GetIOAPICFromIRQ(gsi);
+            if (!ioapic) continue;
+
+            _gsiRoutes[gsi].ioapic = ioapic;
+            _gsiRoutes[gsi].entry = gsi - ioapic->gsiBase;
         }
 
-        uint8_t entry = gsi - APICData->gsiBase;
-        uint32_t low =
-            irqVector
-            | (0 << 8)            // Fixed delivery mode
-            | (0 << 11)           // Physical destination mode
-            | (polarity << 13)    // Polarity
-            | (triggerMode << 15) // Trigger mode
-            | (1 << 16);          // Masked
+        for (uint32_t vector = 0; vector < 256; vector++) _vectorGSIs[vector] = NO_GSI;
+
+        for (uint8_t irqNum = 0; irqNum < 16; irqNum++) {
+            // ISA PIC defaults to active high and edge triggered modes
+            ISARoute& isaRoute = _isaRoutes[irqNum];
+            isaRoute.gsi = irqNum;
+            isaRoute.polarity = 0;
+            isaRoute.trigger = 0;
 
-        // High 32 bits: destination LAPIC ID in bits 56-59 (bits 24-27 of the high register)
-        uint32_t high = ((_LAPICID & 0xFF) << 24);
+            Core::Firmware::ACPI::MADTIRQSrcOverride* IRQOverride = GetIRQSrcOverride(irqNum);
+            if (!IRQOverride) continue;
 
-        WriteIOAPICRegister(APICData->base, 0x10 + (entry * 2), low);
-        WriteIOAPICRegister(APICData->base, 0x11 + (entry * 2), high);
+            uint8_t polarityFlags = IRQOverride->flags & 0x03;
+            uint8_t triggerFlags = (IRQOverride->flags >> 2) & 0x03;
+
+            isaRoute.gsi = IRQOverride->globalSysInterrupt;
+            if (polarityFlags == 0x3) isaRoute.polarity = 1; // 0x01 means active high, 0x03 means active low
+            if (triggerFlags == 0x3) isaRoute.trigger = 1;   // 0x01 means edge triggered, 0x03 means level triggered
+        }
     }
 
-    // NOTE: This APIC init is uniprocessor only, it doesn't yet initialize other per-core APIC chips
+    // NOTE: This sets up the boot CPU's LAPIC and the IOAPICs, application processors only run InitializeLocal
     void APIC::Initialize() {
         // Check if this system has APIC
         if (!_cpu->HasFeature(Core::CPUFeatures::APIC)) {
@@ -172,62 +339,50 @@ namespace Interrupts {
         // Extract the physical APIC base address (bits 12 to 35)
         uint64_t APICBaseIA32 = _cpu->ReadMSR(MSR_IA32_APIC_BASE);
         uint64_t MMIOLAPICPhysAddr = APICBaseIA32 & 0xFFFFFFFFFFFFF000ULL;
-        MMIOLAPICAddr = reinterpret_cast<volatile uint32_t*>(MMIOLAPICPhysAddr);
-        LOG_DEBUG("MMIO LAPIC address is %p.", MMIOLAPICAddr);
-
-        // Check if the system supports x2APIC (bit 10) and that APIC is globally enabled (bit 11)
-        // NOTE: Set up xAPIC if/when it becomes necessary
-        if (APICBaseIA32 & (1ULL << 10)) PANIC("x2APIC mode is enabled, MMIO is not possible!");
-        if ((APICBaseIA32 & (1ULL << 11)) == 0) PANIC("APIC is globally disabled!");
-
-        // Map the LAPIC MMIO region
-        if (MMIOLAPICPhysAddr % Architecture::KernelPageSize != 0) PANIC("LAPIC base address is not page aligned!");
-        _paging->MapPage(
-            MMIOLAPICPhysAddr,
-            MMIOLAPICPhysAddr,
-            Memory::PageFlags::ReadWrite | Memory::PageFlags::NoExecute | Memory::PageFlags::CacheDisable
-        );        
+        if ((APICBaseIA32 & APIC_BASE_GLOBAL_ENABLE) == 0) PANIC("APIC is globally disabled!");
+
+        // Firmware (or Limine, which we ask for it) may have switched to x2APIC mode already, which can't be undone without resetting the
+        // LAPIC. It's the faster mode anyway, so it is used as it is; otherwise the LAPIC stays in xAPIC mode and is accessed through MMIO.
+        _x2apic = APICBaseIA32 & APIC_BASE_X2APIC_ENABLE;
+        if (_x2apic) {
+            if (!_cpu->HasFeature(Core::CPUFeatures::X2APIC)) PANIC("x2APIC mode is enabled, but the CPU doesn't report x2APIC support!");
+            LOG_DEBUG("LAPIC is in x2APIC mode, using MSR access.");
+        }
+        else {
+            MMIOLAPICAddr = reinterpret_cast<volatile uint32_t*>(MMIOLAPICPhysAddr);
+            LOG_DEBUG("MMIO LAPIC address is %p.", MMIOLAPICAddr);
+
+            // Map the LAPIC MMIO region
+            if (MMIOLAPICPhysAddr % Architecture::KernelPageSize != 0) PANIC("LAPIC base address is not page aligned!");
+            _paging->MapPage(
+                MMIOLAPICPhysAddr,
+                MMIOLAPICPhysAddr,
+                Memory::PageFlags::ReadWrite | Memory::PageFlags::NoExecute | Memory::PageFlags::CacheDisable
+            );
+        }
 
         // Find the MADT and LAPIC ID
         _madt = (Core::Firmware::ACPI::MADT*)_acpi->GetTable("APIC");
         if (!_madt) PANIC("Failed to find the MADT!");
-        _LAPICID = (ReadLAPICRegister(LAPIC_ID_REG_OFFSET) >> 24) & 0xFF;
+        _LAPICID = GetCurrentLAPICID();
 
-        // Now we need to configure the Spurious Interrupt Vector Register
-        WriteLAPICRegister(SPIRV_REG_OFFSET, SPIRV_VECTOR | (1 << 8));
-        if ((ReadLAPICRegister(SPIRV_REG_OFFSET) & (1 << 8)) == 0) PANIC("Failed to configure LAPIC spurious vector register, bit 8 (software enable) of LAPIC SPIRV is not set!");
-
-        // We should mask all of the Local Vector Table entries to put the LAPIC into a controlled state, this disables interrupts during initialization
-        MaskLVTEntry(LVT_TIMER_OFFSET);
-        MaskLVTEntry(LVT_LINT0_OFFSET);
-        MaskLVTEntry(LVT_LINT1_OFFSET);
-        MaskLVTEntry(LVT_ERROR_OFFSET);
+        // The IOAPIC destination field is 8 bits wide, larger x2APIC IDs are only reachable through interrupt remapping
+        if (_LAPICID > 0xFF) {
+            LOG_ERROR("The boot CPU has x2APIC ID %u32, which IOAPIC interrupts can't be delivered to without interrupt remapping.", _LAPICID);
+            PANIC("Boot CPU APIC ID doesn't fit the IOAPIC destination field!");
+        }
 
         // The 8259 PIC chip MUST be disabled before APIC can be used
         _pic->Disable();
 
-        // We need to clear the Error Status Register by writing to it *TWICE*. After this we can issue an initial End Of Interrupt by writing 0x0 to offset 0xB0
-        WriteLAPICRegister(ERROR_STATUS_REG_OFFSET, 0x00);
-        WriteLAPICRegister(ERROR_STATUS_REG_OFFSET, 0x00);
-        WriteLAPICRegister(EOI_REG_OFFSET, 0x00);
+        // Interrupts for several CPUs need a logical destination that names them all: the flat model has a bit for each of up to 8
+        // CPUs, the cluster model groups up to 60 into clusters of 4. x2APIC mode stays physical, see DestinationModel.
+        uint64_t cpuCount = mp_request.response ? mp_request.response->cpu_count : 1;
+        if (_x2apic) _destinationModel = DestinationModel::Physical;
+        else if (cpuCount <= MAX_FLAT_CPUS) _destinationModel = DestinationModel::Flat;
+        else _destinationModel = DestinationModel::Cluster;
 
-        // Now we can set up a vector for the LVT timer, we'll use 0x40 to avoid IRQ conflicts with vectors 0x21-0x2F
-        WriteLAPICRegister(LVT_TIMER_OFFSET, 
-            LVT_VECTOR
-            | (0 << 8)  // Fixed delivery
-            | (0 << 16) // Unmasked
-            | (1 << 17) // Periodic mode
-        );
-
-        // We set the division configuration register to 16, and the initial count register to 10^7; this triggers a very fast interrupt
-        // NOTE: The DivConf register does not take a literal integer divisor, it uses a specific encoding
-        //      see figure 11-10 in section 11.5.4 for the correct values (Intel 64 and IA-32 Software Developer's Manual, Volume 3A, page 401)
-        WriteLAPICRegister(DIVIDE_CONFIG_REG_OFFSET, 0b011);
-        WriteLAPICRegister(INITIAL_COUNT_REG_OFFSET, 10000000);
-
-        // Finally, set the task priority register (TPR) to 0 so no interrupts are blocked
-        // NOTE: Interrupts below <TPR value> are blocked, so we set it to 0 becasue there are no interrupts less than 0
-        WriteLAPICRegister(TPR_REG_OFFSET, MINIMUM_IRQ_NUM);
+        InitializeLocal();
 
 
 
@@ -301,6 +456,8 @@ namespace Interrupts {
             _IOAPICs.Add(data);
         }
 
+        BuildRoutes();
+
 
 
         // --- IRQ SETUP ---
@@ -316,4 +473,63 @@ namespace Interrupts {
         // Finally, enable interrupts again so this whole init process has a purpose and isn't here for shits and giggles
         asm volatile ("sti");
     }
+
+    void APIC::InitializeLocal() {
+        // Application processors normally come up in the boot CPU's mode, but nothing guarantees it when firmware enabled x2APIC itself
+        uint64_t apicBase = _cpu->ReadMSR(MSR_IA32_APIC_BASE);
+        if (_x2apic && !(apicBase & APIC_BASE_X2APIC_ENABLE)) {
+            _cpu->WriteMSR(MSR_IA32_APIC_BASE, apicBase | APIC_BASE_GLOBAL_ENABLE | APIC_BASE_X2APIC_ENABLE);
+        }
+        else if (!_x2apic && (apicBase & APIC_BASE_X2APIC_ENABLE)) {
+            PANIC("This CPU's LAPIC is in x2APIC mode while the boot CPU's is in xAPIC mode!");
+        }
+
+        // Every CPU needs the same logical destination model, and its own bits in it. CPUs past the end of the model are only
+        // reachable through physical destinations.
+        uint32_t index = Core::PerCPU::Get()->Index;
+        uint32_t lapicId = GetCurrentLAPICID();
+        uint8_t logicalID = 0;
+        if (_destinationModel == DestinationModel::Flat && index < MAX_FLAT_CPUS) logicalID = 1 << index;
+        else if (_destinationModel == DestinationModel::Cluster && index < MAX_CLUSTER_CPUS) logicalID = ((index / 4) << 4) | (1 << (index % 4));
+
+        if (!_x2apic) {
+            WriteLAPICRegister(DFR_REG_OFFSET, _destinationModel == DestinationModel::Cluster ? DFR_CLUSTER_MODEL : DFR_FLAT_MODEL);
+            WriteLAPICRegister(LDR_REG_OFFSET, logicalID << 24);
+        }
+
+        if (index < MAX_CPUS) {
+            _lapicIDs[index] = lapicId;
+            _logicalIDs[index] = logicalID;
+            if (lapicId <= 0xFF) __atomic_or_fetch(&_destinationMask, 1ULL << index, __ATOMIC_RELEASE);
+        }
+
+        // Now we need to configure the Spurious Interrupt Vector Register
+        WriteLAPICRegister(SPIRV_REG_OFFSET, SPIRV_VECTOR | (1 << 8));
+        if ((ReadLAPICRegister(SPIRV_REG_OFFSET) & (1 << 8)) == 0) PANIC("Failed to configure LAPIC spurious vector register, bit 8 (software enable) of LAPIC SPIRV is not set!");
+
+        // We should mask all of the Local Vector Table entries to put the LAPIC into a controlled state, this disables interrupts during initialization
+        MaskLVTEntry(LVT_TIMER_OFFSET);
+        MaskLVTEntry(LVT_LINT0_OFFSET);
+        MaskLVTEntry(LVT_LINT1_OFFSET);
+        MaskLVTEntry(LVT_ERROR_OFFSET);
+
+        // We need to clear the Error Status Register by writing to it *TWICE*. After this we can issue an initial End Of Interrupt by writing 0x0 to offset 0xB0
+        WriteLAPICRegister(ERROR_STATUS_REG_OFFSET, 0x00);
+        WriteLAPICRegister(ERROR_STATUS_REG_OFFSET, 0x00);
+        WriteLAPICRegister(EOI_REG_OFFSET, 0x00);
+
+        // The LVT timer gets vector 0x40 to avoid IRQ conflicts with vectors 0x21-0x2F. It stays masked and stopped here, the clock event layer
+        // programs it in one-shot or TSC-deadline mode for the next timer deadline instead of letting it interrupt periodically.
+        SetTimerMode(LVT_TIMER_ONESHOT, true);
+        SetTimerInitialCount(0);
+
+        // Finally, set the task priority register (TPR) to 0 so no interrupts are blocked
+        // NOTE: Interrupts below <TPR value> are blocked, so we set it to 0 becasue there are no interrupts less than 0
+        WriteLAPICRegister(TPR_REG_OFFSET, MINIMUM_IRQ_NUM);
+    }
+
+    uint32_t APIC::GetCurrentLAPICID() {
+        if (_x2apic) return ReadLAPICRegister(LAPIC_ID_REG_OFFSET);
+        return (ReadLAPICRegister(LAPIC_ID_REG_OFFSET) >> 24) & 0xFF;
+    }
 }
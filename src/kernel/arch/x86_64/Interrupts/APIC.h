@@ -7,17 +7,20 @@
 #include "Utility/List.h"
 #include "../Core/Firmware/ACPI.h"
 #include "../Core/CPU.h"
+#include "../Core/Sync/SpinLock.h"
 #include "../Memory/Paging.h"
 #include "IDT.h"
 #include "PIC.h"
 
 // APIC information was provided by the Intel 64 and IA-32 Software Developer's Manual, Volume 3A, Chapter 11
 // See Table 11-1 on pages 390-391 for a table of LAPIC register offsets and their properties (only the second "half" of the address is used)
+// In x2APIC mode (section 11.12) the same registers are MSRs at X2APIC_MSR_BASE + offset / 16, and the ICR is a single 64 bit MSR.
 namespace Interrupts {
     class APIC : public InterruptController {
         public:
             explicit APIC(Core::Firmware::ACPI* acpi, Core::CPU* cpu, PIC* pic, Memory::Paging* paging, IDT* idt);
             void Initialize() override;
+            void InitializeLocal(); // Enables the LAPIC of the calling CPU and puts it into a known state, with every LVT entry masked
 
             // Register offsets
             static constexpr uint32_t IOAPIC_VERSION_REG_OFFSET = 0x01;
@@ -28,7 +31,12 @@ namespace Interrupts {
             static constexpr uint32_t EOI_REG_OFFSET            = 0xB0;
             static constexpr uint32_t TPR_REG_OFFSET            = 0x80;
             static constexpr uint32_t INITIAL_COUNT_REG_OFFSET  = 0x380;
+            static constexpr uint32_t CURRENT_COUNT_REG_OFFSET  = 0x390;
             static constexpr uint32_t DIVIDE_CONFIG_REG_OFFSET  = 0x3E0;
+            static constexpr uint32_t ICR_LOW_REG_OFFSET        = 0x300;
+            static constexpr uint32_t ICR_HIGH_REG_OFFSET       = 0x310;
+            static constexpr uint32_t LDR_REG_OFFSET            = 0xD0;
+            static constexpr uint32_t DFR_REG_OFFSET            = 0xE0;
 
             // LVT offsets
             static constexpr uint32_t LVT_TIMER_OFFSET = 0x320;
@@ -40,17 +48,84 @@ namespace Interrupts {
             static constexpr uint32_t SPIRV_VECTOR = 0xFF;
             static constexpr uint32_t LVT_VECTOR   = 0x40;
 
+            // LVT timer modes (bits 17-18 of the LVT timer register)
+            static constexpr uint32_t LVT_TIMER_ONESHOT      = 0b00 << 17;
+            static constexpr uint32_t LVT_TIMER_PERIODIC     = 0b01 << 17;
+            static constexpr uint32_t LVT_TIMER_TSC_DEADLINE = 0b10 << 17;
+
+            // Interrupt command register (ICR) fields, see section 11.6.1 of the Intel SDM volume 3A
+            static constexpr uint32_t ICR_DELIVERY_FIXED   = 0b000 << 8;
+            static constexpr uint32_t ICR_DELIVERY_NMI     = 0b100 << 8;
+            static constexpr uint32_t ICR_DELIVERY_INIT    = 0b101 << 8;
+            static constexpr uint32_t ICR_DELIVERY_STARTUP = 0b110 << 8;
+            static constexpr uint32_t ICR_DELIVERY_PENDING = 1 << 12; // Read only, set while the previous IPI hasn't been accepted yet
+            static constexpr uint32_t ICR_LEVEL_ASSERT     = 1 << 14;
+            static constexpr uint32_t ICR_ALL_EXCLUDING_SELF = 0b11 << 18;
+
+            // Delivery and destination modes, the same bits in IOAPIC redirection entries and MSI data (section 11.11.2)
+            static constexpr uint32_t DELIVERY_FIXED           = 0b000 << 8;
+            static constexpr uint32_t DELIVERY_LOWEST_PRIORITY = 0b001 << 8;
+            static constexpr uint32_t IOAPIC_DESTINATION_LOGICAL = 1 << 11;
+
+            // MSI message format, see section 11.11 of the Intel SDM volume 3A
+            static constexpr uint64_t MSI_ADDRESS_BASE = 0xFEE00000;
+            static constexpr uint64_t MSI_ADDRESS_LOGICAL = 1 << 2; // Destination mode
+            static constexpr uint64_t MSI_ADDRESS_REDIRECTION_HINT = 1 << 3; // Lowest priority delivery among the destination CPUs
+
+            // Logical destinations (section 11.6.2.2): in the flat model every CPU has one of 8 bits, in the cluster model the high
+            // nibble picks one of 15 clusters and the low nibble one of 4 CPUs in it
+            static constexpr uint32_t DFR_FLAT_MODEL    = 0xFFFFFFFF;
+            static constexpr uint32_t DFR_CLUSTER_MODEL = 0x0FFFFFFF;
+            static constexpr uint32_t MAX_FLAT_CPUS     = 8;
+            static constexpr uint32_t MAX_CLUSTER_CPUS  = 60;
+            static constexpr uint32_t MAX_CPUS          = 64; // Core::SMP::MAX_CPUS, which can't be included here
+
             // Entry types
             static constexpr uint8_t IRQ_SRCOVR_ENTRY_TYPE = 0x02;
             static constexpr uint8_t IOAPIC_ENTRY_TYPE     = 0x01;
 
+            // IA32_APIC_BASE bits
+            static constexpr uint64_t APIC_BASE_X2APIC_ENABLE = 1ULL << 10;
+            static constexpr uint64_t APIC_BASE_GLOBAL_ENABLE = 1ULL << 11;
+
+            // x2APIC registers
+            static constexpr uint32_t X2APIC_MSR_BASE = 0x800;
+            static constexpr uint32_t X2APIC_ICR_MSR  = 0x830;
+
             // Misc
             static constexpr uint32_t MSR_IA32_APIC_BASE = 0x1B;
             static constexpr uint8_t  MINIMUM_IRQ_NUM    = 0x00;
             static constexpr uint8_t  IRQ_OFFSET         = 0x20;
 
-            uint8_t GetLAPICID() const { return _LAPICID; }
-            void MapGSI(uint32_t gsi, uint8_t vector, uint8_t deliveryMode, uint8_t polarity, uint8_t trigger);
+            uint32_t GetLAPICID() const { return _LAPICID; } // Of the boot CPU
+            uint32_t GetCurrentLAPICID(); // Of the calling CPU, 32 bits wide in x2APIC mode
+            [[nodiscard]] bool IsX2APIC() const { return _x2apic; }
+
+            /// Routes the GSI to vector on the CPUs in cpuMask (CPU indices, see Core::PerCPU::Index). With fixed delivery the destination
+            /// decides: one CPU gets fixed delivery, several get lowest priority delivery to their logical destination.
+            void MapGSI(uint32_t gsi, uint8_t vector, uint8_t deliveryMode, uint8_t polarity, uint8_t trigger, uint64_t cpuMask = 1);
+            void MaskGSI(uint32_t gsi);
+            void UnmaskGSI(uint32_t gsi);
+            bool SetGSIAffinity(uint32_t gsi, uint64_t cpuMask); // Returns false if no IOAPIC handles the GSI
+            bool SetIRQAffinity(uint8_t irqNum, uint64_t cpuMask); // For ISA IRQs, through their source override
+            [[nodiscard]] uint32_t GetIRQGSI(uint8_t irqNum) const;
+
+            // LAPIC timer, the timer is left masked by Initialize until a clock event device takes it over
+            void SetTimerMode(uint32_t mode, bool masked);
+            void SetTimerDivide(uint8_t divideConfig);
+            void SetTimerInitialCount(uint32_t count);
+            [[nodiscard]] uint32_t GetTimerCurrentCount();
+
+            // Inter-processor interrupts
+            void SendIPI(uint32_t lapicId, uint8_t vector);
+            void SendIPIToOthers(uint8_t vector); // Every CPU except the calling one
+            void SendNMI(uint32_t lapicId);
+            void SendInitIPI(uint32_t lapicId);
+            void SendStartupIPI(uint32_t lapicId, uint8_t page); // The CPU starts in real mode at page * 4KiB
+
+            /// The address and data a PCI device writes to raise the vector on the CPUs in cpuMask. CPUs that can't be a destination
+            /// (see ComposeDestination) are left out.
+            void ComposeMSIMessage(uint64_t cpuMask, uint8_t vector, uint64_t& address, uint32_t& data);
 
         private:
             struct IOAPICData {
@@ -59,6 +134,29 @@ namespace Interrupts {
                 uint8_t redirectionEntryCount;
             };
 
+            // Precomputed in Initialize, so masking and retargeting a GSI is an array lookup
+            struct GSIRoute {
+                IOAPICData* ioapic = nullptr; // Null if no IOAPIC handles the GSI
+                uint8_t entry = 0;
+                uint32_t low = 1 << 16; // Copy of the redirection entry, it is never read back from the IOAPIC
+                uint32_t high = 0;
+            };
+
+            // Where an ISA IRQ ends up, after its source override if it has one
+            struct ISARoute {
+                uint32_t gsi;
+                uint8_t polarity;
+                uint8_t trigger;
+            };
+
+            enum class DestinationModel : uint8_t {
+                Physical, // x2APIC: logical x2APIC IDs don't fit the 8 bit destination of IOAPICs and MSI without interrupt remapping
+                Flat,
+                Cluster
+            };
+
+            static constexpr uint32_t NO_GSI = 0xFFFFFFFF;
+
             void WriteIOAPICRegister(volatile uint32_t* base, uint8_t regOffset, uint32_t value);
             void WriteLAPICRegister(uint32_t regOffset, uint32_t value);
             
@@ -67,6 +165,16 @@ namespace Interrupts {
 
             Core::Firmware::ACPI::MADTIRQSrcOverride* GetIRQSrcOverride(uint8_t irqNum);
             IOAPICData* GetIOAPICFromIRQ(uint32_t irqNum);
+            void BuildRoutes();
+            GSIRoute* GetRoute(uint32_t gsi);
+            void WriteRoute(GSIRoute* route); // _ioapicLock must be held
+
+            /// The destination field for cpuMask and whether it is logical. Online CPUs whose LAPIC ID fits in 8 bits can be destinations;
+            /// without any of them in the mask it is the boot CPU. Several CPUs only share a logical destination within one cluster,
+            /// the one of the lowest CPU in the mask.
+            void ComposeDestination(uint64_t cpuMask, uint32_t& destination, bool& logical);
+            static bool SetIRQBalancerAffinity(void* context, uint8_t vector, uint64_t cpuMask);
+            void WriteICR(uint32_t destination, uint32_t command);
             void UnmaskLVTEntry(uint32_t regOffset);
             void MaskLVTEntry(uint32_t regOffset);
             void MaskIRQ(uint8_t irqNum) override;
@@ -84,8 +192,20 @@ namespace Interrupts {
             PIC* _pic;
             IDT* _idt;
 
-            volatile uint32_t* MMIOLAPICAddr;
+            volatile uint32_t* MMIOLAPICAddr = nullptr; // Unused in x2APIC mode
             uint32_t _LAPICID;
+            bool _x2apic = false; // Every CPU uses the mode the boot CPU was left in by the firmware or the bootloader
+
+            Core::Sync::SpinLock _ioapicLock; // IOREGSEL and IOWIN are one register pair per IOAPIC, and the routes are shared
+            GSIRoute* _gsiRoutes = nullptr;
+            uint32_t _gsiRouteCount = 0;
+            ISARoute _isaRoutes[16] {};
+            uint32_t _vectorGSIs[256] {}; // The GSI routed to each vector, NO_GSI if none, for the IRQ balancer
+
+            DestinationModel _destinationModel = DestinationModel::Physical;
+            uint32_t _lapicIDs[MAX_CPUS] {}; // By CPU index, filled in by InitializeLocal
+            uint8_t _logicalIDs[MAX_CPUS] {}; // Logical destination bits by CPU index, 0 if the CPU has none
+            volatile uint64_t _destinationMask = 0; // CPUs that interrupts can be routed to
     };
 }
 
@@ -8,8 +8,7 @@ extern "C" {
 }
 
 namespace Interrupts {
-    uint64_t GDT::entries[8]; // Null, Code, Data, TSS low and high, UserCode, UserData
-    GDT::GDTPointer GDT::gdtp;
+    GDT::Table GDT::_bootTable;
 
     /*void GDT::SetEntry(int index, uint32_t base, uint32_t limit, uint8_t access, uint8_t granularity) {
         GDTEntry entry = {};
@@ -25,7 +24,7 @@ namespace Interrupts {
         entries[index] = *reinterpret_cast<uint64_t*>(&entry);
     }*/
 
-    void GDT::SetEntry(int index, uint32_t base, uint32_t limit, uint8_t access, uint8_t granularity) {
+    void GDT::SetEntry(uint64_t* entries, int index, uint32_t base, uint32_t limit, uint8_t access, uint8_t granularity) {
         GDTEntry entry = {};
         entry.LimitLow    = limit & 0xFFFF;
         entry.BaseLow     = base & 0xFFFF;
@@ -37,7 +36,7 @@ namespace Interrupts {
         memcpy(&entries[index], &entry, sizeof(uint64_t));
     }
 
-    void GDT::SetTSSDescriptor(int index, uint64_t base, uint32_t limit) {
+    void GDT::SetTSSDescriptor(uint64_t* entries, int index, uint64_t base, uint32_t limit) {
         uint64_t low = 0;
         uint64_t high = 0;
 
@@ -55,33 +54,42 @@ namespace Interrupts {
 
     void GDT::Initialize() {
         TSS::Initialize();
-        auto tss_address = reinterpret_cast<uintptr_t>(TSS::GetTSSStruct());
+        InitializeForCPU(&_bootTable, TSS::GetTSSStruct());
+    }
+
+    void GDT::InitializeForCPU(Table* table, TSS::TSSStruct* tss) {
+        uint64_t* entries = table->Entries;
+        auto tss_address = reinterpret_cast<uintptr_t>(tss);
 
         // Null descriptor
-        SetEntry(0, 0, 0, 0, 0);
+        SetEntry(entries, 0, 0, 0, 0, 0);
 
         // Code segment descriptor
-        SetEntry(1, 0, 0xFFFFF, 0x9A, 0xA0);
+        SetEntry(entries, 1, 0, 0xFFFFF, 0x9A, 0xA0);
 
         // Data segment descriptor
-        SetEntry(2, 0, 0xFFFFF, 0x92, 0xA0);
+        SetEntry(entries, 2, 0, 0xFFFFF, 0x92, 0xA0);
 
         // TSS descriptor
-        SetTSSDescriptor(3, tss_address, sizeof(TSS::TSSStruct) - 1);
+        SetTSSDescriptor(entries, 3, tss_address, sizeof(TSS::TSSStruct) - 1);
 
         // User mode code segment descriptor
-        SetEntry(5, 0, 0xFFFFF, 0xF2, 0xC0); // star anchor
-        SetEntry(6, 0, 0xFFFFF, 0xF2, 0xA0); // UserData 64 DPL=3 SS on SYSRET
-        SetEntry(7, 0, 0xFFFFF, 0xFA, 0xA0); // UserCode 64 DPL=3 CS on SYSRET, L bit set
+        SetEntry(entries, 5, 0, 0xFFFFF, 0xF2, 0xC0); // star anchor
+        SetEntry(entries, 6, 0, 0xFFFFF, 0xF2, 0xA0); // UserData 64 DPL=3 SS on SYSRET
+        SetEntry(entries, 7, 0, 0xFFFFF, 0xFA, 0xA0); // UserCode 64 DPL=3 CS on SYSRET, L bit set
 
-        gdtp.Limit = sizeof(entries) - 1;
-        gdtp.Base = reinterpret_cast<uint64_t>(&entries);
+        table->Pointer.Limit = sizeof(table->Entries) - 1;
+        table->Pointer.Base = reinterpret_cast<uint64_t>(entries);
 
-        LoadGDT(reinterpret_cast<uint64_t>(&gdtp));
+        LoadGDT(reinterpret_cast<uint64_t>(&table->Pointer));
         LoadTSS(0x18); // TSS selector is at offset 0x18 in the GDT (3rd entry, 3 * 8 = 0x18)
     }
 
     GDT::GDTPointer * GDT::GetGDTPointer() {
-        return &gdtp;
+        return &_bootTable.Pointer;
+    }
+
+    GDT::Table* GDT::GetBootTable() {
+        return &_bootTable;
     }
 } // Interrupts
\ No newline at end of file
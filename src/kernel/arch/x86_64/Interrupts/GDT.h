@@ -3,8 +3,27 @@
 
 #include <Definitions.h>
 
+#include "TSS.h"
+
 namespace Interrupts {
     class GDT {
+    public:
+        struct PACKED GDTPointer {
+            uint16_t Limit;
+            uint64_t Base;
+        };
+
+        // Every CPU needs its own GDT, since the TSS descriptor is marked busy when it's loaded and each CPU has its own TSS
+        struct ALIGNED(16) Table {
+            uint64_t Entries[8]; // Null, Code, Data, TSS low and high, UserCode, UserData
+            GDTPointer Pointer;
+        };
+
+        static void Initialize(); // Loads the boot CPU's GDT and TSS
+        static void InitializeForCPU(Table* table, TSS::TSSStruct* tss); // Builds the GDT for a CPU with the given TSS and loads both on the calling CPU
+        static GDTPointer* GetGDTPointer();
+        static Table* GetBootTable();
+
     private:
         struct PACKED GDTEntry {
             uint16_t LimitLow;
@@ -15,19 +34,9 @@ namespace Interrupts {
             uint8_t BaseHigh;
         };
 
-        struct PACKED GDTPointer {
-            uint16_t Limit;
-            uint64_t Base;
-        };
-
-        static uint64_t entries[8]; // Null, Code, Data, TSS, UserCode, UserData
-        static GDTPointer gdtp;
-        static void SetEntry(int index, uint32_t base, uint32_t limit, uint8_t access, uint8_t granularity);
-        static void SetTSSDescriptor(int index, uint64_t base, uint32_t limit);
-
-    public:
-        static void Initialize();
-        static GDTPointer* GetGDTPointer();
+        static Table _bootTable;
+        static void SetEntry(uint64_t* entries, int index, uint32_t base, uint32_t limit, uint8_t access, uint8_t granularity);
+        static void SetTSSDescriptor(uint64_t* entries, int index, uint64_t base, uint32_t limit);
     };
 } // Interrupts
 
@@ -6,6 +6,7 @@ extern "C" {
 
 #include "Kernel.h"
 #include "../KernelData.h"
+#include "../Core/PerCPU.h"
 
 static const char* ExceptionNames[] = {
     "<FATAL_CPU_EXCEPTION_0> Division By Zero",
@@ -49,6 +50,12 @@ extern "C" {
 extern "C" uint64_t dbg_regs[];
 
 namespace Interrupts {
+    static inline uint64_t ReadCycles() {
+        uint32_t low, high;
+        asm volatile ("rdtsc" : "=a"(low), "=d"(high));
+        return (static_cast<uint64_t>(high) << 32) | low;
+    }
+
     IDT::IDT(InterruptController *ic) {
         this->_ic = ic;
     }
@@ -66,9 +73,14 @@ namespace Interrupts {
         }
 
         // Override the stack for DF, GPF and PF to use the IST entry 1.
-        _idtEntries[8].IST = 1; // Double Fault
-        _idtEntries[13].IST = 1; // General Protection Fault
-        _idtEntries[14].IST = 1; // Page Fault
+        _idtEntries[8].IST = TSS::FAULT_IST; // Double Fault
+        _idtEntries[13].IST = TSS::FAULT_IST; // General Protection Fault
+        _idtEntries[14].IST = TSS::FAULT_IST; // Page Fault
+
+        // NMIs and machine checks can hit any instruction, including the syscall entry before its swapgs and a fault handler that is
+        // still on the fault stack, so they get a stack of their own
+        _idtEntries[2].IST = TSS::NMI_IST; // Non-Maskable Interrupt
+        _idtEntries[18].IST = TSS::NMI_IST; // Machine Check
 
         for (auto & _exceptionHandler : _exceptionHandlers) {
             _exceptionHandler = nullptr; // Initialize exception handlers to nullptr
@@ -78,7 +90,18 @@ namespace Interrupts {
             _irqHandler = nullptr; // Initialize IRQ handlers to nullptr
         }
 
-        asm volatile("lidt %0" : : "m" (_idtPointer)); // Load the IDT
+        for (auto & action : _irqActions) {
+            action = { nullptr, nullptr };
+        }
+
+        // Everything outside the dynamic range is either used by the CPU or has a fixed owner
+        for (uint32_t vector = 0; vector < 256; vector++) {
+            bool dynamic = vector >= DYNAMIC_VECTOR_START && vector <= DYNAMIC_VECTOR_END;
+            if (dynamic) _usedVectors[vector / 64] &= ~(1ULL << (vector % 64));
+            else _usedVectors[vector / 64] |= 1ULL << (vector % 64);
+        }
+
+        Load();
         asm volatile("sti"); // Enable interrupts after loading IDT
 
         _isTesting = true;
@@ -87,6 +110,10 @@ namespace Interrupts {
         _isTesting = false;
     }
 
+    void IDT::Load() const {
+        asm volatile("lidt %0" : : "m" (_idtPointer)); // Load the IDT
+    }
+
     void IDT::RegisterExceptionHandler(uint8_t exceptionVector, void(*handler)()) {
         if (exceptionVector >= 32) {
             LOG_ERROR("Attempted to register an exception handler for vector %u8, which is not a CPU exception vector!", exceptionVector);
@@ -100,16 +127,98 @@ namespace Interrupts {
         _irqHandlers[irq] = handler;
     }
 
+    void IDT::RegisterIRQHandler(uint8_t irq, IRQContextHandler handler, void *context) {
+        // The interrupt handler reads the function first, so the context must be in place before the function that uses it
+        __atomic_store_n(&_irqActions[irq].Context, context, __ATOMIC_RELAXED);
+        __atomic_store_n(&_irqActions[irq].Function, handler, __ATOMIC_RELEASE);
+    }
+
+    uint8_t IDT::AllocateVectors(uint32_t count) {
+        if (count == 0 || count > 32) return 0;
+
+        uint32_t size = 1;
+        while (size < count) size <<= 1;
+
+        uint64_t flags = _vectorLock.LockIrqSave();
+        uint8_t first = 0;
+        for (uint32_t start = (DYNAMIC_VECTOR_START + size - 1) & ~(size - 1); start + size - 1 <= DYNAMIC_VECTOR_END; start += size) {
+            // A block never crosses a word, it is at most 32 vectors and aligned to its size
+            uint64_t mask = ((1ULL << size) - 1) << (start % 64);
+            if (_usedVectors[start / 64] & mask) continue;
+
+            _usedVectors[start / 64] |= mask;
+            first = static_cast<uint8_t>(start);
+            break;
+        }
+        _vectorLock.UnlockIrqRestore(flags);
+
+        if (!first) LOG_WARNING("No block of %u32 free interrupt vectors is left!", size);
+        return first;
+    }
+
+    void IDT::FreeVectors(uint8_t firstVector, uint32_t count) {
+        uint32_t size = 1;
+        while (size < count) size <<= 1;
+
+        uint64_t flags = _vectorLock.LockIrqSave();
+        for (uint32_t vector = firstVector; vector < firstVector + size && vector <= DYNAMIC_VECTOR_END; vector++) {
+            if (vector < DYNAMIC_VECTOR_START) continue;
+
+            uint8_t irq = vector - 32;
+            _irqHandlers[irq] = nullptr;
+            __atomic_store_n(&_irqActions[irq].Function, nullptr, __ATOMIC_RELEASE);
+            _usedVectors[vector / 64] &= ~(1ULL << (vector % 64));
+        }
+        _vectorLock.UnlockIrqRestore(flags);
+    }
+
+    uint32_t IDT::GetFreeVectorCount() {
+        uint64_t flags = _vectorLock.LockIrqSave();
+        uint32_t count = 0;
+        for (uint32_t vector = DYNAMIC_VECTOR_START; vector <= DYNAMIC_VECTOR_END; vector++) {
+            if (!(_usedVectors[vector / 64] & (1ULL << (vector % 64)))) count++;
+        }
+        _vectorLock.UnlockIrqRestore(flags);
+        return count;
+    }
+
     void IDT::IRQHandler(uint8_t irq, Registers *registers) {
+        [[maybe_unused]] uint64_t start = SETTING_IRQ_STAT ? ReadCycles() : 0;
+        Core::PerCPU* cpu = Core::PerCPU::Get();
+
+        // Written with a plain store, only this CPU writes its counters and the readers only need whole values
+        uint64_t& count = cpu->InterruptCounts[irq + 32];
+        __atomic_store_n(&count, count + 1, __ATOMIC_RELAXED);
+
+        // Spurious interrupts are nothing the LAPIC has in service, an EOI would end whatever interrupt it does have in service
+        if (irq + 32 == APIC::SPIRV_VECTOR) {
+            cpu->SpuriousInterrupts++;
+            return;
+        }
+
+        if (cpu->InterruptDepth) cpu->NestedInterrupts++;
+        cpu->InterruptDepth++;
+        if (cpu->InterruptDepth > cpu->MaxInterruptDepth) cpu->MaxInterruptDepth = cpu->InterruptDepth;
+
         Memory::Paging::PagingState* backupState = nullptr;
         if (_pagingInitialized) {
             backupState = _paging->GetCurrentPagingState();
         }
 
+        bool handled = false;
         if (_irqHandlers[irq] != nullptr) {
             _irqHandlers[irq]();
+            handled = true;
         }
 
+        IRQContextHandler action = __atomic_load_n(&_irqActions[irq].Function, __ATOMIC_ACQUIRE);
+        if (action) {
+            action(__atomic_load_n(&_irqActions[irq].Context, __ATOMIC_ACQUIRE));
+            handled = true;
+        }
+
+        if (!handled) cpu->UnhandledInterrupts++;
+
         if (_pagingInitialized) {
             // Check if the handler changed the paging state, and if so, switch back to the kernel's paging state before sending EOI
             if (backupState != _paging->GetCurrentPagingState()) {
@@ -118,6 +227,156 @@ namespace Interrupts {
         }
 
         _ic->SendEOI(irq);
+
+#if SETTING_IRQ_STAT
+        if (cpu->InterruptStats) cpu->InterruptStats->HandlerCycles[irq].Record(ReadCycles() - start);
+#endif
+
+        RunDeferredWork();
+        cpu->InterruptDepth--;
+
+        // Switching threads only after the EOI keeps the interrupt controller from holding back same or lower priority interrupts
+        // until the interrupted thread runs again. The other thread's stack still has its own interrupt frame to return through.
+        auto scheduler = cpu->Scheduler;
+        if (scheduler) scheduler->PreemptIfNeeded();
+    }
+
+    void IDT::QueueDeferredWork(DeferredWork *work) {
+        // Claimed atomically, so an item queued from two CPUs at once still only runs once
+        if (__atomic_exchange_n(&work->Queued, true, __ATOMIC_ACQUIRE)) return;
+
+        uint64_t flags = Core::CPU::DisableInterrupts();
+        Core::PerCPU* cpu = Core::PerCPU::Get();
+        work->Next = nullptr;
+        if (cpu->DeferredWorkTail) cpu->DeferredWorkTail->Next = work;
+        else cpu->DeferredWork = work;
+        cpu->DeferredWorkTail = work;
+        Core::CPU::RestoreInterrupts(flags);
+    }
+
+    void IDT::RunDeferredWork() {
+        Core::PerCPU* cpu = Core::PerCPU::Get();
+
+        // Interrupts that arrive while the work runs only queue more, the outermost handler runs all of it in order
+        if (!cpu->DeferredWork || cpu->InDeferredWork) return;
+        cpu->InDeferredWork = true;
+
+        // The list belongs to this CPU, so the interrupted thread must not be switched away (and maybe to another CPU) until it's empty
+        Core::Time::Scheduler::DisablePreemption();
+        [[maybe_unused]] uint64_t start = SETTING_IRQ_STAT ? ReadCycles() : 0;
+
+        while (DeferredWork* work = cpu->DeferredWork) {
+            cpu->DeferredWork = work->Next;
+            if (!cpu->DeferredWork) cpu->DeferredWorkTail = nullptr;
+
+            // Cleared before it runs, so an interrupt during the run queues it again instead of being lost
+            __atomic_store_n(&work->Queued, false, __ATOMIC_RELEASE);
+
+            asm volatile ("sti" ::: "memory");
+            work->Function(work->Context);
+            asm volatile ("cli" ::: "memory");
+        }
+
+#if SETTING_IRQ_STAT
+        if (cpu->InterruptStats) cpu->InterruptStats->DeferredWorkCycles.Record(ReadCycles() - start);
+#endif
+
+        Core::Time::Scheduler::EnablePreemption();
+        cpu->InDeferredWork = false;
+    }
+
+    // What sits behind the fixed vectors, for the statistics
+    static const char* VectorName(uint8_t vector, char* buffer, size_t size) {
+        if (vector >= APIC::IRQ_OFFSET && vector < APIC::IRQ_OFFSET + 16) {
+            Utility::StringFormatter::snprintf(buffer, size, "ISA IRQ %u8", static_cast<uint8_t>(vector - APIC::IRQ_OFFSET));
+            return buffer;
+        }
+
+        switch (vector) {
+            case APIC::LVT_VECTOR: return "LAPIC timer";
+            case Core::Time::HPETClockEvent::VECTOR: return "HPET";
+            case Core::SMP::CALL_FUNCTION_VECTOR: return "call function IPI";
+            case Core::SMP::RESCHEDULE_VECTOR: return "reschedule IPI";
+            case APIC::SPIRV_VECTOR: return "spurious";
+            default: break;
+        }
+
+        if (vector >= IDT::DYNAMIC_VECTOR_START && vector <= IDT::DYNAMIC_VECTOR_END) return "MSI/MSI-X";
+        return "-";
+    }
+
+    void IDT::DumpStatistics() {
+        auto data = Kernel<KernelData>::GetInstance()->ArchitectureData;
+        Core::SMP* smp = data->Smp;
+        uint32_t cpuCount = smp ? smp->GetCPUCount() : 1;
+        auto getCPU = [smp](uint32_t index) { return smp ? smp->GetCPU(index) : Core::PerCPU::Get(); };
+
+        uint64_t uptimeMs = Core::Time::GetNanoseconds() / 1'000'000;
+        char line[1024];
+        char cell[32];
+        char name[32];
+        size_t length = 0;
+
+        // StringFormatter has no field widths, the columns are right aligned by hand
+        auto appendColumn = [&line, &length](size_t width, const char* text) {
+            size_t textLength = 0;
+            while (text[textLength]) textLength++;
+            for (size_t i = textLength; i < width && length + 1 < sizeof(line); i++) line[length++] = ' ';
+            length += Utility::StringFormatter::snprintf(line + length, sizeof(line) - length, "%s", text);
+        };
+
+        LOG_INFO("Interrupts (handler times are TSC reference cycles until the EOI, over all CPUs):");
+        appendColumn(10, "vector");
+        for (uint32_t cpu = 0; cpu < cpuCount; cpu++) {
+            Utility::StringFormatter::snprintf(cell, sizeof(cell), "CPU%u32", cpu);
+            appendColumn(12, cell);
+        }
+        appendColumn(12, "total");
+        appendColumn(10, "per s");
+        Utility::StringFormatter::snprintf(line + length, sizeof(line) - length, "  handler avg/p99/max  source");
+        LOG_INFO("%s", line);
+
+        for (uint32_t vector = APIC::IRQ_OFFSET; vector < 256; vector++) {
+            uint64_t total = 0;
+            Utility::Histogram cycles;
+            for (uint32_t cpu = 0; cpu < cpuCount; cpu++) {
+                Core::PerCPU* perCPU = getCPU(cpu);
+                total += __atomic_load_n(&perCPU->InterruptCounts[vector], __ATOMIC_RELAXED);
+                if (perCPU->InterruptStats) cycles.Merge(perCPU->InterruptStats->HandlerCycles[vector - APIC::IRQ_OFFSET]);
+            }
+            if (!total) continue;
+
+            length = 0;
+            Utility::StringFormatter::snprintf(cell, sizeof(cell), "0x%x32:", vector);
+            appendColumn(10, cell);
+            for (uint32_t cpu = 0; cpu < cpuCount; cpu++) {
+                Utility::StringFormatter::snprintf(cell, sizeof(cell), "%u64", __atomic_load_n(&getCPU(cpu)->InterruptCounts[vector], __ATOMIC_RELAXED));
+                appendColumn(12, cell);
+            }
+            Utility::StringFormatter::snprintf(cell, sizeof(cell), "%u64", total);
+            appendColumn(12, cell);
+            Utility::StringFormatter::snprintf(cell, sizeof(cell), "%u64", uptimeMs ? total * 1000 / uptimeMs : 0);
+            appendColumn(10, cell);
+            Utility::StringFormatter::snprintf(line + length, sizeof(line) - length, "  %u64/%u64/%u64  %s", cycles.Average(), cycles.Percentile(990),
+                                      cycles.Max, VectorName(vector, name, sizeof(name)));
+            LOG_INFO("%s", line);
+        }
+
+        for (uint32_t cpu = 0; cpu < cpuCount; cpu++) {
+            Core::PerCPU* perCPU = getCPU(cpu);
+            LOG_INFO("  CPU %u32: %u64 spurious, %u64 unhandled, %u64 nested (deepest nesting %u32).", cpu, perCPU->SpuriousInterrupts,
+                     perCPU->UnhandledInterrupts, perCPU->NestedInterrupts, perCPU->MaxInterruptDepth);
+
+            if (perCPU->InterruptStats && perCPU->InterruptStats->DeferredWorkCycles.Count) {
+                const Utility::Histogram& deferred = perCPU->InterruptStats->DeferredWorkCycles;
+                LOG_INFO("  CPU %u32 deferred work (cycles): %u64 runs, avg %u64, p99 <= %u64, max %u64", cpu, deferred.Count,
+                         deferred.Average(), deferred.Percentile(990), deferred.Max);
+            }
+        }
+
+#if !SETTING_IRQ_STAT
+        LOG_INFO("Interrupt handler times are disabled, set SETTING_IRQ_STAT to collect them.");
+#endif
     }
 
     void IDT::HandleException(uint32_t exceptionVector, uint32_t errorCode, Registers *registers) const {
@@ -2,11 +2,33 @@
 #define BOREALOS_IDT_H
 
 #include <Definitions.h>
+#include <Settings.h>
+#include <Utility/Histogram.h>
 
 #include "PIC.h"
 #include "Memory/Paging.h"
+#include "../Core/Sync/SpinLock.h"
 
 namespace Interrupts {
+    typedef void (*DeferredFunction)(void* context);
+    typedef void (*IRQContextHandler)(void* context);
+
+    /// Work an interrupt handler hands off so that it runs after the EOI with interrupts enabled (a bottom half).
+    /// Queueing an item that is already queued does nothing, so it runs once for any number of interrupts before it got to run.
+    struct DeferredWork {
+        DeferredFunction Function = nullptr;
+        void* Context = nullptr;
+        DeferredWork* Next = nullptr;
+        volatile bool Queued = false;
+    };
+
+    /// Interrupt handler durations of one CPU, collected while SETTING_IRQ_STAT is enabled. The counters that are always kept are in
+    /// Core::PerCPU. Only the owning CPU writes it, with interrupts disabled.
+    struct InterruptStatistics {
+        Utility::Histogram HandlerCycles[224]; // By IRQ (vector - 32): TSC cycles from entering IRQHandler until the EOI
+        Utility::Histogram DeferredWorkCycles; // One run of the deferred work queue, interrupts that came in meanwhile included
+    };
+
     class IDT {
     public:
         struct PACKED IDTEntry {
@@ -33,9 +55,29 @@ namespace Interrupts {
         explicit IDT(InterruptController* ic);
 
         void Initialize();
+        void Load() const; // Loads this IDT on the calling CPU, all CPUs share it
         void RegisterExceptionHandler(uint8_t exceptionVector, void (*handler)(void));
         void RegisterIRQHandler(uint8_t irq, void (*handler)(void));
+        /// Handlers registered with a context get it passed on every interrupt, so one function can serve e.g. every queue of a device.
+        /// A null handler removes the registration. The interrupt source must be masked (or not enabled yet) while a handler is replaced.
+        void RegisterIRQHandler(uint8_t irq, IRQContextHandler handler, void* context);
+
+        /// Vectors for interrupts that nothing has a fixed number for, MSI and MSI-X in particular. Returns the first of count vectors
+        /// (rounded up to a power of two, aligned to it as multi-message MSI requires), 0 if there is no such block left.
+        uint8_t AllocateVectors(uint32_t count);
+        void FreeVectors(uint8_t firstVector, uint32_t count); // Also removes the handlers of the vectors
+        [[nodiscard]] uint32_t GetFreeVectorCount();
+
+        // Vectors below are fixed (exceptions, legacy IRQs, LAPIC timer, HPET), the ones above are SMP and spurious interrupts
+        static constexpr uint8_t DYNAMIC_VECTOR_START = 0x50;
+        static constexpr uint8_t DYNAMIC_VECTOR_END   = 0xEF;
         void IRQHandler(uint8_t irq, Registers *registers);
+        /// Queues work on the calling CPU, which runs it when the outermost interrupt handler returns. Meant for interrupt handlers,
+        /// which should only take the data off the device and leave the rest to deferred work. Queued elsewhere, it waits for the next interrupt.
+        static void QueueDeferredWork(DeferredWork* work);
+        /// Logs a /proc/interrupts style table over serial: per vector the count on every CPU, the rate since boot and the handler
+        /// durations, then the spurious, unhandled and nested interrupts of every CPU
+        static void DumpStatistics();
         void HandleException(uint32_t exceptionVector, uint32_t errorCode, Registers *registers) const;
         void UnmaskIRQ(uint8_t uint8) const;
         void MaskIRQ(uint8_t uint8) const;
@@ -47,7 +89,17 @@ namespace Interrupts {
         IDTPointer _idtPointer = {0, 0};
         void (*_exceptionHandlers[32])(void) = { nullptr };
         void (*_irqHandlers[256])(void) = { nullptr };
+
+        struct IRQAction {
+            IRQContextHandler Function;
+            void* Context;
+        };
+
+        IRQAction _irqActions[256] = {};
+        uint64_t _usedVectors[4] = {}; // Bit n of word n / 64 is set if vector n is taken, only dynamic vectors are ever clear
+        Core::Sync::SpinLock _vectorLock;
         void SetIDTEntry(uint8_t vector, uint64_t isr, uint8_t flags);
+        static void RunDeferredWork();
         bool _isTesting = false;
 
         Memory::Paging* _paging;
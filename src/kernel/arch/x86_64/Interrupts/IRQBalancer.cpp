@@ -0,0 +1,170 @@
+#include "IRQBalancer.h"
+
+#include "Kernel.h"
+#include "../KernelData.h"
+
+namespace Interrupts {
+    static_assert(APIC::MAX_CPUS == Core::SMP::MAX_CPUS, "The APIC keeps destinations for every CPU the balancer may pick");
+
+    Core::Sync::SpinLock IRQBalancer::_lock;
+    IRQBalancer::Source IRQBalancer::_sources[256] = {};
+    Core::Threading::WorkItem* IRQBalancer::_work = nullptr;
+    bool IRQBalancer::_started = false;
+
+    void IRQBalancer::Register(uint8_t vector, AffinityFunction function, void *context, uint64_t affinity) {
+        uint64_t flags = _lock.LockIrqSave();
+        Source& source = _sources[vector];
+        source.Function = function;
+        source.Context = context;
+        source.Allowed = affinity;
+        source.Current = affinity;
+        source.Pinned = false;
+        source.Rate = 0;
+
+        // The counters of a reused vector still hold what its previous owner got
+        source.LastCount = _started ? CountInterrupts(Kernel<KernelData>::GetInstance()->ArchitectureData->Smp, vector) : 0;
+        _lock.UnlockIrqRestore(flags);
+    }
+
+    void IRQBalancer::Unregister(uint8_t vector) {
+        uint64_t flags = _lock.LockIrqSave();
+        _sources[vector] = Source();
+        _lock.UnlockIrqRestore(flags);
+    }
+
+    bool IRQBalancer::SetAffinity(uint8_t vector, uint64_t cpuMask) {
+        if (!cpuMask) return false;
+
+        uint64_t flags = _lock.LockIrqSave();
+        Source& source = _sources[vector];
+        bool set = source.Function && source.Function(source.Context, vector, cpuMask);
+        if (set) {
+            source.Current = cpuMask;
+            source.Pinned = true;
+        }
+        _lock.UnlockIrqRestore(flags);
+
+        if (!set) LOG_WARNING("Couldn't set the affinity of interrupt vector 0x%x8.", vector);
+        return set;
+    }
+
+    void IRQBalancer::Unpin(uint8_t vector) {
+        uint64_t flags = _lock.LockIrqSave();
+        Source& source = _sources[vector];
+        if (source.Function && source.Pinned) {
+            source.Pinned = false;
+            if (source.Function(source.Context, vector, source.Allowed)) source.Current = source.Allowed;
+        }
+        _lock.UnlockIrqRestore(flags);
+    }
+
+    uint64_t IRQBalancer::GetAffinity(uint8_t vector) {
+        uint64_t flags = _lock.LockIrqSave();
+        uint64_t affinity = _sources[vector].Function ? _sources[vector].Current : 0;
+        _lock.UnlockIrqRestore(flags);
+        return affinity;
+    }
+
+    void IRQBalancer::Start() {
+        auto data = Kernel<KernelData>::GetInstance()->ArchitectureData;
+
+        // Sources registered during boot could only be pointed at the boot CPU, the destinations now include the other CPUs
+        uint64_t flags = _lock.LockIrqSave();
+        for (uint32_t vector = 0; vector < 256; vector++) {
+            Source& source = _sources[vector];
+            if (!source.Function) continue;
+
+            source.Function(source.Context, vector, source.Current);
+            source.LastCount = CountInterrupts(data->Smp, vector);
+        }
+        _started = true;
+        _lock.UnlockIrqRestore(flags);
+
+        _work = new Core::Threading::WorkItem();
+        _work->Function = BalanceWork;
+        data->SystemWorkQueue->QueueDelayed(_work, BALANCE_INTERVAL_NS);
+    }
+
+    void IRQBalancer::Balance() {
+        Core::SMP* smp = Kernel<KernelData>::GetInstance()->ArchitectureData->Smp;
+        uint64_t online = smp->GetOnlineMask();
+
+        uint64_t load[Core::SMP::MAX_CPUS] = {}; // Interrupts per interval each CPU got from the sources placed so far
+        uint8_t busy[256];
+        size_t busyCount = 0;
+
+        uint64_t flags = _lock.LockIrqSave();
+        for (uint32_t vector = 0; vector < 256; vector++) {
+            Source& source = _sources[vector];
+            if (!source.Function) continue;
+
+            uint64_t count = CountInterrupts(smp, vector);
+            source.Rate = count - source.LastCount;
+            source.LastCount = count;
+
+            if (!source.Pinned && source.Rate >= MIN_BALANCE_RATE) {
+                busy[busyCount++] = vector;
+                continue;
+            }
+
+            // A source that went quiet may use all of its CPUs again
+            if (!source.Pinned && source.Current != source.Allowed && source.Function(source.Context, vector, source.Allowed)) {
+                source.Current = source.Allowed;
+            }
+
+            // Load we can't move still decides where the busy sources fit
+            uint64_t current = source.Current & online;
+            if (current && !(current & (current - 1))) load[__builtin_ctzll(current)] += source.Rate;
+        }
+
+        // Busiest first, so the big ones get the emptiest CPUs and the small ones fill the gaps
+        for (size_t i = 1; i < busyCount; i++) {
+            uint8_t vector = busy[i];
+            size_t j = i;
+            while (j > 0 && _sources[busy[j - 1]].Rate < _sources[vector].Rate) {
+                busy[j] = busy[j - 1];
+                j--;
+            }
+            busy[j] = vector;
+        }
+
+        for (size_t i = 0; i < busyCount; i++) {
+            Source& source = _sources[busy[i]];
+            uint64_t allowed = source.Allowed & online;
+            if (!allowed) continue;
+
+            uint32_t best = __builtin_ctzll(allowed);
+            for (uint64_t rest = allowed; rest; rest &= rest - 1) {
+                uint32_t cpu = __builtin_ctzll(rest);
+                if (load[cpu] < load[best]) best = cpu;
+            }
+
+            // Staying put unless the move takes off more than half the source's rate keeps two similar sources from trading places
+            // every round, and the source's data in the cache of the CPU that handles it
+            uint32_t target = best;
+            uint64_t current = source.Current & allowed;
+            if (current && !(current & (current - 1))) {
+                uint32_t currentCPU = __builtin_ctzll(current);
+                if (load[currentCPU] <= load[best] + source.Rate / 2) target = currentCPU;
+            }
+
+            load[target] += source.Rate;
+            uint64_t mask = 1ULL << target;
+            if (mask != source.Current && source.Function(source.Context, busy[i], mask)) source.Current = mask;
+        }
+        _lock.UnlockIrqRestore(flags);
+    }
+
+    uint64_t IRQBalancer::CountInterrupts(Core::SMP *smp, uint8_t vector) {
+        uint64_t count = 0;
+        for (uint32_t i = 0; i < smp->GetCPUCount(); i++) {
+            count += __atomic_load_n(&smp->GetCPU(i)->InterruptCounts[vector], __ATOMIC_RELAXED);
+        }
+        return count;
+    }
+
+    void IRQBalancer::BalanceWork(void *context) {
+        Balance();
+        Kernel<KernelData>::GetInstance()->ArchitectureData->SystemWorkQueue->QueueDelayed(_work, BALANCE_INTERVAL_NS);
+    }
+}
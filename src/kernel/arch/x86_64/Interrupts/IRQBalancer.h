@@ -0,0 +1,64 @@
+#ifndef BOREALOS_IRQBALANCER_H
+#define BOREALOS_IRQBALANCER_H
+
+#include <Definitions.h>
+
+#include "../Core/SMP.h"
+#include "../Core/Sync/SpinLock.h"
+#include "../Core/Threading/WorkQueue.h"
+
+namespace Interrupts {
+    /// Moves the destinations of device interrupts to the CPUs that have time for them. Interrupt sources (IOAPIC pins, MSI and MSI-X
+    /// vectors) register with the function that retargets them. Once a second the balancer reads how often every vector fired from the
+    /// per-CPU counters, and points each busy source at a single CPU, busiest first, picking the least loaded one its affinity allows.
+    /// Quiet sources keep their affinity, with more than one CPU in it the interrupt controller picks one per interrupt.
+    /// A driver that wants a queue's interrupt on the CPU that consumes the queue's data pins it with SetAffinity, the balancer leaves
+    /// pinned sources alone.
+    class IRQBalancer {
+    public:
+        /// Points the source behind vector at cpuMask, returns false if it can't (anymore)
+        typedef bool (*AffinityFunction)(void* context, uint8_t vector, uint64_t cpuMask);
+
+        static constexpr uint64_t ALL_CPUS = ~0ULL;
+        static constexpr uint64_t BOOT_CPU = 1ULL << 0;
+
+        /// Called by whoever programs the source, affinity is the set of CPUs it may be moved between
+        static void Register(uint8_t vector, AffinityFunction function, void* context, uint64_t affinity = ALL_CPUS);
+        static void Unregister(uint8_t vector);
+
+        /// Pins the source to cpuMask until Unpin and programs it right away. Returns false if nothing registered the vector or
+        /// the source couldn't be retargeted.
+        static bool SetAffinity(uint8_t vector, uint64_t cpuMask);
+        static void Unpin(uint8_t vector); // Hands the source back to the balancer
+        [[nodiscard]] static uint64_t GetAffinity(uint8_t vector); // Where the source currently points, 0 if it isn't registered
+
+        /// Reprograms every source for the CPUs that came online since it registered and balances once a second from then on.
+        /// After SMP and the system workqueue are up.
+        static void Start();
+        static void Balance(); // One balancing round, Start schedules them
+
+        static constexpr uint64_t BALANCE_INTERVAL_NS = 1'000'000'000; // 1s
+        static constexpr uint64_t MIN_BALANCE_RATE = 100; // Interrupts per interval, quieter sources aren't worth moving
+
+    private:
+        struct Source {
+            AffinityFunction Function = nullptr;
+            void* Context = nullptr;
+            uint64_t Allowed = 0; // The CPUs it registered with
+            uint64_t Current = 0; // Where the source points right now
+            uint64_t LastCount = 0; // Sum of the per-CPU counters at the last round
+            uint64_t Rate = 0; // Interrupts in the last interval
+            bool Pinned = false;
+        };
+
+        static Core::Sync::SpinLock _lock;
+        static Source _sources[256]; // Indexed by vector
+        static Core::Threading::WorkItem* _work;
+        static bool _started;
+
+        static uint64_t CountInterrupts(Core::SMP* smp, uint8_t vector); // Over every online CPU
+        static void BalanceWork(void* context);
+    };
+}
+
+#endif //BOREALOS_IRQBALANCER_H
@@ -0,0 +1,175 @@
+#include "Moderation.h"
+
+#include "Kernel.h"
+#include "../KernelData.h"
+#include "../Core/PerCPU.h"
+#include "../Core/Time/Scheduler.h"
+
+namespace Interrupts {
+    Core::Sync::SpinLock InterruptModerator::_listLock;
+    InterruptModerator* InterruptModerator::_first = nullptr;
+
+    InterruptModerator::InterruptModerator(const char *name, PollFunction poll, ControlFunction control, void *context, const ModerationConfig &config)
+        : _name(name), _poll(poll), _control(control), _context(context), _config(config) {
+        if (!_poll) PANIC("Interrupt moderator without a poll function!");
+        if (!_config.Budget) _config.Budget = 1;
+
+        if (_config.MaxInterruptRate) {
+            uint64_t limit = static_cast<uint64_t>(_config.MaxInterruptRate) * RATE_WINDOW_NS / 1'000'000'000;
+            _windowLimit = limit ? static_cast<uint32_t>(limit) : 1;
+        }
+
+        _timer.function = TimerExpired;
+        _timer.context = this;
+        _work.Function = RunWork;
+        _work.Context = this;
+
+        uint64_t flags = _listLock.LockIrqSave();
+        _next = _first;
+        _first = this;
+        _listLock.UnlockIrqRestore(flags);
+    }
+
+    void InterruptModerator::Interrupt() {
+        uint64_t flags = _lock.LockIrqSave();
+        _statistics.Interrupts++;
+        _batchInterrupts++;
+
+        if (_config.MaxInterruptRate && !_polling) {
+            uint64_t now = Core::Time::GetNanoseconds();
+            if (now - _windowStart >= RATE_WINDOW_NS) {
+                _windowStart = now;
+                _windowInterrupts = 0;
+            }
+
+            if (++_windowInterrupts > _windowLimit) {
+                EnterPolling(now);
+                _statistics.RateLimited++;
+            }
+        }
+
+        Schedule(_polling ? _config.PollIntervalNs : _config.CoalesceNs);
+        _lock.UnlockIrqRestore(flags);
+    }
+
+    ModerationStatistics InterruptModerator::GetStatistics() {
+        uint64_t flags = _lock.LockIrqSave();
+        ModerationStatistics statistics = _statistics;
+        _lock.UnlockIrqRestore(flags);
+        return statistics;
+    }
+
+    void InterruptModerator::DumpStatistics() {
+        uint64_t listFlags = _listLock.LockIrqSave();
+        InterruptModerator* first = _first;
+        _listLock.UnlockIrqRestore(listFlags);
+
+        // Moderators are never destroyed, so the list can be walked without the lock
+        if (!first) {
+            LOG_INFO("Interrupt moderation: no moderated interrupt sources.");
+            return;
+        }
+
+        LOG_INFO("Interrupt moderation (events are what the poll functions reported handling):");
+        for (InterruptModerator* moderator = first; moderator; moderator = moderator->_next) {
+            ModerationStatistics statistics = moderator->GetStatistics();
+
+            // In hundredths, StringFormatter has no floating point
+            uint64_t perInterrupt = statistics.Interrupts ? statistics.Events * 100 / statistics.Interrupts : 0;
+            uint64_t perPoll = statistics.Polls ? statistics.Events * 100 / statistics.Polls : 0;
+
+            LOG_INFO("  %s: %u64 interrupts, %u64 events, %u64.%u64%u64 events per interrupt, %u64 polls (%u64.%u64%u64 events each), %u64 batches",
+                     moderator->_name, statistics.Interrupts, statistics.Events, perInterrupt / 100, perInterrupt % 100 / 10, perInterrupt % 10,
+                     statistics.Polls, perPoll / 100, perPoll % 100 / 10, perPoll % 10, statistics.Batches);
+            LOG_INFO("    events per batch avg %u64 p99 %u64 max %u64, interrupts per batch avg %u64 p99 %u64 max %u64",
+                     statistics.EventsPerBatch.Average(), statistics.EventsPerBatch.Percentile(990), statistics.EventsPerBatch.Max,
+                     statistics.InterruptsPerBatch.Average(), statistics.InterruptsPerBatch.Percentile(990), statistics.InterruptsPerBatch.Max);
+            LOG_INFO("    switched to polling %u64 times for a full budget, %u64 times for the rate limit%s",
+                     statistics.PollModeEntries, statistics.RateLimited, moderator->_polling ? ", polled right now" : "");
+        }
+    }
+
+    void InterruptModerator::Schedule(uint64_t delayNs) {
+        if (_pending) return;
+        _pending = true;
+
+        // The timer is armed on the CPU that took the interrupt, so the poll runs where the handler touched the device's data.
+        // A CPU without a timer can't delay it, it runs with the next deferred work instead.
+        Core::PerCPU* cpu = Core::PerCPU::Get();
+        if (delayNs && cpu->Scheduler && cpu->ClockEvent) cpu->Scheduler->ArmTimer(&_timer, delayNs);
+        else IDT::QueueDeferredWork(&_work);
+    }
+
+    void InterruptModerator::EnterPolling(uint64_t now) {
+        _polling = true;
+        _pollingSince = now;
+        if (_control) _control(_context, false);
+    }
+
+    void InterruptModerator::Run() {
+        uint64_t flags = _lock.LockIrqSave();
+        _pending = false;
+
+        // One poll at a time, the one that runs polls again for this one
+        if (_running) {
+            _rerun = true;
+            _lock.UnlockIrqRestore(flags);
+            return;
+        }
+        _running = true;
+
+        while (true) {
+            _rerun = false;
+            _lock.UnlockIrqRestore(flags);
+            uint32_t handled = _poll(_context, _config.Budget);
+            flags = _lock.LockIrqSave();
+
+            _statistics.Polls++;
+            _statistics.Events += handled;
+            _batchEvents += handled;
+            uint64_t now = Core::Time::GetNanoseconds();
+
+            // More is waiting than one poll may take, an interrupt per event would only add to the backlog
+            if (handled >= _config.Budget) {
+                if (!_polling) {
+                    EnterPolling(now);
+                    _statistics.PollModeEntries++;
+                }
+                break;
+            }
+
+            if (_rerun) continue;
+
+            if (_polling) {
+                // Staying polled for a whole window keeps a source that just went over the rate limit from flapping
+                if (now - _pollingSince < RATE_WINDOW_NS) break;
+
+                _polling = false;
+                if (_control) _control(_context, true);
+
+                // An edge triggered source doesn't interrupt for events that arrived while it was disabled, one more poll picks them up
+                continue;
+            }
+
+            _statistics.Batches++;
+            _statistics.EventsPerBatch.Record(_batchEvents);
+            _statistics.InterruptsPerBatch.Record(_batchInterrupts);
+            _batchEvents = 0;
+            _batchInterrupts = 0;
+            break;
+        }
+
+        if (_polling) Schedule(_config.PollIntervalNs);
+        _running = false;
+        _lock.UnlockIrqRestore(flags);
+    }
+
+    void InterruptModerator::TimerExpired(void *context) {
+        // Timers run in the clock event interrupt, the poll runs after its EOI
+        IDT::QueueDeferredWork(&static_cast<InterruptModerator*>(context)->_work);
+    }
+
+    void InterruptModerator::RunWork(void *context) {
+        static_cast<InterruptModerator*>(context)->Run();
+    }
+}
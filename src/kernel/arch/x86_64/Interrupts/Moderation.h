@@ -0,0 +1,96 @@
+#ifndef BOREALOS_MODERATION_H
+#define BOREALOS_MODERATION_H
+
+#include <Definitions.h>
+#include <Utility/Histogram.h>
+
+#include "IDT.h"
+#include "../Core/Sync/SpinLock.h"
+#include "../Core/Time/TimerWheel.h"
+
+namespace Interrupts {
+    struct ModerationConfig {
+        uint32_t Budget = 64; // Events one poll may handle, a poll that uses all of it switches the source to polling
+        uint64_t CoalesceNs = 0; // How long after the first interrupt of a batch the poll runs, 0 polls right after the EOI
+        uint32_t MaxInterruptRate = 0; // Interrupts per second before the source is switched to polling, 0 for no limit
+        uint64_t PollIntervalNs = 1'000'000; // Time between two polls while the source is polled, 1ms
+    };
+
+    struct ModerationStatistics {
+        uint64_t Interrupts = 0;
+        uint64_t Events = 0; // What the poll function reported handling
+        uint64_t Polls = 0;
+        uint64_t Batches = 0; // From the first interrupt until a poll found the device drained
+        uint64_t PollModeEntries = 0; // Because a poll used its whole budget
+        uint64_t RateLimited = 0; // Because the source went over MaxInterruptRate
+        Utility::Histogram EventsPerBatch;
+        Utility::Histogram InterruptsPerBatch;
+    };
+
+    /// Interrupt moderation for devices that interrupt once per event: the interrupt handler only calls Interrupt, and the events
+    /// are handled by the poll function, in batches, after the EOI (like Linux's NAPI).
+    /// - Coalescing: the poll runs CoalesceNs after the first interrupt of a batch (on a scheduler timer of the CPU that took it),
+    ///   so every event that arrives meanwhile is handled by the same poll.
+    /// - Polling: a poll that handled its whole budget, or a source that interrupts faster than MaxInterruptRate, switches the source
+    ///   to polling. Its interrupt is disabled through the control function and it's polled every PollIntervalNs until a poll finds
+    ///   it drained, at least RATE_WINDOW_NS after it was switched.
+    /// A driver opts in by owning one per interrupt source. Nothing allocates after construction, so Interrupt is safe in any handler.
+    class InterruptModerator {
+    public:
+        /// Handles at most budget events and returns how many it handled, fewer than budget means the device is drained
+        typedef uint32_t (*PollFunction)(void* context, uint32_t budget);
+        /// Enables or disables the source's interrupt (e.g. masks the IRQ or the device's interrupt enable bit). Without one a polled
+        /// source keeps interrupting, the interrupts are counted but don't schedule polls.
+        typedef void (*ControlFunction)(void* context, bool enable);
+
+        static constexpr uint64_t RATE_WINDOW_NS = 10'000'000; // 10ms
+
+        InterruptModerator(const char* name, PollFunction poll, ControlFunction control, void* context, const ModerationConfig& config = {});
+        InterruptModerator(const InterruptModerator&) = delete;
+        InterruptModerator& operator=(const InterruptModerator&) = delete;
+
+        /// From the source's interrupt handler
+        void Interrupt();
+
+        [[nodiscard]] ModerationStatistics GetStatistics();
+        [[nodiscard]] bool IsPolling() const { return _polling; }
+
+        /// Logs the statistics of every moderator
+        static void DumpStatistics();
+
+    private:
+        const char* _name;
+        PollFunction _poll;
+        ControlFunction _control;
+        void* _context;
+        ModerationConfig _config;
+
+        Core::Sync::SpinLock _lock;
+        Core::Time::Timer _timer;
+        DeferredWork _work;
+        bool _pending = false; // A poll is scheduled, on the timer or as deferred work
+        bool _running = false; // A CPU is in the poll function
+        bool _rerun = false; // A poll was scheduled while another one ran, it polls again before it stops
+        bool _polling = false;
+        uint64_t _pollingSince = 0;
+        uint64_t _windowStart = 0;
+        uint32_t _windowInterrupts = 0;
+        uint32_t _windowLimit = 0; // MaxInterruptRate scaled to RATE_WINDOW_NS
+        uint32_t _batchInterrupts = 0;
+        uint64_t _batchEvents = 0;
+        ModerationStatistics _statistics;
+
+        InterruptModerator* _next = nullptr;
+        static Core::Sync::SpinLock _listLock;
+        static InterruptModerator* _first;
+
+        void Schedule(uint64_t delayNs); // With _lock held
+        void EnterPolling(uint64_t now); // With _lock held
+        void Run();
+
+        static void TimerExpired(void* context);
+        static void RunWork(void* context);
+    };
+}
+
+#endif //BOREALOS_MODERATION_H
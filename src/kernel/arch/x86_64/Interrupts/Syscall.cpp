@@ -3,32 +3,173 @@
 #include "Kernel.h"
 #include "KernelData.h"
 #include "TSS.h"
+#include "Core/FPU.h"
+#include "Core/PerCPU.h"
+#include "Core/SMP.h"
+#include "Core/Time/Scheduler.h"
+#include "Benchmarks/Benchmarks.h"
+#include <Settings.h>
 
 #define MSR_EFER 0xC0000080
 #define MSR_STAR 0xC0000081
 #define MSR_LSTAR 0xC0000082
 #define MSR_FMASK 0xC0000084
 
+#define RFLAGS_TF (1 << 8)
+#define RFLAGS_IF (1 << 9)
+#define RFLAGS_DF (1 << 10)
+#define RFLAGS_NT (1 << 14)
+#define RFLAGS_AC (1 << 18)
+
+using Interrupts::Syscall;
+
+namespace {
+    void SyscallNull() {
+
+    }
+
+    uint32_t SyscallGetCPU() {
+        return Core::PerCPU::Get()->Index;
+    }
+
+    uint64_t SyscallGetTime() {
+        return Core::Time::GetNanoseconds();
+    }
+
+    void SyscallYield() {
+        Core::PerCPU::Get()->Scheduler->Yield();
+    }
+
+    void SyscallSleep(uint64_t nanoseconds) {
+        Core::PerCPU::Get()->Scheduler->Sleep(nanoseconds);
+    }
+
+    int64_t SyscallReportSyscallBenchmark(uint64_t iterations, uint64_t totalCycles, uint64_t minCycles) {
+        #if SETTING_BENCHMARK_MODE
+        Benchmarks::ReportSyscallBenchmark(iterations, totalCycles, minCycles);
+        Syscall::DumpStatistics();
+        return 0;
+        #else
+        return Syscall::ERROR_INVALID_SYSCALL;
+        #endif
+    }
+
+    struct SyscallTable {
+        Syscall::Entry Entries[Syscall::COUNT];
+    };
+
+    constexpr SyscallTable BuildSyscallTable() {
+        SyscallTable table {};
+        auto set = [&table](Syscall::Number number, Syscall::Entry entry) { table.Entries[static_cast<uint64_t>(number)] = entry; };
+
+        set(Syscall::Number::Null, Syscall::MakeEntry<SyscallNull>("Null", true));
+        set(Syscall::Number::GetCPU, Syscall::MakeEntry<SyscallGetCPU>("GetCPU", true));
+        set(Syscall::Number::GetTime, Syscall::MakeEntry<SyscallGetTime>("GetTime", true));
+        set(Syscall::Number::Yield, Syscall::MakeEntry<SyscallYield>("Yield", false));
+        set(Syscall::Number::Sleep, Syscall::MakeEntry<SyscallSleep>("Sleep", false));
+        set(Syscall::Number::ReportSyscallBenchmark, Syscall::MakeEntry<SyscallReportSyscallBenchmark>("ReportSyscallBenchmark", false));
+        return table;
+    }
+
+    constexpr SyscallTable SYSCALL_TABLE = BuildSyscallTable();
+
+    constexpr bool HasEveryHandler(const SyscallTable& table) {
+        for (const Syscall::Entry& entry : table.Entries) {
+            if (!entry.Function || !entry.Name) return false;
+        }
+        return true;
+    }
+
+    static_assert(HasEveryHandler(SYSCALL_TABLE), "Every syscall number needs an entry in the syscall table!");
+    static_assert(Syscall::COUNT == 6, "Syscall.S hardcodes the number of syscalls");
+
+}
+
+// The fast path in Syscall.S indexes this by RAX, null means the syscall takes the full path
+struct LeafHandlerTable {
+    Syscall::Handler Handlers[Syscall::COUNT];
+};
+
+static constexpr LeafHandlerTable BuildLeafHandlerTable() {
+    LeafHandlerTable table {};
+    for (uint64_t i = 0; i < Syscall::COUNT; i++) {
+        if (SYSCALL_TABLE.Entries[i].Leaf) table.Handlers[i] = SYSCALL_TABLE.Entries[i].Function;
+    }
+    return table;
+}
+
 extern "C" {
     extern void SyscallHandler();
     extern void EnterUserspace(uint64_t entryPoint, uint64_t userStack);
 
+    extern const LeafHandlerTable SyscallLeafHandlers;
+    constinit const LeafHandlerTable SyscallLeafHandlers = BuildLeafHandlerTable();
+
     void KernelSyscallHandler(Interrupts::Syscall::SyscallFrame* frame) {
-        // For testing purposes, we'll just log the syscall number and return it incremented by 1.
-        LOG_INFO("Syscall invoked with hex: 0x%x64", frame->rax);
-        frame->rax += 1; // Increment the syscall number as a dummy "result"
+        Core::PerCPU* cpu = Core::PerCPU::Get();
+        if (frame->rax >= Syscall::COUNT) {
+            cpu->InvalidSyscalls++;
+            frame->rax = static_cast<uint64_t>(Syscall::ERROR_INVALID_SYSCALL);
+            return;
+        }
+
+        // Counted before interrupts are enabled, a handler that blocks may continue on another CPU
+        const Syscall::Entry& entry = SYSCALL_TABLE.Entries[frame->rax];
+        cpu->SyscallCounts[frame->rax]++;
+        if (!entry.Leaf) asm volatile ("sti" ::: "memory");
+
+        frame->rax = static_cast<uint64_t>(entry.Function(frame->rdi, frame->rsi, frame->rdx, frame->r10, frame->r8, frame->r9));
+    }
+
+    // From Syscall.S, instead of a sysretq that would fault in ring 0 on the user's stack
+    [[noreturn]] void KernelSyscallBadReturn(uint64_t userRip) {
+        // There are no processes to terminate yet, so a corrupted return address takes the kernel down with it
+        LOG_ERROR("Syscall would return to the non-canonical address 0x%x64!", userRip);
+        PANIC("Syscall returned to a non-canonical address!");
     }
 
     extern char __user_trampoline_start[];
     extern char __user_trampoline_end[];
-    uint64_t syscall_kernel_rsp;
 }
 
 // TODO: This needs to be rewritten when we support actual user processes, but for now this is just a test.
+// The trampoline is copied to userspace on its own, so the syscall numbers in it are hardcoded.
+static_assert(static_cast<uint64_t>(Syscall::Number::Null) == 0 && static_cast<uint64_t>(Syscall::Number::ReportSyscallBenchmark) == 5,
+              "The user trampoline hardcodes the syscall numbers");
+
 __attribute__((naked, used, section(".user_trampoline")))
 static void UserTrampoline() {
     __asm__ volatile (
-        "mov $0xDEADBEEF, %rax\n"
+#if SETTING_BENCHMARK_MODE
+        // Null syscall round trips: the total for the average and the fastest one. R12-R15 survive syscalls.
+        "mov $10000, %r12\n"
+        "xor %r15d, %r15d\n"
+        "mov $-1, %r14\n"
+        "1:\n"
+        "lfence\n"
+        "rdtsc\n"
+        "shl $32, %rdx\n"
+        "or %rdx, %rax\n"
+        "mov %rax, %r13\n"
+        "xor %eax, %eax\n" // Null
+        "syscall\n"
+        "lfence\n"
+        "rdtsc\n"
+        "shl $32, %rdx\n"
+        "or %rdx, %rax\n"
+        "sub %r13, %rax\n"
+        "add %rax, %r15\n"
+        "cmp %r14, %rax\n"
+        "cmovb %rax, %r14\n"
+        "dec %r12\n"
+        "jnz 1b\n"
+        "mov $5, %eax\n" // ReportSyscallBenchmark
+        "mov $10000, %edi\n"
+        "mov %r15, %rsi\n"
+        "mov %r14, %rdx\n"
+        "syscall\n"
+#endif
+        "mov $0xDEADBEEF, %rax\n" // No such syscall, returns ERROR_INVALID_SYSCALL
         "syscall\n"
         "jmp .\n" // Infinite loop to prevent falling through
     );
@@ -44,7 +185,12 @@ namespace Interrupts {
         // Set STAR MSR to define syscall/sysret segments and CPL3 code segment selector
         Core::CPU::WriteMSR(MSR_STAR, ((uint64_t)0x28 << 48) | ((uint64_t)0x08 << 32));
         Core::CPU::WriteMSR(MSR_LSTAR, (uint64_t)&SyscallHandler); // called when syscall is invoked with syscall instruction
-        Core::CPU::WriteMSR(MSR_FMASK, 1 << 9);
+        // Cleared on entry: IF until the stack is switched, and TF, DF, AC and NT so user flags can't leak into the kernel.
+        // The handlers are C code and the SysV ABI they follow requires DF to be clear, a user "std; syscall" would run memcpy backwards.
+        Core::CPU::WriteMSR(MSR_FMASK, RFLAGS_TF | RFLAGS_IF | RFLAGS_DF | RFLAGS_NT | RFLAGS_AC);
+
+        // Userspace starts with a zero GS base, swapgs exchanges it with this CPU's PerCPU block on every kernel entry
+        Core::CPU::WriteMSR(Core::PerCPU::MSR_KERNEL_GS_BASE, 0);
     }
 
     void Syscall::Trampoline() {
@@ -69,7 +215,36 @@ namespace Interrupts {
         kernel->ArchitectureData->Paging.SwitchToPageTable(trampolinePageState);
         memcpy((void*)VIRT, reinterpret_cast<void*>(__user_trampoline_start), reinterpret_cast<uint64_t>(__user_trampoline_end) - reinterpret_cast<uint64_t>(__user_trampoline_start));
 
-        syscall_kernel_rsp = TSS::GetTSSStruct()->RSP0;
+        Core::FPU::SetUserStateLive(true); // From now on the vector registers belong to userspace, kernel SIMD sections have to save them
         EnterUserspace(VIRT, USER_STACK + Architecture::KernelPageSize);
     }
-} // Interrupts
\ No newline at end of file
+
+    uint64_t Syscall::GetCount(Number number) {
+        Core::SMP* smp = Kernel<KernelData>::GetInstance()->ArchitectureData->Smp;
+        if (!smp) return Core::PerCPU::Get()->SyscallCounts[static_cast<uint64_t>(number)];
+
+        uint64_t count = 0;
+        for (uint32_t i = 0; i < smp->GetCPUCount(); i++) {
+            count += __atomic_load_n(&smp->GetCPU(i)->SyscallCounts[static_cast<uint64_t>(number)], __ATOMIC_RELAXED);
+        }
+        return count;
+    }
+
+    void Syscall::DumpStatistics() {
+        Core::SMP* smp = Kernel<KernelData>::GetInstance()->ArchitectureData->Smp;
+        uint64_t invalid = 0;
+        if (smp) {
+            for (uint32_t i = 0; i < smp->GetCPUCount(); i++) invalid += __atomic_load_n(&smp->GetCPU(i)->InvalidSyscalls, __ATOMIC_RELAXED);
+        }
+        else {
+            invalid = Core::PerCPU::Get()->InvalidSyscalls;
+        }
+
+        LOG_INFO("Syscalls (over all CPUs):");
+        for (uint64_t i = 0; i < COUNT; i++) {
+            const Entry& entry = SYSCALL_TABLE.Entries[i];
+            LOG_INFO("  %u64 %s: %u64 calls%s", i, entry.Name, GetCount(static_cast<Number>(i)), entry.Leaf ? " (leaf)" : "");
+        }
+        LOG_INFO("  invalid numbers: %u64 calls", invalid);
+    }
+} // Interrupts
@@ -5,11 +5,41 @@
 
 namespace Interrupts {
 
+/// The syscall ABI: the number goes in RAX, up to six arguments in RDI, RSI, RDX, R10, R8 and R9, and the result comes back in RAX
+/// (negative values are errors). Like a SysV call, RBX, RBP, RSP and R12-R15 are preserved and every other register may be clobbered.
+/// Leaf syscalls run on a fast path in Syscall.S that calls the handler straight from the dispatch table, without building a
+/// SyscallFrame: the handler saves the callee-saved registers it uses itself, and the caller-saved ones are zeroed on the way out so
+/// no kernel values leak. Every other syscall saves the whole frame and runs with interrupts enabled, so it may block.
 class Syscall {
 public:
+    enum class Number : uint64_t {
+        Null = 0, // Does nothing, for measuring the cost of a round trip
+        GetCPU = 1, // Index of the CPU the caller runs on
+        GetTime = 2, // Nanoseconds since boot
+        Yield = 3,
+        Sleep = 4, // (nanoseconds)
+        ReportSyscallBenchmark = 5, // (iterations, totalCycles, minCycles), only in benchmark mode
+        Count
+    };
+
+    static constexpr uint64_t COUNT = static_cast<uint64_t>(Number::Count);
+    static constexpr int64_t ERROR_INVALID_SYSCALL = -1;
+
+    /// What the dispatch table holds for every syscall: the handler with its arguments still in registers
+    typedef int64_t (*Handler)(uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t);
+
+    struct Entry {
+        Handler Function = nullptr;
+        const char* Name = nullptr;
+        bool Leaf = false; // Runs on the fast path with interrupts disabled, so it must neither block nor touch user memory
+    };
+
     static void Initialize();
     static void Trampoline(); // This jumps into userspace! With a test function at the moment.
 
+    [[nodiscard]] static uint64_t GetCount(Number number); // Over every CPU
+    static void DumpStatistics();
+
     struct SyscallFrame {
         uint64_t r15, r14, r13, r12, rbp, rbx;
         uint64_t r9, r8, r10, rdx, rsi, rdi;
@@ -20,6 +50,69 @@ public:
         uint64_t user_rflags; // r11
         uint64_t user_rip; // rcx
     };
+
+    /// Builds the table entry of a handler with typed parameters. Each parameter is taken from its argument register, integers by
+    /// value and pointers as the address, and the result is returned as an int64_t (0 for void).
+    template<auto Function>
+    static constexpr Entry MakeEntry(const char* name, bool leaf) {
+        return Entry { &Marshal<decltype(Function)>::template Call<Function>, name, leaf };
+    }
+
+private:
+    template<size_t... I>
+    struct Indices {};
+
+    template<size_t N, size_t... I>
+    struct MakeIndices : MakeIndices<N - 1, N - 1, I...> {};
+
+    template<size_t... I>
+    struct MakeIndices<0, I...> {
+        using Type = Indices<I...>;
+    };
+
+    template<typename T>
+    struct FromRegister {
+        static T Convert(uint64_t value) { return static_cast<T>(value); }
+    };
+
+    template<typename T>
+    struct FromRegister<T*> {
+        static T* Convert(uint64_t value) { return reinterpret_cast<T*>(value); }
+    };
+
+    template<typename Return>
+    struct ToRegister {
+        template<typename Call>
+        static int64_t Convert(Call call) { return static_cast<int64_t>(call()); }
+    };
+
+    template<typename Signature>
+    struct Marshal;
+
+    template<typename Return, typename... Parameters>
+    struct Marshal<Return (*)(Parameters...)> {
+        static_assert(sizeof...(Parameters) <= 6, "Syscalls take at most six arguments!");
+
+        template<Return (*Function)(Parameters...)>
+        static int64_t Call(uint64_t a0, uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5) {
+            const uint64_t arguments[6] = { a0, a1, a2, a3, a4, a5 };
+            return Invoke<Function>(arguments, typename MakeIndices<sizeof...(Parameters)>::Type());
+        }
+
+        template<Return (*Function)(Parameters...), size_t... I>
+        static int64_t Invoke(const uint64_t* arguments, Indices<I...>) {
+            return ToRegister<Return>::Convert([arguments] { return Function(FromRegister<Parameters>::Convert(arguments[I])...); });
+        }
+    };
+};
+
+template<>
+struct Syscall::ToRegister<void> {
+    template<typename Call>
+    static int64_t Convert(Call call) {
+        call();
+        return 0;
+    }
 };
 
 } // Interrupts
@@ -3,21 +3,32 @@
 extern "C" {
     extern char _fault_handler_stack_bottom[];
     extern char _fault_handler_stack_top[];
+    extern char _nmi_stack_top[];
 }
 
 namespace Interrupts {
     TSS::TSSStruct TSS::_tss = {};
 
     void TSS::Initialize() {
+        // The boot CPU uses the kernel, fault and NMI stacks from the linker script, application processors get their own (see Core::SMP)
+        InitializeForCPU(&_tss, reinterpret_cast<uint64_t>(Architecture::KernelStackTop), reinterpret_cast<uint64_t>(&_fault_handler_stack_top[0]),
+                         reinterpret_cast<uint64_t>(&_nmi_stack_top[0]));
+    }
+
+    void TSS::InitializeForCPU(TSSStruct *tss, uint64_t rsp0, uint64_t ist1, uint64_t ist2) {
+        *tss = {};
+
         // Set RSP0 to the top of the kernel stack
-        // TODO: RSP0 must be set per CPU when we implement SMP support, so uhh yeah update this then.
-        _tss.RSP0 = reinterpret_cast<uint64_t>(Architecture::KernelStackTop);
+        tss->RSP0 = rsp0;
+
+        // Set IST1 to the top of the double fault stack
+        tss->IST1 = ist1;
 
-        // Set IST1 to the top of the double fault stack (defined in entry.S)
-        _tss.IST1 = reinterpret_cast<uint64_t>(&_fault_handler_stack_top[0]);
+        // Set IST2 to the top of the NMI stack
+        tss->IST2 = ist2;
 
         // We don't use an I/O map, so set the base to the size of the TSS
-        _tss.IOMapBase = sizeof(TSSStruct);
+        tss->IOMapBase = sizeof(TSSStruct);
     }
 
     TSS::TSSStruct* TSS::GetTSSStruct() {
@@ -24,8 +24,12 @@ namespace Interrupts {
             uint16_t IOMapBase;
         };
 
-        static void Initialize();
-        static TSSStruct* GetTSSStruct();
+        static void Initialize(); // Sets up the boot CPU's TSS
+        static void InitializeForCPU(TSSStruct* tss, uint64_t rsp0, uint64_t ist1, uint64_t ist2);
+
+        static constexpr uint8_t FAULT_IST = 1; // Double faults, GPFs and page faults
+        static constexpr uint8_t NMI_IST = 2; // NMIs and machine checks
+        static TSSStruct* GetTSSStruct(); // The boot CPU's TSS, other CPUs find theirs through PerCPU
     private:
         static TSSStruct _tss;
     };
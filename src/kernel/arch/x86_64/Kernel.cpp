@@ -1,5 +1,6 @@
 #include <Definitions.h>
 #include <Kernel.h>
+#include <Settings.h>
 #include <stdarg.h>
 
 extern "C" {
@@ -16,9 +17,183 @@ extern "C" {
 #include "Utility/ANSI.h"
 #include "Memory/PMM.h"
 #include "Interrupts/Syscall.h"
+#include "Interrupts/IRQBalancer.h"
+#include "Interrupts/Moderation.h"
+#include "Memory/MemoryRoutines.h"
+#include "Core/FPU.h"
+#include "Core/PerCPU.h"
+#include "Core/CPUIdle.h"
+#include "Core/Sync/LockStat.h"
+#include "Core/Sync/SpinLock.h"
+#include "Core/Sync/WaitQueue.h"
+#include "Benchmarks/Benchmarks.h"
 
 Kernel<KernelData> kernel;
 KernelData kernelData;
+
+// Log output. The serial port (38400 baud, ~4ms per FIFO) and the console only take one writer at a time, the output owner.
+// Threads wait for ownership on a wait queue and sleep while the FIFO drains. Everything that can't sleep (interrupt handlers,
+// NMIs, code with interrupts or preemption disabled, early boot) queues its line in a ring instead and writes the ring out itself
+// only if nobody owns the output, otherwise the owner writes it before letting go. Panics write directly.
+enum class LogLineKind : uint8_t {
+    Level, // Core::Log, to the serial port and the console with the level in front
+    Plain, // printf, to the serial port and the console
+    Serial // Core::Write, to the serial port only
+};
+
+struct LogLine {
+    LogLineKind Kind;
+    LOG_LEVEL Level;
+    bool Truncated;
+    char Text[1025]; // +1 for null terminator
+};
+
+static constexpr size_t LOG_RING_SIZE = 16; // Lines, a power of two
+
+static Core::Sync::SpinLock logRingLock;
+static LogLine logRing[LOG_RING_SIZE];
+static size_t logRingHead = 0; // Next line to write out
+static size_t logRingTail = 0; // Next free slot
+static size_t logRingDropped = 0; // Lines lost to a full ring since the last one was written out
+
+static bool logOutputOwned = false;
+static Core::Sync::WaitQueue logOutputWaiters;
+
+static size_t FormatLogLine(LogLine& line, LogLineKind kind, LOG_LEVEL level, const char* fmt, va_list args) {
+    auto len = Utility::StringFormatter::vsnprintf(line.Text, sizeof(line.Text), fmt, args);
+
+    line.Kind = kind;
+    line.Level = level;
+    line.Truncated = len > 1024;
+    if (line.Truncated) len = 1024;
+    line.Text[len] = '\0';
+    return len;
+}
+
+static void WriteLogText(LogLineKind kind, LOG_LEVEL level, const char* text, bool truncated, bool maySleep) {
+    auto serial = [maySleep](const char* string) {
+        if (maySleep) kernelData.SerialPort.WriteBulk(string);
+        else kernelData.SerialPort.WriteString(string);
+    };
+
+    if (kind == LogLineKind::Serial) {
+        serial(text);
+        return;
+    }
+
+    if (kind == LogLineKind::Level) {
+        kernelData.Console.PrintString("[");
+
+        switch (level) {
+            case LOG_LEVEL::INFO:
+                serial("[INFO] ");
+                kernelData.Console.PrintString(ANSI::Colors::Foreground::Green);
+                kernelData.Console.PrintString("INFO");
+                break;
+            case LOG_LEVEL::WARNING:
+                serial("[WARNING] ");
+                kernelData.Console.PrintString(ANSI::Colors::Foreground::Yellow);
+                kernelData.Console.PrintString("WARNING");
+                break;
+            case LOG_LEVEL::ERROR:
+                serial("[ERROR] ");
+                kernelData.Console.PrintString(ANSI::Colors::Foreground::Red);
+                kernelData.Console.PrintString("ERROR");
+                break;
+            case LOG_LEVEL::DEBUG:
+                serial("[DEBUG] ");
+                kernelData.Console.PrintString(ANSI::Colors::Foreground::Cyan);
+                kernelData.Console.PrintString("DEBUG");
+                break;
+        }
+
+        kernelData.Console.PrintString("\033[0m] ");
+    }
+
+    serial(text);
+    kernelData.Console.PrintString(text);
+    kernelData.Console.PrintString("\r");
+    if (truncated) {
+        serial("...[TRUNCATED]");
+        kernelData.Console.PrintString("...[TRUNCATED]\r");
+    }
+}
+
+static void WriteLogLine(const LogLine& line, bool maySleep) {
+    WriteLogText(line.Kind, line.Level, line.Text, line.Truncated, maySleep);
+}
+
+static void QueueLogLine(const LogLine& line, size_t length) {
+    uint64_t flags = logRingLock.LockIrqSave();
+    if (logRingTail - logRingHead < LOG_RING_SIZE) {
+        LogLine& slot = logRing[logRingTail % LOG_RING_SIZE];
+        slot.Kind = line.Kind;
+        slot.Level = line.Level;
+        slot.Truncated = line.Truncated;
+        Memory::MemoryRoutines::Copy(slot.Text, line.Text, length + 1);
+        __atomic_store_n(&logRingTail, logRingTail + 1, __ATOMIC_SEQ_CST);
+    }
+    else {
+        logRingDropped++;
+    }
+    logRingLock.UnlockIrqRestore(flags);
+}
+
+// Writes the queued lines, by the output owner. The ring lock is only held to copy a line out, not while it is written.
+static void WriteQueuedLines(bool maySleep) {
+    LogLine line;
+
+    while (true) {
+        uint64_t flags = logRingLock.LockIrqSave();
+        size_t dropped = logRingDropped;
+        logRingDropped = 0;
+        bool empty = logRingHead == logRingTail;
+        if (!empty) {
+            line = logRing[logRingHead % LOG_RING_SIZE];
+            __atomic_store_n(&logRingHead, logRingHead + 1, __ATOMIC_SEQ_CST);
+        }
+        logRingLock.UnlockIrqRestore(flags);
+
+        if (dropped) {
+            char message[64];
+            Utility::StringFormatter::snprintf(message, sizeof(message), "%u64 log lines were dropped, the log ring was full.\n", static_cast<uint64_t>(dropped));
+            WriteLogText(LogLineKind::Level, LOG_LEVEL::WARNING, message, false, maySleep);
+        }
+        if (empty) return;
+
+        WriteLogLine(line, maySleep);
+    }
+}
+
+static bool TryOwnLogOutput() {
+    return !__atomic_exchange_n(&logOutputOwned, true, __ATOMIC_SEQ_CST);
+}
+
+static void ReleaseLogOutput(bool maySleep) {
+    while (true) {
+        WriteQueuedLines(maySleep);
+        __atomic_store_n(&logOutputOwned, false, __ATOMIC_SEQ_CST);
+
+        // A line queued after the ring was written out but before the release saw the output owned, and relies on this check
+        if (__atomic_load_n(&logRingTail, __ATOMIC_SEQ_CST) == __atomic_load_n(&logRingHead, __ATOMIC_SEQ_CST) || !TryOwnLogOutput()) break;
+    }
+
+    if (logOutputWaiters.HasWaiters()) logOutputWaiters.WakeOne();
+}
+
+static void EmitLogLine(LogLine& line, size_t length) {
+    if (!Core::Sync::CanSleep()) {
+        QueueLogLine(line, length);
+        if (TryOwnLogOutput()) ReleaseLogOutput(false);
+        return;
+    }
+
+    logOutputWaiters.WaitEvent(TryOwnLogOutput);
+    WriteQueuedLines(true); // Lines queued before this one go first
+    WriteLogLine(line, true);
+    ReleaseLogOutput(true);
+}
+
 bool debugLogging = false;
 
 template<typename T>
@@ -42,6 +217,9 @@ void Kernel<T>::Initialize() {
         Interrupts::GDT::GetGDTPointer(),
         Interrupts::TSS::GetTSSStruct());
 
+    // Per-CPU data (the GDT load cleared GS base, from here on Core::PerCPU::Get() works):
+    Core::SMP::InitializeBootCPU();
+
     // Syscall:
     Interrupts::Syscall::Initialize();
     LOG(LOG_LEVEL::INFO, "Initialized syscall handling.");
@@ -75,6 +253,14 @@ void Kernel<T>::Initialize() {
     ArchitectureData->Cpu.Initialize();
     LOG(LOG_LEVEL::INFO, "Initialized CPU.");
 
+    // Kernel SIMD sections:
+    Core::FPU::Initialize(&ArchitectureData->Cpu);
+    LOG_INFO("Initialized kernel FPU state management (%s).", Core::FPU::GetSaveMethodName());
+
+    // Memory routines (memcpy & co. switch to the fastest implementation for this CPU):
+    Memory::MemoryRoutines::Initialize(&ArchitectureData->Cpu);
+    LOG_INFO("Initialized memory routines (%s).", Memory::MemoryRoutines::GetStrategyName());
+
     // Paging:
     ArchitectureData->Paging = Memory::Paging(&ArchitectureData->Pmm);
     ArchitectureData->Paging.Initialize();
@@ -86,6 +272,10 @@ void Kernel<T>::Initialize() {
     ArchitectureData->HeapAllocator.Initialize();
     LOG(LOG_LEVEL::INFO, "Initialized heap allocator.");
 
+    #if SETTING_IRQ_STAT
+    Core::PerCPU::Get()->InterruptStats = new Interrupts::InterruptStatistics(); // The application processors get theirs from SMP
+    #endif
+
     // ACPI:
     ArchitectureData->Acpi.Initialize();
     LOG(LOG_LEVEL::INFO, "Initialized ACPI.");
@@ -104,6 +294,14 @@ void Kernel<T>::Initialize() {
     ArchitectureData->Tsc = Core::Time::TSC(&ArchitectureData->Hpet, &ArchitectureData->Cpu);
     LOG(LOG_LEVEL::INFO, "Initialized TSC with frequency approximately %u64hz.", ArchitectureData->Tsc.GetFrequency());
 
+    // Clocksources:
+    ArchitectureData->Clocksources = new Core::Time::ClocksourceManager([] { return kernelData.Tsc.GetNanoseconds(); });
+    ArchitectureData->Clocksources->Register(ArchitectureData->Hpet.GetClocksource());
+    ArchitectureData->PmTimer = new Core::Time::ACPIPMTimer(&ArchitectureData->Acpi);
+    if (ArchitectureData->PmTimer->Initialize()) ArchitectureData->Clocksources->Register(ArchitectureData->PmTimer->GetClocksource());
+    ArchitectureData->Clocksources->Register(ArchitectureData->Tsc.GetClocksource());
+    LOG_INFO("Initialized clocksources (using %s).", ArchitectureData->Clocksources->GetCurrent()->Name);
+
     // PCI:
     ArchitectureData->Pci = new IO::PCI(&ArchitectureData->Paging);
     ArchitectureData->Pci->Initialize();
@@ -144,12 +342,47 @@ void Kernel<T>::Initialize() {
     LOG_INFO("Initialized driver manager.");
 
     // Scheduler:
-    ArchitectureData->DefaultScheduler = new Core::Time::Scheduler(&ArchitectureData->Tsc);
+    ArchitectureData->DefaultScheduler = new Core::Time::Scheduler();
+    Core::PerCPU::Get()->Scheduler = ArchitectureData->DefaultScheduler;
+    ArchitectureData->Clocksources->StartUpdates(ArchitectureData->DefaultScheduler);
     LOG_INFO("Initialized scheduler.");
 
+    // Clock events (one-shot timer interrupts for the scheduler's next deadline):
+    ArchitectureData->ClockEventDevice = Core::Time::ClockEvent::Create(ArchitectureData->Apic, &ArchitectureData->Idt, &ArchitectureData->Hpet, &ArchitectureData->Tsc, &ArchitectureData->Cpu);
+    ArchitectureData->DefaultScheduler->SetClockEvent(ArchitectureData->ClockEventDevice);
+    Core::PerCPU::Get()->ClockEvent = ArchitectureData->ClockEventDevice;
+    LOG_INFO("Initialized clock events (%s).", ArchitectureData->ClockEventDevice->GetName());
+
+    // Threads (the code running right now becomes the first one):
+    ArchitectureData->DefaultScheduler->InitializeThreading(&ArchitectureData->Pmm, &ArchitectureData->Paging);
+    LOG_INFO("Initialized threading.");
+
+    // Idle states (before SMP, the application processors go idle as soon as they are up):
+    Core::CPUIdle::Initialize(&ArchitectureData->Cpu);
+    LOG_INFO("Initialized idle states (C1 with %s).", ArchitectureData->Cpu.HasFeature(Core::CPUFeatures::MONITOR) ? "MWAIT" : "HLT");
+
+    // Application processors:
+    ArchitectureData->Smp = new Core::SMP(ArchitectureData->Apic, &ArchitectureData->Idt, &ArchitectureData->Cpu, &ArchitectureData->Tsc, &ArchitectureData->Pmm, &ArchitectureData->Paging);
+    ArchitectureData->Smp->Initialize();
+    LOG_INFO("Initialized SMP (%u32 CPU(s) online).", ArchitectureData->Smp->GetCPUCount());
+
+    // Workqueues (after SMP, every CPU gets its own workers):
+    ArchitectureData->SystemWorkQueue = new Core::Threading::WorkQueue("system", 4);
+    ArchitectureData->ServiceManager->RegisterService(WORKQUEUE_SERVICE_NAME, Core::Threading::WorkQueue::GetService());
+    LOG_INFO("Initialized the system workqueue.");
+
+    // Interrupt balancing (on the system workqueue, and with every CPU online to spread the interrupts over):
+    Interrupts::IRQBalancer::Start();
+    LOG_INFO("Initialized the IRQ balancer.");
+
+    // Coroutines of asynchronous driver code share one thread on the boot CPU:
+    ArchitectureData->SystemExecutor = new Core::Async::Executor("async", 0);
+    LOG_INFO("Initialized the system executor.");
+
     // Load the AML interpreter:
     ArchitectureData->Acpi.LoadLAI();
     LOG_INFO("Initialized ACPI AML interpreter (LAI).");
+    Core::CPUIdle::LoadACPIStates(&ArchitectureData->Acpi);
 }
 
 template<typename T>
@@ -158,6 +391,18 @@ void Kernel<T>::Start() {
     ArchitectureData->DriverManager->LoadDriversFromFileSystem();
     LOG_INFO("Finished loading drivers.");
 
+    #if SETTING_BENCHMARK_MODE
+    Benchmarks::RunAll();
+    Core::CPUIdle::DumpStatistics();
+    Core::Time::Scheduler::DumpTrace();
+    Interrupts::IDT::DumpStatistics();
+    Interrupts::InterruptModerator::DumpStatistics();
+    #endif
+
+    #if SETTING_LOCK_STAT
+    Core::Sync::LockStat::Dump();
+    #endif
+
     // Load userspace:
     Interrupts::Syscall::Trampoline();
 }
@@ -169,6 +414,10 @@ void Kernel<T>::Log(const char *message) {
 
 template<typename T>
 [[noreturn]] void Kernel<T>::Panic(const char *message) {
+    asm volatile ("cli"); // Nothing else runs on this CPU anymore, and logging must not sleep
+
+    // Whatever led up to the panic may still sit in the log ring. Skipped if the ring is locked, this CPU may have faulted holding it.
+    if (!logRingLock.IsLocked()) WriteQueuedLines(false);
     Log("[PANIC] ");
     Log(message);
     kernelData.Console.PrintString("[");
@@ -194,58 +443,30 @@ template<typename T>
 }
 
 void Core::Write(const char *message) {
-    Kernel<KernelData>::GetInstance()->Log(message);
-}
-
-void Core::Log(LOG_LEVEL level, const char *fmt, ...) {
-    kernelData.Console.PrintString("[");
-
-    switch (level) {
-        case LOG_LEVEL::INFO:
-            kernel.Log("[INFO] ");
-            kernelData.Console.PrintString(ANSI::Colors::Foreground::Green);
-            kernelData.Console.PrintString("INFO");
-            break;
-        case LOG_LEVEL::WARNING:
-            kernel.Log("[WARNING] ");
-            kernelData.Console.PrintString(ANSI::Colors::Foreground::Yellow);
-            kernelData.Console.PrintString("WARNING");
-            break;
-        case LOG_LEVEL::ERROR:
-            kernel.Log("[ERROR] ");
-            kernelData.Console.PrintString(ANSI::Colors::Foreground::Red);
-            kernelData.Console.PrintString("ERROR");
-            break;
-        case LOG_LEVEL::DEBUG:
-            kernel.Log("[DEBUG] ");
-            kernelData.Console.PrintString(ANSI::Colors::Foreground::Cyan);
-            kernelData.Console.PrintString("DEBUG");
-            break;
+    LogLine line;
+    line.Kind = LogLineKind::Serial;
+    line.Level = LOG_LEVEL::INFO;
+
+    // Messages are copied into the line like formatted ones, so a long one gets truncated the same way
+    size_t length = 0;
+    while (message[length] && length < 1024) {
+        line.Text[length] = message[length];
+        length++;
     }
+    line.Truncated = message[length] != '\0';
+    line.Text[length] = '\0';
 
-    kernelData.Console.PrintString("\033[0m] ");
+    EmitLogLine(line, length);
+}
 
-    // Format the message
-    char buffer[1025]; // +1 for null terminator
+void Core::Log(LOG_LEVEL level, const char *fmt, ...) {
+    LogLine line;
     va_list args;
     va_start(args, fmt);
-    auto len = Utility::StringFormatter::vsnprintf(buffer, sizeof(buffer), fmt, args);
+    size_t length = FormatLogLine(line, LogLineKind::Level, level, fmt, args);
     va_end(args);
 
-    bool truncated = false;
-    if (len > 1024) {
-        len = 1024;
-        truncated = true;
-    }
-    buffer[len] = '\0';
-
-    kernel.Log(buffer);
-    kernelData.Console.PrintString(buffer);
-    kernelData.Console.PrintString("\r");
-    if (truncated) {
-        kernel.Log("...[TRUNCATED]");
-        kernelData.Console.PrintString("...[TRUNCATED]\r");
-    }
+    EmitLogLine(line, length);
 }
 
 [[noreturn]] void Core::Panic(const char *message) {
@@ -262,28 +483,14 @@ extern "C" void kernel_assert(bool condition, const char* message) {
 
 // Unfortunately printf is a requirement for the tlsf allocator.
 extern "C" size_t printf(const char *fmt, ...) {
-    char buffer[1025]; // +1 for null terminator
+    LogLine line;
     va_list args;
     va_start(args, fmt);
-    auto len = Utility::StringFormatter::vsnprintf(buffer, sizeof(buffer), fmt, args);
+    size_t length = FormatLogLine(line, LogLineKind::Plain, LOG_LEVEL::INFO, fmt, args);
     va_end(args);
 
-    bool truncated = false;
-    if (len > 1024) {
-        len = 1024;
-        truncated = true;
-    }
-    buffer[len] = '\0';
-
-    kernel.Log(buffer);
-    kernelData.Console.PrintString(buffer);
-    kernelData.Console.PrintString("\r");
-    if (truncated) {
-        kernel.Log("...[TRUNCATED]");
-        kernelData.Console.PrintString("...[TRUNCATED]\r");
-    }
-
-    return len;
+    EmitLogLine(line, length);
+    return length;
 }
 
 template class Kernel<KernelData>; // Initialize the template class
\ No newline at end of file
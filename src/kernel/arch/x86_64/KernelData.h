@@ -11,6 +11,7 @@
 #include "Memory/Paging.h"
 #include "Memory/PMM.h"
 #include "Core/CPU.h"
+#include "Core/SMP.h"
 #include "Core/Time/RTC.h"
 #include "FileSystems/InitRam.h"
 #include "Memory/HeapAllocator.h"
@@ -20,7 +21,12 @@
 #include "Core/Firmware/Hardware.h"
 #include "Core/Time/HPET.h"
 #include "Core/Time/Scheduler.h"
+#include "Core/Time/ClockEvent.h"
 #include "Core/Time/TSC.h"
+#include "Core/Time/Clocksource.h"
+#include "Core/Time/ACPIPMTimer.h"
+#include "Core/Threading/WorkQueue.h"
+#include "Core/Async/Executor.h"
 #include "Formats/SymbolLoader.h"
 #include "IO/PCI.h"
 
@@ -39,11 +45,17 @@ struct KernelData {
     Core::Time::HPET Hpet {&Acpi, &Paging, &Idt};
     Interrupts::APIC *Apic;
     Core::Time::TSC Tsc {&Hpet, &Cpu};
+    Core::Time::ACPIPMTimer* PmTimer;
+    Core::Time::ClocksourceManager* Clocksources; // Monotonic kernel time on the best available counter
     FileSystem::InitRam* InitRamFS;
     Formats::SymbolLoader *KernelSymbols;
     Core::ServiceManager *ServiceManager;
     Core::Drivers::DriverManager *DriverManager;
-    Core::Time::Scheduler *DefaultScheduler; // Core 0 scheduler. Other cores should have their own scheduler instance.
+    Core::Time::Scheduler *DefaultScheduler; // Core 0 scheduler. Every other core has its own, see Core::PerCPU::Scheduler.
+    Core::Time::ClockEvent *ClockEventDevice; // Drives DefaultScheduler's timers
+    Core::SMP *Smp;
+    Core::Threading::WorkQueue *SystemWorkQueue; // Shared background work for everything that doesn't need a queue of its own
+    Core::Async::Executor *SystemExecutor; // Runs the coroutines of drivers that talk to their devices asynchronously
     IO::PCI* Pci;
 };
 
@@ -1,6 +1,7 @@
 #include "HeapAllocator.h"
 #include <Settings.h>
 #include "../KernelData.h"
+#include "../Core/Sync/LockGuard.h"
 
 // ReSharper disable CppDFAMemoryLeak (we free it, but the static analysis doesn't understand that)
 
@@ -68,7 +69,9 @@ void operator delete[](void* ptr, size_t size) noexcept {
 }
 
 namespace Memory {
-    HeapAllocator::HeapAllocator(PMM *pmm, Paging *paging, Paging::PagingState* pagingState) : _pmm(pmm), _paging(paging), _pagingState(pagingState) {
+    static Core::Sync::LockClass heapLockClass = { "heap" };
+
+    HeapAllocator::HeapAllocator(PMM *pmm, Paging *paging, Paging::PagingState* pagingState) : _pmm(pmm), _paging(paging), _pagingState(pagingState), _lock(&heapLockClass) {
         uintptr_t phys = _pmm->AllocatePages(ALIGN_UP(InitialHeapSize, (size_t)Architecture::KernelPageSize) / (Architecture::KernelPageSize));
         if (!phys) {
             PANIC("Failed to allocate physical memory for heap!");
@@ -90,10 +93,15 @@ namespace Memory {
         size_t bytes = args.bytes;
         if (bytes == 0) return 0;
 
-        // Switch to this heap's paging state.
-        _paging->SwitchToPageTable(_pagingState);
+        uintptr_t addr;
+        {
+            Core::Sync::IrqLockGuard guard(_lock);
+
+            // Switch to this heap's paging state.
+            _paging->SwitchToPageTable(_pagingState);
+            addr = (uintptr_t)tlsf_malloc(_tlsf, bytes);
+        }
 
-        uintptr_t addr = (uintptr_t)tlsf_malloc(_tlsf, bytes);
         if (addr && args.mode == AllocateMode::Zeroed) {
             memset(reinterpret_cast<void*>(addr), 0, bytes);
         }
@@ -104,6 +112,8 @@ namespace Memory {
     void HeapAllocator::Free(uintptr_t address, size_t bytes) {
         if (bytes == 0) return;
 
+        Core::Sync::IrqLockGuard guard(_lock);
+
         // Switch to this heap's paging state.
         _paging->SwitchToPageTable(_pagingState);
         tlsf_free(_tlsf, reinterpret_cast<void*>(address));
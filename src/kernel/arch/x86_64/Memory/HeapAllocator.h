@@ -7,10 +7,10 @@
 #include "Kernel.h"
 #include "Paging.h"
 #include "PMM.h"
+#include "../Core/Sync/MCSLock.h"
 
 #include <tlsf.h> // We use the TLSF allocator, since its easy and efficient.
 
-// TODO: Implement spin locks for the heap allocator when moving to multi core.
 namespace Memory {
     class HeapAllocator : public Allocator {
     public:
@@ -41,6 +41,7 @@ namespace Memory {
         Paging *_paging;
         Paging::PagingState* _pagingState;
         tlsf_t _tlsf;
+        Core::Sync::MCSLock _lock; // Every CPU allocates, and so do interrupt handlers, so it's taken with interrupts disabled
 
         [[nodiscard]] STATUS Test();
     };
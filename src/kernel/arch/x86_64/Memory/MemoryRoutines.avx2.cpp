@@ -0,0 +1,150 @@
+#include "MemoryRoutines.h"
+
+// This translation unit is built with AVX2 enabled (see the *.avx2.cpp rule in the kernel CMakeLists), so everything in here
+// may touch the YMM registers and must only run inside a Core::KernelFpuScope on a CPU where FPU::IsAVX2Usable() is true.
+namespace Memory {
+    typedef long long Vector256 __attribute__((vector_size(32)));
+    typedef long long UnalignedVector256 __attribute__((vector_size(32), aligned(1), may_alias));
+    typedef char ByteVector256 __attribute__((vector_size(32)));
+
+    static inline Vector256 Load256(const uint8_t* p) {
+        return *reinterpret_cast<const UnalignedVector256*>(p);
+    }
+
+    static inline void Store256(uint8_t* p, Vector256 v) {
+        *reinterpret_cast<UnalignedVector256*>(p) = v;
+    }
+
+    void* MemoryRoutines::CopyAVX2(void* dest, const void* src, size_t n) {
+        auto d = static_cast<uint8_t*>(dest);
+        auto s = static_cast<const uint8_t*>(src);
+
+        if (n < 32) {
+            while (n--) *d++ = *s++;
+            return dest;
+        }
+
+        // Same structure as the SSE2 version: unaligned head and tail, aligned stores in between
+        Vector256 head = Load256(s);
+        Vector256 tail = Load256(s + n - 32);
+        Store256(d, head);
+
+        size_t skip = 32 - (reinterpret_cast<uintptr_t>(d) & 31);
+        d += skip;
+        s += skip;
+        n -= skip;
+
+        auto dv = reinterpret_cast<Vector256*>(d);
+        if (n >= NON_TEMPORAL_THRESHOLD) {
+            while (n >= 128) {
+                Vector256 a = Load256(s), b = Load256(s + 32), c = Load256(s + 64), e = Load256(s + 96);
+                __builtin_ia32_movntdq256(dv, a);
+                __builtin_ia32_movntdq256(dv + 1, b);
+                __builtin_ia32_movntdq256(dv + 2, c);
+                __builtin_ia32_movntdq256(dv + 3, e);
+                dv += 4;
+                s += 128;
+                n -= 128;
+            }
+            __builtin_ia32_sfence();
+        }
+        else {
+            while (n >= 128) {
+                Vector256 a = Load256(s), b = Load256(s + 32), c = Load256(s + 64), e = Load256(s + 96);
+                dv[0] = a;
+                dv[1] = b;
+                dv[2] = c;
+                dv[3] = e;
+                dv += 4;
+                s += 128;
+                n -= 128;
+            }
+        }
+
+        while (n >= 32) {
+            *dv++ = Load256(s);
+            s += 32;
+            n -= 32;
+        }
+
+        if (n) Store256(reinterpret_cast<uint8_t*>(dv) + n - 32, tail);
+        return dest;
+    }
+
+    void* MemoryRoutines::SetAVX2(void* dest, uint8_t value, size_t n) {
+        auto d = static_cast<uint8_t*>(dest);
+
+        if (n < 32) {
+            while (n--) *d++ = value;
+            return dest;
+        }
+
+        auto pattern = static_cast<long long>(0x0101010101010101ULL * value);
+        Vector256 v = { pattern, pattern, pattern, pattern };
+
+        Store256(d, v);
+        Store256(d + n - 32, v);
+
+        size_t skip = 32 - (reinterpret_cast<uintptr_t>(d) & 31);
+        d += skip;
+        n -= skip;
+
+        auto dv = reinterpret_cast<Vector256*>(d);
+        if (n >= NON_TEMPORAL_THRESHOLD) {
+            while (n >= 128) {
+                __builtin_ia32_movntdq256(dv, v);
+                __builtin_ia32_movntdq256(dv + 1, v);
+                __builtin_ia32_movntdq256(dv + 2, v);
+                __builtin_ia32_movntdq256(dv + 3, v);
+                dv += 4;
+                n -= 128;
+            }
+            __builtin_ia32_sfence();
+        }
+        else {
+            while (n >= 128) {
+                dv[0] = v;
+                dv[1] = v;
+                dv[2] = v;
+                dv[3] = v;
+                dv += 4;
+                n -= 128;
+            }
+        }
+
+        while (n >= 32) {
+            *dv++ = v;
+            n -= 32;
+        }
+
+        return dest;
+    }
+
+    int MemoryRoutines::CompareAVX2(const void* s1, const void* s2, size_t n) {
+        auto p1 = static_cast<const uint8_t*>(s1);
+        auto p2 = static_cast<const uint8_t*>(s2);
+
+        while (n >= 32) {
+            auto a = reinterpret_cast<ByteVector256>(Load256(p1));
+            auto b = reinterpret_cast<ByteVector256>(Load256(p2));
+
+            uint32_t mask = __builtin_ia32_pmovmskb256(reinterpret_cast<ByteVector256>(a == b));
+            if (mask != 0xFFFFFFFF) {
+                uint32_t index = __builtin_ctz(~mask);
+                return p1[index] < p2[index] ? -1 : 1;
+            }
+
+            p1 += 32;
+            p2 += 32;
+            n -= 32;
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            if (p1[i] != p2[i]) {
+                return p1[i] < p2[i] ? -1 : 1;
+            }
+        }
+
+        return 0;
+    }
+} // Memory
@@ -0,0 +1,366 @@
+#include "MemoryRoutines.h"
+
+#include "Core/FPU.h"
+
+namespace Memory {
+    // Word types that are allowed to alias anything; the source of a copy isn't necessarily 8-byte aligned
+    typedef uint64_t UnalignedWord __attribute__((may_alias, aligned(1)));
+    typedef uint64_t AlignedWord __attribute__((may_alias));
+
+    MemoryRoutines::Strategy MemoryRoutines::_strategy = MemoryRoutines::Strategy::WordLoop;
+    MemoryRoutines::SimdLevel MemoryRoutines::_simdLevel = MemoryRoutines::SimdLevel::SSE2;
+    size_t MemoryRoutines::_repThreshold = static_cast<size_t>(-1);
+    size_t MemoryRoutines::_repStosThreshold = static_cast<size_t>(-1);
+    size_t MemoryRoutines::_nonTemporalThreshold = static_cast<size_t>(-1);
+
+    void MemoryRoutines::Initialize(Core::CPU* cpu) {
+        // FSRM makes "rep movsb" fast for every size, ERMS only pays off once the copy is large enough to hide the microcode startup
+        if (cpu->HasFeature(Core::CPUFeatures::FSRM)) {
+            _strategy = Strategy::RepMovsbAll;
+            _repThreshold = 0;
+        }
+        else if (cpu->HasFeature(Core::CPUFeatures::ERMS)) {
+            _strategy = Strategy::RepMovsb;
+            _repThreshold = ERMS_THRESHOLD;
+        }
+        else {
+            _strategy = Strategy::WordLoop;
+            _repThreshold = static_cast<size_t>(-1);
+        }
+
+        // FSRM only speeds up short "rep movsb", a short "rep stosb" still pays the startup cost that ERMS has
+        bool fastStrings = cpu->HasFeature(Core::CPUFeatures::FSRM) || cpu->HasFeature(Core::CPUFeatures::ERMS);
+        _repStosThreshold = fastStrings ? ERMS_THRESHOLD : static_cast<size_t>(-1);
+
+        // MOVNTI was introduced with SSE2, which every x86_64 CPU should have; don't trust that blindly though
+        _nonTemporalThreshold = cpu->HasFeature(Core::CPUFeatures::SSE2) ? NON_TEMPORAL_THRESHOLD : static_cast<size_t>(-1);
+
+        // SSE2 is part of the x86_64 baseline, AVX2 additionally needs the OS (us) to have enabled the YMM state in XCR0
+        _simdLevel = Core::FPU::IsAVX2Usable() ? SimdLevel::AVX2 : SimdLevel::SSE2;
+
+        LOG_DEBUG("Memory routines use the %s strategy (rep threshold %u64, rep stos threshold %u64, non-temporal threshold %u64), SIMD routines use %s.", GetStrategyName(), _repThreshold, _repStosThreshold, _nonTemporalThreshold, GetSimdLevelName());
+    }
+
+    MemoryRoutines::Strategy MemoryRoutines::GetStrategy() {
+        return _strategy;
+    }
+
+    const char* MemoryRoutines::GetStrategyName() {
+        switch (_strategy) {
+            case Strategy::WordLoop: return "word loop";
+            case Strategy::RepMovsb: return "ERMS rep movsb";
+            case Strategy::RepMovsbAll: return "FSRM rep movsb";
+        }
+
+        return "unknown";
+    }
+
+    MemoryRoutines::SimdLevel MemoryRoutines::GetSimdLevel() {
+        return _simdLevel;
+    }
+
+    const char* MemoryRoutines::GetSimdLevelName() {
+        switch (_simdLevel) {
+            case SimdLevel::SSE2: return "SSE2";
+            case SimdLevel::AVX2: return "AVX2";
+        }
+
+        return "unknown";
+    }
+
+    void* MemoryRoutines::CopyWords(void* dest, const void* src, size_t n) {
+        auto d = static_cast<uint8_t*>(dest);
+        auto s = static_cast<const uint8_t*>(src);
+
+        if (n >= 8) {
+            // Align the destination first, misaligned loads are cheap but misaligned stores can split cache lines
+            while (reinterpret_cast<uintptr_t>(d) & 7) {
+                *d++ = *s++;
+                n--;
+            }
+
+            auto dw = reinterpret_cast<AlignedWord*>(d);
+            auto sw = reinterpret_cast<const UnalignedWord*>(s);
+
+            while (n >= 32) {
+                dw[0] = sw[0];
+                dw[1] = sw[1];
+                dw[2] = sw[2];
+                dw[3] = sw[3];
+                dw += 4;
+                sw += 4;
+                n -= 32;
+            }
+
+            while (n >= 8) {
+                *dw++ = *sw++;
+                n -= 8;
+            }
+
+            d = reinterpret_cast<uint8_t*>(dw);
+            s = reinterpret_cast<const uint8_t*>(sw);
+        }
+
+        while (n--) {
+            *d++ = *s++;
+        }
+
+        return dest;
+    }
+
+    void* MemoryRoutines::CopyWordsBackwards(void* dest, const void* src, size_t n) {
+        auto d = static_cast<uint8_t*>(dest) + n;
+        auto s = static_cast<const uint8_t*>(src) + n;
+
+        if (n >= 8) {
+            // Align the end of the destination
+            while (reinterpret_cast<uintptr_t>(d) & 7) {
+                *--d = *--s;
+                n--;
+            }
+
+            auto dw = reinterpret_cast<AlignedWord*>(d);
+            auto sw = reinterpret_cast<const UnalignedWord*>(s);
+
+            while (n >= 8) {
+                *--dw = *--sw;
+                n -= 8;
+            }
+
+            d = reinterpret_cast<uint8_t*>(dw);
+            s = reinterpret_cast<const uint8_t*>(sw);
+        }
+
+        while (n--) {
+            *--d = *--s;
+        }
+
+        return dest;
+    }
+
+    void* MemoryRoutines::CopyRepMovsb(void* dest, const void* src, size_t n) {
+        void* d = dest;
+        asm volatile (
+            "rep movsb"
+            : "+D"(d), "+S"(src), "+c"(n)
+            :
+            : "memory"
+        );
+
+        return dest;
+    }
+
+    void* MemoryRoutines::CopyNonTemporal(void* dest, const void* src, size_t n) {
+        auto d = static_cast<uint8_t*>(dest);
+        auto s = static_cast<const uint8_t*>(src);
+
+        while ((reinterpret_cast<uintptr_t>(d) & 7) && n) {
+            *d++ = *s++;
+            n--;
+        }
+
+        auto dw = reinterpret_cast<AlignedWord*>(d);
+        auto sw = reinterpret_cast<const UnalignedWord*>(s);
+
+        // MOVNTI writes through write-combining buffers without pulling the destination lines into the cache
+        while (n >= 32) {
+            asm volatile ("movnti %1, %0" : "=m"(dw[0]) : "r"(sw[0]));
+            asm volatile ("movnti %1, %0" : "=m"(dw[1]) : "r"(sw[1]));
+            asm volatile ("movnti %1, %0" : "=m"(dw[2]) : "r"(sw[2]));
+            asm volatile ("movnti %1, %0" : "=m"(dw[3]) : "r"(sw[3]));
+            dw += 4;
+            sw += 4;
+            n -= 32;
+        }
+
+        while (n >= 8) {
+            asm volatile ("movnti %1, %0" : "=m"(*dw) : "r"(*sw));
+            dw++;
+            sw++;
+            n -= 8;
+        }
+
+        // Non-temporal stores are weakly ordered, fence them before anyone else can observe the buffer
+        asm volatile ("sfence" ::: "memory");
+
+        d = reinterpret_cast<uint8_t*>(dw);
+        s = reinterpret_cast<const uint8_t*>(sw);
+        while (n--) {
+            *d++ = *s++;
+        }
+
+        return dest;
+    }
+
+    void* MemoryRoutines::SetWords(void* dest, uint8_t value, size_t n) {
+        auto d = static_cast<uint8_t*>(dest);
+
+        if (n >= 8) {
+            uint64_t pattern = 0x0101010101010101ULL * value;
+
+            while (reinterpret_cast<uintptr_t>(d) & 7) {
+                *d++ = value;
+                n--;
+            }
+
+            auto dw = reinterpret_cast<AlignedWord*>(d);
+            while (n >= 32) {
+                dw[0] = pattern;
+                dw[1] = pattern;
+                dw[2] = pattern;
+                dw[3] = pattern;
+                dw += 4;
+                n -= 32;
+            }
+
+            while (n >= 8) {
+                *dw++ = pattern;
+                n -= 8;
+            }
+
+            d = reinterpret_cast<uint8_t*>(dw);
+        }
+
+        while (n--) {
+            *d++ = value;
+        }
+
+        return dest;
+    }
+
+    void* MemoryRoutines::SetRepStosb(void* dest, uint8_t value, size_t n) {
+        void* d = dest;
+        asm volatile (
+            "rep stosb"
+            : "+D"(d), "+c"(n)
+            : "a"(value)
+            : "memory"
+        );
+
+        return dest;
+    }
+
+    void* MemoryRoutines::SetNonTemporal(void* dest, uint8_t value, size_t n) {
+        auto d = static_cast<uint8_t*>(dest);
+        uint64_t pattern = 0x0101010101010101ULL * value;
+
+        while ((reinterpret_cast<uintptr_t>(d) & 7) && n) {
+            *d++ = value;
+            n--;
+        }
+
+        auto dw = reinterpret_cast<AlignedWord*>(d);
+        while (n >= 32) {
+            asm volatile ("movnti %1, %0" : "=m"(dw[0]) : "r"(pattern));
+            asm volatile ("movnti %1, %0" : "=m"(dw[1]) : "r"(pattern));
+            asm volatile ("movnti %1, %0" : "=m"(dw[2]) : "r"(pattern));
+            asm volatile ("movnti %1, %0" : "=m"(dw[3]) : "r"(pattern));
+            dw += 4;
+            n -= 32;
+        }
+
+        while (n >= 8) {
+            asm volatile ("movnti %1, %0" : "=m"(*dw) : "r"(pattern));
+            dw++;
+            n -= 8;
+        }
+
+        asm volatile ("sfence" ::: "memory");
+
+        d = reinterpret_cast<uint8_t*>(dw);
+        while (n--) {
+            *d++ = value;
+        }
+
+        return dest;
+    }
+
+    int MemoryRoutines::CompareWords(const void* s1, const void* s2, size_t n) {
+        auto p1 = static_cast<const uint8_t*>(s1);
+        auto p2 = static_cast<const uint8_t*>(s2);
+
+        while (n >= 8) {
+            uint64_t a = *reinterpret_cast<const UnalignedWord*>(p1);
+            uint64_t b = *reinterpret_cast<const UnalignedWord*>(p2);
+
+            if (a != b) {
+                // Byte swapping turns the little endian words into big endian ones, so the first differing byte decides the comparison
+                return __builtin_bswap64(a) < __builtin_bswap64(b) ? -1 : 1;
+            }
+
+            p1 += 8;
+            p2 += 8;
+            n -= 8;
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            if (p1[i] != p2[i]) {
+                return p1[i] < p2[i] ? -1 : 1;
+            }
+        }
+
+        return 0;
+    }
+
+    void* MemoryRoutines::Copy(void* dest, const void* src, size_t n) {
+        if (n >= _nonTemporalThreshold) return CopyNonTemporal(dest, src, n);
+        if (n >= _repThreshold) return CopyRepMovsb(dest, src, n);
+        return CopyWords(dest, src, n);
+    }
+
+    void* MemoryRoutines::Set(void* dest, uint8_t value, size_t n) {
+        if (n >= _nonTemporalThreshold) return SetNonTemporal(dest, value, n);
+        if (n >= _repStosThreshold) return SetRepStosb(dest, value, n);
+        return SetWords(dest, value, n);
+    }
+
+    void* MemoryRoutines::CopySIMD(void* dest, const void* src, size_t n) {
+        if (n < SIMD_THRESHOLD) return Copy(dest, src, n);
+
+        Core::KernelFpuScope scope;
+        return _simdLevel == SimdLevel::AVX2 ? CopyAVX2(dest, src, n) : CopySSE2(dest, src, n);
+    }
+
+    void* MemoryRoutines::SetSIMD(void* dest, uint8_t value, size_t n) {
+        if (n < SIMD_THRESHOLD) return Set(dest, value, n);
+
+        Core::KernelFpuScope scope;
+        return _simdLevel == SimdLevel::AVX2 ? SetAVX2(dest, value, n) : SetSSE2(dest, value, n);
+    }
+
+    int MemoryRoutines::CompareSIMD(const void* s1, const void* s2, size_t n) {
+        if (n < SIMD_THRESHOLD) return CompareWords(s1, s2, n);
+
+        Core::KernelFpuScope scope;
+        return _simdLevel == SimdLevel::AVX2 ? CompareAVX2(s1, s2, n) : CompareSSE2(s1, s2, n);
+    }
+} // Memory
+
+// These are required by libc (and by the compiler, which is free to emit calls to them)
+extern "C" {
+    void *memcpy(void * dest, const void * src, size_t n) {
+        return Memory::MemoryRoutines::Copy(dest, src, n);
+    }
+
+    void *memset(void *s, int c, size_t n) {
+        return Memory::MemoryRoutines::Set(s, static_cast<uint8_t>(c), n);
+    }
+
+    void *memmove(void *dest, const void *src, size_t n) {
+        auto d = reinterpret_cast<uintptr_t>(dest);
+        auto s = reinterpret_cast<uintptr_t>(src);
+
+        if (d == s || n == 0) return dest;
+
+        // Every forward copy reads a chunk before it overwrites it, so they are safe whenever the destination is below the source
+        if (d < s || d >= s + n) {
+            return Memory::MemoryRoutines::Copy(dest, src, n);
+        }
+
+        return Memory::MemoryRoutines::CopyWordsBackwards(dest, src, n);
+    }
+
+    int memcmp(const void *s1, const void *s2, size_t n) {
+        return Memory::MemoryRoutines::CompareWords(s1, s2, n);
+    }
+}
@@ -0,0 +1,75 @@
+#ifndef BOREALOS_MEMORYROUTINES_H
+#define BOREALOS_MEMORYROUTINES_H
+
+#include <Definitions.h>
+#include "Core/CPU.h"
+
+namespace Memory {
+    // Backing implementations of memcpy, memset, memmove and memcmp.
+    // Until Initialize is called every routine uses the portable 8-byte word loops, since memcpy & co. are needed long before the CPU is probed.
+    // Note that this file must be built with -fno-tree-loop-distribute-patterns, otherwise GCC turns the word loops back into calls to memcpy/memset.
+    class MemoryRoutines {
+    public:
+        enum class Strategy : uint8_t {
+            WordLoop,   // Plain 8-byte loads and stores
+            RepMovsb,   // ERMS: "rep movsb" / "rep stosb" for medium and large sizes
+            RepMovsbAll // FSRM: "rep movsb" / "rep stosb" is fast even for short sizes
+        };
+
+        enum class SimdLevel : uint8_t {
+            SSE2,
+            AVX2
+        };
+
+        static void Initialize(Core::CPU* cpu);
+        static Strategy GetStrategy();
+        static const char* GetStrategyName();
+        static SimdLevel GetSimdLevel();
+        static const char* GetSimdLevelName();
+
+        // The individual implementations are exposed so they can be benchmarked against each other
+        static void* CopyWords(void* dest, const void* src, size_t n);
+        static void* CopyWordsBackwards(void* dest, const void* src, size_t n);
+        static void* CopyRepMovsb(void* dest, const void* src, size_t n);
+        static void* CopyNonTemporal(void* dest, const void* src, size_t n);
+        static void* SetWords(void* dest, uint8_t value, size_t n);
+        static void* SetRepStosb(void* dest, uint8_t value, size_t n);
+        static void* SetNonTemporal(void* dest, uint8_t value, size_t n);
+        static int CompareWords(const void* s1, const void* s2, size_t n);
+
+        static void* Copy(void* dest, const void* src, size_t n);
+        static void* Set(void* dest, uint8_t value, size_t n);
+
+        // SIMD versions for bulk operations, these enter a Core::KernelFpuScope around the vector kernels.
+        // Small sizes use the scalar routines instead, since saving the vector state would cost more than the vector units gain.
+        static void* CopySIMD(void* dest, const void* src, size_t n);
+        static void* SetSIMD(void* dest, uint8_t value, size_t n);
+        static int CompareSIMD(const void* s1, const void* s2, size_t n);
+
+        // Raw vector kernels (MemoryRoutines.sse2.cpp and MemoryRoutines.avx2.cpp), they must only be called inside a Core::KernelFpuScope!
+        static void* CopySSE2(void* dest, const void* src, size_t n);
+        static void* SetSSE2(void* dest, uint8_t value, size_t n);
+        static int CompareSSE2(const void* s1, const void* s2, size_t n);
+        static void* CopyAVX2(void* dest, const void* src, size_t n);
+        static void* SetAVX2(void* dest, uint8_t value, size_t n);
+        static int CompareAVX2(const void* s1, const void* s2, size_t n);
+
+        // Copies at least this large bypass the cache with non-temporal stores, since they would evict the whole working set anyway
+        static constexpr size_t NON_TEMPORAL_THRESHOLD = 1 * Constants::MiB;
+
+        // Below this size the startup cost of "rep movsb" outweighs its throughput on CPUs without FSRM
+        static constexpr size_t ERMS_THRESHOLD = 256;
+
+        // Below this size the SIMD versions defer to the scalar routines
+        static constexpr size_t SIMD_THRESHOLD = 512;
+
+    private:
+        static Strategy _strategy;
+        static SimdLevel _simdLevel;
+        static size_t _repThreshold;         // Copies >= this use "rep movsb"
+        static size_t _repStosThreshold;     // Sets >= this use "rep stosb", FSRM doesn't cover short stores
+        static size_t _nonTemporalThreshold; // Sizes >= this use non-temporal stores
+    };
+} // Memory
+
+#endif //BOREALOS_MEMORYROUTINES_H
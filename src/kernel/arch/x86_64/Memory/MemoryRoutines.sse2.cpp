@@ -0,0 +1,152 @@
+#include "MemoryRoutines.h"
+
+// This translation unit is built with SSE2 enabled (see the *.sse2.cpp rule in the kernel CMakeLists), so everything in here
+// may touch the XMM registers and must only run inside a Core::KernelFpuScope.
+namespace Memory {
+    typedef long long Vector128 __attribute__((vector_size(16)));
+    typedef long long UnalignedVector128 __attribute__((vector_size(16), aligned(1), may_alias));
+    typedef char ByteVector128 __attribute__((vector_size(16)));
+
+    static inline Vector128 Load128(const uint8_t* p) {
+        return *reinterpret_cast<const UnalignedVector128*>(p);
+    }
+
+    static inline void Store128(uint8_t* p, Vector128 v) {
+        *reinterpret_cast<UnalignedVector128*>(p) = v;
+    }
+
+    void* MemoryRoutines::CopySSE2(void* dest, const void* src, size_t n) {
+        auto d = static_cast<uint8_t*>(dest);
+        auto s = static_cast<const uint8_t*>(src);
+
+        if (n < 16) {
+            while (n--) *d++ = *s++;
+            return dest;
+        }
+
+        // Copy the (possibly misaligned) head with one unaligned store, then continue from the first aligned destination address
+        Vector128 head = Load128(s);
+        Vector128 tail = Load128(s + n - 16);
+        Store128(d, head);
+
+        size_t skip = 16 - (reinterpret_cast<uintptr_t>(d) & 15);
+        d += skip;
+        s += skip;
+        n -= skip;
+
+        auto dv = reinterpret_cast<Vector128*>(d);
+        if (n >= NON_TEMPORAL_THRESHOLD) {
+            while (n >= 64) {
+                Vector128 a = Load128(s), b = Load128(s + 16), c = Load128(s + 32), e = Load128(s + 48);
+                __builtin_ia32_movntdq(dv, a);
+                __builtin_ia32_movntdq(dv + 1, b);
+                __builtin_ia32_movntdq(dv + 2, c);
+                __builtin_ia32_movntdq(dv + 3, e);
+                dv += 4;
+                s += 64;
+                n -= 64;
+            }
+            __builtin_ia32_sfence();
+        }
+        else {
+            while (n >= 64) {
+                Vector128 a = Load128(s), b = Load128(s + 16), c = Load128(s + 32), e = Load128(s + 48);
+                dv[0] = a;
+                dv[1] = b;
+                dv[2] = c;
+                dv[3] = e;
+                dv += 4;
+                s += 64;
+                n -= 64;
+            }
+        }
+
+        while (n >= 16) {
+            *dv++ = Load128(s);
+            s += 16;
+            n -= 16;
+        }
+
+        // The last 16 bytes were loaded up front, storing them overlaps bytes that were already copied
+        if (n) Store128(reinterpret_cast<uint8_t*>(dv) + n - 16, tail);
+        return dest;
+    }
+
+    void* MemoryRoutines::SetSSE2(void* dest, uint8_t value, size_t n) {
+        auto d = static_cast<uint8_t*>(dest);
+
+        if (n < 16) {
+            while (n--) *d++ = value;
+            return dest;
+        }
+
+        uint64_t pattern = 0x0101010101010101ULL * value;
+        Vector128 v = { static_cast<long long>(pattern), static_cast<long long>(pattern) };
+
+        Store128(d, v);
+        Store128(d + n - 16, v);
+
+        size_t skip = 16 - (reinterpret_cast<uintptr_t>(d) & 15);
+        d += skip;
+        n -= skip;
+
+        auto dv = reinterpret_cast<Vector128*>(d);
+        if (n >= NON_TEMPORAL_THRESHOLD) {
+            while (n >= 64) {
+                __builtin_ia32_movntdq(dv, v);
+                __builtin_ia32_movntdq(dv + 1, v);
+                __builtin_ia32_movntdq(dv + 2, v);
+                __builtin_ia32_movntdq(dv + 3, v);
+                dv += 4;
+                n -= 64;
+            }
+            __builtin_ia32_sfence();
+        }
+        else {
+            while (n >= 64) {
+                dv[0] = v;
+                dv[1] = v;
+                dv[2] = v;
+                dv[3] = v;
+                dv += 4;
+                n -= 64;
+            }
+        }
+
+        while (n >= 16) {
+            *dv++ = v;
+            n -= 16;
+        }
+
+        return dest;
+    }
+
+    int MemoryRoutines::CompareSSE2(const void* s1, const void* s2, size_t n) {
+        auto p1 = static_cast<const uint8_t*>(s1);
+        auto p2 = static_cast<const uint8_t*>(s2);
+
+        while (n >= 16) {
+            auto a = reinterpret_cast<ByteVector128>(Load128(p1));
+            auto b = reinterpret_cast<ByteVector128>(Load128(p2));
+
+            // PMOVMSKB gathers the top bit of every byte, so a fully equal block gives 0xFFFF
+            uint32_t mask = __builtin_ia32_pmovmskb128(reinterpret_cast<ByteVector128>(a == b));
+            if (mask != 0xFFFF) {
+                uint32_t index = __builtin_ctz(~mask);
+                return p1[index] < p2[index] ? -1 : 1;
+            }
+
+            p1 += 16;
+            p2 += 16;
+            n -= 16;
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            if (p1[i] != p2[i]) {
+                return p1[i] < p2[i] ? -1 : 1;
+            }
+        }
+
+        return 0;
+    }
+} // Memory
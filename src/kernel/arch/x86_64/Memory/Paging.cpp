@@ -4,6 +4,7 @@
 #include "Kernel.h"
 #include "../KernelData.h"
 #include "../IO/FramebufferConsole.h"
+#include "../Core/PerCPU.h"
 
 namespace Memory {
     struct Paging::PagingState {
@@ -13,7 +14,6 @@ namespace Memory {
     Paging::Paging(PMM *pmm) {
         physicalMemoryManager = pmm;
         kernelPagingState = nullptr;
-        currentPagingState = nullptr;
         kernelHigherHalfOffset = hhdm_request.response->offset;
         kernelElfOffset = 0XFFFFFFFF80000000;
     }
@@ -40,11 +40,14 @@ namespace Memory {
     }
 
     void Paging::MapPage(uint64_t virtualAddress, uint64_t physicalAddress, PageFlags flags) {
-        MapPage(currentPagingState, physicalMemoryManager, virtualAddress, physicalAddress, flags, kernelHigherHalfOffset);
+        MapPage(GetCurrentPagingState(), physicalMemoryManager, virtualAddress, physicalAddress, flags, kernelHigherHalfOffset);
     }
 
     void Paging::UnmapPage(uint64_t virtualAddress) {
-        UnmapPage(currentPagingState, physicalMemoryManager, virtualAddress, kernelHigherHalfOffset);
+        uintptr_t freedTables = 0;
+        UnmapPage(GetCurrentPagingState(), physicalMemoryManager, virtualAddress, kernelHigherHalfOffset, &freedTables);
+        ShootdownTLB(virtualAddress, 1);
+        FreeTables(physicalMemoryManager, freedTables, kernelHigherHalfOffset);
     }
 
     void Paging::MapPage(PagingState *vmmState, uint64_t virtualAddress, uint64_t physicalAddress, PageFlags flags) {
@@ -52,7 +55,10 @@ namespace Memory {
     }
 
     void Paging::UnmapPage(PagingState *vmmState, uint64_t virtualAddress) {
-        UnmapPage(vmmState, physicalMemoryManager, virtualAddress, kernelHigherHalfOffset);
+        uintptr_t freedTables = 0;
+        UnmapPage(vmmState, physicalMemoryManager, virtualAddress, kernelHigherHalfOffset, &freedTables);
+        ShootdownTLB(virtualAddress, 1);
+        FreeTables(physicalMemoryManager, freedTables, kernelHigherHalfOffset);
     }
 
     void Paging::MapPages(uint64_t virtualAddressStart, uint64_t physicalAddressStart, size_t pageCount, PageFlags flags) {
@@ -62,9 +68,15 @@ namespace Memory {
     }
 
     void Paging::UnmapPages(uint64_t virtualAddressStart, size_t pageCount) {
+        PagingState* state = GetCurrentPagingState();
+        uintptr_t freedTables = 0;
         for (size_t i = 0; i < pageCount; i++) {
-            UnmapPage(virtualAddressStart + i * Architecture::KernelPageSize);
+            UnmapPage(state, physicalMemoryManager, virtualAddressStart + i * Architecture::KernelPageSize, kernelHigherHalfOffset, &freedTables);
         }
+
+        // One shootdown for the whole range instead of an IPI round trip per page
+        ShootdownTLB(virtualAddressStart, pageCount);
+        FreeTables(physicalMemoryManager, freedTables, kernelHigherHalfOffset);
     }
 
     uint64_t Paging::GetPhysicalAddress(uint64_t virtualAddress) {
@@ -72,7 +84,7 @@ namespace Memory {
         ExtractPageTableIndices(virtualAddress, pml4Index, pdpIndex, pdIndex, ptIndex, pageOffset);
 
         // Apply the higher half offset to the Paging state so we can access it
-        auto vmmState = reinterpret_cast<PagingState *>(reinterpret_cast<uint64_t>(currentPagingState) + kernelHigherHalfOffset);
+        auto vmmState = reinterpret_cast<PagingState *>(reinterpret_cast<uint64_t>(GetCurrentPagingState()) + kernelHigherHalfOffset);
         auto pml4 = reinterpret_cast<PML4 *>(reinterpret_cast<uint64_t>(vmmState->pml4) + kernelHigherHalfOffset);
         if (!(pml4->entries[pml4Index] & static_cast<uint64_t>(PageFlags::Present))) return 0;
 
@@ -116,12 +128,17 @@ namespace Memory {
     void Paging::SwitchToPageTable(PagingState *state) {
         auto newState = reinterpret_cast<PagingState *>(reinterpret_cast<uint64_t>(state) + kernelHigherHalfOffset); // Convert from phys to virt.
         if (!newState || !newState->pml4) PANIC("Invalid Paging state provided for page table switch!");
-        if (newState == currentPagingState) return; // Already on this page table, no need to switch
+        if (state == GetCurrentPagingState()) return; // Already on this page table, no need to switch
 
         auto newPml4PhysicalAddress = reinterpret_cast<uint64_t>(newState->pml4); // the pml4 is in physical memory, so this is already the physical address
         asm volatile("mov %0, %%cr3" : : "r"(newPml4PhysicalAddress) : "memory"); // Load the new page table into CR3
         asm volatile ("invlpg (%0)" : : "r"(0) : "memory"); // Invalidate the TLB to ensure the new page table is used immediately
-        currentPagingState = state;
+        Core::PerCPU::Get()->PagingState = state;
+    }
+
+    Paging::PagingState* Paging::GetCurrentPagingState() const {
+        // Every CPU has its own CR3, so the current page table is tracked per CPU
+        return Core::PerCPU::Get()->PagingState;
     }
 
     // This functions deeply copies the existing page table to a new one.
@@ -236,7 +253,7 @@ namespace Memory {
         asm volatile("invlpg (%0)" ::"r"(virtualAddress) : "memory"); // Invalidate the TLB entry for this page to ensure the new mapping is used immediately
     }
 
-    void Paging::UnmapPage(PagingState *vmmState, PMM *physicalMemoryManager, uint64_t virtualAddress, uint64_t offset) {
+    void Paging::UnmapPage(PagingState *vmmState, PMM *physicalMemoryManager, uint64_t virtualAddress, uint64_t offset, uintptr_t* freedTables) {
         // Reverse of the mapping process, but we also need to check if the page tables are present at each level and panic if we try to unmap an address that isn't mapped
         uint32_t pml4Index, pdpIndex, pdIndex, ptIndex, pageOffset;
         ExtractPageTableIndices(virtualAddress, pml4Index, pdpIndex, pdIndex, ptIndex, pageOffset);
@@ -260,25 +277,49 @@ namespace Memory {
         pt->entries[ptIndex] = 0; // Clear the entry to unmap the page
         asm volatile("invlpg (%0)" ::"r"(virtualAddress) : "memory"); // Invalidate the TLB entry for this page to ensure the unmapping takes effect immediately
 
-        // Check if PT is now empty, and if so, free it and clear the PD entry
+        // Check if PT is now empty, and if so, clear the PD entry and queue it to be freed
+        // The entry is cleared before the table is linked into freedTables, a walker must never find the link through it
         if (IsTableEmpty(reinterpret_cast<uint64_t*>(pt))) {
-            physicalMemoryManager->FreePages(ptPhysicalAddress, 1);
             pd->entries[pdIndex] = 0;
+            QueueFreedTable(ptPhysicalAddress, offset, freedTables);
 
-            // Check if PD is now empty, and if so, free it and clear the PDP entry
+            // Check if PD is now empty, and if so, clear the PDP entry and queue it to be freed
             if (IsTableEmpty(reinterpret_cast<uint64_t*>(pd))) {
-                physicalMemoryManager->FreePages(pdPhysicalAddress, 1);
                 pdp->entries[pdpIndex] = 0;
+                QueueFreedTable(pdPhysicalAddress, offset, freedTables);
 
-                // Check if PDP is now empty, and if so, free it and clear the PML4 entry
+                // Check if PDP is now empty, and if so, clear the PML4 entry and queue it to be freed
                 if (IsTableEmpty(reinterpret_cast<uint64_t*>(pdp))) {
-                    physicalMemoryManager->FreePages(pdpPhysicalAddress, 1);
                     pml4->entries[pml4Index] = 0;
+                    QueueFreedTable(pdpPhysicalAddress, offset, freedTables);
                 }
             }
         }
     }
 
+    void Paging::QueueFreedTable(uintptr_t tablePhysicalAddress, uint64_t offset, uintptr_t *freedTables) {
+        // Linked through their first entry. The link is a page aligned physical address, so the present bit stays clear and a CPU
+        // that still walks the table until the shootdown finds nothing in it.
+        auto* table = reinterpret_cast<uint64_t *>(tablePhysicalAddress + offset);
+        table[0] = *freedTables;
+        *freedTables = tablePhysicalAddress;
+    }
+
+    void Paging::FreeTables(PMM *physicalMemoryManager, uintptr_t freedTables, uint64_t offset) {
+        while (freedTables) {
+            uintptr_t next = reinterpret_cast<uint64_t *>(freedTables + offset)[0];
+            physicalMemoryManager->FreePages(freedTables, 1);
+            freedTables = next;
+        }
+    }
+
+    void Paging::ShootdownTLB(uint64_t virtualAddress, size_t pageCount) {
+        // The local TLB was already invalidated while unmapping, only the other CPUs still have to drop their entries.
+        // Until they have, they may still walk page tables the unmap emptied, which is why those are only freed once this returned.
+        auto smp = Kernel<KernelData>::GetInstance()->ArchitectureData->Smp;
+        if (smp) smp->ShootdownTLB(virtualAddress, pageCount);
+    }
+
     bool Paging::IsTableEmpty(uint64_t *table) {
         for (int i = 0; i < 512; i++) {
             if (table[i] & static_cast<uint64_t>(PageFlags::Present)) return false;
@@ -49,14 +49,13 @@ namespace Memory {
 
         void SwitchToKernelPageTable();
         [[nodiscard]] PagingState* GetKernelPagingState() const { return kernelPagingState; }
-        [[nodiscard]] PagingState* GetCurrentPagingState() const { return currentPagingState; }
+        [[nodiscard]] PagingState* GetCurrentPagingState() const; // Of the calling CPU
         [[nodiscard]] PagingState* CreatePagingStateForProcess();
         void SwitchToPageTable(PagingState* newState);
     private:
         PMM* physicalMemoryManager;
         PagingState* kernelPagingState; // The Paging state for the kernel! When we are in kernel mode this will be used.
         uint64_t kernelHigherHalfOffset;
-        PagingState* currentPagingState; // The currently active Paging state, this will be the same as kernelVmmState when we're in kernel mode
         uint64_t kernelElfOffset;
 
         void CopyExistingPageTableToNew(PagingState *vmmState, uint64_t offset, uint64_t higherHalfOffset);
@@ -64,7 +63,11 @@ namespace Memory {
 
         static void MapPage(PagingState* vmmState, PMM *physicalMemoryManager, uint64_t virtualAddress, uint64_t physicalAddress, PageFlags flags, uint64_t
                             offset);
-        static void UnmapPage(PagingState* vmmState, PMM *physicalMemoryManager, uint64_t virtualAddress, uint64_t offset);
+        // Page tables the unmap emptied are unlinked and added to freedTables, FreeTables gives them back once the shootdown is done
+        static void UnmapPage(PagingState* vmmState, PMM *physicalMemoryManager, uint64_t virtualAddress, uint64_t offset, uintptr_t* freedTables);
+        static void QueueFreedTable(uintptr_t tablePhysicalAddress, uint64_t offset, uintptr_t* freedTables);
+        static void FreeTables(PMM *physicalMemoryManager, uintptr_t freedTables, uint64_t offset);
+        static void ShootdownTLB(uint64_t virtualAddress, size_t pageCount); // On the other CPUs, returns once all of them flushed
         static bool IsTableEmpty(uint64_t* table);
 
         // Some helper functions to extract the indices from a virtual address
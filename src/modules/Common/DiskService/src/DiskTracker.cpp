@@ -3,8 +3,9 @@
 #include <Definitions.h>
 
 DiskTracker *trackerInstance = nullptr;
+static Core::Sync::LockClass diskLockClass = { "disk devices" };
 
-DiskTracker::DiskTracker() : _devices(16) {
+DiskTracker::DiskTracker() : _devices(&diskLockClass) {
     if (trackerInstance != nullptr) {
         PANIC("Multiple instances of DiskTracker detected.");
     }
@@ -27,9 +28,11 @@ Disk::DiskService *DiskTracker::GetService() {
 }
 
 Disk::Device *DiskTracker::GetDeviceByName(const char *name) {
-    for (size_t i = 0; i < trackerInstance->_devices.Size(); i++) {
-        if (strcmp(trackerInstance->_devices[i]->name, name) == 0) {
-            return trackerInstance->_devices[i];
+    Core::Sync::RCUReadGuard guard;
+    auto devices = trackerInstance->_devices.Read();
+    for (size_t i = 0; i < devices->Count; i++) {
+        if (strcmp((*devices)[i]->name, name) == 0) {
+            return (*devices)[i];
         }
     }
 
@@ -37,31 +40,30 @@ Disk::Device *DiskTracker::GetDeviceByName(const char *name) {
 }
 
 STATUS DiskTracker::RegisterDevice(Disk::Device *device) {
-    if (GetDeviceByName(device->name) != nullptr) {
-        return STATUS::FAILURE; // Device with this name is already registered
-    }
+    bool added = trackerInstance->_devices.Add(device, [device](const Disk::Device* existing) {
+        return strcmp(existing->name, device->name) == 0;
+    });
 
-    trackerInstance->_devices.Add(device);
-    return STATUS::SUCCESS;
+    return added ? STATUS::SUCCESS : STATUS::FAILURE; // Fails if a device with this name is already registered
 }
 
 STATUS DiskTracker::UnregisterDevice(const char *name) {
-    for (size_t i = 0; i < trackerInstance->_devices.Size(); i++) {
-        if (strcmp(trackerInstance->_devices[i]->name, name) == 0) {
-            trackerInstance->_devices.Remove(i);
-            return STATUS::SUCCESS;
-        }
-    }
+    bool removed = trackerInstance->_devices.Remove([name](const Disk::Device* device) {
+        return strcmp(device->name, name) == 0;
+    });
 
-    return STATUS::FAILURE; // Device not found
+    return removed ? STATUS::SUCCESS : STATUS::FAILURE; // Fails if the device wasn't found
 }
 
 size_t DiskTracker::GetDevices(Disk::Device **devices, size_t maxDevices) {
-    size_t count = trackerInstance->_devices.Size();
+    Core::Sync::RCUReadGuard guard;
+    auto snapshot = trackerInstance->_devices.Read();
+
+    size_t count = snapshot->Count;
     if (devices != nullptr) {
         size_t toCopy = count < maxDevices ? count : maxDevices;
         for (size_t i = 0; i < toCopy; i++) {
-            devices[i] = trackerInstance->_devices[i];
+            devices[i] = (*snapshot)[i];
         }
     }
 
@@ -1,7 +1,7 @@
 #ifndef BOREALOS_TRACKER_H
 #define BOREALOS_TRACKER_H
 
-#include <Utility/List.h>
+#include <Core/Sync/RCUArray.h>
 
 #include "../Service.h"
 
@@ -15,7 +15,7 @@ public:
 private:
     Disk::DiskService _service{};
 
-    Utility::List<Disk::Device*> _devices;
+    Core::Sync::RCUArray<Disk::Device*> _devices;
 
     static Disk::Device *GetDeviceByName(const char* name);
     static STATUS RegisterDevice(Disk::Device* device);
@@ -7,12 +7,11 @@ STATUS Tracker::RegisterDevice(const HID::InputDevice *device) {
         return STATUS::FAILURE;
     }
 
-    if (HasDevice(device->id)) {
-        return STATUS::FAILURE; // Device with this id is already registered
-    }
+    bool added = trackerInstance->_devices.Add(*device, [device](const HID::InputDevice& existing) {
+        return existing.id == device->id;
+    });
 
-    trackerInstance->_devices.Add(*device);
-    return STATUS::SUCCESS;
+    return added ? STATUS::SUCCESS : STATUS::FAILURE; // Fails if a device with this id is already registered
 }
 
 STATUS Tracker::UnregisterDevice(uint64_t deviceId) {
@@ -20,14 +19,11 @@ STATUS Tracker::UnregisterDevice(uint64_t deviceId) {
         return STATUS::FAILURE;
     }
 
-    for (size_t i = 0; i < trackerInstance->_devices.Size(); i++) {
-        if (trackerInstance->_devices[i].id == deviceId) {
-            trackerInstance->_devices.Remove(i);
-            return STATUS::SUCCESS;
-        }
-    }
+    bool removed = trackerInstance->_devices.Remove([deviceId](const HID::InputDevice& device) {
+        return device.id == deviceId;
+    });
 
-    return STATUS::FAILURE; // Device not found
+    return removed ? STATUS::SUCCESS : STATUS::FAILURE; // Fails if the device wasn't found
 }
 
 bool Tracker::HasDevice(uint64_t deviceId) {
@@ -35,8 +31,10 @@ bool Tracker::HasDevice(uint64_t deviceId) {
         return false;
     }
 
-    for (size_t i = 0; i < trackerInstance->_devices.Size(); i++) {
-        if (trackerInstance->_devices[i].id == deviceId) {
+    Core::Sync::RCUReadGuard guard;
+    auto devices = trackerInstance->_devices.Read();
+    for (size_t i = 0; i < devices->Count; i++) {
+        if ((*devices)[i].id == deviceId) {
             return true;
         }
     }
@@ -49,9 +47,11 @@ STATUS Tracker::GetDeviceInfo(uint64_t deviceId, HID::InputDevice *outDevice) {
         return STATUS::FAILURE;
     }
 
-    for (size_t i = 0; i < trackerInstance->_devices.Size(); i++) {
-        if (trackerInstance->_devices[i].id == deviceId) {
-            *outDevice = trackerInstance->_devices[i];
+    Core::Sync::RCUReadGuard guard;
+    auto devices = trackerInstance->_devices.Read();
+    for (size_t i = 0; i < devices->Count; i++) {
+        if ((*devices)[i].id == deviceId) {
+            *outDevice = (*devices)[i];
             return STATUS::SUCCESS;
         }
     }
@@ -79,14 +79,11 @@ STATUS Tracker::UnsubscribeInputEvents(const HID::SubscriptionInfo &subscription
         return STATUS::FAILURE;
     }
 
-    for (size_t i = 0; i < trackerInstance->_eventHandlers.Size(); i++) {
-        if (trackerInstance->_eventHandlers[i].subscriptionId == subscription.subscriptionId) {
-            trackerInstance->_eventHandlers.Remove(i);
-            return STATUS::SUCCESS;
-        }
-    }
+    bool removed = trackerInstance->_eventHandlers.Remove([&subscription](const HID::SubscriptionInfo& handler) {
+        return handler.subscriptionId == subscription.subscriptionId;
+    });
 
-    return STATUS::FAILURE; // Event handler not found
+    return removed ? STATUS::SUCCESS : STATUS::FAILURE; // Fails if the event handler wasn't found
 }
 
 void Tracker::BroadcastInputEvent(const HID::InputEvent *event) {
@@ -94,9 +91,12 @@ void Tracker::BroadcastInputEvent(const HID::InputEvent *event) {
         return;
     }
 
-    for (size_t i = 0; i < trackerInstance->_eventHandlers.Size(); i++) {
-        if (trackerInstance->_eventHandlers[i].deviceId == event->deviceId || trackerInstance->_eventHandlers[i].deviceId == 0) { // deviceId of 0 means subscribe to all events regardless of device
-            trackerInstance->_eventHandlers[i].callback(event);
+    // Callbacks see the handlers that were subscribed when the broadcast started, they may (un)subscribe but must not block
+    Core::Sync::RCUReadGuard guard;
+    auto handlers = trackerInstance->_eventHandlers.Read();
+    for (size_t i = 0; i < handlers->Count; i++) {
+        if ((*handlers)[i].deviceId == event->deviceId || (*handlers)[i].deviceId == 0) { // deviceId of 0 means subscribe to all events regardless of device
+            (*handlers)[i].callback(event);
         }
     }
 }
@@ -104,10 +104,13 @@ void Tracker::BroadcastInputEvent(const HID::InputEvent *event) {
 uint64_t Tracker::GenerateSubscriptionId() {
     static uint64_t nextId = 1; // if there are more than (2 ^ 64) - 1 subscriptions, we have bigger problems than id collisions.
     // I'm not even sure if there are that many devices in the world, let alone that many subscriptions to input events.
-    return nextId++;
+    return __atomic_fetch_add(&nextId, 1, __ATOMIC_RELAXED);
 }
 
-Tracker::Tracker() : _devices(16), _eventHandlers(16) {
+static Core::Sync::LockClass devicesLockClass = { "HID devices" };
+static Core::Sync::LockClass eventHandlersLockClass = { "HID event handlers" };
+
+Tracker::Tracker() : _devices(&devicesLockClass), _eventHandlers(&eventHandlersLockClass) {
     if (trackerInstance != nullptr) {
         PANIC("Tracker instance already exists!");
     }
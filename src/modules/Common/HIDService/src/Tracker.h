@@ -2,7 +2,7 @@
 #define BOREALOS_TRACKER_H
 
 #include <Definitions.h>
-#include <Utility/List.h>
+#include <Core/Sync/RCUArray.h>
 
 #include "../Service.h"
 
@@ -14,8 +14,9 @@ public:
 private:
     HID::HIDService _service{};
 
-    Utility::List<HID::InputDevice> _devices;
-    Utility::List<HID::SubscriptionInfo> _eventHandlers;
+    // Input events are broadcast from interrupt handlers on every key press and mouse move, so lookups take no lock
+    Core::Sync::RCUArray<HID::InputDevice> _devices;
+    Core::Sync::RCUArray<HID::SubscriptionInfo> _eventHandlers;
 
     static STATUS RegisterDevice(const HID::InputDevice* device);
     static STATUS UnregisterDevice(uint64_t deviceId);
@@ -30,6 +30,12 @@
 #define PERIPHERAL_RESET_FAILED     0xFC
 #define CONTROLLER_ACK              0xFA
 #define DATA_RESEND                 0xFE
+#define NO_RESPONSE                 0xFF // Not sent by the controller, ReadDataFromController returns it on a timeout
+
+// Timeouts, waits poll the status register and sleep in between
+#define CONTROLLER_WRITE_TIMEOUT_NS 100000000ULL  // 100ms
+#define CONTROLLER_READ_TIMEOUT_NS  1000000000ULL // 1s, a peripheral reset only answers once its self test is done
+#define CONTROLLER_POLL_INTERVAL_NS 250000ULL     // 250us
 
 // Scancode set 2 modifier bytes
 #define KEYBOARD_EXTENDED_MODIFIER 0xE0
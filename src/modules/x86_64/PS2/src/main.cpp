@@ -9,6 +9,10 @@
 #include "PS2Definitions.h"
 #include "KernelData.h"
 #include "IO/Serial.h"
+#include "Core/Async/Completion.h"
+#include "Interrupts/Moderation.h"
+
+using Core::Async::Task;
 
 RELY_ON(EXTERNAL_MODULE(HID_MODULE_NAME, HID_MODULE_VERSION));
 MODULE(PS2_MODULE_NAME, PS2_MODULE_DESCRIPTION, PS2_MODULE_VERSION, PS2_MODULE_IMPORTANCE);
@@ -27,6 +31,49 @@ bool port1Works = false, port2Works = false;
 bool keyboardInitialized = false;
 bool mouseInitialized = false;
 
+// Held by the coroutine that is talking to the controller, responses of two conversations would get mixed up otherwise.
+// Initialization holds it from the start, so it starts out taken.
+Core::Async::Completion controllerIdle;
+
+// Bytes the interrupt handlers took off the controller, decoded and broadcast by deferred work after the EOI.
+// Single producer and single consumer: the deferred work runs on the CPU whose interrupt queued it, and ISA IRQs only go to the
+// boot CPU (see APIC::MapIRQ).
+struct ByteQueue {
+    static constexpr uint32_t SIZE = 64; // Power of two
+
+    uint8_t data[SIZE] {};
+    uint32_t head = 0; // Written by the consumer
+    uint32_t tail = 0; // Written by the producer
+
+    bool Push(uint8_t byte) {
+        uint32_t t = __atomic_load_n(&tail, __ATOMIC_RELAXED);
+        if (t - __atomic_load_n(&head, __ATOMIC_ACQUIRE) == SIZE) return false;
+        data[t & (SIZE - 1)] = byte;
+        __atomic_store_n(&tail, t + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    bool Pop(uint8_t* byte) {
+        uint32_t h = __atomic_load_n(&head, __ATOMIC_RELAXED);
+        if (h == __atomic_load_n(&tail, __ATOMIC_ACQUIRE)) return false;
+        *byte = data[h & (SIZE - 1)];
+        __atomic_store_n(&head, h + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+};
+
+void KeyboardDeferred(void*);
+uint32_t MousePoll(void*, uint32_t budget);
+
+ByteQueue keyboardBytes;
+ByteQueue mouseBytes;
+Interrupts::DeferredWork keyboardWork = { KeyboardDeferred, nullptr };
+
+// The mouse interrupts once per byte, three or four times per packet. The moderator polls the queue a little after the first byte
+// instead, so a packet is decoded in one go, and a poll that finds several packets broadcasts their movement as one event.
+Interrupts::InterruptModerator* mouseModerator = nullptr;
+int32_t pendingMouseX = 0, pendingMouseY = 0; // Movement of the packets decoded since the last move event
+
 // Clear any left over data in the PS/2 controller's data port
 // NOTE: We don't use ReadDataFromController because it waits, and we shouldn't wait for data to become available here!
 void ClearDataBuffer() {
@@ -35,90 +82,97 @@ void ClearDataBuffer() {
     }
 }
 
-void SendDataToController(uint8_t port, uint8_t value) {
-    // Wait for the input buffer to be empty before sending the data
-    while (IO::Serial::inb(STATUS_CMD) & 0x2);
+Task<> SendDataToController(uint8_t port, uint8_t value) {
+    // Wait for the input buffer to be empty before sending the data. The controller raises no interrupt for this, so the status is
+    // polled, and the executor runs other coroutines in between.
+    bool ready = co_await Core::Async::PollEventTimeout([] {
+        return !(IO::Serial::inb(STATUS_CMD) & 0x2);
+    }, CONTROLLER_WRITE_TIMEOUT_NS, CONTROLLER_POLL_INTERVAL_NS);
+    if (!ready) LOG_WARNING("PS/2 controller input buffer stayed full, sending 0x%x8 anyway!", value);
 
     // Send the data
     IO::Serial::outb(port, value);
 }
 
-uint8_t ReadDataFromController(uint8_t port) {
-    // Wait until output buffer is full before reading
-    while (!(IO::Serial::inb(STATUS_CMD) & 0x1));
+Task<uint8_t> ReadDataFromController(uint8_t port) {
+    // Wait until output buffer is full before reading, the port's interrupt may still be disabled during initialization
+    bool ready = co_await Core::Async::PollEventTimeout([] {
+        return (IO::Serial::inb(STATUS_CMD) & 0x1) != 0;
+    }, CONTROLLER_READ_TIMEOUT_NS, CONTROLLER_POLL_INTERVAL_NS);
+    if (!ready) co_return NO_RESPONSE;
 
     // Return the data
-    return IO::Serial::inb(port);
+    co_return IO::Serial::inb(port);
 }
 
-uint8_t SendKBCommandWithResult(uint8_t command, bool responseIsACK = false) {
+Task<uint8_t> SendKBCommandWithResult(uint8_t command, bool responseIsACK = false) {
     uint8_t result;
     uint8_t retries = 0;
 
     do {
-        SendDataToController(DATA, command);
-        result = ReadDataFromController(DATA);
+        co_await SendDataToController(DATA, command);
+        result = co_await ReadDataFromController(DATA);
         retries++;
     } while (result == DATA_RESEND && retries < 3);
 
     // Failed to send after all retries
     if (result == DATA_RESEND)
-        return DATA_RESEND;
+        co_return DATA_RESEND;
 
     // Consume the ACK, then read the real response
     if (responseIsACK == false && result == CONTROLLER_ACK) {
-        result = ReadDataFromController(DATA);
+        result = co_await ReadDataFromController(DATA);
     }
 
-    return result;
+    co_return result;
 }
 
-uint8_t SendMouseCommandWithResult(uint8_t command, bool responseIsACK = false) {
+Task<uint8_t> SendMouseCommandWithResult(uint8_t command, bool responseIsACK = false) {
     uint8_t result;
     uint8_t retries = 0;
 
     do {
-        SendDataToController(STATUS_CMD, CONTROLLER_ADDRESS_MOUSE);
-        SendDataToController(DATA, command);
-        result = ReadDataFromController(DATA);
+        co_await SendDataToController(STATUS_CMD, CONTROLLER_ADDRESS_MOUSE);
+        co_await SendDataToController(DATA, command);
+        result = co_await ReadDataFromController(DATA);
         retries++;
     } while (result == DATA_RESEND && retries < 3);
 
     // Failed to send after all retries
     if (result == DATA_RESEND)
-        return DATA_RESEND;
+        co_return DATA_RESEND;
 
     // Consume the ACK, then read the real response
     if (responseIsACK == false && result == CONTROLLER_ACK) {
-        result = ReadDataFromController(DATA);
+        result = co_await ReadDataFromController(DATA);
     }
 
-    return result;
+    co_return result;
 }
 
-uint8_t TestPort(uint8_t portTestCmd) {
+Task<uint8_t> TestPort(uint8_t portTestCmd) {
     uint8_t testResponse = 0xFF;
 
     for (uint8_t retries = 3; retries > 0; retries--) {
-        SendDataToController(STATUS_CMD, portTestCmd);
-        testResponse = ReadDataFromController(DATA);
-        if (testResponse != DATA_RESEND) return testResponse;
+        co_await SendDataToController(STATUS_CMD, portTestCmd);
+        testResponse = co_await ReadDataFromController(DATA);
+        if (testResponse != DATA_RESEND) co_return testResponse;
     }
 
-    return testResponse;
+    co_return testResponse;
 }
 
-uint8_t ResetPort(bool isPort2) {
+Task<uint8_t> ResetPort(bool isPort2) {
     // Mice send 3 bytes on reset (FA AA 00), keyboards send 2 (FA AA)
     // NOTE: QEMU does not send the 0x00 device ID byte, so we only read 2 bytes for both ports
     for (uint8_t retries = 3; retries > 0; retries--) {
-        if (isPort2) SendDataToController(STATUS_CMD, SELECT_PORT_2);
+        if (isPort2) co_await SendDataToController(STATUS_CMD, SELECT_PORT_2);
 
-        SendDataToController(DATA, PERIPHERAL_RESET);
-        uint8_t response1 = ReadDataFromController(DATA);
+        co_await SendDataToController(DATA, PERIPHERAL_RESET);
+        uint8_t response1 = co_await ReadDataFromController(DATA);
         if (response1 == DATA_RESEND) continue;
 
-        uint8_t response2 = ReadDataFromController(DATA);
+        uint8_t response2 = co_await ReadDataFromController(DATA);
         if (response2 == DATA_RESEND) continue;
 
         bool gotACK  = (response1 == 0xFA || response2 == 0xFA);
@@ -127,7 +181,7 @@ uint8_t ResetPort(bool isPort2) {
         if (response1 == 0xFC || response2 == 0xFC) {
             LOG_WARNING("PS/2 port %u8 self test failed!", isPort2 ? 2 : 1);
             ClearDataBuffer();
-            return 0xFC;
+            co_return 0xFC;
         }
 
         if (!gotACK || !gotPass) {
@@ -137,11 +191,11 @@ uint8_t ResetPort(bool isPort2) {
         }
 
         ClearDataBuffer();
-        return 0x00;
+        co_return 0x00;
     }
 
     LOG_WARNING("PS/2 port %u8 reset failed after 3 retries!", isPort2 ? 2 : 1);
-    return 0xFF;
+    co_return 0xFF;
 }
 
 uint8_t BuildTypematicByte(uint8_t rate, uint8_t delay) {
@@ -150,31 +204,44 @@ uint8_t BuildTypematicByte(uint8_t rate, uint8_t delay) {
     return (delay << 3) | rate;
 }
 
-void UpdateKeyboardLEDs() {
-    if (keyboardInitialized == false) return;
+Task<> SetKeyboardLEDs() {
+    co_await controllerIdle.Wait();
 
+    // Lock keys pressed while this waited for the controller are included, their own updates then set the same LEDs again
     uint8_t LEDStates = 0;
     scrollLock ? SET_BIT(LEDStates, 0) : CLEAR_BIT(LEDStates, 0);
     numLock    ? SET_BIT(LEDStates, 1) : CLEAR_BIT(LEDStates, 1);
     capsLock   ? SET_BIT(LEDStates, 2) : CLEAR_BIT(LEDStates, 2);
 
-    uint8_t cmdResult = SendKBCommandWithResult(KEYBOARD_SET_LEDS, true);
+    // The ACKs raise keyboard interrupts, and this runs with interrupts enabled, so the handler would take them off the controller first
+    kernel->ArchitectureData->Idt.MaskIRQ(KEYBOARD_IRQ);
+
+    uint8_t cmdResult = co_await SendKBCommandWithResult(KEYBOARD_SET_LEDS, true);
     if (cmdResult != CONTROLLER_ACK) {
         LOG_WARNING("Failed to send SET_LEDS command to PS/2 keyboard(response was 0x%x8 instead of 0x%x8)!", cmdResult, CONTROLLER_ACK);
-        return;
     }
-
-    uint8_t LEDResult = SendKBCommandWithResult(LEDStates, true);
-    if (LEDResult != CONTROLLER_ACK) {
-        LOG_WARNING("Failed to update PS/2 keyboard LEDs (response was 0x%x8 instead of 0x%x8)!", LEDResult, CONTROLLER_ACK);
+    else {
+        uint8_t LEDResult = co_await SendKBCommandWithResult(LEDStates, true);
+        if (LEDResult != CONTROLLER_ACK) {
+            LOG_WARNING("Failed to update PS/2 keyboard LEDs (response was 0x%x8 instead of 0x%x8)!", LEDResult, CONTROLLER_ACK);
+        }
     }
+
+    kernel->ArchitectureData->Idt.UnmaskIRQ(KEYBOARD_IRQ);
+    controllerIdle.Complete();
 }
 
-void KeyboardHandler() {
+// The LED commands wait for ACKs, which deferred work must not do, so they run as a coroutine on the system executor
+void UpdateKeyboardLEDs() {
     if (keyboardInitialized == false) return;
 
-    // Get the scancode
-    uint8_t scancode = ReadDataFromController(DATA);
+    if (!kernel->ArchitectureData->SystemExecutor->Spawn(SetKeyboardLEDs())) {
+        LOG_WARNING("Failed to start updating the PS/2 keyboard LEDs!");
+    }
+}
+
+// Runs as deferred work with interrupts enabled, so the subscriber callbacks don't hold other interrupts off
+void ProcessScancode(uint8_t scancode) {
     bool keyReleased = lastScancode == KEYBOARD_RELEASE_MODIFIER;
 
     // Toggle lock statuses and LEDs
@@ -229,23 +296,56 @@ void KeyboardHandler() {
     lastScancode = scancode;
 }
 
-void MouseHandler() {
-    if (mouseInitialized == false) return;
+void KeyboardDeferred(void*) {
+    uint8_t scancode;
+    while (keyboardBytes.Pop(&scancode)) ProcessScancode(scancode);
+}
 
+void KeyboardHandler() {
+    if (keyboardInitialized == false) return;
+
+    // Only take the byte off the controller, everything else runs after the EOI. An interrupt that was already on its way
+    // while UpdateKeyboardLEDs masked the IRQ finds the buffer empty.
+    if (!(IO::Serial::inb(STATUS_CMD) & 0x1)) return;
+    if (!keyboardBytes.Push(IO::Serial::inb(DATA))) LOG_WARNING("PS/2 keyboard byte queue is full, dropping a scancode!");
+    Interrupts::IDT::QueueDeferredWork(&keyboardWork);
+}
+
+// Broadcasts the movement collected so far as one event
+void FlushMouseMovement() {
+    if (pendingMouseX == 0 && pendingMouseY == 0) return;
+
+    HID::InputEvent* moveEvent = new HID::InputEvent {
+        .deviceId = 2,
+        .type = HID::InputEventType::MouseMove,
+        .mouseMoveEvent = {
+            .deltaX = (int16_t)pendingMouseX,
+            .deltaY = (int16_t)pendingMouseY,
+        }
+    };
+
+    HIDService->BroadcastInputEvent(moveEvent);
+    delete moveEvent;
+    pendingMouseX = 0;
+    pendingMouseY = 0;
+}
+
+// Runs from the mouse moderator's poll, like ProcessScancode runs as deferred work. Returns true once it decoded a whole packet.
+bool ProcessMouseByte(uint8_t byte) {
     static uint8_t packetBuffer[4] = {0};
     static uint8_t packetIndex = 0;
 
-    packetBuffer[packetIndex++] = ReadDataFromController(DATA);
+    packetBuffer[packetIndex++] = byte;
 
     // If we're reading the first byte but bit 3 isn't set, it's not a valid packet start
     if (packetIndex == 1 && !(packetBuffer[0] & (1 << 3))) {
         packetIndex = 0;
-        return;
+        return false;
     }
 
     // Wait until we have all the bytes we need
     uint8_t expectedPackets = mouseID != 0x00 ? 4 : 3;
-    if (packetIndex < expectedPackets) return;
+    if (packetIndex < expectedPackets) return false;
     packetIndex = 0;
 
     uint8_t packet1 = packetBuffer[0];
@@ -269,19 +369,14 @@ void MouseHandler() {
     bool yNegative = packet1 & (1 << 5);
 
     // Generate and broadcast input events
-    // Movement
-    HID::InputEvent* moveEvent = new HID::InputEvent {
-        .deviceId = 2,
-        .type = HID::InputEventType::MouseMove,
-        .mouseMoveEvent = {
-            .deltaX = xNegative ? (int16_t)(packet2 - 256) : (int16_t)packet2,
-            .deltaY = yNegative ? (int16_t)(packet3 - 256) : (int16_t)packet3,
-        }
-    };
-
-    // Some mice broadcast "resting" state events when no movement occurs
-    if (moveEvent->mouseMoveEvent.deltaX != 0 || moveEvent->mouseMoveEvent.deltaY != 0) HIDService->BroadcastInputEvent(moveEvent);
-    delete moveEvent;
+    // Movement, collected until the end of the poll. Some mice send "resting" state packets when no movement occurs, those add nothing.
+    // Flushing before the sum could leave the range of the event's deltas keeps it from wrapping around.
+    int16_t deltaX = xNegative ? (int16_t)(packet2 - 256) : (int16_t)packet2;
+    int16_t deltaY = yNegative ? (int16_t)(packet3 - 256) : (int16_t)packet3;
+    if (pendingMouseX + deltaX > INT16_MAX || pendingMouseX + deltaX < INT16_MIN ||
+        pendingMouseY + deltaY > INT16_MAX || pendingMouseY + deltaY < INT16_MIN) FlushMouseMovement();
+    pendingMouseX += deltaX;
+    pendingMouseY += deltaY;
 
     // Scrolling
     HID::InputEvent* scrollEvent = new HID::InputEvent {
@@ -295,12 +390,17 @@ void MouseHandler() {
     };
 
     // Some mice broadcast "resting" state events when no scrolling stops
-    if (scrollEvent->mouseScrollEvent.deltaVerticalWheel != 0 || scrollEvent->mouseScrollEvent.deltaHorizontalWheel != 0) HIDService->BroadcastInputEvent(scrollEvent);
+    // The movement before the scroll goes out first, so the receivers see both in the order they happened
+    if (scrollEvent->mouseScrollEvent.deltaVerticalWheel != 0 || scrollEvent->mouseScrollEvent.deltaHorizontalWheel != 0) {
+        FlushMouseMovement();
+        HIDService->BroadcastInputEvent(scrollEvent);
+    }
     delete scrollEvent;
 
-    // Buttons
+    // Buttons, like scrolling after the movement so far (a click lands where the pointer was when it happened)
     auto sendButtonEvent = [&](bool prevState, bool currrentState, HID::MouseButton button) {
         if (prevState == currrentState) return;
+        FlushMouseMovement();
         HID::InputEvent* buttonEvent = new HID::InputEvent {
             .deviceId = 2,
             .type = currrentState ? HID::InputEventType::MouseButtonPress : HID::InputEventType::MouseButtonRelease,
@@ -324,13 +424,34 @@ void MouseHandler() {
     prevMouseMiddle = middleBtnDown;
     prevMouseBtn4   = btn4Down;
     prevMouseBtn5   = btn5Down;
+    return true;
+}
+
+// The budget counts packets, so a partial packet at the end of the queue doesn't count as work left
+uint32_t MousePoll(void*, uint32_t budget) {
+    uint32_t packets = 0;
+    uint8_t byte;
+    while (packets < budget && mouseBytes.Pop(&byte)) {
+        if (ProcessMouseByte(byte)) packets++;
+    }
+
+    FlushMouseMovement();
+    return packets;
+}
+
+void MouseHandler() {
+    if (mouseInitialized == false) return;
+
+    if (!(IO::Serial::inb(STATUS_CMD) & 0x1)) return;
+    if (!mouseBytes.Push(IO::Serial::inb(DATA))) LOG_WARNING("PS/2 mouse byte queue is full, dropping a byte!");
+    mouseModerator->Interrupt();
 }
 
-STATUS InitPS2Controller() {
+Task<STATUS> InitPS2Controller() {
     // Disable the mouse and keyboard during initialization
     LOG_DEBUG("Disabling PS/2 keyboard and mouse...");
-    SendDataToController(STATUS_CMD, PORT_1_DISABLE);
-    SendDataToController(STATUS_CMD, PORT_2_DISABLE); // This is ignored if the PS/2 controller only has one port
+    co_await SendDataToController(STATUS_CMD, PORT_1_DISABLE);
+    co_await SendDataToController(STATUS_CMD, PORT_2_DISABLE); // This is ignored if the PS/2 controller only has one port
 
     // Clear any left over data in the PS/2 controller's data port. This will place the controller in a known and stable state
     // NOTE: We don't use ReadDataFromController because it waits, and we shouldn't wait for data to become available here!
@@ -338,51 +459,51 @@ STATUS InitPS2Controller() {
 
     // Set the controller's config byte
     LOG_DEBUG("Modifying PS/2 controller's configuration byte...");
-    SendDataToController(STATUS_CMD, READ_CONFIG_BYTE_CMD);
-    uint8_t configByte = ReadDataFromController(DATA);
+    co_await SendDataToController(STATUS_CMD, READ_CONFIG_BYTE_CMD);
+    uint8_t configByte = co_await ReadDataFromController(DATA);
     CLEAR_BIT(configByte, 0); // Disable IRQs for port 1
     CLEAR_BIT(configByte, 6); // Disable translation for port 1
     CLEAR_BIT(configByte, 4); // Enable the clock signal for port 1
-    SendDataToController(STATUS_CMD, WRITE_CONFIG_BYTE_CMD);
-    SendDataToController(DATA, configByte);
+    co_await SendDataToController(STATUS_CMD, WRITE_CONFIG_BYTE_CMD);
+    co_await SendDataToController(DATA, configByte);
 
     // Test the controller by sending 0xAA and checking if the response is 0x55
     LOG_DEBUG("Testing PS/2 controller...");
-    SendDataToController(STATUS_CMD, CONTROLLER_SELF_TEST);
-    uint8_t testResponse = ReadDataFromController(DATA);
+    co_await SendDataToController(STATUS_CMD, CONTROLLER_SELF_TEST);
+    uint8_t testResponse = co_await ReadDataFromController(DATA);
     
     // Handle ACKs
-    if (testResponse == CONTROLLER_ACK) testResponse = ReadDataFromController(DATA);
+    if (testResponse == CONTROLLER_ACK) testResponse = co_await ReadDataFromController(DATA);
     if (testResponse != CONTROLLER_SELF_TEST_PASSED) {
         LOG_ERROR("PS/2 controller self test failed (0x%x8 != 0x%x8)!", testResponse, CONTROLLER_SELF_TEST_PASSED);
-        return STATUS::FAILURE;
+        co_return STATUS::FAILURE;
     }    
 
     // Check if there are two channels
     LOG_DEBUG("Getting PS/2 channel count...");
-    SendDataToController(STATUS_CMD, PORT_2_ENABLE);
-    SendDataToController(STATUS_CMD, READ_CONFIG_BYTE_CMD);
-    configByte = ReadDataFromController(DATA);
+    co_await SendDataToController(STATUS_CMD, PORT_2_ENABLE);
+    co_await SendDataToController(STATUS_CMD, READ_CONFIG_BYTE_CMD);
+    configByte = co_await ReadDataFromController(DATA);
     if (!(configByte & (1 << 5))) twoChannels = true;
 
     // Disable port 2 again and reconfigure the config byte
-    SendDataToController(STATUS_CMD, PORT_2_DISABLE);
-    SendDataToController(STATUS_CMD, READ_CONFIG_BYTE_CMD);
-    configByte = ReadDataFromController(DATA);
+    co_await SendDataToController(STATUS_CMD, PORT_2_DISABLE);
+    co_await SendDataToController(STATUS_CMD, READ_CONFIG_BYTE_CMD);
+    configByte = co_await ReadDataFromController(DATA);
     CLEAR_BIT(configByte, 1); // Disable IRQs for port 2
     CLEAR_BIT(configByte, 5); // Enable the clock signal for port 2
-    SendDataToController(STATUS_CMD, WRITE_CONFIG_BYTE_CMD);
-    SendDataToController(DATA, configByte);
+    co_await SendDataToController(STATUS_CMD, WRITE_CONFIG_BYTE_CMD);
+    co_await SendDataToController(DATA, configByte);
 
     // Perform an interface test on port 1 and port 2 (if port 2 exists)
     LOG_DEBUG("Performing interface tests on %u8 channel(s)...", twoChannels ? 2 : 1);
-    uint8_t port1TestResult = TestPort(PORT_1_TEST);
+    uint8_t port1TestResult = co_await TestPort(PORT_1_TEST);
     uint8_t port2TestResult = 0xFF;
 
     if (port1TestResult != 0x00) LOG_WARNING("PS/2 port 1 test failed (got 0x%x8 instead of 0x00)!", port1TestResult);
 
     if (twoChannels) {
-        port2TestResult = TestPort(PORT_2_TEST);
+        port2TestResult = co_await TestPort(PORT_2_TEST);
         if (port2TestResult != 0x00) LOG_WARNING("PS/2 port 2 test failed (got 0x%x8 instead of 0x00)!", port2TestResult);
     }
 
@@ -391,34 +512,34 @@ STATUS InitPS2Controller() {
 
     if (!port1Works && !port2Works) {
         LOG_DEBUG("There are no working PS/2 ports available!");
-        return STATUS::FAILURE;
+        co_return STATUS::FAILURE;
     }
 
     // Enable the peripherals again and enable interrupts in the config byte
     LOG_DEBUG("Enabling PS/2 keyboard and mouse and their interrupts...");
-    if (port1Works) SendDataToController(STATUS_CMD, PORT_1_ENABLE);    
-    if (port2Works) SendDataToController(STATUS_CMD, PORT_2_ENABLE);
+    if (port1Works) co_await SendDataToController(STATUS_CMD, PORT_1_ENABLE);    
+    if (port2Works) co_await SendDataToController(STATUS_CMD, PORT_2_ENABLE);
 
-    SendDataToController(STATUS_CMD, READ_CONFIG_BYTE_CMD);
-    configByte = ReadDataFromController(DATA);
+    co_await SendDataToController(STATUS_CMD, READ_CONFIG_BYTE_CMD);
+    configByte = co_await ReadDataFromController(DATA);
     port1Works ? SET_BIT(configByte, 0) : CLEAR_BIT(configByte, 0);
     port2Works ? SET_BIT(configByte, 1) : CLEAR_BIT(configByte, 1);
-    SendDataToController(STATUS_CMD, WRITE_CONFIG_BYTE_CMD);
-    SendDataToController(DATA, configByte);
+    co_await SendDataToController(STATUS_CMD, WRITE_CONFIG_BYTE_CMD);
+    co_await SendDataToController(DATA, configByte);
 
     // Reset the peripherals
     LOG_DEBUG("Resetting PS/2 keyboard and mouse...");
-    if (port1Works) port1Works = ResetPort(false) == 0x00;
-    if (port2Works) port2Works = ResetPort(true) == 0x00;
+    if (port1Works) port1Works = co_await ResetPort(false) == 0x00;
+    if (port2Works) port2Works = co_await ResetPort(true) == 0x00;
 
     LOG_INFO("PS/2 controller initialized in %s-channel mode.", (twoChannels && port1Works && port2Works) ? "dual" : "single");
-    return STATUS::SUCCESS;
+    co_return STATUS::SUCCESS;
 }
 
-STATUS InitKeyboard() {
+Task<STATUS> InitKeyboard() {
     if (!port1Works) {
         LOG_ERROR("Port 1 does not work, the keyboard IRQ cannot be handled!");
-        return STATUS::FAILURE;
+        co_return STATUS::FAILURE;
     }
 
     // Clear the data buffer to get rid of stuck data
@@ -426,33 +547,33 @@ STATUS InitKeyboard() {
 
     // We use scancode set 2
     LOG_DEBUG("Setting scancode set to 2...");
-    SendKBCommandWithResult(KEYBOARD_GET_SELECT_SCANCODE_SET, true); // Set the scancode set
-    SendKBCommandWithResult(0x2, true);
+    co_await SendKBCommandWithResult(KEYBOARD_GET_SELECT_SCANCODE_SET, true); // Set the scancode set
+    co_await SendKBCommandWithResult(0x2, true);
 
     LOG_DEBUG("Verifying scancode set...");
-    SendKBCommandWithResult(KEYBOARD_GET_SELECT_SCANCODE_SET, true); // Get the scancode set
-    uint8_t currentSet = SendKBCommandWithResult(0x0);
+    co_await SendKBCommandWithResult(KEYBOARD_GET_SELECT_SCANCODE_SET, true); // Get the scancode set
+    uint8_t currentSet = co_await SendKBCommandWithResult(0x0);
 
     if (currentSet == CONTROLLER_ACK) {
         LOG_WARNING("PS/2 keyboard didn't send the scancode set, we will have to assume that it's set 2!");;
     }
     else if (currentSet != 0x02) {
         LOG_ERROR("PS/2 keyboard initialization failed, scancode set 0x%x8 is not set 2 (0x02)!", currentSet);
-        return STATUS::FAILURE;
+        co_return STATUS::FAILURE;
     }
 
     // Enable scanning so the keyboard actually sends scancodes
     LOG_DEBUG("Enabling scanning");
-    uint8_t scanningResult = SendKBCommandWithResult(KEYBOARD_ENABLE_SCANNING, true);
+    uint8_t scanningResult = co_await SendKBCommandWithResult(KEYBOARD_ENABLE_SCANNING, true);
     if (scanningResult != CONTROLLER_ACK) {
         LOG_ERROR("PS/2 keyboard initialization failed, could not enable scanning (response was 0x%x8 instead of 0x%x8)!", scanningResult, CONTROLLER_ACK);
-        return STATUS::FAILURE;
+        co_return STATUS::FAILURE;
     }
 
     // Finally, set the typematic rate and delay
     // NOTE: This is non-fatal, the keyboard will just use default typematic settings
-    SendKBCommandWithResult(KEYBOARD_SET_TYPEMATIC_RATE_DELAY, true);
-    uint8_t typematicResult = SendKBCommandWithResult(BuildTypematicByte(0x05, 0x03), true);
+    co_await SendKBCommandWithResult(KEYBOARD_SET_TYPEMATIC_RATE_DELAY, true);
+    uint8_t typematicResult = co_await SendKBCommandWithResult(BuildTypematicByte(0x05, 0x03), true);
     if (typematicResult != CONTROLLER_ACK) {
         LOG_WARNING("PS/2 keyboard typematic configuration failed (response was 0x%x8 instead of 0x%x8)!", typematicResult, CONTROLLER_ACK);
     }
@@ -463,15 +584,15 @@ STATUS InitKeyboard() {
     kernel->ArchitectureData->Idt.UnmaskIRQ(KEYBOARD_IRQ);
 
     keyboardInitialized = true;
-    return STATUS::SUCCESS;
+    co_return STATUS::SUCCESS;
 }
 
 // NOTE: Apparently QEMU's PS/2 mouse emulation is kinda ass. The mouse refuses to send IRQs if it's moved during the
 //  init and is not yet fully initialized. Issuing the movement counter reset command seems to fix this *mostly*, maybe the values are corrupted?
-STATUS InitMouse() {
+Task<STATUS> InitMouse() {
     if (!port2Works) {
         LOG_ERROR("Port 2 does not work, the mouse IRQ cannot be handled!");
-        return STATUS::FAILURE;
+        co_return STATUS::FAILURE;
     }
 
     // Flush any movement packets that may have accumulated during initialization
@@ -479,10 +600,10 @@ STATUS InitMouse() {
 
     // Set the resolution to 4 counts per millimeter
     LOG_DEBUG("Setting PS/2 mouse resolution...");
-    uint8_t resolutionResult = SendMouseCommandWithResult(MOUSE_SET_RESOLUTION, true);
+    uint8_t resolutionResult = co_await SendMouseCommandWithResult(MOUSE_SET_RESOLUTION, true);
     if (resolutionResult != CONTROLLER_ACK) LOG_WARNING("Failed to issue PS/2 mouse resolution command (response was 0x%x8 instead of 0x%x8)!", resolutionResult, CONTROLLER_ACK);
     else {
-        uint8_t resolutionValueResult = SendMouseCommandWithResult(0x02, true);
+        uint8_t resolutionValueResult = co_await SendMouseCommandWithResult(0x02, true);
         if (resolutionValueResult != CONTROLLER_ACK) LOG_WARNING("Failed to set PS/2 mouse resolution value (response was 0x%x8 instead of 0x%x8)!", resolutionValueResult, CONTROLLER_ACK);
     }
 
@@ -491,30 +612,30 @@ STATUS InitMouse() {
     // NOTE: This mist be done before IntelliMouse configuration, as it might reset the mouse to a 3-packet state
     LOG_DEBUG("Resetting PS/2 mouse movement counters...");
     ClearDataBuffer();
-    uint8_t defaultsResult = SendMouseCommandWithResult(MOUSE_RESET_MOVEMENT_COUNTERS, true);
+    uint8_t defaultsResult = co_await SendMouseCommandWithResult(MOUSE_RESET_MOVEMENT_COUNTERS, true);
     if (defaultsResult != CONTROLLER_ACK) LOG_WARNING("PS/2 mouse set defaults command failed (response was 0x%x8 instead of 0x%x8)!", defaultsResult, CONTROLLER_ACK);
 
     // Attempt to enable scroll wheel support via the IntelliMouse magic sequence (set sample rate 200, 100, 80)
     // If the mouse supports it, it will switch to a 4-byte packet format with a scroll wheel byte
     // NOTE: The mouse may not support this, that's fine
     LOG_DEBUG("Attempting to enable PS/2 mouse scroll wheel...");
-    SendMouseCommandWithResult(MOUSE_SET_SAMPLE_RATE, true); SendMouseCommandWithResult(200, true);
-    SendMouseCommandWithResult(MOUSE_SET_SAMPLE_RATE, true); SendMouseCommandWithResult(100, true);
-    SendMouseCommandWithResult(MOUSE_SET_SAMPLE_RATE, true); SendMouseCommandWithResult(80,  true);
+    co_await SendMouseCommandWithResult(MOUSE_SET_SAMPLE_RATE, true); co_await SendMouseCommandWithResult(200, true);
+    co_await SendMouseCommandWithResult(MOUSE_SET_SAMPLE_RATE, true); co_await SendMouseCommandWithResult(100, true);
+    co_await SendMouseCommandWithResult(MOUSE_SET_SAMPLE_RATE, true); co_await SendMouseCommandWithResult(80,  true);
 
     // Check if the mouse accepted the IntelliMouse sequence by reading its device ID (should be 0x03 if it did)
-    mouseID = SendMouseCommandWithResult(MOUSE_GET_ID);
+    mouseID = co_await SendMouseCommandWithResult(MOUSE_GET_ID);
     if (mouseID == 0x03) {
         LOG_INFO("PS/2 mouse supports scroll wheel.");
 
         // Attempt to enable extra buttons via a second magic sequence
         LOG_DEBUG("Attempting to enable extra buttons...");
-        SendMouseCommandWithResult(MOUSE_SET_SAMPLE_RATE, true); SendMouseCommandWithResult(200, true);
-        SendMouseCommandWithResult(MOUSE_SET_SAMPLE_RATE, true); SendMouseCommandWithResult(200, true);
-        SendMouseCommandWithResult(MOUSE_SET_SAMPLE_RATE, true); SendMouseCommandWithResult(80,  true);
+        co_await SendMouseCommandWithResult(MOUSE_SET_SAMPLE_RATE, true); co_await SendMouseCommandWithResult(200, true);
+        co_await SendMouseCommandWithResult(MOUSE_SET_SAMPLE_RATE, true); co_await SendMouseCommandWithResult(200, true);
+        co_await SendMouseCommandWithResult(MOUSE_SET_SAMPLE_RATE, true); co_await SendMouseCommandWithResult(80,  true);
 
         // Check if the mouse accepted the explorer sequence by reading its device ID (should be 0x04 if it did)
-        mouseID = SendMouseCommandWithResult(MOUSE_GET_ID);
+        mouseID = co_await SendMouseCommandWithResult(MOUSE_GET_ID);
         if (mouseID == 0x04) {
             LOG_INFO("PS/2 mouse supports extra buttons.");
         }
@@ -523,28 +644,84 @@ STATUS InitMouse() {
 
     // Set the sample rate to 100 samples per second
     LOG_DEBUG("Setting PS/2 mouse sample rate...");
-    uint8_t sampleRateResult = SendMouseCommandWithResult(MOUSE_SET_SAMPLE_RATE, true);
+    uint8_t sampleRateResult = co_await SendMouseCommandWithResult(MOUSE_SET_SAMPLE_RATE, true);
     if (sampleRateResult != CONTROLLER_ACK) LOG_WARNING("PS/2 mouse sample rate command failed (response was 0x%x8 instead of 0x%x8)!", sampleRateResult, CONTROLLER_ACK);
     else {
-        uint8_t sampleRateValueResult = SendMouseCommandWithResult(0x64, true);
+        uint8_t sampleRateValueResult = co_await SendMouseCommandWithResult(0x64, true);
         if (sampleRateValueResult != CONTROLLER_ACK) LOG_WARNING("PS/2 mouse sample rate value failed (response was 0x%x8 instead of 0x%x8)!", sampleRateValueResult, CONTROLLER_ACK);
     }
 
     // Enable packet transmission
     LOG_DEBUG("Enabling packet transmission for PS/2 mouse...");
-    uint8_t packetTXResult = SendMouseCommandWithResult(MOUSE_ENABLE_PACKET_TRANSMISSION, true);
+    uint8_t packetTXResult = co_await SendMouseCommandWithResult(MOUSE_ENABLE_PACKET_TRANSMISSION, true);
     if (packetTXResult != CONTROLLER_ACK) {
         LOG_ERROR("PS/2 mouse initialization failed, could not enable packet transmission (response was 0x%x8 instead of 0x%x8)!", packetTXResult, CONTROLLER_ACK);
-        return STATUS::FAILURE;
+        co_return STATUS::FAILURE;
     }
 
     // Finally, set up the IRQ handler and unmask IRQ 12
     LOG_DEBUG("Setting up PS/2 mouse IRQ handler...");
+
+    // A packet's bytes arrive within about a millisecond, and the mouse sends at most one packet per 5ms (200 samples per second).
+    // The IRQ isn't disabled while polling: the controller has one output buffer for both ports, an unread mouse byte would block
+    // the keyboard too. The handler keeps taking the bytes off the controller and the polls drain the queue.
+    Interrupts::ModerationConfig moderation;
+    moderation.Budget = 16;
+    moderation.CoalesceNs = 2'000'000;
+    mouseModerator = new Interrupts::InterruptModerator("PS/2 mouse", MousePoll, nullptr, nullptr, moderation);
+
     kernel->ArchitectureData->Idt.RegisterIRQHandler(MOUSE_IRQ, MouseHandler);
     kernel->ArchitectureData->Idt.UnmaskIRQ(MOUSE_IRQ);
 
     mouseInitialized = true;
-    return STATUS::SUCCESS;
+    co_return STATUS::SUCCESS;
+}
+
+// Runs on the system executor, LOAD_FUNC doesn't wait for it. The controller stays taken if it failed, nothing may talk to it then.
+Task<> InitPS2() {
+    if (co_await InitPS2Controller() != STATUS::SUCCESS) {
+        LOG_ERROR("PS/2 controller initialization failed!");
+        co_return;
+    }
+
+    // Initialize the keyboard and mouse
+    if (co_await InitKeyboard() == STATUS::SUCCESS) {
+        LOG_DEBUG("Registering PS/2 keyboard as HID device...");
+        HID::InputDevice* keyboard = new HID::InputDevice {
+            .id = 1,
+            .type = HID::DeviceType::Keyboard,
+            .vendorId = 0x00,
+            .productId = 0x00,
+            .name = "Generic PS/2 Keyboard",
+            .description = "Generic PS/2 Keyboard",
+            .manufacturer = "Unknown"
+        };
+
+        HIDService->RegisterDevice(keyboard);
+    }
+    else {
+        LOG_WARNING("PS/2 keyboard initialization failed!");
+    }
+
+    if (co_await InitMouse() == STATUS::SUCCESS) {
+        LOG_DEBUG("Registering PS/2 mouse as HID device...");
+        HID::InputDevice* mouse = new HID::InputDevice {
+            .id = 2,
+            .type = HID::DeviceType::Mouse,
+            .vendorId = 0x00,
+            .productId = 0x00,
+            .name = "Generic PS/2 Mouse",
+            .description = "Generic PS/2 Mouse",
+            .manufacturer = "Unknown"
+        };
+
+        HIDService->RegisterDevice(mouse);
+    }
+    else {
+        LOG_WARNING("PS/2 Mouse initialization failed!");
+    }
+
+    controllerIdle.Complete();
 }
 
 COMPATIBLE_FUNC() {
@@ -593,49 +770,12 @@ LOAD_FUNC() {
         return STATUS::FAILURE;
     }
 
-    // Initialize the PS/2 controller
+    // Talking to the controller and the devices takes up to seconds of waiting for answers, the rest of the boot goes on meanwhile
     LOG_DEBUG("Initializing PS/2 controller...");
-    if (InitPS2Controller() != STATUS::SUCCESS) {
-        LOG_ERROR("PS/2 controller initialization failed!");
+    if (!kernel->ArchitectureData->SystemExecutor->Spawn(InitPS2())) {
+        LOG_ERROR("Failed to start the PS/2 initialization!");
         return STATUS::FAILURE;
     }
-    
-    // Initialize the keyboard and mouse
-    if (InitKeyboard() == STATUS::SUCCESS) {
-        LOG_DEBUG("Registering PS/2 keyboard as HID device...");
-        HID::InputDevice* keyboard = new HID::InputDevice {
-            .id = 1,
-            .type = HID::DeviceType::Keyboard,
-            .vendorId = 0x00,
-            .productId = 0x00,
-            .name = "Generic PS/2 Keyboard",
-            .description = "Generic PS/2 Keyboard",
-            .manufacturer = "Unknown"
-        };
-
-        HIDService->RegisterDevice(keyboard);
-    }
-    else {
-        LOG_WARNING("PS/2 keyboard initialization failed!");
-    }
-
-    if (InitMouse() == STATUS::SUCCESS) {
-        LOG_DEBUG("Registering PS/2 mouse as HID device...");
-        HID::InputDevice* mouse = new HID::InputDevice {
-            .id = 2,
-            .type = HID::DeviceType::Mouse,
-            .vendorId = 0x00,
-            .productId = 0x00,
-            .name = "Generic PS/2 Mouse",
-            .description = "Generic PS/2 Mouse",
-            .manufacturer = "Unknown"
-        };
-
-        HIDService->RegisterDevice(mouse);
-    }
-    else {
-        LOG_WARNING("PS/2 Mouse initialization failed!");
-    }
 
     return STATUS::SUCCESS;
 }
\ No newline at end of file